@@ -1,33 +1,105 @@
 #include "sokol_app.h"
+#include "sokol_audio.h"
 #include "clock.h"
 #include <assert.h>
+#include <stdbool.h>
+
+#define CLOCK_MAX_FRAME_TIME_US (24000)
+// max correction per frame in hybrid mode
+#define CLOCK_MAX_CORRECTION_US (2000)
 
 typedef struct {
     bool valid;
+    clock_pacing_t pacing;
     uint64_t cur_time;
+    int audio_capacity;         // max observed free space in the audio buffer
+    double vsync_us;            // smoothed display frame duration
+    int32_t drift_us;
+    float speed;
 } clock_state_t;
 static clock_state_t state;
 
 void clock_init(void) {
     state = (clock_state_t) {
         .valid = true,
+        .pacing = CLOCK_PACING_VSYNC,
         .cur_time = 0,
+        .speed = 1.0f,
     };
 }
 
+void clock_set_pacing(clock_pacing_t pacing) {
+    assert(state.valid);
+    state.pacing = pacing;
+}
+
+// update the audio buffer drift, returns false if there's no audio device
+static bool clock_update_drift(void) {
+    if (!saudio_isvalid()) {
+        state.drift_us = 0;
+        return false;
+    }
+    // keep the audio buffer half full, saudio_expect() returns the free space
+    const int expect = saudio_expect();
+    if (expect > state.audio_capacity) {
+        state.audio_capacity = expect;
+    }
+    const int deviation = expect - (state.audio_capacity / 2);
+    state.drift_us = (int32_t)(((int64_t)deviation * 1000000) / saudio_sample_rate());
+    return true;
+}
+
 uint32_t clock_frame_time(void) {
     assert(state.valid);
-    uint32_t frame_time_us = (uint32_t) (sapp_frame_duration() * 1000000.0);
+    const double raw_frame_time_us = sapp_frame_duration() * 1000000.0;
+    if (state.vsync_us == 0.0) {
+        state.vsync_us = raw_frame_time_us;
+    }
+    state.vsync_us += (raw_frame_time_us - state.vsync_us) * 0.05;
+
+    double frame_time_us = raw_frame_time_us;
+    const bool has_audio = clock_update_drift();
+    if (has_audio && (state.pacing == CLOCK_PACING_AUDIO)) {
+        // emulate enough to move the audio buffer halfway back to its target fill level,
+        // correcting all at once would oscillate because audio is pushed in packets
+        frame_time_us = raw_frame_time_us + state.drift_us * 0.5;
+    }
+    else if (has_audio && (state.pacing == CLOCK_PACING_HYBRID)) {
+        // steady display-rate steps, plus a small sub-frame correction towards the audio clock
+        double correction = state.drift_us * 0.05;
+        if (correction > CLOCK_MAX_CORRECTION_US) {
+            correction = CLOCK_MAX_CORRECTION_US;
+        }
+        else if (correction < -CLOCK_MAX_CORRECTION_US) {
+            correction = -CLOCK_MAX_CORRECTION_US;
+        }
+        frame_time_us = state.vsync_us + correction;
+    }
+    if (frame_time_us < 0.0) {
+        frame_time_us = 0.0;
+    }
     // prevent death-spiral on host systems that are too slow to emulate
     // in real time, or during long frames (e.g. debugging)
-    if (frame_time_us > 24000) {
-        frame_time_us = 24000;
+    if (frame_time_us > CLOCK_MAX_FRAME_TIME_US) {
+        frame_time_us = CLOCK_MAX_FRAME_TIME_US;
+    }
+    if (raw_frame_time_us > 0.0) {
+        state.speed += ((float)(frame_time_us / raw_frame_time_us) - state.speed) * 0.01f;
     }
-    state.cur_time += frame_time_us;
-    return frame_time_us;
+    state.cur_time += (uint32_t)frame_time_us;
+    return (uint32_t)frame_time_us;
 }
 
 uint32_t clock_frame_count_60hz(void) {
     assert(state.valid);
     return (uint32_t) (state.cur_time / 16667);
 }
+
+clock_stats_t clock_stats(void) {
+    assert(state.valid);
+    return (clock_stats_t) {
+        .pacing = state.pacing,
+        .drift_us = state.drift_us,
+        .speed = state.speed,
+    };
+}
@@ -1,6 +1,22 @@
 #pragma once
 #include <stdint.h>
 
+typedef enum {
+    CLOCK_PACING_VSYNC,     // emulated time follows the display refresh (default)
+    CLOCK_PACING_AUDIO,     // emulated time follows the audio device consumption rate
+    CLOCK_PACING_HYBRID,    // display refresh with a slow correction towards the audio clock
+} clock_pacing_t;
+
+typedef struct {
+    clock_pacing_t pacing;
+    int32_t drift_us;       // audio buffer fill deviation from target, positive if emulation is behind
+    float speed;            // smoothed ratio of emulated time to host time
+} clock_stats_t;
+
 void clock_init(void);
+// the pacing (and the drift and speed stats) only apply when the emulator runs on the
+// main thread, the emulator thread follows the audio device by itself
+void clock_set_pacing(clock_pacing_t pacing);
 uint32_t clock_frame_time(void);
 uint32_t clock_frame_count_60hz(void);
+clock_stats_t clock_stats(void);
@@ -9,7 +9,18 @@
 #include "clock.h"
 #include "prof.h"
 #include "fs.h"
+#include "snapshot.h"
 #include "gfx.h"
+#include "hash.h"
+#include "inflate.h"
 #include "keybuf.h"
+#include "lz.h"
+#include "pagestore.h"
+#include "metrics.h"
 #include "webapi.h"
+#include "gdbstub.h"
+#include "ctrlsock.h"
+#include "thread.h"
+#include "recorder.h"
+#include "romlib.h"
 #include <ctype.h> // isupper, islower, toupper, tolower
@@ -0,0 +1,460 @@
+#include "ctrlsock.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__) || defined(_WIN32)
+    #define CTRLSOCK_NO_SOCKETS (1)
+#else
+    #include <unistd.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/mman.h>
+#endif
+
+#define CTRLSOCK_REQUEST_HEADER_SIZE (9)    // size, seq, cmd
+#define CTRLSOCK_RESPONSE_HEADER_SIZE (10)  // size, seq, cmd, status
+#define CTRLSOCK_TX_BUFFER_SIZE (512 * 1024)
+#define CTRLSOCK_MAX_READ_SIZE (64 * 1024)
+#define CTRLSOCK_MAX_DASM_LINES (256)
+#define CTRLSOCK_MAX_SCREENSHOT_SIZE (256 * 1024)  // for inline screenshots
+
+typedef struct {
+    bool valid;
+    webapi_interface_t funcs;
+    thread_t thread;
+    volatile uint32_t quit;
+    char path[256];
+    int listen_fd;
+    int client_fd;
+    struct {
+        char name[64];
+        uint8_t* ptr;
+        size_t slot_size;
+    } shm;
+    struct {
+        uint8_t* buf;               // CTRLSOCK_MAX_REQUEST_SIZE bytes
+        size_t len;
+    } rx;
+    struct {
+        uint8_t* buf;               // CTRLSOCK_TX_BUFFER_SIZE bytes
+        size_t len;
+    } tx;
+    uint8_t pixels[CTRLSOCK_MAX_SCREENSHOT_SIZE];
+    webapi_dasm_line_t dasm[CTRLSOCK_MAX_DASM_LINES];
+} ctrlsock_state_t;
+static ctrlsock_state_t state;
+
+#if !defined(CTRLSOCK_NO_SOCKETS)
+
+static uint16_t ctrlsock_get_u16(const uint8_t* ptr) {
+    return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+static uint32_t ctrlsock_get_u32(const uint8_t* ptr) {
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static void ctrlsock_put_u16(uint8_t* ptr, uint16_t val) {
+    ptr[0] = (uint8_t)val;
+    ptr[1] = (uint8_t)(val >> 8);
+}
+
+static void ctrlsock_put_u32(uint8_t* ptr, uint32_t val) {
+    ptr[0] = (uint8_t)val;
+    ptr[1] = (uint8_t)(val >> 8);
+    ptr[2] = (uint8_t)(val >> 16);
+    ptr[3] = (uint8_t)(val >> 24);
+}
+
+static void ctrlsock_flush(void) {
+    #if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+    #else
+    const int flags = 0;
+    #endif
+    const uint8_t* ptr = state.tx.buf;
+    size_t size = state.tx.len;
+    while ((size > 0) && (state.client_fd >= 0)) {
+        const ssize_t res = send(state.client_fd, ptr, size, flags);
+        if (res <= 0) {
+            break;
+        }
+        ptr += res;
+        size -= (size_t)res;
+    }
+    state.tx.len = 0;
+}
+
+// start a response in the tx buffer, returns a pointer to payload_size bytes to fill in
+static uint8_t* ctrlsock_begin_response(uint32_t seq, uint8_t cmd, uint8_t status, size_t payload_size) {
+    assert(CTRLSOCK_RESPONSE_HEADER_SIZE + payload_size <= CTRLSOCK_TX_BUFFER_SIZE);
+    if (state.tx.len + CTRLSOCK_RESPONSE_HEADER_SIZE + payload_size > CTRLSOCK_TX_BUFFER_SIZE) {
+        ctrlsock_flush();
+    }
+    uint8_t* ptr = state.tx.buf + state.tx.len;
+    ctrlsock_put_u32(ptr, (uint32_t)(6 + payload_size));
+    ctrlsock_put_u32(ptr + 4, seq);
+    ptr[8] = cmd;
+    ptr[9] = status;
+    state.tx.len += CTRLSOCK_RESPONSE_HEADER_SIZE + payload_size;
+    return ptr + CTRLSOCK_RESPONSE_HEADER_SIZE;
+}
+
+static void ctrlsock_respond(uint32_t seq, uint8_t cmd, uint8_t status) {
+    ctrlsock_begin_response(seq, cmd, status, 0);
+}
+
+static void ctrlsock_screenshot(uint32_t seq, uint8_t cmd, const uint8_t* payload, size_t size) {
+    if (size < 1) {
+        ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+        return;
+    }
+    const bool use_shm = (payload[0] & CTRLSOCK_SCREENSHOT_SHM) && state.shm.ptr;
+    uint8_t* dst = state.pixels;
+    size_t dst_size = sizeof(state.pixels);
+    uint32_t slot = 0;
+    if (use_shm) {
+        // the client owns the slots, a slot it still reads from is never overwritten
+        if ((size < 2) || (payload[1] >= CTRLSOCK_SHM_SLOTS)) {
+            ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+            return;
+        }
+        slot = payload[1];
+        dst = state.shm.ptr + slot * state.shm.slot_size;
+        dst_size = state.shm.slot_size;
+    }
+    int width = 0, height = 0;
+    if (!state.funcs.screenshot((chips_range_t){ .ptr = dst, .size = dst_size }, &width, &height)) {
+        ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_FAILED);
+        return;
+    }
+    const size_t pixel_bytes = (size_t)width * (size_t)height * 4;
+    uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, 4 + (use_shm ? 4 : pixel_bytes));
+    ctrlsock_put_u16(out, (uint16_t)width);
+    ctrlsock_put_u16(out + 2, (uint16_t)height);
+    if (use_shm) {
+        ctrlsock_put_u32(out + 4, slot);
+    }
+    else {
+        memcpy(out + 4, dst, pixel_bytes);
+    }
+}
+
+static void ctrlsock_handle_request(uint32_t seq, uint8_t cmd, const uint8_t* payload, size_t size) {
+    const webapi_interface_t* funcs = &state.funcs;
+    switch (cmd) {
+        case CTRLSOCK_CMD_HELLO: {
+            const size_t name_len = strlen(state.shm.name) + 1;
+            uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, 12 + name_len);
+            ctrlsock_put_u32(out, CTRLSOCK_VERSION);
+            ctrlsock_put_u32(out + 4, state.shm.ptr ? CTRLSOCK_SHM_SLOTS : 0);
+            ctrlsock_put_u32(out + 8, (uint32_t)state.shm.slot_size);
+            memcpy(out + 12, state.shm.name, name_len);
+            return;
+        }
+        case CTRLSOCK_CMD_BOOT:
+        case CTRLSOCK_CMD_RESET:
+        case CTRLSOCK_CMD_DBG_BREAK:
+        case CTRLSOCK_CMD_DBG_CONTINUE:
+        case CTRLSOCK_CMD_DBG_STEP_INTO:
+        case CTRLSOCK_CMD_DBG_STEP_NEXT: {
+            void (*func)(void) = 0;
+            switch (cmd) {
+                case CTRLSOCK_CMD_BOOT:             func = funcs->boot; break;
+                case CTRLSOCK_CMD_RESET:            func = funcs->reset; break;
+                case CTRLSOCK_CMD_DBG_BREAK:        func = funcs->dbg_break; break;
+                case CTRLSOCK_CMD_DBG_CONTINUE:     func = funcs->dbg_continue; break;
+                case CTRLSOCK_CMD_DBG_STEP_INTO:    func = funcs->dbg_step_into; break;
+                default:                            func = funcs->dbg_step_next; break;
+            }
+            if (func) {
+                func();
+            }
+            ctrlsock_respond(seq, cmd, func ? CTRLSOCK_STATUS_OK : CTRLSOCK_STATUS_UNSUPPORTED);
+            return;
+        }
+        case CTRLSOCK_CMD_DBG_ADD_BREAKPOINT:
+        case CTRLSOCK_CMD_DBG_REMOVE_BREAKPOINT: {
+            void (*func)(uint16_t) = (cmd == CTRLSOCK_CMD_DBG_ADD_BREAKPOINT) ? funcs->dbg_add_breakpoint : funcs->dbg_remove_breakpoint;
+            if (size < 2) {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+            }
+            else if (func) {
+                func(ctrlsock_get_u16(payload));
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_OK);
+            }
+            else {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_UNSUPPORTED);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    // the remaining commands need their function and call it with arguments
+    bool supported = false;
+    switch (cmd) {
+        case CTRLSOCK_CMD_READY:            supported = funcs->ready; break;
+        case CTRLSOCK_CMD_LOAD:             supported = funcs->load; break;
+        case CTRLSOCK_CMD_STEP_FRAMES:      supported = funcs->step_frames; break;
+        case CTRLSOCK_CMD_INPUT:            supported = funcs->input; break;
+        case CTRLSOCK_CMD_SCREENSHOT:       supported = funcs->screenshot; break;
+        case CTRLSOCK_CMD_DBG_CPU_STATE:    supported = funcs->dbg_cpu_state; break;
+        case CTRLSOCK_CMD_DBG_DISASSEMBLE:  supported = funcs->dbg_request_disassembly; break;
+        case CTRLSOCK_CMD_DBG_READ_MEMORY:  supported = funcs->dbg_read_memory; break;
+        default: break;
+    }
+    if (!supported) {
+        ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_UNSUPPORTED);
+        return;
+    }
+    switch (cmd) {
+        case CTRLSOCK_CMD_READY: {
+            uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, 1);
+            out[0] = funcs->ready() ? 1 : 0;
+            break;
+        }
+        case CTRLSOCK_CMD_LOAD: {
+            const webapi_fileheader_t* hdr = (const webapi_fileheader_t*)payload;
+            bool ok = (size > sizeof(webapi_fileheader_t)) &&
+                      (hdr->magic[0] == 'C') && (hdr->magic[1] == 'H') && (hdr->magic[2] == 'I') && (hdr->magic[3] == 'P');
+            if (ok) {
+                ok = funcs->load((chips_range_t){ .ptr = (void*)payload, .size = size });
+            }
+            ctrlsock_respond(seq, cmd, ok ? CTRLSOCK_STATUS_OK : CTRLSOCK_STATUS_FAILED);
+            break;
+        }
+        case CTRLSOCK_CMD_STEP_FRAMES: {
+            if (size < 4) {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+                break;
+            }
+            const uint32_t num_frames = funcs->step_frames(ctrlsock_get_u32(payload));
+            ctrlsock_put_u32(ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, 4), num_frames);
+            break;
+        }
+        case CTRLSOCK_CMD_INPUT: {
+            if (size < 5) {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+                break;
+            }
+            funcs->input(payload[0], ctrlsock_get_u32(payload + 1));
+            ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_OK);
+            break;
+        }
+        case CTRLSOCK_CMD_SCREENSHOT:
+            ctrlsock_screenshot(seq, cmd, payload, size);
+            break;
+        case CTRLSOCK_CMD_DBG_CPU_STATE: {
+            const webapi_cpu_state_t cpu_state = funcs->dbg_cpu_state();
+            uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, WEBAPI_CPUSTATE_MAX * 2);
+            for (int i = 0; i < WEBAPI_CPUSTATE_MAX; i++) {
+                ctrlsock_put_u16(out + i * 2, cpu_state.items[i]);
+            }
+            break;
+        }
+        case CTRLSOCK_CMD_DBG_DISASSEMBLE: {
+            if (size < 6) {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+                break;
+            }
+            uint16_t num_lines = ctrlsock_get_u16(payload + 4);
+            if (num_lines > CTRLSOCK_MAX_DASM_LINES) {
+                num_lines = CTRLSOCK_MAX_DASM_LINES;
+            }
+            memset(state.dasm, 0, num_lines * sizeof(webapi_dasm_line_t));
+            funcs->dbg_request_disassembly(ctrlsock_get_u16(payload), (int16_t)ctrlsock_get_u16(payload + 2), num_lines, state.dasm);
+            uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, num_lines * CTRLSOCK_DASM_LINE_SIZE);
+            for (int i = 0; i < num_lines; i++, out += CTRLSOCK_DASM_LINE_SIZE) {
+                const webapi_dasm_line_t* line = &state.dasm[i];
+                ctrlsock_put_u16(out, line->addr);
+                out[2] = line->num_bytes;
+                out[3] = line->num_chars;
+                memcpy(out + 4, line->bytes, WEBAPI_DASM_LINE_MAX_BYTES);
+                memcpy(out + 4 + WEBAPI_DASM_LINE_MAX_BYTES, line->chars, WEBAPI_DASM_LINE_MAX_CHARS);
+            }
+            break;
+        }
+        case CTRLSOCK_CMD_DBG_READ_MEMORY: {
+            if (size < 6) {
+                ctrlsock_respond(seq, cmd, CTRLSOCK_STATUS_INVALID);
+                break;
+            }
+            const uint16_t addr = ctrlsock_get_u16(payload);
+            uint32_t num_bytes = ctrlsock_get_u32(payload + 2);
+            if (num_bytes > CTRLSOCK_MAX_READ_SIZE) {
+                num_bytes = CTRLSOCK_MAX_READ_SIZE;
+            }
+            uint8_t* out = ctrlsock_begin_response(seq, cmd, CTRLSOCK_STATUS_OK, num_bytes);
+            funcs->dbg_read_memory(addr, (int)num_bytes, out);
+            break;
+        }
+    }
+}
+
+static void ctrlsock_disconnect(void) {
+    if (state.client_fd >= 0) {
+        close(state.client_fd);
+        state.client_fd = -1;
+    }
+    state.rx.len = 0;
+    state.tx.len = 0;
+}
+
+// execute all complete requests in the receive buffer, and send the responses in one go
+static void ctrlsock_process(void) {
+    size_t pos = 0;
+    while (state.rx.len - pos >= 4) {
+        const uint32_t size = ctrlsock_get_u32(state.rx.buf + pos);
+        // NOTE: compare against MAX - 4, size + 4 would wrap for huge sizes
+        if ((size < 5) || (size > CTRLSOCK_MAX_REQUEST_SIZE - 4)) {
+            // can't resynchronize a corrupt stream
+            ctrlsock_disconnect();
+            return;
+        }
+        if (state.rx.len - pos < (size_t)size + 4) {
+            break;
+        }
+        const uint8_t* req = state.rx.buf + pos;
+        ctrlsock_handle_request(ctrlsock_get_u32(req + 4), req[8], req + CTRLSOCK_REQUEST_HEADER_SIZE, size - 5);
+        pos += size + 4;
+    }
+    ctrlsock_flush();
+    if (pos > 0) {
+        memmove(state.rx.buf, state.rx.buf + pos, state.rx.len - pos);
+        state.rx.len -= pos;
+    }
+}
+
+static void ctrlsock_thread_func(void* user_data) {
+    (void)user_data;
+    while (!thread_atomic_load(&state.quit)) {
+        if (state.client_fd < 0) {
+            struct pollfd pfd = { .fd = state.listen_fd, .events = POLLIN };
+            if (poll(&pfd, 1, 100) > 0) {
+                state.client_fd = accept(state.listen_fd, 0, 0);
+                #if defined(SO_NOSIGPIPE)
+                if (state.client_fd >= 0) {
+                    const int one = 1;
+                    setsockopt(state.client_fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+                }
+                #endif
+            }
+            continue;
+        }
+        struct pollfd pfd = { .fd = state.client_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        const ssize_t num_bytes = recv(state.client_fd, state.rx.buf + state.rx.len, CTRLSOCK_MAX_REQUEST_SIZE - state.rx.len, 0);
+        if (num_bytes <= 0) {
+            ctrlsock_disconnect();
+            continue;
+        }
+        state.rx.len += (size_t)num_bytes;
+        ctrlsock_process();
+    }
+    ctrlsock_disconnect();
+}
+
+static bool ctrlsock_create_shm(size_t slot_size) {
+    snprintf(state.shm.name, sizeof(state.shm.name), "/ctrlsock-%d", (int)getpid());
+    const int fd = shm_open(state.shm.name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    const size_t size = slot_size * CTRLSOCK_SHM_SLOTS;
+    void* ptr = MAP_FAILED;
+    if (0 == ftruncate(fd, (off_t)size)) {
+        ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        shm_unlink(state.shm.name);
+        return false;
+    }
+    state.shm.ptr = (uint8_t*)ptr;
+    state.shm.slot_size = slot_size;
+    return true;
+}
+
+static void ctrlsock_destroy_shm(void) {
+    if (state.shm.ptr) {
+        munmap(state.shm.ptr, state.shm.slot_size * CTRLSOCK_SHM_SLOTS);
+        shm_unlink(state.shm.name);
+        state.shm.ptr = 0;
+    }
+    state.shm.name[0] = 0;
+    state.shm.slot_size = 0;
+}
+
+#endif // !CTRLSOCK_NO_SOCKETS
+
+bool ctrlsock_start(const ctrlsock_desc_t* desc) {
+    assert(desc && desc->path && !state.valid);
+    #if defined(CTRLSOCK_NO_SOCKETS)
+    return false;
+    #else
+    if (!thread_supported()) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(desc->path) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, desc->path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    unlink(desc->path);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, 1) != 0)) {
+        close(fd);
+        return false;
+    }
+    memset(&state, 0, sizeof(state));
+    state.funcs = desc->funcs;
+    snprintf(state.path, sizeof(state.path), "%s", desc->path);
+    state.listen_fd = fd;
+    state.client_fd = -1;
+    state.rx.buf = (uint8_t*)malloc(CTRLSOCK_MAX_REQUEST_SIZE);
+    state.tx.buf = (uint8_t*)malloc(CTRLSOCK_TX_BUFFER_SIZE);
+    // without shared memory, screenshots are returned inline
+    if (desc->shm_slot_size > 0) {
+        ctrlsock_create_shm(desc->shm_slot_size);
+    }
+    state.valid = true;
+    if (!state.rx.buf || !state.tx.buf || !thread_create(&state.thread, ctrlsock_thread_func, 0)) {
+        state.valid = false;
+        ctrlsock_destroy_shm();
+        free(state.rx.buf);
+        free(state.tx.buf);
+        close(fd);
+        unlink(state.path);
+        return false;
+    }
+    return true;
+    #endif
+}
+
+void ctrlsock_stop(void) {
+    #if !defined(CTRLSOCK_NO_SOCKETS)
+    if (state.valid) {
+        thread_atomic_store(&state.quit, 1);
+        thread_join(&state.thread);
+        close(state.listen_fd);
+        unlink(state.path);
+        ctrlsock_destroy_shm();
+        free(state.rx.buf);
+        free(state.tx.buf);
+        state.valid = false;
+    }
+    #endif
+}
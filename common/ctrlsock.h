@@ -0,0 +1,106 @@
+#pragma once
+/*
+    A native automation server: a compact binary request/response protocol
+    over a Unix domain socket which maps onto webapi_interface_t (see
+    webapi.h), for test orchestrators which drive an emulator instance
+    from outside the process.
+
+    The server runs on its own thread and serves one client at a time, the
+    webapi functions are called on the server thread (so they must lock
+    the emulator state themselves).
+
+    All integers are little-endian. A request is:
+
+        u32 size            number of bytes following this field (>= 5)
+        u32 seq             echoed in the response
+        u8  cmd             CTRLSOCK_CMD_xxx
+        u8  payload[size-5]
+
+    ...and a response is:
+
+        u32 size            number of bytes following this field (>= 6)
+        u32 seq
+        u8  cmd
+        u8  status          CTRLSOCK_STATUS_xxx
+        u8  payload[size-6]
+
+    Requests may be pipelined: the client can send any number of requests
+    without waiting, they are executed in order and answered in order.
+
+    Commands (request payload => response payload):
+
+        HELLO           => u32 version, u32 num_shm_slots, u32 shm_slot_size, char shm_name[] (zero-terminated, empty if none)
+        BOOT, RESET     => -
+        READY           => u8 ready
+        LOAD            webapi_fileheader_t + file data => -
+        STEP_FRAMES     u32 num_frames => u32 frames executed (less if a breakpoint was hit)
+        INPUT           u8 port, u32 mask => -
+        SCREENSHOT      u8 flags[, u8 shm_slot] => u16 width, u16 height, then either u32 shm_slot (CTRLSOCK_SCREENSHOT_SHM) or width*height RGBA8 pixels
+        DBG_BREAK, DBG_CONTINUE, DBG_STEP_INTO, DBG_STEP_NEXT => -
+        DBG_ADD_BREAKPOINT, DBG_REMOVE_BREAKPOINT   u16 addr => -
+        DBG_CPU_STATE   => u16 items[WEBAPI_CPUSTATE_MAX]
+        DBG_DISASSEMBLE u16 addr, i16 offset_lines, u16 num_lines => num_lines lines of CTRLSOCK_DASM_LINE_SIZE bytes:
+                        u16 addr, u8 num_bytes, u8 num_chars, u8 bytes[8], char chars[32]
+        DBG_READ_MEMORY u16 addr, u32 num_bytes => u8 bytes[num_bytes]
+
+    Shared memory screenshots: the server creates a POSIX shared memory
+    object (name returned by HELLO) with num_shm_slots slots. A SCREENSHOT
+    request with CTRLSOCK_SCREENSHOT_SHM names the slot the pixels are
+    written to (the request is invalid without it), and the response only
+    returns the slot index. The server never writes to a slot on its own,
+    so the client decides when a slot may be reused, e.g. to keep several
+    pipelined screenshots in flight.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "webapi.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define CTRLSOCK_VERSION (2)      // 2: the client names the shared memory screenshot slot
+#define CTRLSOCK_SHM_SLOTS (4)
+#define CTRLSOCK_MAX_REQUEST_SIZE (4 * 1024 * 1024)
+#define CTRLSOCK_DASM_LINE_SIZE (4 + WEBAPI_DASM_LINE_MAX_BYTES + WEBAPI_DASM_LINE_MAX_CHARS)
+
+#define CTRLSOCK_CMD_HELLO                  (0)
+#define CTRLSOCK_CMD_BOOT                   (1)
+#define CTRLSOCK_CMD_RESET                  (2)
+#define CTRLSOCK_CMD_READY                  (3)
+#define CTRLSOCK_CMD_LOAD                   (4)
+#define CTRLSOCK_CMD_STEP_FRAMES            (5)
+#define CTRLSOCK_CMD_INPUT                  (6)
+#define CTRLSOCK_CMD_SCREENSHOT             (7)
+#define CTRLSOCK_CMD_DBG_BREAK              (8)
+#define CTRLSOCK_CMD_DBG_CONTINUE           (9)
+#define CTRLSOCK_CMD_DBG_STEP_INTO          (10)
+#define CTRLSOCK_CMD_DBG_STEP_NEXT          (11)
+#define CTRLSOCK_CMD_DBG_ADD_BREAKPOINT     (12)
+#define CTRLSOCK_CMD_DBG_REMOVE_BREAKPOINT  (13)
+#define CTRLSOCK_CMD_DBG_CPU_STATE          (14)
+#define CTRLSOCK_CMD_DBG_DISASSEMBLE        (15)
+#define CTRLSOCK_CMD_DBG_READ_MEMORY        (16)
+
+#define CTRLSOCK_STATUS_OK          (0)
+#define CTRLSOCK_STATUS_FAILED      (1)     // the operation failed (e.g. invalid file)
+#define CTRLSOCK_STATUS_UNSUPPORTED (2)     // unknown command, or not implemented by the emulator
+#define CTRLSOCK_STATUS_INVALID     (3)     // malformed request payload
+
+#define CTRLSOCK_SCREENSHOT_SHM (1<<0)      // return the pixels in a shared memory slot
+
+typedef struct {
+    const char* path;           // path of the Unix domain socket (an existing socket file is replaced)
+    size_t shm_slot_size;       // size of a shared memory screenshot slot in bytes, 0 disables shared memory
+    webapi_interface_t funcs;
+} ctrlsock_desc_t;
+
+// start the server thread, returns false if not supported or the socket can't be created
+bool ctrlsock_start(const ctrlsock_desc_t* desc);
+// disconnect the client, stop the server thread and remove the socket file and shared memory
+void ctrlsock_stop(void);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -8,7 +8,6 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
-#include <stdalign.h>
 #include <stdarg.h>
 #if defined(__EMSCRIPTEN__)
 #include <emscripten/emscripten.h>
@@ -20,6 +19,7 @@
 #define FS_EXT_SIZE (16)
 #define FS_PATH_SIZE (2048)
 #define FS_MAX_SIZE (2024 * 1024)
+#define FS_CHUNK_SIZE (64 * 1024)
 
 typedef struct {
     char cstr[FS_PATH_SIZE];
@@ -29,14 +29,20 @@ typedef struct {
 typedef struct {
     size_t snapshot_index;
     fs_snapshot_load_callback_t callback;
+    uint8_t* buf;
 } fs_snapshot_load_context_t;
 
+// the load buffer is allocated when a request starts, and freed in fs_reset(),
+// a buffer which is still in use by a pending request is freed in the
+// fetch callback instead
 typedef struct {
     fs_path_t path;
     fs_result_t result;
     uint8_t* ptr;
     size_t size;
-    alignas(64) uint8_t buf[FS_MAX_SIZE + 1];
+    uint8_t* buf;
+    fs_chunk_callback_t chunk_callback;
+    sfetch_handle_t handle;
 } fs_channel_state_t;
 
 typedef struct {
@@ -61,6 +67,13 @@ void fs_dowork(void) {
     sfetch_dowork();
 }
 
+// allocate a new load buffer, with room for a zero-terminator
+static uint8_t* fs_channel_alloc(fs_channel_state_t* channel, size_t size) {
+    assert(0 == channel->buf);
+    channel->buf = (uint8_t*) malloc(size + 1);
+    return channel->buf;
+}
+
 static void fs_path_reset(fs_path_t* path) {
     memset(path->cstr, 0, sizeof(path->cstr));
     path->clamped = false;
@@ -169,9 +182,10 @@ static bool fs_base64_decode(fs_channel_state_t* channel, const char* src) {
 
     // output length
     int olen = (count / 4) * 3;
-    if (olen >= (int)sizeof(channel->buf)) {
+    if (olen > FS_MAX_SIZE) {
         return false;
     }
+    fs_channel_alloc(channel, (size_t)olen);
 
     // decode loop
     count = 0;
@@ -225,10 +239,19 @@ void fs_reset(fs_channel_t chn) {
     assert(state.valid);
     assert(chn < FS_CHANNEL_NUM);
     fs_channel_state_t* channel = &state.channels[chn];
+    if (channel->result == FS_RESULT_PENDING) {
+        // the request still owns the buffer, it will be freed in the fetch callback
+        sfetch_cancel(channel->handle);
+    }
+    else {
+        free(channel->buf);
+    }
     fs_path_reset(&channel->path);
     channel->result = FS_RESULT_IDLE;
     channel->ptr = 0;
     channel->size = 0;
+    channel->buf = 0;
+    channel->chunk_callback = 0;
 }
 
 bool fs_load_base64(fs_channel_t chn, const char* name, const char* payload) {
@@ -248,16 +271,30 @@ bool fs_load_base64(fs_channel_t chn, const char* name, const char* payload) {
     }
 }
 
+// return true if the response belongs to a request which has been replaced or reset
+static bool fs_stale_response(const fs_channel_state_t* channel, const void* buf, bool finished) {
+    if (buf == channel->buf) {
+        return false;
+    }
+    if (finished) {
+        free((void*)buf);
+    }
+    return true;
+}
+
 static void fs_fetch_callback(const sfetch_response_t* response) {
     assert(state.valid);
     fs_channel_t chn = *(fs_channel_t*)response->user_data;
     assert(chn < FS_CHANNEL_NUM);
     fs_channel_state_t* channel = &state.channels[chn];
+    if (fs_stale_response(channel, response->buffer.ptr, response->finished)) {
+        return;
+    }
     if (response->fetched) {
         channel->result = FS_RESULT_SUCCESS;
         channel->ptr = (uint8_t*)response->data.ptr;
         channel->size = response->data.size;
-        assert(channel->size < sizeof(channel->buf));
+        assert(channel->size <= FS_MAX_SIZE);
         // in case it's a text file, zero-terminate the data
         channel->buf[channel->size] = 0;
     }
@@ -266,6 +303,23 @@ static void fs_fetch_callback(const sfetch_response_t* response) {
     }
 }
 
+// chunked loading: the data is passed to the chunk callback, and not available via fs_data()
+static void fs_fetch_chunk_callback(const sfetch_response_t* response) {
+    assert(state.valid);
+    fs_channel_t chn = *(fs_channel_t*)response->user_data;
+    assert(chn < FS_CHANNEL_NUM);
+    fs_channel_state_t* channel = &state.channels[chn];
+    if (fs_stale_response(channel, response->buffer.ptr, response->finished)) {
+        return;
+    }
+    if (response->fetched && (response->data.size > 0)) {
+        channel->chunk_callback(chn, (chips_range_t){ .ptr = (void*)response->data.ptr, .size = response->data.size });
+    }
+    if (response->finished) {
+        channel->result = response->failed ? FS_RESULT_FAILED : FS_RESULT_SUCCESS;
+    }
+}
+
 #if defined(__EMSCRIPTEN__)
 
 EM_JS_DEPS(chips_ini, "$UTF8ToString,$stringToNewUTF8");
@@ -296,13 +350,22 @@ static void fs_emsc_dropped_file_callback(const sapp_html5_fetch_response* respo
     fs_channel_t chn = (fs_channel_t)(uintptr_t)response->user_data;
     assert(chn < FS_CHANNEL_NUM);
     fs_channel_state_t* channel = &state.channels[chn];
+    if (fs_stale_response(channel, response->buffer.ptr, true)) {
+        return;
+    }
     if (response->succeeded) {
         channel->result = FS_RESULT_SUCCESS;
-        channel->ptr = (uint8_t*)response->data.ptr;
-        channel->size = response->data.size;
-        assert(channel->size < sizeof(channel->buf));
-        // in case it's a text file, zero-terminate the data
-        channel->buf[channel->size] = 0;
+        if (channel->chunk_callback) {
+            // the browser delivers dropped files in one piece
+            channel->chunk_callback(chn, (chips_range_t){ .ptr = response->data.ptr, .size = response->data.size });
+        }
+        else {
+            channel->ptr = (uint8_t*)response->data.ptr;
+            channel->size = response->data.size;
+            assert(channel->size <= FS_MAX_SIZE);
+            // in case it's a text file, zero-terminate the data
+            channel->buf[channel->size] = 0;
+        }
     }
     else {
         channel->result = FS_RESULT_FAILED;
@@ -465,6 +528,10 @@ static void fs_win32_posix_snapshot_fetch_callback(const sfetch_response_t* resp
             .result = FS_RESULT_FAILED,
         });
     }
+    if (response->finished) {
+        // the snapshot buffer is only needed during the callback
+        free(ctx->buf);
+    }
 }
 
 static bool fs_win32_posix_write_file(fs_path_t path, chips_range_t data) {
@@ -582,15 +649,15 @@ bool fs_win32_posix_load_snapshot_async(const char* system_name, size_t snapshot
     }
     fs_snapshot_load_context_t context = {
         .snapshot_index = snapshot_index,
-        .callback = callback
+        .callback = callback,
+        .buf = (uint8_t*) malloc(FS_MAX_SIZE),
     };
     const fs_channel_t chn = FS_CHANNEL_SNAPSHOTS;
-    fs_channel_state_t* channel = &state.channels[chn];
     sfetch_send(&(sfetch_request_t){
         .path = path.cstr,
         .channel = (int)chn,
         .callback = fs_win32_posix_snapshot_fetch_callback,
-        .buffer = { .ptr = channel->buf, .size = FS_MAX_SIZE },
+        .buffer = { .ptr = context.buf, .size = FS_MAX_SIZE },
         .user_data = { .ptr = &context, .size = sizeof(context) }
     });
     return true;
@@ -604,11 +671,30 @@ void fs_load_file_async(fs_channel_t chn, const char* path) {
     fs_channel_state_t* channel = &state.channels[chn];
     channel->path = fs_path_printf("%s", path);
     channel->result = FS_RESULT_PENDING;
-    sfetch_send(&(sfetch_request_t){
+    channel->handle = sfetch_send(&(sfetch_request_t){
         .path = path,
         .channel = chn,
         .callback = fs_fetch_callback,
-        .buffer = { .ptr = channel->buf, .size = FS_MAX_SIZE },
+        .buffer = { .ptr = fs_channel_alloc(channel, FS_MAX_SIZE), .size = FS_MAX_SIZE },
+        .user_data = { .ptr = &chn, .size = sizeof(chn) },
+    });
+}
+
+void fs_load_file_chunked_async(fs_channel_t chn, const char* path, fs_chunk_callback_t callback) {
+    assert(state.valid);
+    assert(chn < FS_CHANNEL_NUM);
+    assert(callback);
+    fs_reset(chn);
+    fs_channel_state_t* channel = &state.channels[chn];
+    channel->path = fs_path_printf("%s", path);
+    channel->result = FS_RESULT_PENDING;
+    channel->chunk_callback = callback;
+    channel->handle = sfetch_send(&(sfetch_request_t){
+        .path = path,
+        .channel = chn,
+        .chunk_size = FS_CHUNK_SIZE,
+        .callback = fs_fetch_chunk_callback,
+        .buffer = { .ptr = fs_channel_alloc(channel, FS_CHUNK_SIZE), .size = FS_CHUNK_SIZE },
         .user_data = { .ptr = &chn, .size = sizeof(chn) },
     });
 }
@@ -625,7 +711,7 @@ void fs_load_dropped_file_async(fs_channel_t chn) {
         sapp_html5_fetch_dropped_file(&(sapp_html5_fetch_request){
             .dropped_file_index = 0,
             .callback = fs_emsc_dropped_file_callback,
-            .buffer = { .ptr = channel->buf, .size = FS_MAX_SIZE },
+            .buffer = { .ptr = fs_channel_alloc(channel, FS_MAX_SIZE), .size = FS_MAX_SIZE },
             .user_data = (void*)(intptr_t)chn,
         });
     #else
@@ -633,6 +719,18 @@ void fs_load_dropped_file_async(fs_channel_t chn) {
     #endif
 }
 
+void fs_load_dropped_file_chunked_async(fs_channel_t chn, fs_chunk_callback_t callback) {
+    assert(state.valid);
+    assert(chn < FS_CHANNEL_NUM);
+    assert(callback);
+    #if defined(__EMSCRIPTEN__)
+        fs_load_dropped_file_async(chn);
+        state.channels[chn].chunk_callback = callback;
+    #else
+        fs_load_file_chunked_async(chn, sapp_get_dropped_file_path(0), callback);
+    #endif
+}
+
 bool fs_save_snapshot(const char* system_name, size_t snapshot_index, chips_range_t data) {
     #if defined(__EMSCRIPTEN__)
     return fs_emsc_save_snapshot(system_name, snapshot_index, data);
@@ -649,6 +747,16 @@ bool fs_load_snapshot_async(const char* system_name, size_t snapshot_index, fs_s
     #endif
 }
 
+chips_range_t fs_read_snapshot(const char* system_name, size_t snapshot_index) {
+    #if defined(__EMSCRIPTEN__)
+    (void)system_name;
+    (void)snapshot_index;
+    return (chips_range_t){0};
+    #else
+    return fs_win32_posix_read_file(fs_win32_posix_make_snapshot_path(system_name, snapshot_index), false);
+    #endif
+}
+
 void fs_save_ini(const char* key, const char* payload) {
     assert(key && payload);
     #if defined(__EMSCRIPTEN__)
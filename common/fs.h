@@ -28,15 +28,21 @@ typedef struct {
 } fs_snapshot_response_t;
 
 typedef void (*fs_snapshot_load_callback_t)(const fs_snapshot_response_t* response);
+// called with each chunk of a file loaded with fs_load_file_chunked_async()
+typedef void (*fs_chunk_callback_t)(fs_channel_t chn, chips_range_t chunk);
 
 void fs_init(void);
 void fs_dowork(void);
 void fs_reset(fs_channel_t chn);
 void fs_load_file_async(fs_channel_t chn, const char* path);
 void fs_load_dropped_file_async(fs_channel_t chn);
+void fs_load_file_chunked_async(fs_channel_t chn, const char* path, fs_chunk_callback_t callback);
+void fs_load_dropped_file_chunked_async(fs_channel_t chn, fs_chunk_callback_t callback);
 bool fs_load_base64(fs_channel_t chn, const char* name, const char* payload);
 bool fs_save_snapshot(const char* system_name, size_t snapshot_index, chips_range_t data);
 bool fs_load_snapshot_async(const char* system_name, size_t snapshot_index, fs_snapshot_load_callback_t callback);
+// blocking snapshot load which can be called from any thread (native platforms only), free the returned range.ptr with free()
+chips_range_t fs_read_snapshot(const char* system_name, size_t snapshot_index);
 fs_result_t fs_result(fs_channel_t chn);
 bool fs_success(fs_channel_t chn);
 bool fs_failed(fs_channel_t chn);
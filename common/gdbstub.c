@@ -0,0 +1,616 @@
+#include "gdbstub.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__) || defined(_WIN32)
+    #define GDBSTUB_NO_SOCKETS (1)
+#else
+    #include <unistd.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+#endif
+
+#define GDBSTUB_MAX_PACKET_SIZE (4096)      // must match PacketSize in the qSupported reply
+#define GDBSTUB_MAX_DASM_LINES (64)
+#define GDBSTUB_SIGINT (2)
+#define GDBSTUB_SIGTRAP (5)
+
+static const char* gdbstub_target_xml =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.gnu.gdb.m6502.core\">"
+    "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+    "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"s\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+typedef enum {
+    GDBSTUB_RX_IDLE,
+    GDBSTUB_RX_DATA,
+    GDBSTUB_RX_CHECKSUM_HI,
+    GDBSTUB_RX_CHECKSUM_LO,
+} gdbstub_rx_state_t;
+
+typedef struct {
+    bool valid;
+    webapi_interface_t funcs;
+    thread_t thread;
+    volatile uint32_t quit;
+    volatile uint32_t pending_stop;     // signal number of an unreported stop event, 0 if none
+    int listen_fd;
+    int client_fd;
+    bool no_ack;
+    bool waiting;                       // the client waits for a stop reply (after c, s or vCont)
+    struct {
+        gdbstub_rx_state_t state;
+        uint8_t checksum;
+        uint8_t received_checksum;
+        int len;
+        char buf[GDBSTUB_MAX_PACKET_SIZE + 1];
+    } rx;
+    char tx[GDBSTUB_MAX_PACKET_SIZE + 8];
+    uint8_t mem[GDBSTUB_MAX_PACKET_SIZE / 2];
+    webapi_dasm_line_t dasm[GDBSTUB_MAX_DASM_LINES];
+} gdbstub_state_t;
+static gdbstub_state_t state;
+
+void gdbstub_event_stopped(int stop_reason, uint16_t addr) {
+    (void)addr;
+    if (state.valid) {
+        const uint32_t sig = (stop_reason == WEBAPI_STOPREASON_BREAK) ? GDBSTUB_SIGINT : GDBSTUB_SIGTRAP;
+        thread_atomic_store(&state.pending_stop, sig);
+    }
+}
+
+#if !defined(GDBSTUB_NO_SOCKETS)
+
+static const char gdbstub_hex_chars[] = "0123456789abcdef";
+
+static int gdbstub_hex_val(char c) {
+    if ((c >= '0') && (c <= '9')) { return c - '0'; }
+    if ((c >= 'a') && (c <= 'f')) { return c - 'a' + 10; }
+    if ((c >= 'A') && (c <= 'F')) { return c - 'A' + 10; }
+    return -1;
+}
+
+// parse a hex number, returns a pointer past the last hex digit
+static const char* gdbstub_parse_hex(const char* str, uint32_t* out_val) {
+    uint32_t val = 0;
+    int digit;
+    while ((digit = gdbstub_hex_val(*str)) >= 0) {
+        val = (val << 4) | (uint32_t)digit;
+        str++;
+    }
+    *out_val = val;
+    return str;
+}
+
+static char* gdbstub_put_hex8(char* dst, uint8_t val) {
+    *dst++ = gdbstub_hex_chars[val >> 4];
+    *dst++ = gdbstub_hex_chars[val & 15];
+    return dst;
+}
+
+static void gdbstub_send_raw(const char* data, size_t size) {
+    #if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+    #else
+    const int flags = 0;
+    #endif
+    while ((size > 0) && (state.client_fd >= 0)) {
+        const ssize_t res = send(state.client_fd, data, size, flags);
+        if (res <= 0) {
+            return;
+        }
+        data += res;
+        size -= (size_t)res;
+    }
+}
+
+// send a packet with binary-unsafe payload (the payload must not contain $, # or })
+static void gdbstub_send(const char* payload, size_t len) {
+    assert(len <= GDBSTUB_MAX_PACKET_SIZE);
+    uint8_t checksum = 0;
+    state.tx[0] = '$';
+    for (size_t i = 0; i < len; i++) {
+        state.tx[1 + i] = payload[i];
+        checksum += (uint8_t)payload[i];
+    }
+    char* end = &state.tx[1 + len];
+    *end++ = '#';
+    end = gdbstub_put_hex8(end, checksum);
+    gdbstub_send_raw(state.tx, (size_t)(end - state.tx));
+}
+
+static void gdbstub_send_str(const char* str) {
+    gdbstub_send(str, strlen(str));
+}
+
+static void gdbstub_send_stop_reply(uint32_t sig) {
+    char reply[4] = { 'S' };
+    gdbstub_put_hex8(&reply[1], (uint8_t)sig);
+    gdbstub_send(reply, 3);
+}
+
+// send text as console output (O packet), used by monitor commands
+static void gdbstub_send_output(const char* text) {
+    char payload[GDBSTUB_MAX_PACKET_SIZE];
+    size_t len = 0;
+    payload[len++] = 'O';
+    while (*text && (len + 2 <= sizeof(payload))) {
+        gdbstub_put_hex8(&payload[len], (uint8_t)*text++);
+        len += 2;
+    }
+    gdbstub_send(payload, len);
+}
+
+static webapi_cpu_state_t gdbstub_cpu_state(void) {
+    webapi_cpu_state_t cpu_state = {0};
+    if (state.funcs.dbg_cpu_state) {
+        cpu_state = state.funcs.dbg_cpu_state();
+    }
+    return cpu_state;
+}
+
+// write register n as little-endian hex, returns pointer past the written chars, or 0 if n is out of range
+static char* gdbstub_put_reg(char* dst, const webapi_cpu_state_t* cpu_state, uint32_t n) {
+    static const int regs[] = {
+        WEBAPI_CPUSTATE_6502_A, WEBAPI_CPUSTATE_6502_X, WEBAPI_CPUSTATE_6502_Y,
+        WEBAPI_CPUSTATE_6502_S, WEBAPI_CPUSTATE_6502_P,
+    };
+    if (n < 5) {
+        return gdbstub_put_hex8(dst, (uint8_t)cpu_state->items[regs[n]]);
+    }
+    else if (n == 5) {
+        const uint16_t pc = cpu_state->items[WEBAPI_CPUSTATE_6502_PC];
+        dst = gdbstub_put_hex8(dst, (uint8_t)pc);
+        return gdbstub_put_hex8(dst, (uint8_t)(pc >> 8));
+    }
+    return 0;
+}
+
+static void gdbstub_read_registers(void) {
+    const webapi_cpu_state_t cpu_state = gdbstub_cpu_state();
+    char reply[16];
+    char* end = reply;
+    for (uint32_t n = 0; n < 6; n++) {
+        end = gdbstub_put_reg(end, &cpu_state, n);
+    }
+    gdbstub_send(reply, (size_t)(end - reply));
+}
+
+static void gdbstub_read_register(const char* args) {
+    uint32_t n;
+    gdbstub_parse_hex(args, &n);
+    const webapi_cpu_state_t cpu_state = gdbstub_cpu_state();
+    char reply[8];
+    char* end = gdbstub_put_reg(reply, &cpu_state, n);
+    if (end) {
+        gdbstub_send(reply, (size_t)(end - reply));
+    }
+    else {
+        gdbstub_send_str("E01");
+    }
+}
+
+// m addr,length: the whole range is read with a single dbg_read_memory() call
+static void gdbstub_read_memory(const char* args) {
+    uint32_t addr, len;
+    args = gdbstub_parse_hex(args, &addr);
+    if ((*args != ',') || !state.funcs.dbg_read_memory || (addr > 0xFFFF)) {
+        gdbstub_send_str("E01");
+        return;
+    }
+    gdbstub_parse_hex(args + 1, &len);
+    if (len > sizeof(state.mem)) {
+        len = sizeof(state.mem);
+    }
+    if (addr + len > 0x10000) {
+        len = 0x10000 - addr;
+    }
+    state.funcs.dbg_read_memory((uint16_t)addr, (int)len, state.mem);
+    char payload[GDBSTUB_MAX_PACKET_SIZE];
+    for (uint32_t i = 0; i < len; i++) {
+        gdbstub_put_hex8(&payload[i * 2], state.mem[i]);
+    }
+    gdbstub_send(payload, len * 2);
+}
+
+// Z0/Z1/z0/z1 type,addr,kind: software and hardware breakpoints are the same thing here
+static void gdbstub_breakpoint(const char* args, bool add) {
+    uint32_t type, addr;
+    args = gdbstub_parse_hex(args, &type);
+    if (((type != 0) && (type != 1)) || (*args != ',')) {
+        gdbstub_send_str("");
+        return;
+    }
+    gdbstub_parse_hex(args + 1, &addr);
+    if (add && state.funcs.dbg_add_breakpoint) {
+        state.funcs.dbg_add_breakpoint((uint16_t)addr);
+    }
+    else if (!add && state.funcs.dbg_remove_breakpoint) {
+        state.funcs.dbg_remove_breakpoint((uint16_t)addr);
+    }
+    gdbstub_send_str("OK");
+}
+
+// resume execution, the stop reply is sent when the stop event arrives
+static void gdbstub_resume(bool step) {
+    thread_atomic_store(&state.pending_stop, 0);
+    state.waiting = true;
+    if (step) {
+        if (state.funcs.dbg_step_into) {
+            state.funcs.dbg_step_into();
+        }
+    }
+    else if (state.funcs.dbg_continue) {
+        state.funcs.dbg_continue();
+    }
+}
+
+static void gdbstub_vcont(const char* args) {
+    if (0 == strcmp(args, "?")) {
+        gdbstub_send_str("vCont;c;C;s;S");
+    }
+    else if (args[0] == ';') {
+        // there's only one thread, the first action applies
+        const char action = args[1];
+        if ((action == 'c') || (action == 'C')) {
+            gdbstub_resume(false);
+        }
+        else if ((action == 's') || (action == 'S')) {
+            gdbstub_resume(true);
+        }
+        else {
+            gdbstub_send_str("E01");
+        }
+    }
+    else {
+        gdbstub_send_str("");
+    }
+}
+
+// qXfer:features:read:target.xml:offset,length
+static void gdbstub_read_features(const char* args) {
+    const char* annex = "target.xml:";
+    if (0 != strncmp(args, annex, strlen(annex))) {
+        gdbstub_send_str("E00");
+        return;
+    }
+    uint32_t offset, len;
+    args = gdbstub_parse_hex(args + strlen(annex), &offset);
+    gdbstub_parse_hex((*args == ',') ? args + 1 : args, &len);
+    const size_t xml_len = strlen(gdbstub_target_xml);
+    if (offset >= xml_len) {
+        gdbstub_send_str("l");
+        return;
+    }
+    if (len > GDBSTUB_MAX_PACKET_SIZE - 1) {
+        len = GDBSTUB_MAX_PACKET_SIZE - 1;
+    }
+    size_t num = xml_len - offset;
+    char payload[GDBSTUB_MAX_PACKET_SIZE];
+    payload[0] = (num > len) ? 'm' : 'l';
+    if (num > len) {
+        num = len;
+    }
+    memcpy(&payload[1], gdbstub_target_xml + offset, num);
+    gdbstub_send(payload, num + 1);
+}
+
+// monitor dasm [addr] [lines]
+static void gdbstub_monitor_dasm(const char* args) {
+    if (!state.funcs.dbg_request_disassembly) {
+        gdbstub_send_str("E01");
+        return;
+    }
+    uint32_t addr = gdbstub_cpu_state().items[WEBAPI_CPUSTATE_6502_PC];
+    uint32_t num_lines = 16;
+    char* end;
+    const unsigned long val0 = strtoul(args, &end, 16);
+    if (end != args) {
+        addr = (uint32_t)val0 & 0xFFFF;
+        args = end;
+        const unsigned long val1 = strtoul(args, &end, 10);
+        if (end != args) {
+            num_lines = (uint32_t)val1;
+        }
+    }
+    if (num_lines < 1) {
+        num_lines = 1;
+    }
+    if (num_lines > GDBSTUB_MAX_DASM_LINES) {
+        num_lines = GDBSTUB_MAX_DASM_LINES;
+    }
+    memset(state.dasm, 0, sizeof(state.dasm));
+    state.funcs.dbg_request_disassembly((uint16_t)addr, 0, (int)num_lines, state.dasm);
+    for (uint32_t i = 0; i < num_lines; i++) {
+        const webapi_dasm_line_t* line = &state.dasm[i];
+        char text[80];
+        int pos = snprintf(text, sizeof(text), "%04X: ", line->addr);
+        for (int b = 0; b < 3; b++) {
+            pos += snprintf(&text[pos], sizeof(text) - (size_t)pos, (b < line->num_bytes) ? "%02X " : "   ", line->bytes[b]);
+        }
+        snprintf(&text[pos], sizeof(text) - (size_t)pos, " %.*s\n", (int)line->num_chars, line->chars);
+        gdbstub_send_output(text);
+    }
+    gdbstub_send_str("OK");
+}
+
+// qRcmd,<hex encoded command>
+static void gdbstub_monitor(const char* args) {
+    char cmd[256];
+    size_t len = 0;
+    while ((gdbstub_hex_val(args[0]) >= 0) && (gdbstub_hex_val(args[1]) >= 0) && (len < sizeof(cmd) - 1)) {
+        cmd[len++] = (char)((gdbstub_hex_val(args[0]) << 4) | gdbstub_hex_val(args[1]));
+        args += 2;
+    }
+    cmd[len] = 0;
+    if (0 == strcmp(cmd, "reset")) {
+        if (state.funcs.reset) {
+            state.funcs.reset();
+        }
+        gdbstub_send_str("OK");
+    }
+    else if (0 == strncmp(cmd, "dasm", 4)) {
+        gdbstub_monitor_dasm(cmd + 4);
+    }
+    else {
+        gdbstub_send_output("commands: reset, dasm [addr] [lines]\n");
+        gdbstub_send_str("OK");
+    }
+}
+
+static void gdbstub_query(const char* cmd) {
+    if (0 == strncmp(cmd, "qSupported", 10)) {
+        char reply[128];
+        snprintf(reply, sizeof(reply), "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDBSTUB_MAX_PACKET_SIZE);
+        gdbstub_send_str(reply);
+    }
+    else if (0 == strncmp(cmd, "qXfer:features:read:", 20)) {
+        gdbstub_read_features(cmd + 20);
+    }
+    else if (0 == strncmp(cmd, "qRcmd,", 6)) {
+        gdbstub_monitor(cmd + 6);
+    }
+    else if (0 == strcmp(cmd, "qAttached")) {
+        gdbstub_send_str("1");
+    }
+    else if (0 == strcmp(cmd, "qC")) {
+        gdbstub_send_str("QC1");
+    }
+    else if (0 == strcmp(cmd, "qfThreadInfo")) {
+        gdbstub_send_str("m1");
+    }
+    else if (0 == strcmp(cmd, "qsThreadInfo")) {
+        gdbstub_send_str("l");
+    }
+    else {
+        gdbstub_send_str("");
+    }
+}
+
+static void gdbstub_disconnect(void) {
+    if (state.client_fd >= 0) {
+        close(state.client_fd);
+        state.client_fd = -1;
+        state.waiting = false;
+        if (state.funcs.dbg_disconnect) {
+            state.funcs.dbg_disconnect();
+        }
+    }
+}
+
+static void gdbstub_handle_packet(const char* cmd) {
+    switch (cmd[0]) {
+        case '?':
+            // the target is halted while a debugger is connected, a pending stop is reported now
+            thread_atomic_store(&state.pending_stop, 0);
+            gdbstub_send_stop_reply(GDBSTUB_SIGTRAP);
+            break;
+        case 'g': gdbstub_read_registers(); break;
+        case 'p': gdbstub_read_register(cmd + 1); break;
+        case 'm': gdbstub_read_memory(cmd + 1); break;
+        case 'c': gdbstub_resume(false); break;
+        case 's': gdbstub_resume(true); break;
+        case 'Z': gdbstub_breakpoint(cmd + 1, true); break;
+        case 'z': gdbstub_breakpoint(cmd + 1, false); break;
+        case 'H': gdbstub_send_str("OK"); break;
+        case 'T': gdbstub_send_str("OK"); break;
+        case 'q': gdbstub_query(cmd); break;
+        case 'v':
+            if (0 == strncmp(cmd, "vCont", 5)) {
+                gdbstub_vcont(cmd + 5);
+            }
+            else {
+                gdbstub_send_str("");
+            }
+            break;
+        case 'Q':
+            if (0 == strcmp(cmd, "QStartNoAckMode")) {
+                gdbstub_send_str("OK");
+                state.no_ack = true;
+            }
+            else {
+                gdbstub_send_str("");
+            }
+            break;
+        case 'D':
+            gdbstub_send_str("OK");
+            gdbstub_disconnect();
+            break;
+        case 'k':
+            gdbstub_disconnect();
+            break;
+        default:
+            // G, P, M, X: the debugger interface has no write operations
+            gdbstub_send_str("");
+            break;
+    }
+}
+
+static void gdbstub_receive(const char* data, size_t size) {
+    for (size_t i = 0; (i < size) && (state.client_fd >= 0); i++) {
+        const char c = data[i];
+        switch (state.rx.state) {
+            case GDBSTUB_RX_IDLE:
+                if (c == '$') {
+                    state.rx.state = GDBSTUB_RX_DATA;
+                    state.rx.len = 0;
+                    state.rx.checksum = 0;
+                }
+                else if (c == 0x03) {
+                    // Ctrl-C, the stop reply follows with the stop event
+                    if (state.funcs.dbg_break) {
+                        state.funcs.dbg_break();
+                    }
+                }
+                // acks (+/-) are ignored, packets are never retransmitted
+                break;
+            case GDBSTUB_RX_DATA:
+                if (c == '#') {
+                    state.rx.state = GDBSTUB_RX_CHECKSUM_HI;
+                }
+                else {
+                    state.rx.checksum += (uint8_t)c;
+                    if (state.rx.len < GDBSTUB_MAX_PACKET_SIZE) {
+                        state.rx.buf[state.rx.len++] = c;
+                    }
+                }
+                break;
+            case GDBSTUB_RX_CHECKSUM_HI:
+                state.rx.received_checksum = (uint8_t)(gdbstub_hex_val(c) << 4);
+                state.rx.state = GDBSTUB_RX_CHECKSUM_LO;
+                break;
+            case GDBSTUB_RX_CHECKSUM_LO:
+                state.rx.received_checksum |= (uint8_t)gdbstub_hex_val(c);
+                state.rx.state = GDBSTUB_RX_IDLE;
+                state.rx.buf[state.rx.len] = 0;
+                if (state.no_ack) {
+                    gdbstub_handle_packet(state.rx.buf);
+                }
+                else if (state.rx.received_checksum == state.rx.checksum) {
+                    gdbstub_send_raw("+", 1);
+                    gdbstub_handle_packet(state.rx.buf);
+                }
+                else {
+                    gdbstub_send_raw("-", 1);
+                }
+                break;
+        }
+    }
+}
+
+static void gdbstub_accept(void) {
+    const int fd = accept(state.listen_fd, 0, 0);
+    if (fd < 0) {
+        return;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    #if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
+    state.client_fd = fd;
+    state.no_ack = false;
+    state.waiting = false;
+    state.rx.state = GDBSTUB_RX_IDLE;
+    // the target stops when the debugger attaches
+    if (state.funcs.dbg_connect) {
+        state.funcs.dbg_connect();
+    }
+}
+
+static void gdbstub_thread_func(void* user_data) {
+    (void)user_data;
+    while (!thread_atomic_load(&state.quit)) {
+        if (state.client_fd < 0) {
+            struct pollfd pfd = { .fd = state.listen_fd, .events = POLLIN };
+            if (poll(&pfd, 1, 100) > 0) {
+                gdbstub_accept();
+            }
+            continue;
+        }
+        // wake up regularly to forward stop events while the target runs
+        struct pollfd pfd = { .fd = state.client_fd, .events = POLLIN };
+        const int res = poll(&pfd, 1, 10);
+        if (res > 0) {
+            char buf[1024];
+            const ssize_t num_bytes = recv(state.client_fd, buf, sizeof(buf), 0);
+            if (num_bytes <= 0) {
+                gdbstub_disconnect();
+                continue;
+            }
+            gdbstub_receive(buf, (size_t)num_bytes);
+        }
+        if (state.waiting && (state.client_fd >= 0)) {
+            const uint32_t sig = thread_atomic_exchange(&state.pending_stop, 0);
+            if (sig != 0) {
+                state.waiting = false;
+                gdbstub_send_stop_reply(sig);
+            }
+        }
+    }
+    gdbstub_disconnect();
+}
+
+#endif // !GDBSTUB_NO_SOCKETS
+
+bool gdbstub_start(const gdbstub_desc_t* desc) {
+    assert(desc && !state.valid);
+    #if defined(GDBSTUB_NO_SOCKETS)
+    return false;
+    #else
+    if (!thread_supported()) {
+        return false;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(desc->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, 1) != 0)) {
+        close(fd);
+        return false;
+    }
+    memset(&state, 0, sizeof(state));
+    state.funcs = desc->funcs;
+    state.listen_fd = fd;
+    state.client_fd = -1;
+    state.valid = true;
+    if (!thread_create(&state.thread, gdbstub_thread_func, 0)) {
+        close(fd);
+        state.valid = false;
+        return false;
+    }
+    return true;
+    #endif
+}
+
+void gdbstub_stop(void) {
+    #if !defined(GDBSTUB_NO_SOCKETS)
+    if (state.valid) {
+        thread_atomic_store(&state.quit, 1);
+        thread_join(&state.thread);
+        close(state.listen_fd);
+        state.valid = false;
+    }
+    #endif
+}
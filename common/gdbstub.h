@@ -0,0 +1,44 @@
+#pragma once
+/*
+    A GDB remote serial protocol server for native builds.
+
+    The server runs on its own thread and listens on 127.0.0.1:port for a
+    single debugger connection. Requests are translated into the debugger
+    operations of webapi_interface_t (see webapi.h), the same functions
+    which the web debugger uses under emscripten, and are called on the
+    server thread (so they must lock the emulator state themselves).
+    Stop events reach the client through webapi_event_stopped().
+
+    Supported packets: ?, g, p, m, c, s, vCont, Z0/Z1, z0/z1, D, k,
+    qSupported, qXfer:features:read (6502 register layout), QStartNoAckMode,
+    qRcmd ("monitor reset", "monitor dasm [addr] [lines]") and Ctrl-C.
+    Register and memory writes are not supported by webapi_interface_t and
+    are answered with an empty (unsupported) reply.
+
+    Register layout (all little-endian): a, x, y, s, p (8 bits each), pc (16 bits)
+
+    A memory read request is served with a single dbg_read_memory() call.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "webapi.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+    uint16_t port;
+    webapi_interface_t funcs;
+} gdbstub_desc_t;
+
+// start the server thread, returns false if sockets or threads are not supported or the port is taken
+bool gdbstub_start(const gdbstub_desc_t* desc);
+// disconnect the client and stop the server thread
+void gdbstub_stop(void);
+// report that the target has stopped (WEBAPI_STOPREASON_xxx), called via webapi_event_stopped()
+void gdbstub_event_stopped(int stop_reason, uint16_t addr);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
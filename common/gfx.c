@@ -39,8 +39,10 @@ typedef struct {
     struct {
         sg_buffer vbuf;
         sg_pipeline pip;
+        sg_pipeline crt_pip;
         sg_pass_action pass_action;
         bool portrait;
+        bool crt;
     } display;
     struct {
         sg_image img;
@@ -172,6 +174,22 @@ chips_dim_t gfx_pixel_aspect(void) {
     return state.offscreen.pixel_aspect;
 }
 
+void gfx_set_pixel_aspect(chips_dim_t pixel_aspect) {
+    assert(state.valid);
+    state.offscreen.pixel_aspect.width = GFX_DEF(pixel_aspect.width, 1);
+    state.offscreen.pixel_aspect.height = GFX_DEF(pixel_aspect.height, 1);
+}
+
+void gfx_set_crt(bool enabled) {
+    assert(state.valid);
+    state.display.crt = enabled;
+}
+
+bool gfx_crt(void) {
+    assert(state.valid);
+    return state.display.crt;
+}
+
 sg_image gfx_create_icon_texture(const uint8_t* packed_pixels, int width, int height, int stride) {
     const size_t pixel_data_size = width * height * sizeof(uint32_t);
     uint32_t* pixels = malloc(pixel_data_size);
@@ -280,6 +298,7 @@ void gfx_init(const gfx_desc_t* desc) {
     state.disable_speaker_icon = desc->disable_speaker_icon;
     state.border = desc->border;
     state.display.portrait = desc->display_info.portrait;
+    state.display.crt = desc->crt;
     state.draw_extra_cb = desc->draw_extra_cb;
     state.fb.dim =  desc->display_info.frame.dim;
     state.fb.paletted = 0 != desc->display_info.palette.ptr;
@@ -347,6 +366,16 @@ void gfx_init(const gfx_desc_t* desc) {
         },
         .primitive_type = SG_PRIMITIVETYPE_TRIANGLE_STRIP
     });
+    state.display.crt_pip = sg_make_pipeline(&(sg_pipeline_desc){
+        .shader = sg_make_shader(display_crt_shader_desc(sg_query_backend())),
+        .layout = {
+            .attrs = {
+                [0].format = SG_VERTEXFORMAT_FLOAT2,
+                [1].format = SG_VERTEXFORMAT_FLOAT2
+            }
+        },
+        .primitive_type = SG_PRIMITIVETYPE_TRIANGLE_STRIP
+    });
 
     // create an unpacked speaker icon image and sokol-gl pipeline
     {
@@ -384,9 +413,10 @@ void gfx_init(const gfx_desc_t* desc) {
 
 /* apply a viewport rectangle to preserve the emulator's aspect ratio,
    and for 'portrait' orientations, keep the emulator display at the
-   top, to make room at the bottom for mobile virtual keyboard
+   top, to make room at the bottom for mobile virtual keyboard,
+   returns the viewport rectangle
 */
-static void apply_viewport(chips_dim_t canvas, chips_rect_t view, chips_dim_t pixel_aspect, gfx_border_t border) {
+static chips_rect_t apply_viewport(chips_dim_t canvas, chips_rect_t view, chips_dim_t pixel_aspect, gfx_border_t border) {
     float cw = (float) (canvas.width - border.left - border.right);
     if (cw < 1.0f) {
         cw = 1.0f;
@@ -412,6 +442,7 @@ static void apply_viewport(chips_dim_t canvas, chips_rect_t view, chips_dim_t pi
         vp_y = border.top + (ch - vp_h) * 0.5f;
     }
     sg_apply_viewportf(vp_x, vp_y, vp_w, vp_h, true);
+    return (chips_rect_t){ .x = (int)vp_x, .y = (int)vp_y, .width = (int)vp_w, .height = (int)vp_h };
 }
 
 void gfx_draw(chips_display_info_t display_info) {
@@ -506,13 +537,20 @@ void gfx_draw(chips_display_info_t display_info) {
         .action = state.display.pass_action,
         .swapchain = sglue_swapchain()
     });
-    apply_viewport(display, display_info.screen, state.offscreen.pixel_aspect, state.border);
-    sg_apply_pipeline(state.display.pip);
+    const chips_rect_t vp = apply_viewport(display, display_info.screen, state.offscreen.pixel_aspect, state.border);
+    sg_apply_pipeline(state.display.crt ? state.display.crt_pip : state.display.pip);
     sg_apply_bindings(&(sg_bindings){
         .vertex_buffers[0] = state.display.vbuf,
         .images[IMG_tex] = state.offscreen.img,
         .samplers[SMP_smp] = state.offscreen.smp,
     });
+    if (state.display.crt) {
+        const display_crt_fs_params_t fs_params = {
+            .src_size = { (float)display_info.screen.width, (float)display_info.screen.height },
+            .dst_size = { (float)vp.width, (float)vp.height },
+        };
+        sg_apply_uniforms(UB_display_crt_fs_params, &SG_RANGE(fs_params));
+    }
     sg_draw(0, 4, 1);
     sg_apply_viewport(0, 0, display.width, display.height, true);
     sdtx_draw();
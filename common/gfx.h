@@ -2,9 +2,8 @@
 /*
     Common graphics functions for the chips-test example emulators.
 
-    REMINDER: consider using this CRT shader?
-
-    https://github.com/mattiasgustavsson/rebasic/blob/master/source/libs/crtemu.h
+    The final display pass can optionally simulate a CRT (barrel distortion,
+    scanlines and an aperture grille), see gfx_desc_t.crt and gfx_set_crt().
 */
 #include <stdint.h>
 #include <stdbool.h>
@@ -33,6 +32,7 @@ typedef struct {
     gfx_border_t border;
     chips_display_info_t display_info;
     chips_dim_t pixel_aspect;   // optional pixel aspect ratio, default is 1:1
+    bool crt;                   // optional CRT shader in the display pass
     gfx_draw_extra_t draw_extra_cb;
 } gfx_desc_t;
 
@@ -43,6 +43,10 @@ void gfx_flash_success(void);
 void gfx_flash_error(void);
 void gfx_disable_speaker_icon(void);
 chips_dim_t gfx_pixel_aspect(void);
+// change the pixel aspect ratio, e.g. when the emulator framebuffer width changes
+void gfx_set_pixel_aspect(chips_dim_t pixel_aspect);
+void gfx_set_crt(bool enabled);
+bool gfx_crt(void);
 sg_image gfx_create_icon_texture(const uint8_t* packed_pixels, int width, int height, int stride);
 
 #ifdef __cplusplus
@@ -0,0 +1,35 @@
+#pragma once
+/*
+    Checksum helpers: CRC32 and SHA-1 (both can be computed incrementally),
+    and a fast non-cryptographic 64-bit hash for hash tables.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define HASH_SHA1_SIZE (20)
+
+typedef struct {
+    uint32_t h[5];
+    uint64_t num_bytes;
+    uint32_t buf_size;
+    uint8_t buf[64];
+} hash_sha1_t;
+
+// update a running CRC32 (as used by zip/gzip/PNG), start with crc = 0
+uint32_t hash_crc32(uint32_t crc, const void* data, size_t size);
+// fast 64-bit hash (8 bytes per step), not suitable as a checksum for files or untrusted data
+uint64_t hash_fast64(const void* data, size_t size, uint64_t seed);
+// start a new SHA-1 computation
+void hash_sha1_init(hash_sha1_t* ctx);
+// add data to a SHA-1 computation
+void hash_sha1_update(hash_sha1_t* ctx, const void* data, size_t size);
+// finish a SHA-1 computation and write the 20-byte digest
+void hash_sha1_final(hash_sha1_t* ctx, uint8_t out_digest[HASH_SHA1_SIZE]);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
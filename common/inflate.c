@@ -0,0 +1,691 @@
+/*
+    The DEFLATE decoder follows the structure of Mark Adler's puff.c
+    (canonical Huffman decoding without lookup tables).
+
+    To make decoding resumable across input chunks, each header and each
+    symbol (or length/distance pair) is decoded as a 'transaction': if the
+    input runs out in the middle, the input position is rolled back and the
+    unconsumed bytes are kept in a small carry buffer until the next chunk
+    arrives.
+*/
+#include "inflate.h"
+#include "hash.h"
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define INFLATE_MAX_BITS (15)
+#define INFLATE_MAX_LCODES (286)
+#define INFLATE_MAX_DCODES (30)
+#define INFLATE_FIX_LCODES (288)
+
+#define INFLATE_ZIP_LOCAL_SIG (0x04034B50)
+#define INFLATE_ZIP_DESCRIPTOR_SIG (0x08074B50)
+#define INFLATE_ZIP_FLAG_DESCRIPTOR (1<<3)
+
+enum {
+    INFLATE_STATE_GZIP_HEADER,
+    INFLATE_STATE_GZIP_TRAILER,
+    INFLATE_STATE_ZIP_HEADER,
+    INFLATE_STATE_ZIP_STORED,
+    INFLATE_STATE_ZIP_SKIP,
+    INFLATE_STATE_ZIP_DESCRIPTOR,
+    INFLATE_STATE_BLOCK_HEADER,
+    INFLATE_STATE_STORED,
+    INFLATE_STATE_HUFFMAN,
+    INFLATE_STATE_DONE,
+    INFLATE_STATE_ERROR,
+};
+
+// status of a single decoding step
+typedef enum {
+    INFLATE_STEP_OK,
+    INFLATE_STEP_NEED_INPUT,    // roll back to the start of the step and wait for input
+    INFLATE_STEP_PAUSE,         // keep the progress of the step and wait for input
+    INFLATE_STEP_ERROR,
+} inflate_step_t;
+
+typedef struct {
+    int index;
+    size_t pos;
+    uint32_t bitbuf;
+    int bitcnt;
+} inflate_tx_t;
+
+static const uint16_t inflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint16_t inflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t inflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint16_t inflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t inflate_clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static inflate_tx_t inflate_tx_begin(inflate_stream_t* s) {
+    // don't let a step start at the end of an input segment, otherwise a
+    // rollback would keep the entire next segment as carry
+    while ((s->in_index < 2) && (s->in_pos == s->in_size[s->in_index])) {
+        s->in_index++;
+        s->in_pos = 0;
+    }
+    return (inflate_tx_t){ .index = s->in_index, .pos = s->in_pos, .bitbuf = s->bitbuf, .bitcnt = s->bitcnt };
+}
+
+static void inflate_tx_rollback(inflate_stream_t* s, const inflate_tx_t* tx) {
+    s->in_index = tx->index;
+    s->in_pos = tx->pos;
+    s->bitbuf = tx->bitbuf;
+    s->bitcnt = tx->bitcnt;
+    s->in_eof = false;
+}
+
+// read the next input byte, sets in_eof and returns 0 if no input is left
+static uint32_t inflate_byte(inflate_stream_t* s) {
+    while (s->in_index < 2) {
+        if (s->in_pos < s->in_size[s->in_index]) {
+            return s->in_ptr[s->in_index][s->in_pos++];
+        }
+        s->in_index++;
+        s->in_pos = 0;
+    }
+    s->in_eof = true;
+    return 0;
+}
+
+static uint32_t inflate_bits(inflate_stream_t* s, int num) {
+    assert(num <= 16);
+    uint32_t val = s->bitbuf;
+    while (s->bitcnt < num) {
+        val |= inflate_byte(s) << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf = val >> num;
+    s->bitcnt -= num;
+    return val & ((1u << num) - 1);
+}
+
+// discard bits up to the next byte boundary
+static void inflate_align(inflate_stream_t* s) {
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+}
+
+// read little-endian integers from a byte-aligned position
+static uint32_t inflate_u16(inflate_stream_t* s) {
+    const uint32_t b0 = inflate_byte(s);
+    return b0 | (inflate_byte(s) << 8);
+}
+
+static uint32_t inflate_u32(inflate_stream_t* s) {
+    const uint32_t lo = inflate_u16(s);
+    return lo | (inflate_u16(s) << 16);
+}
+
+static int inflate_decode(inflate_stream_t* s, const inflate_huffman_t* h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= (int)inflate_bits(s, 1);
+        const int count = h->count[len];
+        if ((code - count) < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// build a canonical Huffman table, returns 0 if complete, > 0 if incomplete, < 0 if over-subscribed
+static int inflate_construct(inflate_huffman_t* h, const int16_t* length, int n) {
+    int16_t offs[INFLATE_MAX_BITS + 1];
+    memset(h->count, 0, sizeof(h->count));
+    for (int sym = 0; sym < n; sym++) {
+        h->count[length[sym]]++;
+    }
+    if (h->count[0] == n) {
+        return 0;
+    }
+    int left = 1;
+    for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+    offs[1] = 0;
+    for (int len = 1; len < INFLATE_MAX_BITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int sym = 0; sym < n; sym++) {
+        if (length[sym] != 0) {
+            h->symbol[offs[length[sym]]++] = (int16_t)sym;
+        }
+    }
+    return left;
+}
+
+static void inflate_flush(inflate_stream_t* s) {
+    if (s->wpos > s->wflush) {
+        const uint8_t* ptr = &s->window[s->wflush];
+        const size_t size = s->wpos - s->wflush;
+        s->crc = hash_crc32(s->crc, ptr, size);
+        if (!s->discard && !s->desc.output(ptr, size, s->desc.user_data)) {
+            s->state = INFLATE_STATE_ERROR;
+        }
+        s->wflush = s->wpos;
+    }
+}
+
+static void inflate_put(inflate_stream_t* s, uint8_t val) {
+    s->window[s->wpos++] = val;
+    s->total_out++;
+    if (s->wpos == INFLATE_WINDOW_SIZE) {
+        inflate_flush(s);
+        s->wpos = 0;
+        s->wflush = 0;
+    }
+}
+
+static inflate_step_t inflate_fixed_tables(inflate_stream_t* s) {
+    int16_t lengths[INFLATE_FIX_LCODES];
+    int sym = 0;
+    for (; sym < 144; sym++) lengths[sym] = 8;
+    for (; sym < 256; sym++) lengths[sym] = 9;
+    for (; sym < 280; sym++) lengths[sym] = 7;
+    for (; sym < INFLATE_FIX_LCODES; sym++) lengths[sym] = 8;
+    inflate_construct(&s->lencode, lengths, INFLATE_FIX_LCODES);
+    for (sym = 0; sym < INFLATE_MAX_DCODES; sym++) lengths[sym] = 5;
+    inflate_construct(&s->distcode, lengths, INFLATE_MAX_DCODES);
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_dynamic_tables(inflate_stream_t* s) {
+    int16_t lengths[INFLATE_MAX_LCODES + INFLATE_MAX_DCODES];
+    const int nlen = (int)inflate_bits(s, 5) + 257;
+    const int ndist = (int)inflate_bits(s, 5) + 1;
+    const int ncode = (int)inflate_bits(s, 4) + 4;
+    if ((nlen > INFLATE_MAX_LCODES) || (ndist > INFLATE_MAX_DCODES)) {
+        return INFLATE_STEP_ERROR;
+    }
+    int index = 0;
+    for (; index < ncode; index++) {
+        lengths[inflate_clen_order[index]] = (int16_t)inflate_bits(s, 3);
+    }
+    for (; index < 19; index++) {
+        lengths[inflate_clen_order[index]] = 0;
+    }
+    if (0 != inflate_construct(&s->lencode, lengths, 19)) {
+        return INFLATE_STEP_ERROR;
+    }
+    index = 0;
+    while (index < (nlen + ndist)) {
+        int sym = inflate_decode(s, &s->lencode);
+        if (sym < 0) {
+            return INFLATE_STEP_ERROR;
+        }
+        if (sym < 16) {
+            lengths[index++] = (int16_t)sym;
+        }
+        else {
+            int16_t len = 0;
+            if (sym == 16) {
+                if (index == 0) {
+                    return INFLATE_STEP_ERROR;
+                }
+                len = lengths[index - 1];
+                sym = 3 + (int)inflate_bits(s, 2);
+            }
+            else if (sym == 17) {
+                sym = 3 + (int)inflate_bits(s, 3);
+            }
+            else {
+                sym = 11 + (int)inflate_bits(s, 7);
+            }
+            if ((index + sym) > (nlen + ndist)) {
+                return INFLATE_STEP_ERROR;
+            }
+            while (sym--) {
+                lengths[index++] = len;
+            }
+        }
+    }
+    if (lengths[256] == 0) {
+        return INFLATE_STEP_ERROR;
+    }
+    // incomplete code sets are only allowed for a single length
+    const int err = inflate_construct(&s->lencode, lengths, nlen);
+    if ((err < 0) || ((err > 0) && ((nlen - s->lencode.count[0]) != 1))) {
+        return INFLATE_STEP_ERROR;
+    }
+    const int derr = inflate_construct(&s->distcode, lengths + nlen, ndist);
+    if ((derr < 0) || ((derr > 0) && ((ndist - s->distcode.count[0]) != 1))) {
+        return INFLATE_STEP_ERROR;
+    }
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_block_header(inflate_stream_t* s) {
+    s->final_block = inflate_bits(s, 1);
+    const uint32_t type = inflate_bits(s, 2);
+    inflate_step_t step = INFLATE_STEP_OK;
+    switch (type) {
+        case 0: {
+            inflate_align(s);
+            const uint32_t len = inflate_u16(s);
+            const uint32_t nlen = inflate_u16(s);
+            if (s->in_eof) {
+                return INFLATE_STEP_NEED_INPUT;
+            }
+            if (len != (~nlen & 0xFFFF)) {
+                return INFLATE_STEP_ERROR;
+            }
+            s->remaining = len;
+            s->state = INFLATE_STATE_STORED;
+            return INFLATE_STEP_OK;
+        }
+        case 1:
+            step = inflate_fixed_tables(s);
+            break;
+        case 2:
+            step = inflate_dynamic_tables(s);
+            break;
+        default:
+            step = INFLATE_STEP_ERROR;
+            break;
+    }
+    // garbage decoded past the end of the input is not an error
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if (step == INFLATE_STEP_OK) {
+        s->state = INFLATE_STATE_HUFFMAN;
+    }
+    return step;
+}
+
+static void inflate_end_of_deflate(inflate_stream_t* s) {
+    inflate_flush(s);
+    inflate_align(s);
+    switch (s->desc.format) {
+        case INFLATE_FORMAT_GZIP:
+            s->state = INFLATE_STATE_GZIP_TRAILER;
+            break;
+        case INFLATE_FORMAT_ZIP:
+            if (s->zip_flags & INFLATE_ZIP_FLAG_DESCRIPTOR) {
+                s->state = INFLATE_STATE_ZIP_DESCRIPTOR;
+            }
+            else if (!s->discard && (s->crc != s->expected_crc)) {
+                s->state = INFLATE_STATE_ERROR;
+            }
+            else {
+                s->state = s->discard ? INFLATE_STATE_ZIP_HEADER : INFLATE_STATE_DONE;
+            }
+            break;
+        default:
+            s->state = INFLATE_STATE_DONE;
+            break;
+    }
+}
+
+static inflate_step_t inflate_huffman_symbol(inflate_stream_t* s) {
+    int sym = inflate_decode(s, &s->lencode);
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if (sym < 0) {
+        return INFLATE_STEP_ERROR;
+    }
+    if (sym < 256) {
+        inflate_put(s, (uint8_t)sym);
+        return INFLATE_STEP_OK;
+    }
+    if (sym == 256) {
+        if (s->final_block) {
+            inflate_end_of_deflate(s);
+        }
+        else {
+            s->state = INFLATE_STATE_BLOCK_HEADER;
+        }
+        return INFLATE_STEP_OK;
+    }
+    sym -= 257;
+    if (sym >= 29) {
+        return INFLATE_STEP_ERROR;
+    }
+    const uint32_t len = inflate_len_base[sym] + inflate_bits(s, inflate_len_extra[sym]);
+    const int dsym = inflate_decode(s, &s->distcode);
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if ((dsym < 0) || (dsym >= 30)) {
+        return INFLATE_STEP_ERROR;
+    }
+    const uint32_t dist = inflate_dist_base[dsym] + inflate_bits(s, inflate_dist_extra[dsym]);
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if (dist > s->total_out) {
+        return INFLATE_STEP_ERROR;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        inflate_put(s, s->window[(s->wpos - dist) & (INFLATE_WINDOW_SIZE - 1)]);
+    }
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_gzip_header(inflate_stream_t* s) {
+    const uint32_t id1 = inflate_byte(s);
+    const uint32_t id2 = inflate_byte(s);
+    const uint32_t method = inflate_byte(s);
+    const uint32_t flags = inflate_byte(s);
+    for (int i = 0; i < 6; i++) {
+        inflate_byte(s);    // mtime, xfl, os
+    }
+    if (flags & 4) {
+        const uint32_t xlen = inflate_u16(s);
+        for (uint32_t i = 0; (i < xlen) && !s->in_eof; i++) {
+            inflate_byte(s);
+        }
+    }
+    if (flags & 8) {
+        while (inflate_byte(s) && !s->in_eof);  // file name
+    }
+    if (flags & 16) {
+        while (inflate_byte(s) && !s->in_eof);  // comment
+    }
+    if (flags & 2) {
+        inflate_u16(s);     // header crc
+    }
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if ((id1 != 0x1F) || (id2 != 0x8B) || (method != 8)) {
+        return INFLATE_STEP_ERROR;
+    }
+    s->state = INFLATE_STATE_BLOCK_HEADER;
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_gzip_trailer(inflate_stream_t* s) {
+    const uint32_t crc = inflate_u32(s);
+    const uint32_t isize = inflate_u32(s);
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if ((crc != s->crc) || (isize != s->total_out)) {
+        return INFLATE_STEP_ERROR;
+    }
+    s->state = INFLATE_STATE_DONE;
+    return INFLATE_STEP_OK;
+}
+
+static bool inflate_match_ext(const char* name, size_t name_len, const char* ext) {
+    if ((name_len == 0) || (name[name_len - 1] == '/')) {
+        return false;   // directory entry
+    }
+    if (!ext) {
+        return true;
+    }
+    const size_t ext_len = strlen(ext);
+    if (name_len <= (ext_len + 1)) {
+        return false;
+    }
+    const char* name_ext = name + name_len - ext_len;
+    if (name_ext[-1] != '.') {
+        return false;
+    }
+    for (size_t i = 0; i < ext_len; i++) {
+        if (tolower((unsigned char)name_ext[i]) != tolower((unsigned char)ext[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inflate_step_t inflate_zip_header(inflate_stream_t* s) {
+    const uint32_t sig = inflate_u32(s);
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if (sig != INFLATE_ZIP_LOCAL_SIG) {
+        // central directory reached without finding a matching entry
+        return INFLATE_STEP_ERROR;
+    }
+    inflate_u16(s);     // version needed
+    const uint16_t flags = (uint16_t)inflate_u16(s);
+    const uint32_t method = inflate_u16(s);
+    inflate_u32(s);     // time and date
+    const uint32_t crc = inflate_u32(s);
+    const uint32_t comp_size = inflate_u32(s);
+    inflate_u32(s);     // uncompressed size
+    const uint32_t name_len = inflate_u16(s);
+    const uint32_t extra_len = inflate_u16(s);
+    char name[256];
+    for (uint32_t i = 0; (i < name_len) && !s->in_eof; i++) {
+        const char c = (char)inflate_byte(s);
+        if (i < sizeof(name)) {
+            name[i] = c;
+        }
+    }
+    for (uint32_t i = 0; (i < extra_len) && !s->in_eof; i++) {
+        inflate_byte(s);
+    }
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    const bool match = (name_len <= sizeof(name)) && inflate_match_ext(name, name_len, s->desc.zip_ext);
+    s->zip_flags = flags;
+    s->expected_crc = crc;
+    s->crc = 0;
+    s->total_out = 0;
+    s->discard = !match;
+    if ((method != 0) && (method != 8)) {
+        if (match || (flags & INFLATE_ZIP_FLAG_DESCRIPTOR)) {
+            return INFLATE_STEP_ERROR;
+        }
+        s->remaining = comp_size;
+        s->state = INFLATE_STATE_ZIP_SKIP;
+    }
+    else if (!match && !(flags & INFLATE_ZIP_FLAG_DESCRIPTOR)) {
+        s->remaining = comp_size;
+        s->state = INFLATE_STATE_ZIP_SKIP;
+    }
+    else if (method == 0) {
+        // stored entries need a known size
+        if (flags & INFLATE_ZIP_FLAG_DESCRIPTOR) {
+            return INFLATE_STEP_ERROR;
+        }
+        s->remaining = comp_size;
+        s->state = INFLATE_STATE_ZIP_STORED;
+    }
+    else {
+        s->state = INFLATE_STATE_BLOCK_HEADER;
+    }
+    s->entry_found |= match;
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_zip_descriptor(inflate_stream_t* s) {
+    uint32_t crc = inflate_u32(s);
+    if (crc == INFLATE_ZIP_DESCRIPTOR_SIG) {
+        crc = inflate_u32(s);
+    }
+    inflate_u32(s);     // compressed size
+    inflate_u32(s);     // uncompressed size
+    if (s->in_eof) {
+        return INFLATE_STEP_NEED_INPUT;
+    }
+    if (s->discard) {
+        s->state = INFLATE_STATE_ZIP_HEADER;
+    }
+    else if (crc != s->crc) {
+        return INFLATE_STEP_ERROR;
+    }
+    else {
+        s->state = INFLATE_STATE_DONE;
+    }
+    return INFLATE_STEP_OK;
+}
+
+// copy or skip bytes of a stored block or zip entry
+static inflate_step_t inflate_copy(inflate_stream_t* s, bool output) {
+    while (s->remaining > 0) {
+        const uint32_t val = inflate_byte(s);
+        if (s->in_eof) {
+            s->in_eof = false;
+            return INFLATE_STEP_PAUSE;
+        }
+        if (output) {
+            inflate_put(s, (uint8_t)val);
+        }
+        s->remaining--;
+    }
+    return INFLATE_STEP_OK;
+}
+
+static inflate_step_t inflate_step(inflate_stream_t* s) {
+    switch (s->state) {
+        case INFLATE_STATE_GZIP_HEADER:     return inflate_gzip_header(s);
+        case INFLATE_STATE_GZIP_TRAILER:    return inflate_gzip_trailer(s);
+        case INFLATE_STATE_ZIP_HEADER:      return inflate_zip_header(s);
+        case INFLATE_STATE_ZIP_DESCRIPTOR:  return inflate_zip_descriptor(s);
+        case INFLATE_STATE_BLOCK_HEADER:    return inflate_block_header(s);
+        case INFLATE_STATE_HUFFMAN:         return inflate_huffman_symbol(s);
+        case INFLATE_STATE_STORED: {
+            const inflate_step_t step = inflate_copy(s, true);
+            if (step == INFLATE_STEP_OK) {
+                if (s->final_block) {
+                    inflate_end_of_deflate(s);
+                }
+                else {
+                    s->state = INFLATE_STATE_BLOCK_HEADER;
+                }
+            }
+            return step;
+        }
+        case INFLATE_STATE_ZIP_STORED: {
+            const inflate_step_t step = inflate_copy(s, true);
+            if (step == INFLATE_STEP_OK) {
+                inflate_flush(s);
+                s->state = (s->crc == s->expected_crc) ? INFLATE_STATE_DONE : INFLATE_STATE_ERROR;
+            }
+            return step;
+        }
+        case INFLATE_STATE_ZIP_SKIP: {
+            const inflate_step_t step = inflate_copy(s, false);
+            if (step == INFLATE_STEP_OK) {
+                s->state = INFLATE_STATE_ZIP_HEADER;
+            }
+            return step;
+        }
+        default:
+            return INFLATE_STEP_ERROR;
+    }
+}
+
+void inflate_stream_init(inflate_stream_t* s, const inflate_desc_t* desc) {
+    assert(s && desc && desc->output);
+    memset(s, 0, sizeof(inflate_stream_t));
+    s->desc = *desc;
+    switch (desc->format) {
+        case INFLATE_FORMAT_GZIP:   s->state = INFLATE_STATE_GZIP_HEADER; break;
+        case INFLATE_FORMAT_ZIP:    s->state = INFLATE_STATE_ZIP_HEADER; break;
+        default:                    s->state = INFLATE_STATE_BLOCK_HEADER; break;
+    }
+}
+
+inflate_result_t inflate_stream_feed(inflate_stream_t* s, const uint8_t* data, size_t size) {
+    assert(s && (data || (size == 0)));
+    if (s->state == INFLATE_STATE_DONE) {
+        return INFLATE_RESULT_DONE;
+    }
+    if (s->state == INFLATE_STATE_ERROR) {
+        return INFLATE_RESULT_ERROR;
+    }
+    // the carried-over input is consumed first
+    s->in_ptr[0] = s->carry;
+    s->in_size[0] = s->carry_size;
+    s->in_ptr[1] = data;
+    s->in_size[1] = size;
+    s->in_index = 0;
+    s->in_pos = 0;
+    s->in_eof = false;
+
+    inflate_step_t step = INFLATE_STEP_OK;
+    while ((step == INFLATE_STEP_OK) && (s->state != INFLATE_STATE_DONE) && (s->state != INFLATE_STATE_ERROR)) {
+        const inflate_tx_t tx = inflate_tx_begin(s);
+        step = inflate_step(s);
+        if (step == INFLATE_STEP_NEED_INPUT) {
+            inflate_tx_rollback(s, &tx);
+        }
+        else if (step == INFLATE_STEP_ERROR) {
+            s->state = INFLATE_STATE_ERROR;
+        }
+    }
+    inflate_flush(s);
+    if (s->state == INFLATE_STATE_ERROR) {
+        return INFLATE_RESULT_ERROR;
+    }
+
+    // keep the unconsumed input for the next call
+    size_t carry_size = 0;
+    if (s->state == INFLATE_STATE_DONE) {
+        // ignore trailing data
+    }
+    else if (s->in_index == 0) {
+        const size_t num = s->carry_size - s->in_pos;
+        memmove(s->carry, s->carry + s->in_pos, num);
+        carry_size = num;
+        if ((carry_size + size) > INFLATE_CARRY_SIZE) {
+            s->state = INFLATE_STATE_ERROR;
+            return INFLATE_RESULT_ERROR;
+        }
+        memcpy(s->carry + carry_size, data, size);
+        carry_size += size;
+    }
+    else if (s->in_index == 1) {
+        const size_t num = size - s->in_pos;
+        if (num > INFLATE_CARRY_SIZE) {
+            s->state = INFLATE_STATE_ERROR;
+            return INFLATE_RESULT_ERROR;
+        }
+        memcpy(s->carry, data + s->in_pos, num);
+        carry_size = num;
+    }
+    s->carry_size = carry_size;
+    s->in_ptr[0] = s->in_ptr[1] = 0;
+    s->in_size[0] = s->in_size[1] = 0;
+    return (s->state == INFLATE_STATE_DONE) ? INFLATE_RESULT_DONE : INFLATE_RESULT_NEED_INPUT;
+}
+
+bool inflate_stream_done(const inflate_stream_t* s) {
+    assert(s);
+    return s->state == INFLATE_STATE_DONE;
+}
+
+bool inflate_format_from_ext(const char* ext, inflate_format_t* out_format) {
+    assert(ext && out_format);
+    if (0 == strcmp(ext, "gz")) {
+        *out_format = INFLATE_FORMAT_GZIP;
+        return true;
+    }
+    else if (0 == strcmp(ext, "zip")) {
+        *out_format = INFLATE_FORMAT_ZIP;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,91 @@
+#pragma once
+/*
+    Streaming DEFLATE decompression with gzip and zip container support.
+
+    Compressed data can be fed in chunks of any size, decompressed data
+    is passed to an output callback in chunks of up to 32 KBytes as soon
+    as it is available, so that neither the whole compressed nor the whole
+    decompressed data needs to be held in memory.
+
+    For zip archives, only the first entry with a matching file extension
+    is extracted (stored or deflated entries).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define INFLATE_WINDOW_SIZE (32768)
+#define INFLATE_CARRY_SIZE (4096)   // max size of input carried over between chunks
+
+typedef enum {
+    INFLATE_FORMAT_RAW,     // raw DEFLATE stream
+    INFLATE_FORMAT_GZIP,
+    INFLATE_FORMAT_ZIP,
+} inflate_format_t;
+
+typedef enum {
+    INFLATE_RESULT_NEED_INPUT,
+    INFLATE_RESULT_DONE,
+    INFLATE_RESULT_ERROR,
+} inflate_result_t;
+
+// called with decompressed data, return false to abort decompression
+typedef bool (*inflate_output_t)(const uint8_t* data, size_t size, void* user_data);
+
+typedef struct {
+    inflate_format_t format;
+    inflate_output_t output;
+    void* user_data;
+    const char* zip_ext;    // zip: extract the first entry with this extension (e.g. "nes"), default: first file
+} inflate_desc_t;
+
+typedef struct {
+    int16_t count[16];      // number of codes of each length
+    int16_t symbol[288];    // symbols ordered by code
+} inflate_huffman_t;
+
+typedef struct {
+    inflate_desc_t desc;
+    int state;
+    bool final_block;
+    bool discard;           // zip: decode an entry without output
+    bool entry_found;       // zip: the matching entry has been found
+    uint16_t zip_flags;
+    uint32_t remaining;     // bytes left in a stored block or skipped zip entry
+    uint32_t expected_crc;
+    uint32_t crc;           // running CRC32 of the output
+    uint32_t total_out;
+    inflate_huffman_t lencode;
+    inflate_huffman_t distcode;
+    // input state
+    uint32_t bitbuf;
+    int bitcnt;
+    const uint8_t* in_ptr[2];
+    size_t in_size[2];
+    int in_index;
+    size_t in_pos;
+    bool in_eof;
+    size_t carry_size;
+    uint8_t carry[INFLATE_CARRY_SIZE];
+    // output window
+    uint32_t wpos;
+    uint32_t wflush;
+    uint8_t window[INFLATE_WINDOW_SIZE];
+} inflate_stream_t;
+
+// initialize a decompression stream
+void inflate_stream_init(inflate_stream_t* s, const inflate_desc_t* desc);
+// feed a chunk of compressed data
+inflate_result_t inflate_stream_feed(inflate_stream_t* s, const uint8_t* data, size_t size);
+// return true if the stream has been completely decompressed
+bool inflate_stream_done(const inflate_stream_t* s);
+// guess the container format from a file extension ("gz" or "zip"), returns false if not compressed
+bool inflate_format_from_ext(const char* ext, inflate_format_t* out_format);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
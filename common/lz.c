@@ -0,0 +1,163 @@
+#include "lz.h"
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#define LZ_HASH_BITS (12)
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+
+static uint32_t lz_read32(const uint8_t* ptr) {
+    uint32_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+static uint32_t lz_hash(uint32_t val) {
+    return (val * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// write an extended length (the part which didn't fit into the token nibble)
+static uint8_t* lz_write_length(uint8_t* op, const uint8_t* op_end, size_t len) {
+    while (len >= 255) {
+        if (op >= op_end) {
+            return 0;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= op_end) {
+        return 0;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// write a sequence of literals, optionally followed by a match (match_len == 0 for the last sequence)
+static uint8_t* lz_write_sequence(uint8_t* op, const uint8_t* op_end, const uint8_t* literals, size_t num_literals, size_t offset, size_t match_len) {
+    if (op >= op_end) {
+        return 0;
+    }
+    uint8_t* token = op++;
+    *token = (uint8_t)(((num_literals < 15) ? num_literals : 15) << 4);
+    if (num_literals >= 15) {
+        if (0 == (op = lz_write_length(op, op_end, num_literals - 15))) {
+            return 0;
+        }
+    }
+    if ((size_t)(op_end - op) < num_literals) {
+        return 0;
+    }
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+    if (match_len > 0) {
+        if ((op_end - op) < 2) {
+            return 0;
+        }
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        const size_t len = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)((len < 15) ? len : 15);
+        if (len >= 15) {
+            if (0 == (op = lz_write_length(op, op_end, len - 15))) {
+                return 0;
+            }
+        }
+    }
+    return op;
+}
+
+size_t lz_compress(const void* src, size_t src_size, void* dst, size_t dst_size) {
+    assert(src && dst);
+    const uint8_t* in = (const uint8_t*)src;
+    uint8_t* op = (uint8_t*)dst;
+    const uint8_t* op_end = op + dst_size;
+    // positions + 1 of the last occurrence of each hashed 4-byte sequence, 0 if none
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    size_t ip = 0;
+    size_t anchor = 0;
+    while ((ip + LZ_MIN_MATCH) <= src_size) {
+        const uint32_t seq = lz_read32(in + ip);
+        const uint32_t h = lz_hash(seq);
+        const size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+        if ((ref > 0) && ((ip - (ref - 1)) <= LZ_MAX_OFFSET) && (lz_read32(in + ref - 1) == seq)) {
+            const size_t match = ref - 1;
+            size_t len = LZ_MIN_MATCH;
+            while (((ip + len) < src_size) && (in[match + len] == in[ip + len])) {
+                len++;
+            }
+            if (0 == (op = lz_write_sequence(op, op_end, in + anchor, ip - anchor, ip - match, len))) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+        else {
+            ip++;
+        }
+    }
+    if (0 == (op = lz_write_sequence(op, op_end, in + anchor, src_size - anchor, 0, 0))) {
+        return 0;
+    }
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+// read an extended length, returns false on truncated input
+static bool lz_read_length(const uint8_t** ip, const uint8_t* ip_end, size_t* len) {
+    uint8_t val;
+    do {
+        if (*ip >= ip_end) {
+            return false;
+        }
+        val = *(*ip)++;
+        *len += val;
+    } while (val == 255);
+    return true;
+}
+
+size_t lz_decompress(const void* src, size_t src_size, void* dst, size_t dst_size) {
+    assert(src && dst);
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* ip_end = ip + src_size;
+    uint8_t* out = (uint8_t*)dst;
+    size_t op = 0;
+    while (ip < ip_end) {
+        const uint8_t token = *ip++;
+        size_t num_literals = token >> 4;
+        if ((num_literals == 15) && !lz_read_length(&ip, ip_end, &num_literals)) {
+            return 0;
+        }
+        if (((size_t)(ip_end - ip) < num_literals) || ((dst_size - op) < num_literals)) {
+            return 0;
+        }
+        memcpy(out + op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+        if (ip == ip_end) {
+            // the last sequence has no match
+            break;
+        }
+        if ((ip_end - ip) < 2) {
+            return 0;
+        }
+        const size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if ((len == 15) && !lz_read_length(&ip, ip_end, &len)) {
+            return 0;
+        }
+        len += LZ_MIN_MATCH;
+        if ((offset == 0) || (offset > op) || ((dst_size - op) < len)) {
+            return 0;
+        }
+        // byte-wise copy, matches may overlap the output
+        const uint8_t* match = out + op - offset;
+        for (size_t i = 0; i < len; i++) {
+            out[op + i] = match[i];
+        }
+        op += len;
+    }
+    return op;
+}
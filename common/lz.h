@@ -0,0 +1,28 @@
+#pragma once
+/*
+    A small and fast LZ77 block compressor (LZ4-like sequence format).
+
+    Each sequence is a token byte (high nibble: number of literals, low
+    nibble: match length - 4, a nibble value of 15 is extended with
+    additional length bytes), followed by the literals, a 16-bit
+    little-endian match offset and the extended match length. The last
+    sequence only has literals.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// worst-case compressed size for incompressible data
+#define LZ_MAX_COMPRESSED_SIZE(size) ((size) + ((size) / 255) + 16)
+
+// compress a block of data, returns the compressed size, or 0 if dst is too small
+size_t lz_compress(const void* src, size_t src_size, void* dst, size_t dst_size);
+// decompress a block of data, returns the decompressed size, or 0 on corrupt data or if dst is too small
+size_t lz_decompress(const void* src, size_t src_size, void* dst, size_t dst_size);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
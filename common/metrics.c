@@ -0,0 +1,300 @@
+#include "metrics.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__) || defined(_WIN32)
+    #define METRICS_NO_SOCKETS (1)
+#else
+    #include <unistd.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+
+#define METRICS_MAX_RESPONSE_SIZE (64 * 1024)
+
+// upper bounds of the histogram buckets in milliseconds (the last bucket is +Inf)
+static const float metrics_bucket_bounds[METRICS_NUM_HISTOGRAM_BUCKETS] = {
+    1.0f, 2.0f, 4.0f, 8.0f, 12.0f, 16.7f, 25.0f, 33.3f, 50.0f, 100.0f
+};
+
+typedef struct {
+    metrics_type_t type;
+    char name[64];
+    char help[128];
+    volatile uint64_t value;        // counter/gauge value, histogram sample count
+    volatile uint64_t sum_us;       // histogram: sum of all values in microseconds
+    volatile uint64_t buckets[METRICS_NUM_HISTOGRAM_BUCKETS + 1];
+} metrics_item_t;
+
+typedef struct {
+    bool valid;
+    bool serving;
+    int num_items;
+    metrics_item_t items[METRICS_MAX_METRICS];
+    metrics_t prof[PROF_NUM_BUCKET_TYPES];
+    struct {
+        thread_t thread;
+        volatile uint32_t quit;
+        int listen_fd;
+        char response[METRICS_MAX_RESPONSE_SIZE];
+    } server;
+} metrics_state_t;
+static metrics_state_t state;
+
+void metrics_init(void) {
+    assert(!state.valid);
+    memset(&state, 0, sizeof(state));
+    state.server.listen_fd = -1;
+    state.valid = true;
+    state.prof[PROF_FRAME] = metrics_register(METRICS_HISTOGRAM, "prof_frame_ms", "Host frame time in milliseconds.");
+    state.prof[PROF_EMU] = metrics_register(METRICS_HISTOGRAM, "prof_emu_ms", "Emulator time per host frame in milliseconds.");
+    state.prof[PROF_RESIM] = metrics_register(METRICS_HISTOGRAM, "prof_resim_ms", "Netplay time per (re-)simulated frame in milliseconds.");
+    state.prof[PROF_VIDEO] = metrics_register(METRICS_HISTOGRAM, "prof_video_ms", "CPU-side video filter time per frame in milliseconds.");
+}
+
+metrics_t metrics_register(metrics_type_t type, const char* name, const char* help) {
+    assert(state.valid && name && help);
+    // the server thread reads the registry without locking
+    assert(!state.serving);
+    assert(state.num_items < METRICS_MAX_METRICS);
+    metrics_item_t* item = &state.items[state.num_items];
+    item->type = type;
+    snprintf(item->name, sizeof(item->name), "%s", name);
+    snprintf(item->help, sizeof(item->help), "%s", help);
+    return (metrics_t){ .id = state.num_items++ };
+}
+
+static metrics_item_t* metrics_item(metrics_t metric) {
+    assert(state.valid);
+    assert((metric.id >= 0) && (metric.id < state.num_items));
+    return &state.items[metric.id];
+}
+
+void metrics_add(metrics_t metric, uint64_t delta) {
+    metrics_item_t* item = metrics_item(metric);
+    assert(item->type != METRICS_HISTOGRAM);
+    thread_atomic_add64(&item->value, delta);
+}
+
+void metrics_set(metrics_t metric, uint64_t val) {
+    metrics_item_t* item = metrics_item(metric);
+    assert(item->type == METRICS_GAUGE);
+    thread_atomic_store64(&item->value, val);
+}
+
+void metrics_observe(metrics_t metric, float ms) {
+    metrics_item_t* item = metrics_item(metric);
+    assert(item->type == METRICS_HISTOGRAM);
+    int bucket = 0;
+    while ((bucket < METRICS_NUM_HISTOGRAM_BUCKETS) && (ms > metrics_bucket_bounds[bucket])) {
+        bucket++;
+    }
+    thread_atomic_add64(&item->buckets[bucket], 1);
+    thread_atomic_add64(&item->sum_us, (ms > 0.0f) ? (uint64_t)(ms * 1000.0f) : 0);
+    thread_atomic_add64(&item->value, 1);
+}
+
+void metrics_observe_prof(prof_bucket_type_t type, float ms) {
+    if (state.valid) {
+        assert((type >= 0) && (type < PROF_NUM_BUCKET_TYPES));
+        metrics_observe(state.prof[type], ms);
+    }
+}
+
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t pos;
+} metrics_writer_t;
+
+static void metrics_printf(metrics_writer_t* w, const char* fmt, ...) {
+    if (w->pos + 1 >= w->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    const int res = vsnprintf(w->buf + w->pos, w->size - w->pos, fmt, args);
+    va_end(args);
+    if (res > 0) {
+        w->pos += (size_t)res;
+        if (w->pos >= w->size) {
+            w->pos = w->size - 1;
+        }
+    }
+}
+
+// resident set size of the process in bytes, 0 if unknown
+static uint64_t metrics_resident_bytes(void) {
+    uint64_t bytes = 0;
+    #if defined(__linux__)
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        unsigned long long size_pages = 0, resident_pages = 0;
+        if (fscanf(fp, "%llu %llu", &size_pages, &resident_pages) == 2) {
+            bytes = (uint64_t)resident_pages * (uint64_t)sysconf(_SC_PAGESIZE);
+        }
+        fclose(fp);
+    }
+    #endif
+    return bytes;
+}
+
+size_t metrics_format(char* buf, size_t buf_size) {
+    assert(state.valid && buf && (buf_size > 0));
+    metrics_writer_t w = { .buf = buf, .size = buf_size };
+    buf[0] = 0;
+    static const char* type_names[] = { "counter", "gauge", "histogram" };
+    for (int i = 0; i < state.num_items; i++) {
+        const metrics_item_t* item = &state.items[i];
+        metrics_printf(&w, "# HELP %s %s\n# TYPE %s %s\n", item->name, item->help, item->name, type_names[item->type]);
+        if (item->type == METRICS_HISTOGRAM) {
+            // the counts are read one by one, so a scrape may see a sample in
+            // the count but not yet in its bucket, clamp to keep them consistent
+            const uint64_t count = thread_atomic_load64(&item->value);
+            uint64_t cumulative = 0;
+            for (int b = 0; b < METRICS_NUM_HISTOGRAM_BUCKETS; b++) {
+                cumulative += thread_atomic_load64(&item->buckets[b]);
+                if (cumulative > count) {
+                    cumulative = count;
+                }
+                metrics_printf(&w, "%s_bucket{le=\"%g\"} %llu\n", item->name, (double)metrics_bucket_bounds[b], (unsigned long long)cumulative);
+            }
+            metrics_printf(&w, "%s_bucket{le=\"+Inf\"} %llu\n", item->name, (unsigned long long)count);
+            metrics_printf(&w, "%s_sum %.3f\n", item->name, (double)thread_atomic_load64(&item->sum_us) / 1000.0);
+            metrics_printf(&w, "%s_count %llu\n", item->name, (unsigned long long)count);
+        }
+        else {
+            metrics_printf(&w, "%s %llu\n", item->name, (unsigned long long)thread_atomic_load64(&item->value));
+        }
+    }
+    const uint64_t resident_bytes = metrics_resident_bytes();
+    if (resident_bytes > 0) {
+        metrics_printf(&w, "# HELP process_resident_memory_bytes Resident memory size in bytes.\n"
+                           "# TYPE process_resident_memory_bytes gauge\n"
+                           "process_resident_memory_bytes %llu\n", (unsigned long long)resident_bytes);
+    }
+    return w.pos;
+}
+
+#if !defined(METRICS_NO_SOCKETS)
+static void metrics_send_all(int fd, const char* data, size_t size) {
+    #if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+    #else
+    const int flags = 0;
+    #endif
+    while (size > 0) {
+        const ssize_t res = send(fd, data, size, flags);
+        if (res <= 0) {
+            return;
+        }
+        data += res;
+        size -= (size_t)res;
+    }
+}
+
+// answer one request, the request itself is ignored
+static void metrics_handle_client(int fd) {
+    // don't let a slow client hold up the server thread for long
+    const struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    #if defined(SO_NOSIGPIPE)
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
+    char request[1024];
+    size_t request_len = 0;
+    while (request_len < sizeof(request) - 1) {
+        const ssize_t res = recv(fd, request + request_len, sizeof(request) - 1 - request_len, 0);
+        if (res <= 0) {
+            break;
+        }
+        request_len += (size_t)res;
+        request[request_len] = 0;
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+    const size_t body_len = metrics_format(state.server.response, sizeof(state.server.response));
+    char header[128];
+    const int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        body_len);
+    metrics_send_all(fd, header, (size_t)header_len);
+    metrics_send_all(fd, state.server.response, body_len);
+}
+
+static void metrics_server_func(void* user_data) {
+    (void)user_data;
+    while (!thread_atomic_load(&state.server.quit)) {
+        // wake up regularly to check the quit flag
+        struct pollfd pfd = { .fd = state.server.listen_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+        const int fd = accept(state.server.listen_fd, 0, 0);
+        if (fd >= 0) {
+            metrics_handle_client(fd);
+            close(fd);
+        }
+    }
+}
+#endif
+
+bool metrics_serve(uint16_t port) {
+    assert(state.valid && !state.serving);
+    #if defined(METRICS_NO_SOCKETS)
+    (void)port;
+    return false;
+    #else
+    if (!thread_supported()) {
+        return false;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, 4) != 0)) {
+        close(fd);
+        return false;
+    }
+    state.server.listen_fd = fd;
+    state.server.quit = 0;
+    state.serving = true;
+    if (!thread_create(&state.server.thread, metrics_server_func, 0)) {
+        close(fd);
+        state.server.listen_fd = -1;
+        state.serving = false;
+        return false;
+    }
+    return true;
+    #endif
+}
+
+void metrics_shutdown(void) {
+    assert(state.valid);
+    #if !defined(METRICS_NO_SOCKETS)
+    if (state.serving) {
+        thread_atomic_store(&state.server.quit, 1);
+        thread_join(&state.server.thread);
+        close(state.server.listen_fd);
+        state.server.listen_fd = -1;
+        state.serving = false;
+    }
+    #endif
+    state.valid = false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+/*
+    A metrics registry with a Prometheus text format exporter.
+
+    Metrics are registered once at startup (before metrics_serve()), and
+    then updated from any thread with lock-free atomic operations, so
+    updating a metric from the emulator or audio thread never blocks.
+
+    The profiler buckets (see prof.h) are registered automatically as
+    histograms, every prof_push() also lands in the matching histogram.
+
+    metrics_serve() starts a background thread with an HTTP listener on
+    127.0.0.1:port which answers every request with the current metrics,
+    e.g. for a Prometheus scrape target or curl http://127.0.0.1:port/metrics.
+    The server thread only reads the atomic values, a slow or stuck client
+    can't stall the emulation. On platforms without sockets or threads
+    metrics_serve() returns false and the registry still works locally
+    (see metrics_format()).
+
+    Histogram sums are kept as integer microseconds (for millisecond values)
+    so that they can be updated with a single atomic add.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "prof.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define METRICS_MAX_METRICS (32)
+#define METRICS_NUM_HISTOGRAM_BUCKETS (10)  // bucket bounds in milliseconds, plus +Inf
+
+typedef enum {
+    METRICS_COUNTER,        // monotonically increasing integer
+    METRICS_GAUGE,          // integer value which can go up and down
+    METRICS_HISTOGRAM,      // distribution of millisecond values
+} metrics_type_t;
+
+typedef struct {
+    int id;
+} metrics_t;
+
+// initialize the registry (also registers the profiler bucket histograms)
+void metrics_init(void);
+// stop the server thread (if running) and shutdown the registry
+void metrics_shutdown(void);
+// register a new metric, name must be a valid Prometheus metric name
+metrics_t metrics_register(metrics_type_t type, const char* name, const char* help);
+// add to a counter or gauge
+void metrics_add(metrics_t metric, uint64_t delta);
+// set a gauge
+void metrics_set(metrics_t metric, uint64_t val);
+// add a millisecond value to a histogram
+void metrics_observe(metrics_t metric, float ms);
+// called by prof_push(), a no-op if the registry isn't initialized
+void metrics_observe_prof(prof_bucket_type_t type, float ms);
+// write all metrics in Prometheus text format, returns the length (truncated to buf_size-1)
+size_t metrics_format(char* buf, size_t buf_size);
+// start the HTTP listener thread on 127.0.0.1:port, returns false if not supported or failed
+bool metrics_serve(uint16_t port);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
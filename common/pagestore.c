@@ -0,0 +1,271 @@
+#include "chips/chips_common.h"
+#include "pagestore.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define PAGESTORE_INITIAL_PAGES (256)
+#define PAGESTORE_ZERO_PAGE (0)         // the handle of an all-zero page, which isn't stored
+#define PAGESTORE_NONE (0xFFFFFFFF)     // end of a hash chain or the free list
+
+typedef struct {
+    uint64_t hash;
+    uint32_t refs;                  // 0 if the page is on the free list
+    uint32_t next;                  // next page in the hash chain, or in the free list
+} pagestore_page_t;
+
+struct pagestore_snapshot_t {
+    uint32_t size;
+    uint32_t num_sections;
+    uint32_t section_sizes[PAGESTORE_MAX_SECTIONS];
+    uint32_t num_pages;
+    uint32_t pages[];               // page handles (page index + 1, or PAGESTORE_ZERO_PAGE)
+};
+
+typedef struct {
+    bool valid;
+    uint8_t* data;                  // page content, capacity * PAGESTORE_PAGE_SIZE bytes
+    pagestore_page_t* pages;
+    uint32_t capacity;
+    uint32_t free_list;
+    uint32_t* buckets;              // heads of the hash chains, num_buckets is a power of 2
+    uint32_t num_buckets;
+    uint32_t num_pages;             // pages in use
+    uint32_t num_snapshots;
+    uint64_t snapshot_bytes;
+    uint64_t handle_bytes;
+} pagestore_state_t;
+static pagestore_state_t state;
+
+static const uint8_t pagestore_zeros[PAGESTORE_PAGE_SIZE];
+
+static uint32_t* pagestore_bucket(uint64_t hash) {
+    return &state.buckets[hash & (state.num_buckets - 1)];
+}
+
+// double the number of hash buckets and rebuild the chains, if out of memory
+// the old buckets are kept (the chains just get longer)
+static void pagestore_rehash(void) {
+    const uint32_t num_buckets = (state.num_buckets > 0) ? state.num_buckets * 2 : PAGESTORE_INITIAL_PAGES;
+    uint32_t* buckets = (uint32_t*)malloc(num_buckets * sizeof(uint32_t));
+    if (!buckets) {
+        return;
+    }
+    free(state.buckets);
+    state.buckets = buckets;
+    state.num_buckets = num_buckets;
+    memset(state.buckets, 0xFF, state.num_buckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < state.capacity; i++) {
+        if (state.pages[i].refs > 0) {
+            uint32_t* head = pagestore_bucket(state.pages[i].hash);
+            state.pages[i].next = *head;
+            *head = i;
+        }
+    }
+}
+
+// grow the page pool, the new pages go onto the free list, returns false if out of memory
+// (the old pool is kept)
+static bool pagestore_grow(void) {
+    const uint32_t old_capacity = state.capacity;
+    const uint32_t capacity = (old_capacity > 0) ? old_capacity * 2 : PAGESTORE_INITIAL_PAGES;
+    uint8_t* data = (uint8_t*)realloc(state.data, (size_t)capacity * PAGESTORE_PAGE_SIZE);
+    if (!data) {
+        return false;
+    }
+    state.data = data;
+    pagestore_page_t* pages = (pagestore_page_t*)realloc(state.pages, capacity * sizeof(pagestore_page_t));
+    if (!pages) {
+        // the larger data block is fine to keep, it's only used up to the capacity
+        return false;
+    }
+    state.pages = pages;
+    state.capacity = capacity;
+    for (uint32_t i = state.capacity; i-- > old_capacity; ) {
+        state.pages[i] = (pagestore_page_t){ .next = state.free_list };
+        state.free_list = i;
+    }
+    return true;
+}
+
+// find or add a page, returns its handle with the reference count incremented,
+// or PAGESTORE_NONE if out of memory
+static uint32_t pagestore_add_page(const uint8_t* content) {
+    if (0 == memcmp(content, pagestore_zeros, PAGESTORE_PAGE_SIZE)) {
+        return PAGESTORE_ZERO_PAGE;
+    }
+    if (!state.buckets) {
+        return PAGESTORE_NONE;
+    }
+    const uint64_t hash = hash_fast64(content, PAGESTORE_PAGE_SIZE, 0);
+    uint32_t* head = pagestore_bucket(hash);
+    for (uint32_t i = *head; i != PAGESTORE_NONE; i = state.pages[i].next) {
+        if ((state.pages[i].hash == hash) && (0 == memcmp(&state.data[(size_t)i * PAGESTORE_PAGE_SIZE], content, PAGESTORE_PAGE_SIZE))) {
+            state.pages[i].refs++;
+            return i + 1;
+        }
+    }
+    if ((state.free_list == PAGESTORE_NONE) && !pagestore_grow()) {
+        return PAGESTORE_NONE;
+    }
+    const uint32_t index = state.free_list;
+    state.free_list = state.pages[index].next;
+    memcpy(&state.data[(size_t)index * PAGESTORE_PAGE_SIZE], content, PAGESTORE_PAGE_SIZE);
+    state.pages[index] = (pagestore_page_t){ .hash = hash, .refs = 1, .next = *head };
+    *head = index;
+    state.num_pages++;
+    // keep the average chain length below 1
+    if (state.num_pages > state.num_buckets) {
+        pagestore_rehash();
+    }
+    return index + 1;
+}
+
+static void pagestore_release_page(uint32_t handle) {
+    if (handle == PAGESTORE_ZERO_PAGE) {
+        return;
+    }
+    const uint32_t index = handle - 1;
+    pagestore_page_t* page = &state.pages[index];
+    assert(page->refs > 0);
+    if (--page->refs > 0) {
+        return;
+    }
+    // unlink from the hash chain and put onto the free list
+    uint32_t* link = pagestore_bucket(page->hash);
+    while (*link != index) {
+        assert(*link != PAGESTORE_NONE);
+        link = &state.pages[*link].next;
+    }
+    *link = page->next;
+    page->next = state.free_list;
+    state.free_list = index;
+    state.num_pages--;
+}
+
+void pagestore_init(void) {
+    assert(!state.valid);
+    memset(&state, 0, sizeof(state));
+    state.free_list = PAGESTORE_NONE;
+    // if out of memory, pagestore_put() retries and fails
+    pagestore_grow();
+    pagestore_rehash();
+    state.valid = true;
+}
+
+void pagestore_shutdown(void) {
+    if (!state.valid) {
+        return;
+    }
+    assert(state.num_snapshots == 0);
+    free(state.data);
+    free(state.pages);
+    free(state.buckets);
+    state.valid = false;
+}
+
+pagestore_snapshot_t* pagestore_put(const chips_range_t* sections, int num_sections) {
+    assert(state.valid && sections);
+    if ((num_sections < 1) || (num_sections > PAGESTORE_MAX_SECTIONS)) {
+        return 0;
+    }
+    uint32_t num_pages = 0;
+    for (int i = 0; i < num_sections; i++) {
+        assert(sections[i].ptr || (sections[i].size == 0));
+        num_pages += (uint32_t)((sections[i].size + PAGESTORE_PAGE_SIZE - 1) / PAGESTORE_PAGE_SIZE);
+    }
+    const size_t handles_size = num_pages * sizeof(uint32_t);
+    pagestore_snapshot_t* snapshot = (pagestore_snapshot_t*)malloc(sizeof(pagestore_snapshot_t) + handles_size);
+    if (!snapshot) {
+        return 0;
+    }
+    snapshot->size = 0;
+    snapshot->num_sections = (uint32_t)num_sections;
+    snapshot->num_pages = num_pages;
+    uint32_t page = 0;
+    for (int i = 0; i < num_sections; i++) {
+        const uint8_t* ptr = (const uint8_t*)sections[i].ptr;
+        const size_t size = sections[i].size;
+        for (size_t pos = 0; pos < size; pos += PAGESTORE_PAGE_SIZE) {
+            const size_t num_bytes = size - pos;
+            uint32_t handle;
+            if (num_bytes >= PAGESTORE_PAGE_SIZE) {
+                handle = pagestore_add_page(ptr + pos);
+            } else {
+                // the last page of a section is padded with zeros
+                uint8_t content[PAGESTORE_PAGE_SIZE] = {0};
+                memcpy(content, ptr + pos, num_bytes);
+                handle = pagestore_add_page(content);
+            }
+            if (handle == PAGESTORE_NONE) {
+                // out of memory, drop the pages stored so far
+                while (page > 0) {
+                    pagestore_release_page(snapshot->pages[--page]);
+                }
+                free(snapshot);
+                return 0;
+            }
+            snapshot->pages[page++] = handle;
+        }
+        snapshot->section_sizes[i] = (uint32_t)size;
+        snapshot->size += (uint32_t)size;
+    }
+    state.num_snapshots++;
+    state.snapshot_bytes += snapshot->size;
+    state.handle_bytes += sizeof(pagestore_snapshot_t) + handles_size;
+    return snapshot;
+}
+
+void pagestore_release(pagestore_snapshot_t* snapshot) {
+    assert(state.valid);
+    if (!snapshot) {
+        return;
+    }
+    for (uint32_t i = 0; i < snapshot->num_pages; i++) {
+        pagestore_release_page(snapshot->pages[i]);
+    }
+    assert(state.num_snapshots > 0);
+    state.num_snapshots--;
+    state.snapshot_bytes -= snapshot->size;
+    state.handle_bytes -= sizeof(pagestore_snapshot_t) + snapshot->num_pages * sizeof(uint32_t);
+    free(snapshot);
+}
+
+size_t pagestore_size(const pagestore_snapshot_t* snapshot) {
+    assert(snapshot);
+    return snapshot->size;
+}
+
+size_t pagestore_get(const pagestore_snapshot_t* snapshot, void* buf, size_t buf_size) {
+    assert(state.valid && snapshot && buf);
+    if (buf_size < snapshot->size) {
+        return 0;
+    }
+    uint8_t* dst = (uint8_t*)buf;
+    uint32_t page = 0;
+    for (uint32_t i = 0; i < snapshot->num_sections; i++) {
+        for (size_t pos = 0; pos < snapshot->section_sizes[i]; pos += PAGESTORE_PAGE_SIZE) {
+            const uint32_t handle = snapshot->pages[page++];
+            const size_t remaining = snapshot->section_sizes[i] - pos;
+            const size_t num_bytes = (remaining < PAGESTORE_PAGE_SIZE) ? remaining : PAGESTORE_PAGE_SIZE;
+            if (handle == PAGESTORE_ZERO_PAGE) {
+                memset(dst, 0, num_bytes);
+            } else {
+                memcpy(dst, &state.data[(size_t)(handle - 1) * PAGESTORE_PAGE_SIZE], num_bytes);
+            }
+            dst += num_bytes;
+        }
+    }
+    return snapshot->size;
+}
+
+pagestore_stats_t pagestore_stats(void) {
+    assert(state.valid);
+    return (pagestore_stats_t){
+        .num_snapshots = state.num_snapshots,
+        .num_pages = state.num_pages,
+        .snapshot_bytes = state.snapshot_bytes,
+        .stored_bytes = (uint64_t)state.num_pages * (PAGESTORE_PAGE_SIZE + sizeof(pagestore_page_t)) + state.handle_bytes,
+    };
+}
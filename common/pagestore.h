@@ -0,0 +1,58 @@
+#pragma once
+/*
+    A content-addressed page store for deduplicated snapshots.
+
+    A snapshot is made of one or more sections (e.g. the framebuffer and
+    the parts of a serialized emulator state), each section is split into
+    fixed-size pages, and each unique page is stored only once with a
+    reference count. A stored snapshot is just an array of page handles,
+    so snapshots of the same game (or of several instances running the
+    same cartridge) share most of their memory.
+
+    Sections always start on a new page, so the content of a section which
+    doesn't change isn't shifted against the page grid when a section in
+    front of it changes its size. Pages which are all zeros aren't stored
+    at all.
+
+    The store is global to the process, and not thread-safe: only call
+    the functions from a single thread.
+
+    Include chips/chips_common.h before this header.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define PAGESTORE_PAGE_SIZE (256)
+#define PAGESTORE_MAX_SECTIONS (16)
+
+// a stored snapshot, owned by the caller until pagestore_release()
+typedef struct pagestore_snapshot_t pagestore_snapshot_t;
+
+typedef struct {
+    uint32_t num_snapshots;
+    uint32_t num_pages;         // unique pages in the store
+    uint64_t snapshot_bytes;    // sum of the snapshot sizes
+    uint64_t stored_bytes;      // memory used by the pages and page handles
+} pagestore_stats_t;
+
+void pagestore_init(void);
+// free all pages, all snapshots must have been released
+void pagestore_shutdown(void);
+// store the concatenation of sections, returns 0 if num_sections is out of range or out of memory
+pagestore_snapshot_t* pagestore_put(const chips_range_t* sections, int num_sections);
+// release a snapshot returned by pagestore_put(), unreferenced pages are freed
+void pagestore_release(pagestore_snapshot_t* snapshot);
+// size of a snapshot in bytes (all sections)
+size_t pagestore_size(const pagestore_snapshot_t* snapshot);
+// copy the content of a snapshot into buf, returns the size, or 0 if buf is too small
+size_t pagestore_get(const pagestore_snapshot_t* snapshot, void* buf, size_t buf_size);
+pagestore_stats_t pagestore_stats(void);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
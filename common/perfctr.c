@@ -0,0 +1,158 @@
+#include "perfctr.h"
+#include <string.h>
+#include <assert.h>
+
+#if defined(__linux__)
+    #define PERFCTR_LINUX (1)
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+
+typedef struct {
+    bool valid;
+    int leader_fd;
+    int num_open;                               // number of counters in the group
+    int fds[PERFCTR_NUM_EVENTS];                // -1 if not available
+    int slots[PERFCTR_NUM_EVENTS];              // index into the group read, -1 if not available
+} perfctr_state_t;
+static perfctr_state_t state;
+
+static const char* perfctr_names[PERFCTR_NUM_EVENTS] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1d-misses",
+    "LLC-misses",
+};
+
+#if defined(PERFCTR_LINUX)
+static int perfctr_open(perfctr_event_t event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (event) {
+        case PERFCTR_CYCLES:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PERFCTR_INSTRUCTIONS:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PERFCTR_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case PERFCTR_LLC_MISSES:    attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case PERFCTR_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default: return -1;
+    }
+    // the group leader starts disabled and is enabled once the group is complete
+    attr.disabled = (group_fd == -1) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+bool perfctr_init(void) {
+    assert(!state.valid);
+    memset(&state, 0, sizeof(state));
+    state.leader_fd = -1;
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        state.fds[i] = -1;
+        state.slots[i] = -1;
+    }
+    state.valid = true;
+    #if defined(PERFCTR_LINUX)
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        const int fd = perfctr_open((perfctr_event_t)i, state.leader_fd);
+        if (fd >= 0) {
+            if (state.leader_fd == -1) {
+                state.leader_fd = fd;
+            }
+            state.fds[i] = fd;
+            state.slots[i] = state.num_open++;
+        }
+    }
+    if (state.leader_fd != -1) {
+        ioctl(state.leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(state.leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    #endif
+    return state.num_open > 0;
+}
+
+void perfctr_shutdown(void) {
+    assert(state.valid);
+    #if defined(PERFCTR_LINUX)
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        if (state.fds[i] != -1) {
+            close(state.fds[i]);
+        }
+    }
+    #endif
+    state.valid = false;
+}
+
+bool perfctr_available(void) {
+    assert(state.valid);
+    return state.num_open > 0;
+}
+
+bool perfctr_event_available(perfctr_event_t event) {
+    assert(state.valid);
+    assert((event >= 0) && (event < PERFCTR_NUM_EVENTS));
+    return state.slots[event] != -1;
+}
+
+const char* perfctr_event_name(perfctr_event_t event) {
+    assert((event >= 0) && (event < PERFCTR_NUM_EVENTS));
+    return perfctr_names[event];
+}
+
+void perfctr_read(perfctr_sample_t* out) {
+    assert(state.valid && out);
+    memset(out, 0, sizeof(perfctr_sample_t));
+    #if defined(PERFCTR_LINUX)
+    if (state.leader_fd == -1) {
+        return;
+    }
+    // PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, values[nr]
+    uint64_t buf[3 + PERFCTR_NUM_EVENTS];
+    const ssize_t size = read(state.leader_fd, buf, sizeof(buf));
+    if ((size < (ssize_t)(3 * sizeof(uint64_t))) || (buf[0] != (uint64_t)state.num_open) || (buf[2] == 0)) {
+        return;
+    }
+    const uint64_t enabled = buf[1];
+    const uint64_t running = buf[2];
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        if (state.slots[i] != -1) {
+            uint64_t val = buf[3 + state.slots[i]];
+            if (running < enabled) {
+                val = (uint64_t)((double)val * ((double)enabled / (double)running));
+            }
+            out->values[i] = val;
+        }
+    }
+    #endif
+}
+
+void perfctr_accum(perfctr_bucket_t* bucket, const perfctr_sample_t* begin, const perfctr_sample_t* end) {
+    assert(bucket && begin && end);
+    bucket->count++;
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        // scaled values of a multiplexed group are estimates and may go backward
+        if (end->values[i] > begin->values[i]) {
+            bucket->values[i] += end->values[i] - begin->values[i];
+        }
+    }
+}
+
+double perfctr_ipc(const perfctr_bucket_t* bucket) {
+    assert(bucket);
+    if (bucket->values[PERFCTR_CYCLES] == 0) {
+        return 0.0;
+    }
+    return (double)bucket->values[PERFCTR_INSTRUCTIONS] / (double)bucket->values[PERFCTR_CYCLES];
+}
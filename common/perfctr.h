@@ -0,0 +1,69 @@
+#pragma once
+/*
+    Hardware performance counters for benchmarks (Linux perf_event_open).
+
+    perfctr_init() opens one counter group for the calling thread, the
+    counters then run continuously and perfctr_read() takes a snapshot of
+    all of them. The difference between two snapshots is the cost of the
+    code in between:
+
+        perfctr_sample_t s0, s1;
+        perfctr_read(&s0);
+        ...
+        perfctr_read(&s1);
+        perfctr_accum(&bucket, &s0, &s1);
+
+    Counters that the CPU, kernel or permissions (perf_event_paranoid)
+    don't allow are skipped, perfctr_event_available() tells which ones
+    are valid. On other platforms, or if no counter could be opened at all,
+    perfctr_available() returns false and all samples are zero.
+
+    When the kernel multiplexes the group with other counters, values are
+    scaled up by time-enabled / time-running.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_L1D_MISSES,     // L1 data cache read misses
+    PERFCTR_LLC_MISSES,     // last level cache misses
+    PERFCTR_NUM_EVENTS,
+} perfctr_event_t;
+
+typedef struct {
+    uint64_t values[PERFCTR_NUM_EVENTS];
+} perfctr_sample_t;
+
+// an accumulated measurement over one or more intervals
+typedef struct {
+    uint64_t count;         // number of intervals
+    uint64_t values[PERFCTR_NUM_EVENTS];
+} perfctr_bucket_t;
+
+// open the counters for the calling thread, returns false if none are available
+bool perfctr_init(void);
+// close the counters
+void perfctr_shutdown(void);
+// return true if at least one counter is available
+bool perfctr_available(void);
+// return true if a specific counter is available
+bool perfctr_event_available(perfctr_event_t event);
+// get a short human-readable event name
+const char* perfctr_event_name(perfctr_event_t event);
+// read the current counter values (zero for unavailable counters)
+void perfctr_read(perfctr_sample_t* out);
+// add the difference between two samples to a bucket
+void perfctr_accum(perfctr_bucket_t* bucket, const perfctr_sample_t* begin, const perfctr_sample_t* end);
+// get instructions per cycle of a bucket, 0 if not available
+double perfctr_ipc(const perfctr_bucket_t* bucket);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -1,5 +1,6 @@
 #include "sokol_time.h"
 #include "prof.h"
+#include "metrics.h"
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
@@ -23,6 +24,14 @@ typedef struct {
 } prof_state_t;
 static prof_state_t state;
 
+// outside of state, the startup measurement begins before prof_init()
+static struct {
+    bool begun;
+    bool ended;
+    uint64_t begin_time;
+    float ms;
+} startup;
+
 static int prof_ring_idx(int i) {
     return (i % PROF_BUCKET_SIZE);
 }
@@ -48,8 +57,28 @@ static float prof_ring_get(prof_ring_t* ring, int index) {
     return ring->values[prof_ring_idx(ring->tail + index)];
 }
 
-void prof_init(void) {
+void prof_startup_begin(void) {
     stm_setup();
+    startup.begun = true;
+    startup.begin_time = stm_now();
+}
+
+void prof_startup_end(void) {
+    if (startup.begun && !startup.ended) {
+        startup.ms = (float)stm_ms(stm_since(startup.begin_time));
+        startup.ended = true;
+    }
+}
+
+float prof_startup_ms(void) {
+    return startup.ended ? startup.ms : 0.0f;
+}
+
+void prof_init(void) {
+    // setting up sokol_time again would move the time base of the startup measurement
+    if (!startup.begun) {
+        stm_setup();
+    }
     memset(&state, 0, sizeof(state));
     state.valid = true;
 }
@@ -58,6 +87,7 @@ void prof_push(prof_bucket_type_t type, float val) {
     assert(state.valid);
     assert((type >= 0) && (type < PROF_NUM_BUCKET_TYPES));
     prof_ring_put(&state.buckets[type].ring, val);
+    metrics_observe_prof(type, val);
 }
 
 int prof_count(prof_bucket_type_t type) {
@@ -1,9 +1,12 @@
+#pragma once
 /*
     A simple profiling helper module.
 */
 typedef enum {
     PROF_FRAME,     // frame time
     PROF_EMU,       // emulator time
+    PROF_RESIM,     // netplay time per (re-)simulated frame
+    PROF_VIDEO,     // CPU-side video filter time per frame
     PROF_NUM_BUCKET_TYPES,
 } prof_bucket_type_t;
 
@@ -14,9 +17,15 @@ typedef struct {
     float max_val;
 } prof_stats_t;
 
+// start the startup time measurement, call as early as possible (e.g. at the top of sokol_main())
+void prof_startup_begin(void);
+// end the startup time measurement (e.g. at the first emulated frame), only the first call counts
+void prof_startup_end(void);
+// the startup time in milliseconds, or 0 if the measurement hasn't ended yet
+float prof_startup_ms(void);
 // initialize profiling system
 void prof_init(void);
-// push a value into a profiler bucket
+// push a value into a profiler bucket (also feeds the matching metrics histogram, see metrics.h)
 void prof_push(prof_bucket_type_t type, float val);
 // get number of values in profiler bucket
 int prof_count(prof_bucket_type_t type);
@@ -0,0 +1,169 @@
+#include "recfile.h"
+#include <string.h>
+#include <assert.h>
+
+// longest run which can be encoded in a single RLE packet
+#define RECFILE_MAX_RUN (129)
+// longest literal sequence in a single RLE packet
+#define RECFILE_MAX_LITERAL (128)
+
+static bool recfile_write_u32(FILE* fp, uint32_t val) {
+    const uint8_t bytes[4] = { (uint8_t)val, (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24) };
+    return 1 == fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+static bool recfile_read_u32(FILE* fp, uint32_t* out_val) {
+    uint8_t bytes[4];
+    if (1 != fread(bytes, sizeof(bytes), 1, fp)) {
+        return false;
+    }
+    *out_val = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+bool recfile_write_header(FILE* fp, const recfile_header_t* hdr) {
+    assert(fp && hdr && (hdr->num_colors <= RECFILE_MAX_COLORS));
+    bool ok = (1 == fwrite("NREC", 4, 1, fp));
+    ok = ok && recfile_write_u32(fp, RECFILE_VERSION);
+    ok = ok && recfile_write_u32(fp, hdr->width);
+    ok = ok && recfile_write_u32(fp, hdr->height);
+    ok = ok && recfile_write_u32(fp, hdr->num_colors);
+    ok = ok && recfile_write_u32(fp, hdr->sample_rate);
+    for (uint32_t i = 0; ok && (i < hdr->num_colors); i++) {
+        ok = recfile_write_u32(fp, hdr->palette[i]);
+    }
+    return ok;
+}
+
+bool recfile_read_header(FILE* fp, recfile_header_t* hdr) {
+    assert(fp && hdr);
+    memset(hdr, 0, sizeof(recfile_header_t));
+    char magic[4];
+    uint32_t version = 0;
+    bool ok = (1 == fread(magic, 4, 1, fp)) && (0 == memcmp(magic, "NREC", 4));
+    // version 2 only adds the drop chunk
+    ok = ok && recfile_read_u32(fp, &version) && (version >= 1) && (version <= RECFILE_VERSION);
+    ok = ok && recfile_read_u32(fp, &hdr->width);
+    ok = ok && recfile_read_u32(fp, &hdr->height);
+    ok = ok && recfile_read_u32(fp, &hdr->num_colors) && (hdr->num_colors <= RECFILE_MAX_COLORS);
+    ok = ok && recfile_read_u32(fp, &hdr->sample_rate);
+    for (uint32_t i = 0; ok && (i < hdr->num_colors); i++) {
+        ok = recfile_read_u32(fp, &hdr->palette[i]);
+    }
+    return ok;
+}
+
+bool recfile_write_chunk(FILE* fp, uint8_t type, const void* data, uint32_t size) {
+    assert(fp && (data || (size == 0)));
+    bool ok = (1 == fwrite(&type, 1, 1, fp));
+    ok = ok && recfile_write_u32(fp, size);
+    ok = ok && ((size == 0) || (1 == fwrite(data, size, 1, fp)));
+    return ok;
+}
+
+static void recfile_put_u32(uint8_t* dst, uint32_t val) {
+    dst[0] = (uint8_t)val;
+    dst[1] = (uint8_t)(val >> 8);
+    dst[2] = (uint8_t)(val >> 16);
+    dst[3] = (uint8_t)(val >> 24);
+}
+
+static uint32_t recfile_get_u32(const uint8_t* src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+void recfile_encode_drop(uint32_t num_frames, uint32_t num_samples, uint8_t* dst) {
+    assert(dst);
+    recfile_put_u32(dst, num_frames);
+    recfile_put_u32(dst + 4, num_samples);
+}
+
+void recfile_decode_drop(const uint8_t* src, uint32_t* out_num_frames, uint32_t* out_num_samples) {
+    assert(src && out_num_frames && out_num_samples);
+    *out_num_frames = recfile_get_u32(src);
+    *out_num_samples = recfile_get_u32(src + 4);
+}
+
+bool recfile_read_chunk_header(FILE* fp, uint8_t* out_type, uint32_t* out_size) {
+    assert(fp && out_type && out_size);
+    return (1 == fread(out_type, 1, 1, fp)) && recfile_read_u32(fp, out_size);
+}
+
+size_t recfile_encode_frame(const uint8_t* cur, const uint8_t* prev, size_t num_pixels, uint8_t* dst) {
+    assert(cur && prev && dst);
+    size_t src_pos = 0;
+    size_t dst_pos = 0;
+    size_t lit_start = 0;
+    size_t lit_len = 0;
+    while (src_pos < num_pixels) {
+        const uint8_t val = cur[src_pos] ^ prev[src_pos];
+        size_t run = 1;
+        while (((src_pos + run) < num_pixels) && (run < RECFILE_MAX_RUN) && ((cur[src_pos + run] ^ prev[src_pos + run]) == val)) {
+            run++;
+        }
+        if (run >= 3) {
+            // flush pending literals, then emit the run
+            if (lit_len > 0) {
+                dst[dst_pos++] = (uint8_t)(lit_len - 1);
+                for (size_t i = 0; i < lit_len; i++) {
+                    dst[dst_pos++] = cur[lit_start + i] ^ prev[lit_start + i];
+                }
+                lit_len = 0;
+            }
+            dst[dst_pos++] = (uint8_t)(run + 126);
+            dst[dst_pos++] = val;
+            src_pos += run;
+        }
+        else {
+            if (lit_len == 0) {
+                lit_start = src_pos;
+            }
+            lit_len++;
+            src_pos++;
+            if (lit_len == RECFILE_MAX_LITERAL) {
+                dst[dst_pos++] = (uint8_t)(lit_len - 1);
+                for (size_t i = 0; i < lit_len; i++) {
+                    dst[dst_pos++] = cur[lit_start + i] ^ prev[lit_start + i];
+                }
+                lit_len = 0;
+            }
+        }
+    }
+    if (lit_len > 0) {
+        dst[dst_pos++] = (uint8_t)(lit_len - 1);
+        for (size_t i = 0; i < lit_len; i++) {
+            dst[dst_pos++] = cur[lit_start + i] ^ prev[lit_start + i];
+        }
+    }
+    assert(dst_pos <= RECFILE_MAX_ENCODED_SIZE(num_pixels));
+    return dst_pos;
+}
+
+bool recfile_decode_frame(const uint8_t* src, size_t src_size, uint8_t* frame, size_t num_pixels) {
+    assert(src && frame);
+    size_t src_pos = 0;
+    size_t dst_pos = 0;
+    while (src_pos < src_size) {
+        const uint8_t ctrl = src[src_pos++];
+        if (ctrl < 128) {
+            const size_t len = (size_t)ctrl + 1;
+            if (((src_pos + len) > src_size) || ((dst_pos + len) > num_pixels)) {
+                return false;
+            }
+            for (size_t i = 0; i < len; i++) {
+                frame[dst_pos++] ^= src[src_pos++];
+            }
+        }
+        else {
+            const size_t len = (size_t)ctrl - 126;
+            if ((src_pos >= src_size) || ((dst_pos + len) > num_pixels)) {
+                return false;
+            }
+            const uint8_t val = src[src_pos++];
+            for (size_t i = 0; i < len; i++) {
+                frame[dst_pos++] ^= val;
+            }
+        }
+    }
+    return dst_pos == num_pixels;
+}
@@ -0,0 +1,81 @@
+#pragma once
+/*
+    Gameplay capture file format, used by the recorder and the nesrec tool.
+
+    A capture file starts with a header:
+
+        "NREC"              magic
+        u32 version
+        u32 width, height   frame size in pixels (1 byte palette index per pixel)
+        u32 num_colors      number of palette entries
+        u32 sample_rate     audio sample rate (mono, 32-bit float samples)
+        u32 palette[num_colors]
+
+    ...followed by chunks:
+
+        u8  type            RECFILE_CHUNK_FRAME, RECFILE_CHUNK_AUDIO or RECFILE_CHUNK_DROP
+        u32 size            payload size in bytes
+        u8  payload[size]
+
+    Frame payloads are the XOR delta to the previous frame (the first frame
+    is XOR'ed against an all-zero frame), compressed with a PackBits-style
+    RLE: a control byte c < 128 is followed by c+1 literal bytes, a control
+    byte c >= 128 is followed by one byte repeated c-126 times.
+
+    Audio payloads are raw little-endian 32-bit float samples.
+
+    Drop payloads (version 2) mark data the recorder couldn't keep up with,
+    at the position where it was lost:
+
+        u32 num_frames      dropped frames, replaced by repeating the previous frame
+        u32 num_samples     dropped audio samples, replaced by silence
+
+    All integers are little-endian.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define RECFILE_VERSION (2)
+#define RECFILE_MAX_COLORS (256)
+#define RECFILE_CHUNK_FRAME ('F')
+#define RECFILE_CHUNK_AUDIO ('A')
+#define RECFILE_CHUNK_DROP ('D')
+#define RECFILE_DROP_SIZE (8)
+// worst case size of an RLE encoded frame
+#define RECFILE_MAX_ENCODED_SIZE(num_pixels) ((num_pixels) + ((num_pixels) / 128) + 1)
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_colors;
+    uint32_t sample_rate;
+    uint32_t palette[RECFILE_MAX_COLORS];
+} recfile_header_t;
+
+// write a file header, returns false on error
+bool recfile_write_header(FILE* fp, const recfile_header_t* hdr);
+// read and validate a file header, returns false on error
+bool recfile_read_header(FILE* fp, recfile_header_t* hdr);
+// write a chunk, returns false on error
+bool recfile_write_chunk(FILE* fp, uint8_t type, const void* data, uint32_t size);
+// encode/decode the RECFILE_DROP_SIZE bytes payload of a drop chunk
+void recfile_encode_drop(uint32_t num_frames, uint32_t num_samples, uint8_t* dst);
+void recfile_decode_drop(const uint8_t* src, uint32_t* out_num_frames, uint32_t* out_num_samples);
+// read the next chunk header, returns false at end of file or on error
+bool recfile_read_chunk_header(FILE* fp, uint8_t* out_type, uint32_t* out_size);
+
+// delta+RLE encode a frame against the previous frame, returns the encoded size,
+// dst must have room for RECFILE_MAX_ENCODED_SIZE(num_pixels) bytes
+size_t recfile_encode_frame(const uint8_t* cur, const uint8_t* prev, size_t num_pixels, uint8_t* dst);
+// decode a frame, frame holds the previous frame on input and the decoded frame on output
+bool recfile_decode_frame(const uint8_t* src, size_t src_size, uint8_t* frame, size_t num_pixels);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,267 @@
+#include "recorder.h"
+#include "recfile.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define RECORDER_NUM_SLOTS (64)             // about one second of frames and audio
+#define RECORDER_MAX_AUDIO_SAMPLES (4096)   // max samples per audio chunk
+#define RECORDER_FILE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+    uint8_t type;
+    uint32_t size;
+    uint8_t* data;
+} recorder_slot_t;
+
+typedef struct {
+    bool valid;
+    FILE* fp;
+    thread_t thread;
+    volatile uint32_t quit;
+    volatile uint32_t head;                 // written by the emulator
+    volatile uint32_t tail;                 // written by the writer thread
+    recorder_slot_t slots[RECORDER_NUM_SLOTS];
+    size_t frame_size;
+    uint8_t* prev_frame;                    // writer thread: last written frame
+    uint8_t* encode_buf;                    // writer thread: RLE output
+    int num_pending_samples;                // emulator: audio samples not yet in a slot
+    uint32_t drop_frames;                   // emulator: dropped data not yet recorded in a drop chunk
+    uint32_t drop_samples;
+    float pending_samples[RECORDER_MAX_AUDIO_SAMPLES];
+    volatile uint32_t frames_written;
+    volatile uint32_t frames_dropped;
+    volatile uint32_t samples_dropped;
+    volatile uint32_t kbytes_written;
+    uint64_t bytes_written;                 // writer thread
+} recorder_state_t;
+static recorder_state_t state;
+
+// get a free slot, or NULL if the writer thread is behind
+static recorder_slot_t* recorder_free_slot(void) {
+    const uint32_t head = state.head;
+    if ((head - thread_atomic_load(&state.tail)) >= RECORDER_NUM_SLOTS) {
+        return 0;
+    }
+    return &state.slots[head % RECORDER_NUM_SLOTS];
+}
+
+static void recorder_end_push(void) {
+    thread_atomic_store(&state.head, state.head + 1);
+}
+
+// record previously dropped data at its position in the stream, returns false if the writer thread is still behind
+static bool recorder_push_drop(void) {
+    if ((state.drop_frames == 0) && (state.drop_samples == 0)) {
+        return true;
+    }
+    recorder_slot_t* slot = recorder_free_slot();
+    if (!slot) {
+        return false;
+    }
+    slot->type = RECFILE_CHUNK_DROP;
+    slot->size = RECFILE_DROP_SIZE;
+    recfile_encode_drop(state.drop_frames, state.drop_samples, slot->data);
+    recorder_end_push();
+    state.drop_frames = 0;
+    state.drop_samples = 0;
+    return true;
+}
+
+// get a free slot for the next frame or audio chunk, or NULL if it must be dropped
+static recorder_slot_t* recorder_begin_push(void) {
+    if (!recorder_push_drop()) {
+        return 0;
+    }
+    return recorder_free_slot();
+}
+
+static void recorder_flush_audio(void) {
+    if (state.num_pending_samples == 0) {
+        return;
+    }
+    recorder_slot_t* slot = recorder_begin_push();
+    if (slot) {
+        slot->type = RECFILE_CHUNK_AUDIO;
+        slot->size = (uint32_t)state.num_pending_samples * sizeof(float);
+        memcpy(slot->data, state.pending_samples, slot->size);
+        recorder_end_push();
+    }
+    else {
+        state.drop_samples += (uint32_t)state.num_pending_samples;
+        thread_atomic_store(&state.samples_dropped, state.samples_dropped + (uint32_t)state.num_pending_samples);
+    }
+    state.num_pending_samples = 0;
+}
+
+static void recorder_write_slot(const recorder_slot_t* slot) {
+    bool ok = true;
+    uint32_t size = slot->size;
+    if (slot->type == RECFILE_CHUNK_FRAME) {
+        size = (uint32_t)recfile_encode_frame(slot->data, state.prev_frame, state.frame_size, state.encode_buf);
+        ok = recfile_write_chunk(state.fp, RECFILE_CHUNK_FRAME, state.encode_buf, size);
+        memcpy(state.prev_frame, slot->data, state.frame_size);
+        thread_atomic_store(&state.frames_written, state.frames_written + 1);
+    }
+    else {
+        // audio samples are written in host byte order, which is little-endian on all supported platforms,
+        // drop chunk payloads are already encoded
+        ok = recfile_write_chunk(state.fp, slot->type, slot->data, size);
+    }
+    if (ok) {
+        state.bytes_written += 5 + size;
+        thread_atomic_store(&state.kbytes_written, (uint32_t)(state.bytes_written / 1024));
+    }
+}
+
+static void recorder_thread_func(void* user_data) {
+    (void)user_data;
+    while (true) {
+        const uint32_t tail = state.tail;
+        if (tail != thread_atomic_load(&state.head)) {
+            recorder_write_slot(&state.slots[tail % RECORDER_NUM_SLOTS]);
+            thread_atomic_store(&state.tail, tail + 1);
+        }
+        else if (thread_atomic_load(&state.quit)) {
+            // all pending slots have been written
+            break;
+        }
+        else {
+            thread_sleep_us(1000);
+        }
+    }
+}
+
+bool recorder_start(const recorder_desc_t* desc) {
+    assert(desc && desc->path && (desc->width > 0) && (desc->height > 0));
+    assert(desc->palette && (desc->num_colors > 0) && (desc->num_colors <= RECFILE_MAX_COLORS));
+    assert(!state.valid);
+    if (!thread_supported()) {
+        return false;
+    }
+    FILE* fp = fopen(desc->path, "wb");
+    if (!fp) {
+        return false;
+    }
+    setvbuf(fp, 0, _IOFBF, RECORDER_FILE_BUFFER_SIZE);
+    recfile_header_t hdr = {
+        .width = (uint32_t)desc->width,
+        .height = (uint32_t)desc->height,
+        .num_colors = (uint32_t)desc->num_colors,
+        .sample_rate = (uint32_t)desc->sample_rate,
+    };
+    memcpy(hdr.palette, desc->palette, (size_t)desc->num_colors * sizeof(uint32_t));
+    if (!recfile_write_header(fp, &hdr)) {
+        fclose(fp);
+        return false;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.fp = fp;
+    state.frame_size = (size_t)desc->width * (size_t)desc->height;
+    size_t slot_size = RECORDER_MAX_AUDIO_SAMPLES * sizeof(float);
+    if (state.frame_size > slot_size) {
+        slot_size = state.frame_size;
+    }
+    bool alloc_ok = true;
+    for (int i = 0; i < RECORDER_NUM_SLOTS; i++) {
+        state.slots[i].data = (uint8_t*)malloc(slot_size);
+        alloc_ok &= (0 != state.slots[i].data);
+    }
+    state.prev_frame = (uint8_t*)calloc(1, state.frame_size);
+    state.encode_buf = (uint8_t*)malloc(RECFILE_MAX_ENCODED_SIZE(state.frame_size));
+    alloc_ok &= state.prev_frame && state.encode_buf;
+    // NOTE: free(0) is fine, so the cleanup doesn't need to know which allocation failed
+    if (!alloc_ok || !thread_create(&state.thread, recorder_thread_func, 0)) {
+        for (int i = 0; i < RECORDER_NUM_SLOTS; i++) {
+            free(state.slots[i].data);
+        }
+        free(state.prev_frame);
+        free(state.encode_buf);
+        fclose(fp);
+        memset(&state, 0, sizeof(state));
+        return false;
+    }
+    state.valid = true;
+    return true;
+}
+
+void recorder_stop(void) {
+    if (!state.valid) {
+        return;
+    }
+    recorder_flush_audio();
+    // the file must account for everything which was dropped, wait for the writer thread to make room
+    while (!recorder_push_drop()) {
+        thread_sleep_us(1000);
+    }
+    thread_atomic_store(&state.quit, 1);
+    thread_join(&state.thread);
+    fclose(state.fp);
+    for (int i = 0; i < RECORDER_NUM_SLOTS; i++) {
+        free(state.slots[i].data);
+        state.slots[i].data = 0;
+    }
+    free(state.prev_frame);
+    free(state.encode_buf);
+    state.prev_frame = 0;
+    state.encode_buf = 0;
+    state.fp = 0;
+    // keep the stats of the last recording
+    state.valid = false;
+}
+
+bool recorder_active(void) {
+    return state.valid;
+}
+
+void recorder_frame(const uint8_t* pixels) {
+    if (!state.valid) {
+        return;
+    }
+    assert(pixels);
+    // keep audio and video in order
+    recorder_flush_audio();
+    recorder_slot_t* slot = recorder_begin_push();
+    if (slot) {
+        slot->type = RECFILE_CHUNK_FRAME;
+        slot->size = (uint32_t)state.frame_size;
+        memcpy(slot->data, pixels, state.frame_size);
+        recorder_end_push();
+    }
+    else {
+        state.drop_frames++;
+        thread_atomic_store(&state.frames_dropped, state.frames_dropped + 1);
+    }
+}
+
+void recorder_audio(const float* samples, int num_samples) {
+    if (!state.valid) {
+        return;
+    }
+    assert(samples && (num_samples >= 0));
+    while (num_samples > 0) {
+        int num = RECORDER_MAX_AUDIO_SAMPLES - state.num_pending_samples;
+        if (num > num_samples) {
+            num = num_samples;
+        }
+        memcpy(&state.pending_samples[state.num_pending_samples], samples, (size_t)num * sizeof(float));
+        state.num_pending_samples += num;
+        samples += num;
+        num_samples -= num;
+        if (state.num_pending_samples == RECORDER_MAX_AUDIO_SAMPLES) {
+            recorder_flush_audio();
+        }
+    }
+}
+
+recorder_stats_t recorder_stats(void) {
+    return (recorder_stats_t) {
+        .frames_written = thread_atomic_load(&state.frames_written),
+        .frames_dropped = thread_atomic_load(&state.frames_dropped),
+        .samples_dropped = thread_atomic_load(&state.samples_dropped),
+        .kbytes_written = thread_atomic_load(&state.kbytes_written),
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*
+    Streaming gameplay recorder.
+
+    Palette-indexed frames and audio samples are copied into a ring of
+    slots by the emulator, and compressed and written to disk on a
+    background thread (see recfile.h for the file format). If the writer
+    can't keep up, frames and samples are dropped instead of stalling the
+    emulator, and a drop chunk records what was lost so that the converted
+    video and audio stay in sync.
+
+    Recording requires thread support (not available on the web).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+    const char* path;           // output file path
+    int width;                  // frame width in pixels
+    int height;                 // frame height in pixels
+    const uint32_t* palette;    // palette entries (RGBA8)
+    int num_colors;             // number of palette entries
+    int sample_rate;            // audio sample rate
+} recorder_desc_t;
+
+typedef struct {
+    uint32_t frames_written;
+    uint32_t frames_dropped;
+    uint32_t samples_dropped;
+    uint32_t kbytes_written;
+} recorder_stats_t;
+
+// start recording, returns false if the file can't be created, out of memory or threads are not supported
+bool recorder_start(const recorder_desc_t* desc);
+// stop recording, flushes all pending data and closes the file
+void recorder_stop(void);
+// return true if currently recording
+bool recorder_active(void);
+// record a frame (width * height palette indices), called by the emulator
+void recorder_frame(const uint8_t* pixels);
+// record audio samples, called by the emulator
+void recorder_audio(const float* samples, int num_samples);
+// get recording statistics
+recorder_stats_t recorder_stats(void);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,654 @@
+#include "romlib.h"
+#include "hash.h"
+#include "inflate.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <assert.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define ROMLIB_PATH_SIZE (2048)
+#define ROMLIB_READ_SIZE (64 * 1024)
+#define ROMLIB_MAX_DEPTH (16)           // max directory nesting
+#define ROMLIB_INES_HEADER_SIZE (16)
+#define ROMLIB_INES_TRAINER_SIZE (512)
+
+typedef struct {
+    const uint8_t* ptr;
+    size_t size;
+    #if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+    #endif
+} romlib_map_t;
+
+// parses and hashes an iNES image as it is read (and decompressed)
+typedef struct {
+    size_t offset;
+    bool header_valid;
+    uint8_t header[ROMLIB_INES_HEADER_SIZE];
+    size_t prg_begin;
+    size_t prg_end;
+    size_t chr_end;
+    uint32_t prg_crc32;
+    uint32_t chr_crc32;
+    hash_sha1_t prg_sha1;
+    hash_sha1_t chr_sha1;
+} romlib_parser_t;
+
+typedef struct {
+    bool valid;
+    bool scanning;
+    char index_path[ROMLIB_PATH_SIZE];
+    char tmp_path[ROMLIB_PATH_SIZE];
+    char dirs[ROMLIB_MAX_DIRS][ROMLIB_PATH_SIZE];
+    int num_dirs;
+    bool (*mapper_supported)(uint8_t mapper);
+    // the current index, only replaced while no scan is running
+    romlib_map_t map;
+    romlib_entry_t* entries;            // decoded from the mapped index
+    const char* strings;                // points into the mapped index
+    uint32_t num_entries;
+    // scan thread
+    thread_t thread;
+    volatile uint32_t quit;
+    volatile uint32_t done;
+    volatile uint32_t changed;
+    volatile uint32_t files_found;
+    volatile uint32_t files_parsed;
+    romlib_entry_t* new_entries;
+    uint32_t num_new_entries;
+    uint32_t max_new_entries;
+    char* new_strings;
+    uint32_t new_strings_size;
+    uint32_t max_new_strings_size;
+    uint8_t* read_buf;
+    inflate_stream_t* inflate;
+} romlib_state_t;
+static romlib_state_t state;
+
+#if defined(_WIN32)
+static bool romlib_win32_wide(const char* path, WCHAR* out_buf, int out_num_chars) {
+    return 0 != MultiByteToWideChar(CP_UTF8, 0, path, -1, out_buf, out_num_chars);
+}
+#endif
+
+static FILE* romlib_fopen(const char* path, const char* mode) {
+    #if defined(_WIN32)
+        WCHAR wc_path[ROMLIB_PATH_SIZE];
+        WCHAR wc_mode[8];
+        if (!romlib_win32_wide(path, wc_path, ROMLIB_PATH_SIZE) || !romlib_win32_wide(mode, wc_mode, 8)) {
+            return 0;
+        }
+        return _wfopen(wc_path, wc_mode);
+    #else
+        return fopen(path, mode);
+    #endif
+}
+
+static bool romlib_rename(const char* from, const char* to) {
+    #if defined(_WIN32)
+        WCHAR wc_from[ROMLIB_PATH_SIZE];
+        WCHAR wc_to[ROMLIB_PATH_SIZE];
+        if (!romlib_win32_wide(from, wc_from, ROMLIB_PATH_SIZE) || !romlib_win32_wide(to, wc_to, ROMLIB_PATH_SIZE)) {
+            return false;
+        }
+        return MoveFileExW(wc_from, wc_to, MOVEFILE_REPLACE_EXISTING);
+    #else
+        return 0 == rename(from, to);
+    #endif
+}
+
+static bool romlib_map_file(const char* path, romlib_map_t* map) {
+    memset(map, 0, sizeof(romlib_map_t));
+    #if defined(_WIN32)
+        WCHAR wc_path[ROMLIB_PATH_SIZE];
+        if (!romlib_win32_wide(path, wc_path, ROMLIB_PATH_SIZE)) {
+            return false;
+        }
+        HANDLE file = CreateFileW(wc_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || (file_size.QuadPart == 0)) {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            CloseHandle(file);
+            return false;
+        }
+        const void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!ptr) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        map->file = file;
+        map->mapping = mapping;
+        map->ptr = (const uint8_t*)ptr;
+        map->size = (size_t)file_size.QuadPart;
+    #else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if ((0 != fstat(fd, &st)) || (st.st_size == 0)) {
+            close(fd);
+            return false;
+        }
+        void* ptr = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping stays valid after the file is closed
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        map->ptr = (const uint8_t*)ptr;
+        map->size = (size_t)st.st_size;
+    #endif
+    return true;
+}
+
+static void romlib_unmap_file(romlib_map_t* map) {
+    if (map->ptr) {
+        #if defined(_WIN32)
+            UnmapViewOfFile(map->ptr);
+            CloseHandle(map->mapping);
+            CloseHandle(map->file);
+        #else
+            munmap((void*)map->ptr, map->size);
+        #endif
+    }
+    memset(map, 0, sizeof(romlib_map_t));
+}
+
+static void romlib_put_u32(uint8_t* dst, uint32_t val) {
+    dst[0] = (uint8_t)val;
+    dst[1] = (uint8_t)(val >> 8);
+    dst[2] = (uint8_t)(val >> 16);
+    dst[3] = (uint8_t)(val >> 24);
+}
+
+static void romlib_put_u64(uint8_t* dst, uint64_t val) {
+    romlib_put_u32(dst, (uint32_t)val);
+    romlib_put_u32(dst + 4, (uint32_t)(val >> 32));
+}
+
+static uint32_t romlib_get_u32(const uint8_t* src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint64_t romlib_get_u64(const uint8_t* src) {
+    return (uint64_t)romlib_get_u32(src) | ((uint64_t)romlib_get_u32(src + 4) << 32);
+}
+
+// encode an entry into ROMLIB_FILE_ENTRY_SIZE bytes (see romlib.h)
+static void romlib_encode_entry(const romlib_entry_t* entry, uint8_t* dst) {
+    romlib_put_u32(dst + 0, entry->path_offset);
+    romlib_put_u32(dst + 4, entry->flags);
+    romlib_put_u64(dst + 8, entry->mtime);
+    romlib_put_u64(dst + 16, entry->size);
+    romlib_put_u32(dst + 24, entry->prg_crc32);
+    romlib_put_u32(dst + 28, entry->chr_crc32);
+    memcpy(dst + 32, entry->prg_sha1, 20);
+    memcpy(dst + 52, entry->chr_sha1, 20);
+    dst[72] = entry->mapper;
+    dst[73] = entry->prg_page_count;
+    dst[74] = entry->tile_page_count;
+    memset(dst + 75, 0, 5);
+}
+
+static void romlib_decode_entry(const uint8_t* src, romlib_entry_t* entry) {
+    memset(entry, 0, sizeof(romlib_entry_t));
+    entry->path_offset = romlib_get_u32(src + 0);
+    entry->flags = romlib_get_u32(src + 4);
+    entry->mtime = romlib_get_u64(src + 8);
+    entry->size = romlib_get_u64(src + 16);
+    entry->prg_crc32 = romlib_get_u32(src + 24);
+    entry->chr_crc32 = romlib_get_u32(src + 28);
+    memcpy(entry->prg_sha1, src + 32, 20);
+    memcpy(entry->chr_sha1, src + 52, 20);
+    entry->mapper = src[72];
+    entry->prg_page_count = src[73];
+    entry->tile_page_count = src[74];
+}
+
+// unmap the current index and free the decoded entries
+static void romlib_free_index(void) {
+    romlib_unmap_file(&state.map);
+    free(state.entries);
+    state.entries = 0;
+    state.strings = 0;
+    state.num_entries = 0;
+}
+
+// map the index file and decode the entries, a missing or invalid index is treated as empty
+static void romlib_load_index(void) {
+    romlib_free_index();
+    if (!romlib_map_file(state.index_path, &state.map)) {
+        return;
+    }
+    const uint8_t* hdr = state.map.ptr;
+    bool valid = (state.map.size >= ROMLIB_FILE_HEADER_SIZE) && (0 == memcmp(hdr, "NLIB", 4));
+    const uint32_t version = valid ? romlib_get_u32(hdr + 4) : 0;
+    const uint32_t num_entries = valid ? romlib_get_u32(hdr + 8) : 0;
+    const uint32_t strings_size = valid ? romlib_get_u32(hdr + 12) : 0;
+    valid = valid
+        && (version == ROMLIB_VERSION)
+        && (strings_size > 0)
+        && (state.map.size == (ROMLIB_FILE_HEADER_SIZE + (uint64_t)num_entries * ROMLIB_FILE_ENTRY_SIZE + strings_size));
+    if (valid) {
+        const uint8_t* src = hdr + ROMLIB_FILE_HEADER_SIZE;
+        const char* strings = (const char*)(src + (size_t)num_entries * ROMLIB_FILE_ENTRY_SIZE);
+        valid = strings[strings_size - 1] == 0;
+        romlib_entry_t* entries = (romlib_entry_t*)malloc((num_entries > 0 ? num_entries : 1) * sizeof(romlib_entry_t));
+        for (uint32_t i = 0; valid && (i < num_entries); i++) {
+            romlib_decode_entry(src + (size_t)i * ROMLIB_FILE_ENTRY_SIZE, &entries[i]);
+            valid = entries[i].path_offset < strings_size;
+        }
+        if (valid) {
+            state.entries = entries;
+            state.strings = strings;
+            state.num_entries = num_entries;
+        }
+        else {
+            free(entries);
+        }
+    }
+    if (!valid) {
+        romlib_free_index();
+    }
+}
+
+// binary search an entry of the current index by path
+static const romlib_entry_t* romlib_find(const char* path) {
+    uint32_t lo = 0;
+    uint32_t hi = state.num_entries;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        const int cmp = strcmp(path, state.strings + state.entries[mid].path_offset);
+        if (cmp == 0) {
+            return &state.entries[mid];
+        }
+        else if (cmp < 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return 0;
+}
+
+// hash the part of the input stream at [offset, offset+size) which overlaps [begin, end)
+static void romlib_hash_range(size_t begin, size_t end, size_t offset, const uint8_t* data, size_t size, uint32_t* crc, hash_sha1_t* sha1) {
+    const size_t lo = (offset > begin) ? offset : begin;
+    const size_t hi = ((offset + size) < end) ? (offset + size) : end;
+    if (lo < hi) {
+        *crc = hash_crc32(*crc, data + (lo - offset), hi - lo);
+        hash_sha1_update(sha1, data + (lo - offset), hi - lo);
+    }
+}
+
+static bool romlib_parser_complete(const romlib_parser_t* p) {
+    return p->header_valid && (p->offset >= p->chr_end);
+}
+
+static bool romlib_parser_output(const uint8_t* data, size_t size, void* user_data) {
+    romlib_parser_t* p = (romlib_parser_t*)user_data;
+    while ((size > 0) && (p->offset < ROMLIB_INES_HEADER_SIZE)) {
+        p->header[p->offset++] = *data++;
+        size--;
+        if (p->offset == ROMLIB_INES_HEADER_SIZE) {
+            if (0 != memcmp(p->header, "NES\x1A", 4)) {
+                return false;
+            }
+            p->header_valid = true;
+            p->prg_begin = ROMLIB_INES_HEADER_SIZE + ((p->header[6] & 4) ? ROMLIB_INES_TRAINER_SIZE : 0);
+            p->prg_end = p->prg_begin + p->header[4] * 0x4000;
+            p->chr_end = p->prg_end + p->header[5] * 0x2000;
+        }
+    }
+    if (size > 0) {
+        romlib_hash_range(p->prg_begin, p->prg_end, p->offset, data, size, &p->prg_crc32, &p->prg_sha1);
+        romlib_hash_range(p->prg_end, p->chr_end, p->offset, data, size, &p->chr_crc32, &p->chr_sha1);
+        p->offset += size;
+    }
+    return true;
+}
+
+// read, decompress and hash a ROM file
+static void romlib_parse_file(const char* path, const inflate_format_t* format, romlib_entry_t* entry) {
+    memset(entry, 0, sizeof(romlib_entry_t));
+    romlib_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    hash_sha1_init(&parser.prg_sha1);
+    hash_sha1_init(&parser.chr_sha1);
+    if (format) {
+        entry->flags |= ROMLIB_FLAG_COMPRESSED;
+        inflate_stream_init(state.inflate, &(inflate_desc_t){
+            .format = *format,
+            .output = romlib_parser_output,
+            .user_data = &parser,
+            .zip_ext = "nes",
+        });
+    }
+    FILE* fp = romlib_fopen(path, "rb");
+    if (!fp) {
+        return;
+    }
+    bool ok = true;
+    // stop reading as soon as the PRG and CHR data is complete
+    while (ok && !romlib_parser_complete(&parser)) {
+        const size_t num_bytes = fread(state.read_buf, 1, ROMLIB_READ_SIZE, fp);
+        if (num_bytes == 0) {
+            break;
+        }
+        if (format) {
+            ok = INFLATE_RESULT_ERROR != inflate_stream_feed(state.inflate, state.read_buf, num_bytes);
+        }
+        else {
+            ok = romlib_parser_output(state.read_buf, num_bytes, &parser);
+        }
+    }
+    fclose(fp);
+    if (!parser.header_valid) {
+        return;
+    }
+    const uint8_t* hdr = parser.header;
+    entry->mapper = (hdr[6] >> 4) | (hdr[7] & 0xF0);
+    entry->prg_page_count = hdr[4];
+    entry->tile_page_count = hdr[5];
+    entry->flags |= (hdr[6] & 1) ? ROMLIB_FLAG_VERTICAL : 0;
+    entry->flags |= (hdr[6] & 2) ? ROMLIB_FLAG_BATTERY : 0;
+    entry->flags |= (hdr[6] & 4) ? ROMLIB_FLAG_TRAINER : 0;
+    entry->flags |= (hdr[6] & 8) ? ROMLIB_FLAG_FOUR_SCREEN : 0;
+    if (romlib_parser_complete(&parser)) {
+        entry->flags |= ROMLIB_FLAG_VALID;
+        if (!state.mapper_supported || state.mapper_supported(entry->mapper)) {
+            entry->flags |= ROMLIB_FLAG_SUPPORTED;
+        }
+        entry->prg_crc32 = parser.prg_crc32;
+        entry->chr_crc32 = parser.chr_crc32;
+        hash_sha1_final(&parser.prg_sha1, entry->prg_sha1);
+        hash_sha1_final(&parser.chr_sha1, entry->chr_sha1);
+    }
+}
+
+static uint32_t romlib_add_string(const char* str) {
+    const uint32_t len = (uint32_t)strlen(str) + 1;
+    if ((state.new_strings_size + len) > state.max_new_strings_size) {
+        while ((state.new_strings_size + len) > state.max_new_strings_size) {
+            state.max_new_strings_size = state.max_new_strings_size ? (state.max_new_strings_size * 2) : (64 * 1024);
+        }
+        state.new_strings = (char*)realloc(state.new_strings, state.max_new_strings_size);
+    }
+    const uint32_t offset = state.new_strings_size;
+    memcpy(&state.new_strings[offset], str, len);
+    state.new_strings_size += len;
+    return offset;
+}
+
+static void romlib_add_entry(const romlib_entry_t* entry) {
+    if (state.num_new_entries == state.max_new_entries) {
+        state.max_new_entries = state.max_new_entries ? (state.max_new_entries * 2) : 256;
+        state.new_entries = (romlib_entry_t*)realloc(state.new_entries, state.max_new_entries * sizeof(romlib_entry_t));
+    }
+    state.new_entries[state.num_new_entries++] = *entry;
+}
+
+// return true if the file is a ROM image, and if it's compressed
+static bool romlib_rom_file(const char* path, inflate_format_t* out_format, bool* out_compressed) {
+    const char* ext = strrchr(path, '.');
+    if (!ext) {
+        return false;
+    }
+    char buf[8];
+    size_t i = 0;
+    for (ext++; *ext && (i < (sizeof(buf) - 1)); ext++, i++) {
+        buf[i] = (char)tolower(*ext);
+    }
+    buf[i] = 0;
+    *out_compressed = inflate_format_from_ext(buf, out_format);
+    return *out_compressed || (0 == strcmp(buf, "nes"));
+}
+
+static void romlib_scan_file(const char* path, uint64_t mtime, uint64_t size) {
+    inflate_format_t format;
+    bool compressed;
+    if (!romlib_rom_file(path, &format, &compressed)) {
+        return;
+    }
+    thread_atomic_store(&state.files_found, state.files_found + 1);
+    romlib_entry_t entry;
+    const romlib_entry_t* old_entry = romlib_find(path);
+    if (old_entry && (old_entry->mtime == mtime) && (old_entry->size == size)) {
+        entry = *old_entry;
+    }
+    else {
+        romlib_parse_file(path, compressed ? &format : 0, &entry);
+        entry.mtime = mtime;
+        entry.size = size;
+        thread_atomic_store(&state.files_parsed, state.files_parsed + 1);
+    }
+    entry.path_offset = romlib_add_string(path);
+    romlib_add_entry(&entry);
+}
+
+static void romlib_scan_dir(const char* dir, int depth) {
+    if (depth > ROMLIB_MAX_DEPTH) {
+        return;
+    }
+    char path[ROMLIB_PATH_SIZE];
+    #if defined(_WIN32)
+        WCHAR wc_pattern[ROMLIB_PATH_SIZE];
+        if ((snprintf(path, sizeof(path), "%s\\*", dir) >= (int)sizeof(path)) || !romlib_win32_wide(path, wc_pattern, ROMLIB_PATH_SIZE)) {
+            return;
+        }
+        WIN32_FIND_DATAW data;
+        HANDLE find = FindFirstFileW(wc_pattern, &data);
+        if (find == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        do {
+            char name[ROMLIB_PATH_SIZE];
+            if (0 == WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, name, sizeof(name), NULL, NULL)) {
+                continue;
+            }
+            // skip '.', '..' and hidden files
+            if ((name[0] == '.') || (snprintf(path, sizeof(path), "%s\\%s", dir, name) >= (int)sizeof(path))) {
+                continue;
+            }
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                romlib_scan_dir(path, depth + 1);
+            }
+            else {
+                const uint64_t mtime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+                const uint64_t size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+                romlib_scan_file(path, mtime, size);
+            }
+        } while (!thread_atomic_load(&state.quit) && FindNextFileW(find, &data));
+        FindClose(find);
+    #else
+        DIR* d = opendir(dir);
+        if (!d) {
+            return;
+        }
+        struct dirent* ent;
+        while (!thread_atomic_load(&state.quit) && (ent = readdir(d))) {
+            // skip '.', '..' and hidden files
+            if ((ent->d_name[0] == '.') || (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >= (int)sizeof(path))) {
+                continue;
+            }
+            struct stat st;
+            if (0 != stat(path, &st)) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                romlib_scan_dir(path, depth + 1);
+            }
+            else if (S_ISREG(st.st_mode)) {
+                romlib_scan_file(path, (uint64_t)st.st_mtime, (uint64_t)st.st_size);
+            }
+        }
+        closedir(d);
+    #endif
+}
+
+static int romlib_cmp_entries(const void* a, const void* b) {
+    const romlib_entry_t* ea = (const romlib_entry_t*)a;
+    const romlib_entry_t* eb = (const romlib_entry_t*)b;
+    return strcmp(state.new_strings + ea->path_offset, state.new_strings + eb->path_offset);
+}
+
+static bool romlib_write_index(const char* path) {
+    FILE* fp = romlib_fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    uint8_t hdr[ROMLIB_FILE_HEADER_SIZE];
+    memcpy(hdr, "NLIB", 4);
+    romlib_put_u32(hdr + 4, ROMLIB_VERSION);
+    romlib_put_u32(hdr + 8, state.num_new_entries);
+    romlib_put_u32(hdr + 12, state.new_strings_size);
+    bool ok = 1 == fwrite(hdr, sizeof(hdr), 1, fp);
+    for (uint32_t i = 0; ok && (i < state.num_new_entries); i++) {
+        uint8_t entry[ROMLIB_FILE_ENTRY_SIZE];
+        romlib_encode_entry(&state.new_entries[i], entry);
+        ok = 1 == fwrite(entry, sizeof(entry), 1, fp);
+    }
+    ok = ok && (1 == fwrite(state.new_strings, state.new_strings_size, 1, fp));
+    ok = (0 == fclose(fp)) && ok;
+    return ok;
+}
+
+static void romlib_thread_func(void* user_data) {
+    (void)user_data;
+    for (int i = 0; i < state.num_dirs; i++) {
+        romlib_scan_dir(state.dirs[i], 0);
+    }
+    // the string table always contains at least an empty string
+    romlib_add_string("");
+    if (!thread_atomic_load(&state.quit)) {
+        // if no file has been parsed and the number of files is unchanged, all old entries have been reused
+        const bool changed = (state.files_parsed > 0) || (state.num_new_entries != state.num_entries);
+        if (changed) {
+            qsort(state.new_entries, state.num_new_entries, sizeof(romlib_entry_t), romlib_cmp_entries);
+            thread_atomic_store(&state.changed, romlib_write_index(state.tmp_path) ? 1 : 0);
+        }
+    }
+    thread_atomic_store(&state.done, 1);
+}
+
+static void romlib_free_scan(void) {
+    free(state.new_entries);
+    free(state.new_strings);
+    free(state.read_buf);
+    free(state.inflate);
+    state.new_entries = 0;
+    state.new_strings = 0;
+    state.read_buf = 0;
+    state.inflate = 0;
+    state.num_new_entries = state.max_new_entries = 0;
+    state.new_strings_size = state.max_new_strings_size = 0;
+}
+
+// wait for the scan thread, and replace the index file if it has changed
+static bool romlib_finish_scan(void) {
+    thread_join(&state.thread);
+    state.scanning = false;
+    romlib_free_scan();
+    if (!thread_atomic_load(&state.changed)) {
+        return false;
+    }
+    // the old index must be unmapped before it can be replaced on Windows
+    romlib_free_index();
+    romlib_rename(state.tmp_path, state.index_path);
+    romlib_load_index();
+    return true;
+}
+
+bool romlib_init(const romlib_desc_t* desc) {
+    assert(desc && desc->index_path);
+    assert(!state.valid);
+    if (!thread_supported()) {
+        return false;
+    }
+    memset(&state, 0, sizeof(state));
+    if ((snprintf(state.index_path, sizeof(state.index_path), "%s", desc->index_path) >= (int)sizeof(state.index_path)) ||
+        (snprintf(state.tmp_path, sizeof(state.tmp_path), "%s.tmp", desc->index_path) >= (int)sizeof(state.tmp_path)))
+    {
+        return false;
+    }
+    for (int i = 0; (i < ROMLIB_MAX_DIRS) && desc->dirs[i]; i++) {
+        snprintf(state.dirs[state.num_dirs++], ROMLIB_PATH_SIZE, "%s", desc->dirs[i]);
+    }
+    state.mapper_supported = desc->mapper_supported;
+    romlib_load_index();
+
+    state.read_buf = (uint8_t*)malloc(ROMLIB_READ_SIZE);
+    state.inflate = (inflate_stream_t*)calloc(1, sizeof(inflate_stream_t));
+    if (!thread_create(&state.thread, romlib_thread_func, 0)) {
+        romlib_free_scan();
+        romlib_free_index();
+        return false;
+    }
+    state.scanning = true;
+    state.valid = true;
+    return true;
+}
+
+void romlib_shutdown(void) {
+    if (!state.valid) {
+        return;
+    }
+    if (state.scanning) {
+        thread_atomic_store(&state.quit, 1);
+        romlib_finish_scan();
+    }
+    romlib_free_index();
+    state.valid = false;
+}
+
+bool romlib_update(void) {
+    if (!state.valid || !state.scanning || !thread_atomic_load(&state.done)) {
+        return false;
+    }
+    return romlib_finish_scan();
+}
+
+romlib_status_t romlib_status(void) {
+    return (romlib_status_t) {
+        .scanning = state.scanning,
+        .files_found = thread_atomic_load(&state.files_found),
+        .files_parsed = thread_atomic_load(&state.files_parsed),
+    };
+}
+
+int romlib_num_entries(void) {
+    return (int)state.num_entries;
+}
+
+const romlib_entry_t* romlib_entry(int index) {
+    assert((index >= 0) && (index < (int)state.num_entries));
+    return &state.entries[index];
+}
+
+const char* romlib_entry_path(const romlib_entry_t* entry) {
+    assert(entry && state.strings);
+    return state.strings + entry->path_offset;
+}
@@ -0,0 +1,98 @@
+#pragma once
+/*
+    ROM library indexer.
+
+    Scans directories for iNES images (.nes, .nes.gz and .zip) on a
+    background thread, and stores the parsed cartridge header fields and
+    the CRC32/SHA-1 checksums of the PRG and CHR data in a compact index
+    file. At startup the index file is memory-mapped, so the library is
+    available immediately without opening any ROM file. Files whose
+    modification time and size didn't change since the last scan are
+    taken from the existing index instead of being parsed again.
+
+    Index file layout, all integers are little-endian:
+
+        header (ROMLIB_FILE_HEADER_SIZE bytes):
+            "NLIB"              magic
+            u32 version
+            u32 num_entries
+            u32 strings_size
+        entries (ROMLIB_FILE_ENTRY_SIZE bytes each, sorted by path):
+            u32 path_offset, u32 flags, u64 mtime, u64 size,
+            u32 prg_crc32, u32 chr_crc32, u8 prg_sha1[20], u8 chr_sha1[20],
+            u8 mapper, u8 prg_page_count, u8 tile_page_count, u8 reserved[5]
+        char strings[strings_size]      (zero-terminated paths)
+
+    The entries are decoded into romlib_entry_t when the index is loaded,
+    the string table is used in place.
+
+    Scanning requires thread support (not available on the web).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define ROMLIB_MAX_DIRS (8)
+#define ROMLIB_VERSION (1)
+#define ROMLIB_FILE_HEADER_SIZE (16)
+#define ROMLIB_FILE_ENTRY_SIZE (80)
+
+typedef enum {
+    ROMLIB_FLAG_VALID       = (1<<0),   // file contains a complete iNES image
+    ROMLIB_FLAG_SUPPORTED   = (1<<1),   // the mapper is supported by the emulator
+    ROMLIB_FLAG_VERTICAL    = (1<<2),   // vertical mirroring
+    ROMLIB_FLAG_BATTERY     = (1<<3),   // battery-backed save RAM
+    ROMLIB_FLAG_TRAINER     = (1<<4),   // contains a 512 byte trainer
+    ROMLIB_FLAG_FOUR_SCREEN = (1<<5),   // four screen nametables
+    ROMLIB_FLAG_COMPRESSED  = (1<<6),   // gzip or zip file
+} romlib_flags_t;
+
+typedef struct {
+    uint32_t path_offset;           // offset of the path in the string table
+    uint32_t flags;                 // ROMLIB_FLAG_*
+    uint64_t mtime;                 // file modification time
+    uint64_t size;                  // file size in bytes
+    uint32_t prg_crc32;
+    uint32_t chr_crc32;
+    uint8_t prg_sha1[20];
+    uint8_t chr_sha1[20];
+    uint8_t mapper;                 // iNES mapper number
+    uint8_t prg_page_count;         // 16 KB page size
+    uint8_t tile_page_count;        // 8 KB page size
+    uint8_t reserved[5];
+} romlib_entry_t;
+
+typedef struct {
+    const char* index_path;                 // path of the index file
+    const char* dirs[ROMLIB_MAX_DIRS];      // directories to scan (recursively)
+    bool (*mapper_supported)(uint8_t mapper);   // optional: return true if a mapper is supported
+} romlib_desc_t;
+
+typedef struct {
+    bool scanning;                  // a background scan is in progress
+    uint32_t files_found;           // ROM files found by the current or last scan
+    uint32_t files_parsed;          // files which had to be parsed (new or modified)
+} romlib_status_t;
+
+// map the existing index file and start a background scan, returns false if scanning is not supported
+bool romlib_init(const romlib_desc_t* desc);
+// stop scanning and unmap the index
+void romlib_shutdown(void);
+// call once per frame, installs the result of a finished scan, returns true if the index has changed
+bool romlib_update(void);
+// get the scanning status
+romlib_status_t romlib_status(void);
+// number of entries in the current index
+int romlib_num_entries(void);
+// get an index entry, the pointer is valid until romlib_update() returns true
+const romlib_entry_t* romlib_entry(int index);
+// get the file path of an entry
+const char* romlib_entry_path(const romlib_entry_t* entry);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -58,6 +58,37 @@ void main() {
 }
 @end
 
+// optional CRT look: barrel distortion, scanlines and an aperture grille mask
+@fs display_crt_fs
+layout(binding=0) uniform texture2D tex;
+layout(binding=0) uniform sampler smp;
+layout(binding=0) uniform display_crt_fs_params {
+    vec2 src_size;      // emulator screen size in pixels (one scanline per pixel row)
+    vec2 dst_size;      // viewport size in pixels
+};
+in vec2 uv;
+out vec4 frag_color;
+
+void main() {
+    vec2 cc = uv - 0.5;
+    vec2 crt_uv = uv + cc * dot(cc, cc) * 0.12;
+    if ((crt_uv.x < 0.0) || (crt_uv.x > 1.0) || (crt_uv.y < 0.0) || (crt_uv.y > 1.0)) {
+        frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    vec3 color = texture(sampler2D(tex, smp), crt_uv).xyz;
+    // scanlines are darkest between two emulator pixel rows
+    float scanline = 0.5 + 0.5 * cos(6.2831853 * crt_uv.y * src_size.y);
+    color *= mix(0.65, 1.0, scanline);
+    // aperture grille, one RGB triad per 3 display pixels
+    float column = mod(floor(uv.x * dst_size.x), 3.0);
+    color *= vec3(0.8) + 0.2 * vec3(equal(vec3(column), vec3(0.0, 1.0, 2.0)));
+    // compensate for the overall darkening
+    frag_color = vec4(color * 1.35, 1.0);
+}
+@end
+
 @program offscreen offscreen_vs offscreen_fs
 @program offscreen_pal offscreen_vs offscreen_pal_fs
 @program display display_vs display_fs
+@program display_crt display_vs display_crt_fs
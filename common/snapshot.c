@@ -0,0 +1,276 @@
+#include "chips/chips_common.h"
+#include "fs.h"
+#include "snapshot.h"
+#include "lz.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define SNAPSHOT_MAX_JOBS (16)
+#define SNAPSHOT_NAME_SIZE (32)
+#define SNAPSHOT_HEADER_SIZE (12)
+#define SNAPSHOT_MAX_SIZE (16 * 1024 * 1024)    // sanity check for the decompressed size
+
+typedef enum {
+    SNAPSHOT_METHOD_STORED = 0,
+    SNAPSHOT_METHOD_LZ = 1,
+} snapshot_method_t;
+
+typedef enum {
+    SNAPSHOT_JOB_SAVE,
+    SNAPSHOT_JOB_LOAD,
+} snapshot_job_type_t;
+
+typedef struct {
+    bool in_use;                    // only accessed by the main thread
+    bool pending;                   // web: waiting for the fs load callback
+    snapshot_job_type_t type;
+    char system_name[SNAPSHOT_NAME_SIZE];
+    size_t snapshot_index;
+    uint8_t* data;                  // save: uncompressed input, load: decompressed output
+    size_t size;
+    bool success;
+    snapshot_save_callback_t save_callback;
+    fs_snapshot_load_callback_t load_callback;
+} snapshot_job_t;
+
+typedef struct {
+    bool valid;
+    bool threaded;
+    thread_t thread;
+    volatile uint32_t quit;
+    thread_queue_t requests;        // job indices from the main thread to the worker
+    thread_queue_t results;         // finished job indices back to the main thread
+    snapshot_job_t jobs[SNAPSHOT_MAX_JOBS];
+} snapshot_state_t;
+static snapshot_state_t state;
+
+// compress data into a snapshot file image, free the returned range.ptr with free(),
+// returns an empty range if out of memory
+static chips_range_t snapshot_encode(const uint8_t* data, size_t size) {
+    const size_t max_size = SNAPSHOT_HEADER_SIZE + LZ_MAX_COMPRESSED_SIZE(size);
+    uint8_t* file = (uint8_t*)malloc(max_size);
+    if (!file) {
+        return (chips_range_t){0};
+    }
+    size_t payload_size = lz_compress(data, size, file + SNAPSHOT_HEADER_SIZE, max_size - SNAPSHOT_HEADER_SIZE);
+    uint8_t method = SNAPSHOT_METHOD_LZ;
+    if ((payload_size == 0) || (payload_size >= size)) {
+        memcpy(file + SNAPSHOT_HEADER_SIZE, data, size);
+        payload_size = size;
+        method = SNAPSHOT_METHOD_STORED;
+    }
+    memcpy(file, "NSNP", 4);
+    file[4] = method;
+    file[5] = file[6] = file[7] = 0;
+    for (int i = 0; i < 4; i++) {
+        file[8 + i] = (uint8_t)(size >> (i * 8));
+    }
+    return (chips_range_t){ .ptr = file, .size = SNAPSHOT_HEADER_SIZE + payload_size };
+}
+
+// decompress a snapshot file image, returns false if the file is invalid or out of memory
+static bool snapshot_decode(const uint8_t* file, size_t file_size, uint8_t** out_data, size_t* out_size) {
+    *out_data = 0;
+    *out_size = 0;
+    if ((file_size < SNAPSHOT_HEADER_SIZE) || (0 != memcmp(file, "NSNP", 4))) {
+        return false;
+    }
+    const size_t size = (size_t)file[8] | ((size_t)file[9] << 8) | ((size_t)file[10] << 16) | ((size_t)file[11] << 24);
+    if ((size == 0) || (size > SNAPSHOT_MAX_SIZE)) {
+        return false;
+    }
+    const uint8_t* payload = file + SNAPSHOT_HEADER_SIZE;
+    const size_t payload_size = file_size - SNAPSHOT_HEADER_SIZE;
+    uint8_t* data = (uint8_t*)malloc(size);
+    if (!data) {
+        return false;
+    }
+    bool ok = false;
+    if (file[4] == SNAPSHOT_METHOD_STORED) {
+        ok = payload_size == size;
+        if (ok) {
+            memcpy(data, payload, size);
+        }
+    }
+    else if (file[4] == SNAPSHOT_METHOD_LZ) {
+        ok = lz_decompress(payload, payload_size, data, size) == size;
+    }
+    if (!ok) {
+        free(data);
+        return false;
+    }
+    *out_data = data;
+    *out_size = size;
+    return true;
+}
+
+// the part of a job which runs on the worker thread
+static void snapshot_process_job(snapshot_job_t* job) {
+    if (job->type == SNAPSHOT_JOB_SAVE) {
+        chips_range_t file = snapshot_encode(job->data, job->size);
+        job->success = file.ptr && fs_save_snapshot(job->system_name, job->snapshot_index, file);
+        free(file.ptr);
+    }
+    else {
+        chips_range_t file = fs_read_snapshot(job->system_name, job->snapshot_index);
+        job->success = file.ptr && snapshot_decode((const uint8_t*)file.ptr, file.size, &job->data, &job->size);
+        free(file.ptr);
+    }
+}
+
+static void snapshot_thread_func(void* user_data) {
+    (void)user_data;
+    while (true) {
+        uint32_t job_index;
+        if (thread_queue_pop(&state.requests, &job_index)) {
+            snapshot_process_job(&state.jobs[job_index]);
+            while (!thread_queue_push(&state.results, job_index)) {
+                thread_sleep_us(1000);
+            }
+        }
+        else if (thread_atomic_load(&state.quit)) {
+            // all pending requests have been processed
+            break;
+        }
+        else {
+            thread_sleep_us(1000);
+        }
+    }
+}
+
+static snapshot_job_t* snapshot_alloc_job(snapshot_job_type_t type, const char* system_name, size_t snapshot_index) {
+    for (int i = 0; i < SNAPSHOT_MAX_JOBS; i++) {
+        snapshot_job_t* job = &state.jobs[i];
+        if (!job->in_use) {
+            memset(job, 0, sizeof(snapshot_job_t));
+            job->in_use = true;
+            job->type = type;
+            snprintf(job->system_name, sizeof(job->system_name), "%s", system_name);
+            job->snapshot_index = snapshot_index;
+            return job;
+        }
+    }
+    return 0;
+}
+
+static uint32_t snapshot_job_index(const snapshot_job_t* job) {
+    return (uint32_t)(job - state.jobs);
+}
+
+// invoke the completion callback of a finished job, and free the job
+static void snapshot_finish_job(snapshot_job_t* job, bool invoke_callback) {
+    if (invoke_callback) {
+        if (job->type == SNAPSHOT_JOB_SAVE) {
+            if (job->save_callback) {
+                job->save_callback(job->snapshot_index, job->success);
+            }
+        }
+        else {
+            job->load_callback(&(fs_snapshot_response_t){
+                .snapshot_index = job->snapshot_index,
+                .result = job->success ? FS_RESULT_SUCCESS : FS_RESULT_FAILED,
+                .data = { .ptr = job->data, .size = job->size },
+            });
+        }
+    }
+    free(job->data);
+    job->data = 0;
+    job->in_use = false;
+}
+
+// web: completion of fs_load_snapshot_async(), decompression happens on the main thread
+static void snapshot_fs_load_callback(const fs_snapshot_response_t* response) {
+    for (int i = 0; i < SNAPSHOT_MAX_JOBS; i++) {
+        snapshot_job_t* job = &state.jobs[i];
+        if (job->in_use && job->pending && (job->snapshot_index == response->snapshot_index)) {
+            job->pending = false;
+            job->success = (response->result == FS_RESULT_SUCCESS) &&
+                snapshot_decode((const uint8_t*)response->data.ptr, response->data.size, &job->data, &job->size);
+            thread_queue_push(&state.results, snapshot_job_index(job));
+            break;
+        }
+    }
+}
+
+void snapshot_init(void) {
+    assert(!state.valid);
+    memset(&state, 0, sizeof(state));
+    state.threaded = thread_create(&state.thread, snapshot_thread_func, 0);
+    state.valid = true;
+}
+
+void snapshot_shutdown(void) {
+    if (!state.valid) {
+        return;
+    }
+    if (state.threaded) {
+        thread_atomic_store(&state.quit, 1);
+        thread_join(&state.thread);
+    }
+    for (int i = 0; i < SNAPSHOT_MAX_JOBS; i++) {
+        if (state.jobs[i].in_use) {
+            snapshot_finish_job(&state.jobs[i], false);
+        }
+    }
+    state.valid = false;
+}
+
+void snapshot_dowork(void) {
+    assert(state.valid);
+    uint32_t job_index;
+    while (thread_queue_pop(&state.results, &job_index)) {
+        snapshot_finish_job(&state.jobs[job_index], true);
+    }
+}
+
+bool snapshot_save_async(const char* system_name, size_t snapshot_index, chips_range_t data, snapshot_save_callback_t callback) {
+    assert(state.valid);
+    assert(system_name && data.ptr && (data.size > 0));
+    snapshot_job_t* job = snapshot_alloc_job(SNAPSHOT_JOB_SAVE, system_name, snapshot_index);
+    if (!job) {
+        return false;
+    }
+    job->save_callback = callback;
+    job->data = (uint8_t*)malloc(data.size);
+    if (!job->data) {
+        snapshot_finish_job(job, false);
+        return false;
+    }
+    job->size = data.size;
+    memcpy(job->data, data.ptr, data.size);
+    if (!state.threaded) {
+        // fs_save_snapshot() is asynchronous on the web
+        snapshot_process_job(job);
+        thread_queue_push(&state.results, snapshot_job_index(job));
+    }
+    else if (!thread_queue_push(&state.requests, snapshot_job_index(job))) {
+        snapshot_finish_job(job, false);
+        return false;
+    }
+    return true;
+}
+
+bool snapshot_load_async(const char* system_name, size_t snapshot_index, fs_snapshot_load_callback_t callback) {
+    assert(state.valid);
+    assert(system_name && callback);
+    snapshot_job_t* job = snapshot_alloc_job(SNAPSHOT_JOB_LOAD, system_name, snapshot_index);
+    if (!job) {
+        return false;
+    }
+    job->load_callback = callback;
+    if (!state.threaded) {
+        job->pending = true;
+        if (!fs_load_snapshot_async(system_name, snapshot_index, snapshot_fs_load_callback)) {
+            snapshot_finish_job(job, false);
+            return false;
+        }
+    }
+    else if (!thread_queue_push(&state.requests, snapshot_job_index(job))) {
+        snapshot_finish_job(job, false);
+        return false;
+    }
+    return true;
+}
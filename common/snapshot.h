@@ -0,0 +1,42 @@
+#pragma once
+/*
+    Asynchronous snapshot saving and loading.
+
+    Saving copies the snapshot data, compression (see lz.h) and writing
+    the file happen on a worker thread. Loading reads and decompresses
+    the file on the worker thread, the decompressed data is passed to
+    the load callback on the main thread in snapshot_dowork().
+
+    Without thread support (on the web), compression and decompression
+    happen on the main thread, and the storage access goes through the
+    asynchronous fs_save_snapshot() and fs_load_snapshot_async().
+
+    Snapshot file layout (little-endian):
+
+        "NSNP", u8 method (0: stored, 1: lz), u8[3] reserved, u32 size
+        (compressed) payload
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// called on the main thread when a snapshot has been written
+typedef void (*snapshot_save_callback_t)(size_t snapshot_index, bool success);
+
+void snapshot_init(void);
+// finish all pending requests and stop the worker thread
+void snapshot_shutdown(void);
+// call once per frame on the main thread, invokes the completion callbacks
+void snapshot_dowork(void);
+// start saving a snapshot, the data is copied, the callback is optional
+bool snapshot_save_async(const char* system_name, size_t snapshot_index, chips_range_t data, snapshot_save_callback_t callback);
+// start loading a snapshot, the response data is only valid during the callback
+bool snapshot_load_async(const char* system_name, size_t snapshot_index, fs_snapshot_load_callback_t callback);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
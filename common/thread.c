@@ -0,0 +1,286 @@
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    #define THREAD_NONE (1)
+#elif defined(_WIN32)
+    #define THREAD_WIN32 (1)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <intrin.h>
+#else
+    #define THREAD_PTHREADS (1)
+    #include <pthread.h>
+    #include <time.h>
+#endif
+#if defined(__EMSCRIPTEN__)
+    #include <time.h>
+#endif
+
+#define TRIBUF_DIRTY (4)
+#define TRIBUF_INDEX_MASK (3)
+
+bool thread_supported(void) {
+    #if defined(THREAD_NONE)
+        return false;
+    #else
+        return true;
+    #endif
+}
+
+#if defined(THREAD_WIN32)
+typedef struct {
+    HANDLE handle;
+    thread_func_t func;
+    void* user_data;
+} _thread_win32_t;
+
+static DWORD WINAPI _thread_win32_entry(LPVOID arg) {
+    _thread_win32_t* t = (_thread_win32_t*)arg;
+    t->func(t->user_data);
+    return 0;
+}
+#elif defined(THREAD_PTHREADS)
+typedef struct {
+    pthread_t handle;
+    thread_func_t func;
+    void* user_data;
+} _thread_pthread_t;
+
+static void* _thread_pthread_entry(void* arg) {
+    _thread_pthread_t* t = (_thread_pthread_t*)arg;
+    t->func(t->user_data);
+    return 0;
+}
+#endif
+
+bool thread_create(thread_t* thread, thread_func_t func, void* user_data) {
+    assert(thread && func);
+    thread->handle = 0;
+    #if defined(THREAD_WIN32)
+        _thread_win32_t* t = (_thread_win32_t*)calloc(1, sizeof(_thread_win32_t));
+        t->func = func;
+        t->user_data = user_data;
+        t->handle = CreateThread(NULL, 0, _thread_win32_entry, t, 0, NULL);
+        if (!t->handle) {
+            free(t);
+            return false;
+        }
+        thread->handle = t;
+        return true;
+    #elif defined(THREAD_PTHREADS)
+        _thread_pthread_t* t = (_thread_pthread_t*)calloc(1, sizeof(_thread_pthread_t));
+        t->func = func;
+        t->user_data = user_data;
+        if (0 != pthread_create(&t->handle, NULL, _thread_pthread_entry, t)) {
+            free(t);
+            return false;
+        }
+        thread->handle = t;
+        return true;
+    #else
+        (void)user_data;
+        return false;
+    #endif
+}
+
+void thread_join(thread_t* thread) {
+    assert(thread);
+    if (!thread->handle) {
+        return;
+    }
+    #if defined(THREAD_WIN32)
+        _thread_win32_t* t = (_thread_win32_t*)thread->handle;
+        WaitForSingleObject(t->handle, INFINITE);
+        CloseHandle(t->handle);
+        free(t);
+    #elif defined(THREAD_PTHREADS)
+        _thread_pthread_t* t = (_thread_pthread_t*)thread->handle;
+        pthread_join(t->handle, NULL);
+        free(t);
+    #endif
+    thread->handle = 0;
+}
+
+void thread_sleep_us(uint32_t micro_seconds) {
+    #if defined(THREAD_WIN32)
+        Sleep((micro_seconds + 999) / 1000);
+    #else
+        struct timespec ts = {
+            .tv_sec = micro_seconds / 1000000,
+            .tv_nsec = (long)(micro_seconds % 1000000) * 1000,
+        };
+        nanosleep(&ts, NULL);
+    #endif
+}
+
+void thread_mutex_init(thread_mutex_t* mutex) {
+    assert(mutex);
+    #if defined(THREAD_WIN32)
+        CRITICAL_SECTION* cs = (CRITICAL_SECTION*)calloc(1, sizeof(CRITICAL_SECTION));
+        InitializeCriticalSection(cs);
+        mutex->handle = cs;
+    #elif defined(THREAD_PTHREADS)
+        pthread_mutex_t* m = (pthread_mutex_t*)calloc(1, sizeof(pthread_mutex_t));
+        pthread_mutex_init(m, NULL);
+        mutex->handle = m;
+    #else
+        mutex->handle = 0;
+    #endif
+}
+
+void thread_mutex_destroy(thread_mutex_t* mutex) {
+    assert(mutex);
+    if (!mutex->handle) {
+        return;
+    }
+    #if defined(THREAD_WIN32)
+        DeleteCriticalSection((CRITICAL_SECTION*)mutex->handle);
+    #elif defined(THREAD_PTHREADS)
+        pthread_mutex_destroy((pthread_mutex_t*)mutex->handle);
+    #endif
+    free(mutex->handle);
+    mutex->handle = 0;
+}
+
+void thread_mutex_lock(thread_mutex_t* mutex) {
+    assert(mutex);
+    #if defined(THREAD_WIN32)
+        EnterCriticalSection((CRITICAL_SECTION*)mutex->handle);
+    #elif defined(THREAD_PTHREADS)
+        pthread_mutex_lock((pthread_mutex_t*)mutex->handle);
+    #else
+        (void)mutex;
+    #endif
+}
+
+void thread_mutex_unlock(thread_mutex_t* mutex) {
+    assert(mutex);
+    #if defined(THREAD_WIN32)
+        LeaveCriticalSection((CRITICAL_SECTION*)mutex->handle);
+    #elif defined(THREAD_PTHREADS)
+        pthread_mutex_unlock((pthread_mutex_t*)mutex->handle);
+    #else
+        (void)mutex;
+    #endif
+}
+
+uint32_t thread_atomic_load(const volatile uint32_t* ptr) {
+    #if defined(_MSC_VER)
+        return (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, 0, 0);
+    #else
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    #endif
+}
+
+void thread_atomic_store(volatile uint32_t* ptr, uint32_t val) {
+    #if defined(_MSC_VER)
+        _InterlockedExchange((volatile long*)ptr, (long)val);
+    #else
+        __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+    #endif
+}
+
+uint32_t thread_atomic_exchange(volatile uint32_t* ptr, uint32_t val) {
+    #if defined(_MSC_VER)
+        return (uint32_t)_InterlockedExchange((volatile long*)ptr, (long)val);
+    #else
+        return __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL);
+    #endif
+}
+
+uint64_t thread_atomic_load64(const volatile uint64_t* ptr) {
+    #if defined(_MSC_VER)
+        return (uint64_t)_InterlockedCompareExchange64((volatile long long*)ptr, 0, 0);
+    #else
+        return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+    #endif
+}
+
+void thread_atomic_store64(volatile uint64_t* ptr, uint64_t val) {
+    #if defined(_MSC_VER)
+        _InterlockedExchange64((volatile long long*)ptr, (long long)val);
+    #else
+        __atomic_store_n(ptr, val, __ATOMIC_RELAXED);
+    #endif
+}
+
+void thread_atomic_add64(volatile uint64_t* ptr, uint64_t val) {
+    #if defined(_MSC_VER)
+        _InterlockedExchangeAdd64((volatile long long*)ptr, (long long)val);
+    #else
+        __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+    #endif
+}
+
+void thread_tribuf_init(thread_tribuf_t* tb, size_t slot_size) {
+    assert(tb && (slot_size > 0));
+    memset(tb, 0, sizeof(thread_tribuf_t));
+    tb->slot_size = slot_size;
+    for (int i = 0; i < 3; i++) {
+        tb->slots[i] = (uint8_t*)calloc(1, slot_size);
+    }
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+}
+
+void thread_tribuf_discard(thread_tribuf_t* tb) {
+    assert(tb);
+    for (int i = 0; i < 3; i++) {
+        free(tb->slots[i]);
+        tb->slots[i] = 0;
+    }
+}
+
+uint8_t* thread_tribuf_back(thread_tribuf_t* tb) {
+    assert(tb && tb->slots[tb->back]);
+    return tb->slots[tb->back];
+}
+
+void thread_tribuf_publish(thread_tribuf_t* tb) {
+    assert(tb);
+    // swap the back slot with the middle slot and flag it as new
+    tb->back = thread_atomic_exchange(&tb->middle, tb->back | TRIBUF_DIRTY) & TRIBUF_INDEX_MASK;
+}
+
+bool thread_tribuf_acquire(thread_tribuf_t* tb, const uint8_t** out_slot) {
+    assert(tb && out_slot);
+    bool is_new = false;
+    if (thread_atomic_load(&tb->middle) & TRIBUF_DIRTY) {
+        // swap the front slot with the middle slot
+        tb->front = thread_atomic_exchange(&tb->middle, tb->front) & TRIBUF_INDEX_MASK;
+        is_new = true;
+    }
+    *out_slot = tb->slots[tb->front];
+    return is_new;
+}
+
+bool thread_queue_push(thread_queue_t* q, uint32_t val) {
+    assert(q);
+    const uint32_t head = q->head;
+    if ((head - thread_atomic_load(&q->tail)) >= THREAD_QUEUE_SIZE) {
+        return false;
+    }
+    q->items[head & (THREAD_QUEUE_SIZE - 1)] = val;
+    thread_atomic_store(&q->head, head + 1);
+    return true;
+}
+
+bool thread_queue_pop(thread_queue_t* q, uint32_t* out_val) {
+    assert(q && out_val);
+    const uint32_t tail = q->tail;
+    if (tail == thread_atomic_load(&q->head)) {
+        return false;
+    }
+    *out_val = q->items[tail & (THREAD_QUEUE_SIZE - 1)];
+    thread_atomic_store(&q->tail, tail + 1);
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+/*
+    Minimal threading helpers: threads, a mutex, atomics, a lock-free
+    triple buffer to hand completed frames from a producer thread to a
+    consumer thread, and a lock-free single-producer/single-consumer queue.
+
+    On platforms without threads (emscripten without pthreads),
+    thread_supported() returns false and thread_create() fails, the caller
+    is expected to fall back to running everything on the main thread.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define THREAD_QUEUE_SIZE (256)     // must be a power of 2
+
+typedef struct {
+    void* handle;
+} thread_t;
+
+typedef struct {
+    void* handle;
+} thread_mutex_t;
+
+typedef void (*thread_func_t)(void* user_data);
+
+// a lock-free triple buffer, the producer always has a free slot to write into,
+// and the consumer always gets the most recently completed slot
+typedef struct {
+    uint8_t* slots[3];
+    size_t slot_size;
+    uint32_t back;                  // producer-owned slot index
+    uint32_t front;                 // consumer-owned slot index
+    volatile uint32_t middle;       // shared slot index, bit 2 set if new data
+} thread_tribuf_t;
+
+// a lock-free single-producer/single-consumer queue of 32-bit values
+typedef struct {
+    volatile uint32_t head;         // written by producer
+    volatile uint32_t tail;         // written by consumer
+    uint32_t items[THREAD_QUEUE_SIZE];
+} thread_queue_t;
+
+// return true if threads are supported on this platform
+bool thread_supported(void);
+// create and start a thread, returns false if threads are not supported
+bool thread_create(thread_t* thread, thread_func_t func, void* user_data);
+// wait for a thread to finish
+void thread_join(thread_t* thread);
+// put the calling thread to sleep
+void thread_sleep_us(uint32_t micro_seconds);
+
+// create/destroy/lock/unlock a mutex (no-ops if threads are not supported)
+void thread_mutex_init(thread_mutex_t* mutex);
+void thread_mutex_destroy(thread_mutex_t* mutex);
+void thread_mutex_lock(thread_mutex_t* mutex);
+void thread_mutex_unlock(thread_mutex_t* mutex);
+
+// atomic load/store/exchange with acquire/release semantics
+uint32_t thread_atomic_load(const volatile uint32_t* ptr);
+void thread_atomic_store(volatile uint32_t* ptr, uint32_t val);
+uint32_t thread_atomic_exchange(volatile uint32_t* ptr, uint32_t val);
+// 64-bit atomic load/store/add (relaxed, for statistics counters)
+uint64_t thread_atomic_load64(const volatile uint64_t* ptr);
+void thread_atomic_store64(volatile uint64_t* ptr, uint64_t val);
+void thread_atomic_add64(volatile uint64_t* ptr, uint64_t val);
+
+// initialize a triple buffer with 3 slots of slot_size bytes each
+void thread_tribuf_init(thread_tribuf_t* tb, size_t slot_size);
+void thread_tribuf_discard(thread_tribuf_t* tb);
+// producer: get the slot to write the next frame into
+uint8_t* thread_tribuf_back(thread_tribuf_t* tb);
+// producer: publish the back slot
+void thread_tribuf_publish(thread_tribuf_t* tb);
+// consumer: get the most recently published slot, returns true if it's new
+bool thread_tribuf_acquire(thread_tribuf_t* tb, const uint8_t** out_slot);
+
+// producer: push a value, returns false if the queue is full
+bool thread_queue_push(thread_queue_t* q, uint32_t val);
+// consumer: pop a value, returns false if the queue is empty
+bool thread_queue_pop(thread_queue_t* q, uint32_t* out_val);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
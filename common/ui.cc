@@ -223,14 +223,21 @@ ui_texture_t ui_create_screenshot_texture(chips_display_info_t info) {
         }
     }
 
+    ui_texture_t tex = ui_create_thumbnail_texture(dst, (int) (info.portrait ? dst_h : dst_w), (int) (info.portrait ? dst_w : dst_h));
+    free(dst);
+    return tex;
+}
+
+// creates an immutable texture from already downscaled RGBA8 pixels
+ui_texture_t ui_create_thumbnail_texture(const uint32_t* pixels, int width, int height) {
+    assert(pixels && (width > 0) && (height > 0));
     sg_image_desc img_desc = {
-        .width = (int) (info.portrait ? dst_h : dst_w),
-        .height = (int) (info.portrait ? dst_w : dst_h),
+        .width = width,
+        .height = height,
         .pixel_format = SG_PIXELFORMAT_RGBA8,
     };
-    img_desc.data.subimage[0][0] = { .ptr = dst, .size = dst_num_bytes };
+    img_desc.data.subimage[0][0] = { .ptr = pixels, .size = (size_t)(width * height * 4) };
     sg_image img = sg_make_image(img_desc);
-    free(dst);
     return simgui_imtextureid_with_sampler(img, state.linear_sampler);
 }
 
@@ -34,6 +34,7 @@ ui_texture_t ui_create_texture(int w, int h);
 void ui_update_texture(ui_texture_t h, void* data, int data_byte_size);
 void ui_destroy_texture(ui_texture_t h);
 ui_texture_t ui_create_screenshot_texture(chips_display_info_t display_info);
+ui_texture_t ui_create_thumbnail_texture(const uint32_t* pixels, int width, int height);
 ui_texture_t ui_shared_empty_snapshot_texture(void);
 
 #ifdef __cplusplus
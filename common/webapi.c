@@ -5,6 +5,7 @@
 #include <emscripten/emscripten.h>
 #endif
 #include "gfx.h"
+#include "gdbstub.h"
 
 static struct {
     bool dbg_connect_requested;
@@ -193,6 +194,40 @@ EMSCRIPTEN_KEEPALIVE uint8_t* webapi_dbg_read_memory(uint16_t addr, int num_byte
     }
 }
 
+EMSCRIPTEN_KEEPALIVE uint32_t webapi_step_frames(uint32_t num_frames) {
+    if (state.inited && state.funcs.step_frames) {
+        return state.funcs.step_frames(num_frames);
+    } else {
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE void webapi_input(int port, uint32_t mask) {
+    if (state.inited && state.funcs.input) {
+        state.funcs.input(port, mask);
+    }
+}
+
+// returns heap-allocated buffer with u32 width, u32 height and RGBA8 pixels which must be freed with webapi_free()
+// NOTE: returns 0 on failure (no screenshot support, invalid size or out of memory)
+EMSCRIPTEN_KEEPALIVE uint32_t* webapi_screenshot(int max_width, int max_height) {
+    if (state.inited && state.funcs.screenshot && (max_width > 0) && (max_height > 0)) {
+        const size_t num_pixels = (size_t)max_width * (size_t)max_height;
+        uint32_t* ptr = calloc(num_pixels + 2, sizeof(uint32_t));
+        if (!ptr) {
+            return 0;
+        }
+        int width = 0, height = 0;
+        if (state.funcs.screenshot((chips_range_t){ .ptr = ptr + 2, .size = num_pixels * sizeof(uint32_t) }, &width, &height)) {
+            ptr[0] = (uint32_t)width;
+            ptr[1] = (uint32_t)height;
+            return ptr;
+        }
+        free(ptr);
+    }
+    return 0;
+}
+
 #endif // __EMSCRIPTEN__
 
 // stop_reason is UI_DBG_STOP_REASON_xxx
@@ -200,7 +235,7 @@ void webapi_event_stopped(int stop_reason, uint16_t addr) {
     #if defined(__EMSCRIPTEN__)
         webapi_js_event_stopped(stop_reason, addr);
     #else
-        (void)stop_reason; (void)addr;
+        gdbstub_event_stopped(stop_reason, addr);
     #endif
 }
 
@@ -88,6 +88,12 @@ typedef struct {
     webapi_cpu_state_t (*dbg_cpu_state)(void);
     void (*dbg_request_disassembly)(uint16_t addr, int offset_lines, int num_lines, webapi_dasm_line_t* dst_lines);
     void (*dbg_read_memory)(uint16_t addr, int num_bytes, uint8_t* dst_ptr);
+    // run num_frames frames, returns the number of completed frames (less if a breakpoint was hit)
+    uint32_t (*step_frames)(uint32_t num_frames);
+    // set the input state of a controller port (emulator-specific button mask)
+    void (*input)(int port, uint32_t mask);
+    // copy the current frame as RGBA8 pixels into dst, returns false if it doesn't fit
+    bool (*screenshot)(chips_range_t dst, int* out_width, int* out_height);
 } webapi_interface_t;
 
 typedef struct {
@@ -0,0 +1,148 @@
+/*
+    ctrlsocktest.c
+
+    Check that the control socket server (common/ctrlsock.c) answers a
+    well-formed request and drops the client when a request's length
+    prefix is out of range, including prefixes where size + 4 wraps
+    around in 32 bits.
+
+    Returns 0 if all checks passed.
+
+    Usage: ctrlsocktest
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ctrlsock.h"
+
+#if defined(__EMSCRIPTEN__) || defined(_WIN32)
+int main(void) {
+    printf("ctrlsocktest: not supported on this platform\n");
+    return 0;
+}
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static void put_u32(uint8_t* ptr, uint32_t val) {
+    ptr[0] = (uint8_t)val;
+    ptr[1] = (uint8_t)(val >> 8);
+    ptr[2] = (uint8_t)(val >> 16);
+    ptr[3] = (uint8_t)(val >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* ptr) {
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static int connect_client(const char* path) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    // don't hang if the server neither answers nor disconnects
+    const struct timeval timeout = { .tv_sec = 2 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const uint8_t* ptr, size_t num_bytes) {
+    while (num_bytes > 0) {
+        const ssize_t res = send(fd, ptr, num_bytes, 0);
+        if (res <= 0) {
+            return false;
+        }
+        ptr += res;
+        num_bytes -= (size_t)res;
+    }
+    return true;
+}
+
+// returns the number of bytes received, 0 if the server closed the connection, -1 on timeout or error
+static int recv_all(int fd, uint8_t* ptr, size_t num_bytes) {
+    size_t pos = 0;
+    while (pos < num_bytes) {
+        const ssize_t res = recv(fd, ptr + pos, num_bytes - pos, 0);
+        if (res <= 0) {
+            return (res == 0) ? (int)pos : -1;
+        }
+        pos += (size_t)res;
+    }
+    return (int)pos;
+}
+
+// a HELLO request must be answered with the protocol version
+static bool check_hello(const char* path) {
+    const int fd = connect_client(path);
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t req[9];
+    put_u32(req, 5);
+    put_u32(req + 4, 1);
+    req[8] = CTRLSOCK_CMD_HELLO;
+    uint8_t resp[10 + 12];
+    const bool ok = send_all(fd, req, sizeof(req))
+        && (recv_all(fd, resp, sizeof(resp)) == (int)sizeof(resp))
+        && (get_u32(resp + 4) == 1)
+        && (resp[9] == CTRLSOCK_STATUS_OK)
+        && (get_u32(resp + 10) == CTRLSOCK_VERSION);
+    close(fd);
+    return ok;
+}
+
+// a request with an out of range length prefix must close the connection
+static bool check_bad_size(const char* path, uint32_t size) {
+    const int fd = connect_client(path);
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t req[9];
+    put_u32(req, size);
+    put_u32(req + 4, 1);
+    req[8] = CTRLSOCK_CMD_LOAD;
+    uint8_t resp[16];
+    const bool ok = send_all(fd, req, sizeof(req)) && (recv_all(fd, resp, sizeof(resp)) == 0);
+    close(fd);
+    return ok;
+}
+
+static int num_failed;
+
+static void report(const char* name, bool ok) {
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", name);
+    if (!ok) {
+        num_failed++;
+    }
+}
+
+int main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ctrlsocktest-%d.sock", (int)getpid());
+    if (!ctrlsock_start(&(ctrlsock_desc_t){ .path = path })) {
+        printf("ctrlsocktest: failed to start the server on %s\n", path);
+        return 1;
+    }
+    report("hello", check_hello(path));
+    report("size 0xFFFFFFFC disconnects", check_bad_size(path, 0xFFFFFFFC));
+    report("size 0xFFFFFFFF disconnects", check_bad_size(path, 0xFFFFFFFF));
+    report("size > max disconnects", check_bad_size(path, CTRLSOCK_MAX_REQUEST_SIZE));
+    report("size < 5 disconnects", check_bad_size(path, 4));
+    report("hello after bad requests", check_hello(path));
+    ctrlsock_stop();
+    return (num_failed > 0) ? 1 : 0;
+}
+#endif
@@ -4,6 +4,7 @@
     NES.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #define CHIPS_IMPL
 #include "chips/chips_common.h"
@@ -12,6 +13,9 @@
 #include "chips/m6502.h"
 #include "r2c02.h"
 #include "nes.h"
+#include "nes_netplay.h"
+#include "nes_video.h"
+#include "util/m6502dasm.h"
 #if defined(CHIPS_USE_UI)
     #define UI_DBG_USE_M6502
     #include "ui.h"
@@ -24,18 +28,102 @@
     #include "ui/ui_m6502.h"
     #include "ui/ui_snapshot.h"
     #include "ui_nes.h"
-#endif
 
+// a snapshot slot, the serialized emulator state (see nes_save_state()) lives in the page store,
+// the screenshot is kept as a downscaled thumbnail until the snapshot menu is shown
 typedef struct {
-    uint32_t version;
-    nes_t nes;
+    pagestore_snapshot_t* body;     // 0 for an empty slot
+    uint32_t* thumbnail;            // pending thumbnail pixels, freed when the texture is created
+    ui_texture_t texture;           // 0 until the snapshot menu has been shown
 } nes_snapshot_t;
+#endif
+
+// a snapshot file is the framebuffer followed by the serialized emulator state
+#define SNAPSHOT_MAX_SIZE (PPU_FRAMEBUFFER_SIZE_BYTES + NES_STATE_MAX_SIZE)
+
+// max amount of time the emulator thread runs in one slice
+#define EMU_THREAD_MAX_SLICE_US (24000)
+// a completed frame handed from the emulator thread to the main thread: palette indices + per-line emphasis + frame number
+#define EMU_FRAME_SIZE_BYTES (PPU_FRAMEBUFFER_SIZE_BYTES + PPU_DISPLAY_HEIGHT + sizeof(uint32_t))
 
 static struct {
     nes_t nes;
     uint32_t frame_time_us;
     uint32_t ticks;
     double emu_time_ms;
+    volatile uint32_t pad_mask;     // host input state (NES_PAD_*), written by main thread
+    volatile uint32_t remote_pad_mask[2];   // input set through the webapi (control socket), ORed with the host input
+    // netplay=loopback: a second emulator instance acts as remote peer
+    struct {
+        bool enabled;
+        bool active;
+        uint32_t time_acc_us;
+        uint32_t rand_state;
+        uint8_t peer_pad;
+        uint32_t resim_count;           // last status.resim_count pushed into PROF_RESIM (main thread)
+        nes_netplay_loopback_desc_t loopback_desc;
+        nes_netplay_loopback_t loopback;
+        nes_netplay_t session[2];   // [0]: local session, [1]: peer session
+        nes_t peer;
+    } netplay;
+    // threaded=true (default where supported): emulation runs on its own thread
+    struct {
+        bool enabled;
+        volatile uint32_t quit;
+        thread_t thread;
+        thread_mutex_t lock;        // held while the emulator runs, and by the main thread to access state.nes
+        thread_tribuf_t frames;     // completed frames from the emulator thread
+        volatile uint32_t ticks;
+        volatile uint32_t emu_time_us;
+    } emu_thread;
+    // emulator status for the status bar, published after each emulation slice so that the
+    // main thread doesn't need the emulator lock to draw it
+    struct {
+        volatile uint32_t frame_count;
+        volatile uint32_t cart_inserted;
+        volatile uint32_t netplay_active;
+        volatile uint32_t frame_us;         // duration of a frame of the active console timing
+        volatile uint32_t rollbacks;
+        volatile uint32_t last_rollback_frames;
+        volatile uint32_t max_rollback_frames;
+        volatile uint32_t stalls;
+        volatile uint32_t resim_count;      // incremented with each new resim_us measurement
+        volatile uint32_t resim_us;         // cost of simulating one netplay frame
+    } status;
+    // streaming ROM loader, the cartridge is filled while the image file is loaded
+    struct {
+        bool active;
+        bool failed;
+        inflate_stream_t* inflate;  // only for compressed images
+    } loader;
+    // video=palette|ntsc emphasis=true|false crt=true|false: CPU-side video filter and CRT shader
+    nes_video_t video;
+    // romlib=dir[;dir...]: ROM library index, scanned in the background
+    struct {
+        bool enabled;
+        int num_supported;
+        char dirs[256];
+    } romlib;
+    // gdb=port: debugger interface (see webapi.h), served by the GDB stub on 127.0.0.1:port in native builds
+    struct {
+        bool connected;
+        volatile uint32_t stopped;
+        int num_breakpoints;
+        int step_over_addr;                 // temporary breakpoint behind a JSR (dbg_step_next), -1 if none
+        uint8_t breakpoints[0x10000 / 8];   // 1 bit per CPU address
+    } dbg;
+    // metrics=port: Prometheus metrics on http://127.0.0.1:port
+    struct {
+        int audio_queue_frames;     // capacity of the audio queue, an empty queue is an underrun
+        metrics_t frames;
+        metrics_t audio_samples;
+        metrics_t audio_underruns;
+        metrics_t audio_dropped;
+        metrics_t instances;
+        metrics_t instance_bytes;
+        metrics_t snapshot_bytes;
+        metrics_t snapshot_stored_bytes;
+    } metrics;
     #if defined(CHIPS_USE_UI)
         ui_nes_t ui;
         nes_snapshot_t snapshots[UI_SNAPSHOT_MAX_SLOTS];
@@ -46,38 +134,129 @@ static struct {
 static void ui_draw_cb(const ui_draw_info_t* draw_info);
 static bool ui_load_snapshot(size_t slot_index);
 static void ui_save_snapshot(size_t slot_index);
+static void ui_fetch_snapshot_callback(const fs_snapshot_response_t* response);
+static void ui_snapshot_menu_cb(void);
 #endif
 
 static void draw_status_bar(void);
+static void load_chunk(fs_channel_t chn, chips_range_t chunk);
+static void library_init(void);
+static void netplay_start(void);
+static void netplay_stop(void);
+static uint32_t netplay_exec(uint32_t micro_seconds);
+static void emu_thread_start(void);
+static void emu_thread_stop(void);
+static void emu_lock(void);
+static void emu_unlock(void);
+static void emu_publish_status(void);
+static chips_dim_t video_pixel_aspect(void);
+static webapi_interface_t web_api_funcs(void);
+static void dbg_breakpoint_hit(void);
 
 // audio-streaming callback
 static void push_audio(const float* samples, int num_samples, void* user_data) {
     (void)user_data;
-    saudio_push(samples, num_samples);
+    if ((state.metrics.audio_queue_frames > 0) && (saudio_expect() >= state.metrics.audio_queue_frames)) {
+        metrics_add(state.metrics.audio_underruns, 1);
+    }
+    const int num_pushed = saudio_push(samples, num_samples);
+    if (num_pushed < num_samples) {
+        metrics_add(state.metrics.audio_dropped, (uint64_t)(num_samples - num_pushed));
+    }
+    metrics_add(state.metrics.audio_samples, (uint64_t)num_samples);
+    recorder_audio(samples, num_samples);
 }
 
-static void app_init(void) {
-    saudio_setup(&(saudio_desc){
-        .logger.func = slog_func,
-    });
-    nes_init(&state.nes, &(nes_desc_t) {
+static void add_cheats(const char* codes) {
+    char code[16];
+    while (*codes) {
+        const size_t len = strcspn(codes, ",");
+        snprintf(code, sizeof(code), "%.*s", (int)len, codes);
+        nes_cheat_t cheat;
+        if (!nes_cheat_parse(code, &cheat) || !nes_add_cheat(&state.nes, cheat)) {
+            fprintf(stderr, "invalid cheat code '%s'\n", code);
+        }
+        codes += len;
+        if (*codes == ',') {
+            codes++;
+        }
+    }
+}
+
+// frame callback, streams completed frames to the recorder
+static void record_frame(const uint8_t* fb, void* user_data) {
+    (void)user_data;
+    metrics_add(state.metrics.frames, 1);
+    recorder_frame(fb);
+}
+
+// input provider, called when the game strobes the controllers (possibly on the emulator thread)
+static uint8_t host_input(int port, void* user_data) {
+    (void)user_data;
+    const uint32_t host_mask = (port == 0) ? thread_atomic_load(&state.pad_mask) : 0;
+    return (uint8_t)(host_mask | thread_atomic_load(&state.remote_pad_mask[port & 1]));
+}
+
+static nes_desc_t nes_desc(void) {
+    return (nes_desc_t) {
+        .input = { .func = host_input },
+        .frame = { .func = record_frame },
          .audio = {
             .callback = { .func = push_audio },
             .sample_rate = saudio_sample_rate(),
         },
+        // spritelimit=false: render all sprites of a scanline instead of flickering
+        .unlimited_sprites = sargs_exists("spritelimit") && !sargs_boolean("spritelimit"),
+        // region=ntsc|pal|dendy: override the console timing of the cartridge header
+        .region = sargs_equals("region", "ntsc") ? NES_REGION_NTSC :
+                  sargs_equals("region", "pal") ? NES_REGION_PAL :
+                  sargs_equals("region", "dendy") ? NES_REGION_DENDY : NES_REGION_AUTO,
         #if defined(CHIPS_USE_UI)
         .debug = ui_nes_get_debug(&state.ui)
         #endif
+    };
+}
+
+static void app_init(void) {
+    saudio_setup(&(saudio_desc){
+        .logger.func = slog_func,
+    });
+    const nes_desc_t desc = nes_desc();
+    nes_init(&state.nes, &desc);
+    thread_mutex_init(&state.emu_thread.lock);
+    nes_video_init(&state.video, &(nes_video_desc_t){
+        .filter = sargs_equals("video", "ntsc") ? NES_VIDEO_FILTER_NTSC : NES_VIDEO_FILTER_PALETTE,
+        .disable_emphasis = sargs_exists("emphasis") && !sargs_boolean("emphasis"),
     });
     gfx_init(&(gfx_desc_t){
     #ifdef CHIPS_USE_UI
     .draw_extra_cb = ui_draw,
     #endif
-    .display_info = nes_display_info(&state.nes),
+    .display_info = nes_video_process(&state.video, state.nes.fb, state.nes.fb_emphasis, state.nes.frame_count),
+    .pixel_aspect = video_pixel_aspect(),
+    .crt = sargs_boolean("crt"),
     });
     clock_init();
+    if (sargs_equals("pacing", "audio")) {
+        clock_set_pacing(CLOCK_PACING_AUDIO);
+    }
+    else if (sargs_equals("pacing", "hybrid")) {
+        clock_set_pacing(CLOCK_PACING_HYBRID);
+    }
     prof_init();
+    metrics_init();
+    state.metrics.audio_queue_frames = saudio_expect();
+    state.metrics.frames = metrics_register(METRICS_COUNTER, "nes_frames_total", "Emulated frames.");
+    state.metrics.audio_samples = metrics_register(METRICS_COUNTER, "nes_audio_samples_total", "Audio samples generated.");
+    state.metrics.audio_underruns = metrics_register(METRICS_COUNTER, "nes_audio_underruns_total", "Audio pushes which found the audio queue empty.");
+    state.metrics.audio_dropped = metrics_register(METRICS_COUNTER, "nes_audio_dropped_samples_total", "Audio samples dropped because the audio queue was full.");
+    state.metrics.instances = metrics_register(METRICS_GAUGE, "nes_instances", "Number of emulator instances.");
+    state.metrics.instance_bytes = metrics_register(METRICS_GAUGE, "nes_instance_bytes", "Memory used by the emulator instances in bytes.");
+    state.metrics.snapshot_bytes = metrics_register(METRICS_GAUGE, "nes_snapshot_bytes", "Size of the snapshots in memory in bytes.");
+    state.metrics.snapshot_stored_bytes = metrics_register(METRICS_GAUGE, "nes_snapshot_stored_bytes", "Memory used by the deduplicated snapshot pages in bytes.");
     fs_init();
+    snapshot_init();
+    pagestore_init();
 
 #ifdef CHIPS_USE_UI
     ui_init(&(ui_desc_t){
@@ -101,6 +280,7 @@ static void app_init(void) {
                 .texture = ui_shared_empty_snapshot_texture(),
             }
         },
+        .snapshot_menu_cb = ui_snapshot_menu_cb,
         .dbg_keys = {
            .cont = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F5), .name = "F5" },
            .stop = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F5), .name = "F5" },
@@ -110,26 +290,210 @@ static void app_init(void) {
            .toggle_breakpoint = { .keycode = simgui_map_keycode(SAPP_KEYCODE_F9), .name = "F9" }
        }
     });
+    // prefetch the snapshot slots in the background, so that loading a snapshot is a cheap swap-in
+    for (size_t slot = 0; slot < UI_SNAPSHOT_MAX_SLOTS; slot++) {
+        snapshot_load_async("nes", slot, ui_fetch_snapshot_callback);
+    }
 #endif
 
+    if (sargs_equals("netplay", "loopback")) {
+        state.netplay.enabled = true;
+        state.netplay.loopback_desc = (nes_netplay_loopback_desc_t){
+            .latency_us = (uint32_t)atoi(sargs_value_def("latency", "50")) * 1000,
+            .jitter_us = (uint32_t)atoi(sargs_value_def("jitter", "10")) * 1000,
+        };
+    }
+    // cheats=CODE,CODE,...: Game Genie or raw codes (see nes_cheat_parse), not with netplay
+    if (sargs_exists("cheats") && !state.netplay.enabled) {
+        add_cheats(sargs_value("cheats"));
+    }
     if (sargs_exists("file")) {
-        fs_load_file_async(FS_CHANNEL_IMAGES, sargs_value("file"));
+        fs_load_file_chunked_async(FS_CHANNEL_IMAGES, sargs_value("file"), load_chunk);
+    }
+    if (sargs_exists("romlib")) {
+        library_init();
+    }
+    if (sargs_exists("record")) {
+        const chips_display_info_t info = nes_display_info(&state.nes);
+        const bool recording = recorder_start(&(recorder_desc_t){
+            .path = sargs_value("record"),
+            .width = info.frame.dim.width,
+            .height = info.frame.dim.height,
+            .palette = (const uint32_t*)info.palette.ptr,
+            .num_colors = (int)(info.palette.size / sizeof(uint32_t)),
+            .sample_rate = saudio_sample_rate(),
+        });
+        if (!recording) {
+            fprintf(stderr, "failed to start recording to %s\n", sargs_value("record"));
+        }
+    }
+    const int num_instances = state.netplay.enabled ? 2 : 1;
+    metrics_set(state.metrics.instances, (uint64_t)num_instances);
+    metrics_set(state.metrics.instance_bytes, (uint64_t)num_instances * sizeof(nes_t));
+    if (sargs_exists("metrics")) {
+        const int port = atoi(sargs_value("metrics"));
+        if ((port <= 0) || (port > 0xFFFF) || !metrics_serve((uint16_t)port)) {
+            fprintf(stderr, "failed to start metrics server on port %s\n", sargs_value("metrics"));
+        }
+    }
+    state.dbg.step_over_addr = -1;
+    webapi_init(&(webapi_desc_t){ .funcs = web_api_funcs() });
+    // ctrl=path: automation control socket (see ctrlsock.h)
+    if (sargs_exists("ctrl")) {
+        if (state.netplay.enabled || !ctrlsock_start(&(ctrlsock_desc_t){
+            .path = sargs_value("ctrl"),
+            .shm_slot_size = PPU_DISPLAY_WIDTH * PPU_DISPLAY_HEIGHT * 4,
+            .funcs = web_api_funcs(),
+        })) {
+            fprintf(stderr, "failed to start control socket '%s'\n", sargs_value("ctrl"));
+        }
+    }
+    if (sargs_exists("gdb")) {
+        const int port = atoi(sargs_value("gdb"));
+        if (state.netplay.enabled || (port <= 0) || (port > 0xFFFF) || !gdbstub_start(&(gdbstub_desc_t){ .port = (uint16_t)port, .funcs = web_api_funcs() })) {
+            fprintf(stderr, "failed to start GDB stub on port %s\n", sargs_value("gdb"));
+        }
+    }
+    if (thread_supported() && (!sargs_exists("threaded") || sargs_boolean("threaded"))) {
+        emu_thread_start();
+    }
+    // the emulator thread is always paced by the audio device (see emu_thread_func),
+    // the main thread clock only measures the display frame time
+    if (state.emu_thread.enabled && sargs_exists("pacing")) {
+        fprintf(stderr, "pacing=%s has no effect in threaded mode\n", sargs_value("pacing"));
+        clock_set_pacing(CLOCK_PACING_VSYNC);
     }
 }
 
 static void handle_file_loading(void);
 
+// count the loadable entries of the ROM library, after the index has changed
+static void library_count_supported(void) {
+    state.romlib.num_supported = 0;
+    for (int i = 0; i < romlib_num_entries(); i++) {
+        if (romlib_entry(i)->flags & ROMLIB_FLAG_SUPPORTED) {
+            state.romlib.num_supported++;
+        }
+    }
+}
+
+// start the ROM library scanner, the index is stored in the first directory unless romindex=path is given
+static void library_init(void) {
+    romlib_desc_t desc = { .mapper_supported = nes_mapper_supported };
+    snprintf(state.romlib.dirs, sizeof(state.romlib.dirs), "%s", sargs_value("romlib"));
+    int num_dirs = 0;
+    for (char* dir = strtok(state.romlib.dirs, ";"); dir && (num_dirs < ROMLIB_MAX_DIRS); dir = strtok(0, ";")) {
+        desc.dirs[num_dirs++] = dir;
+    }
+    if (num_dirs == 0) {
+        return;
+    }
+    char index_path[1024];
+    if (sargs_exists("romindex")) {
+        snprintf(index_path, sizeof(index_path), "%s", sargs_value("romindex"));
+    }
+    else {
+        snprintf(index_path, sizeof(index_path), "%s/madnes.idx", desc.dirs[0]);
+    }
+    desc.index_path = index_path;
+    state.romlib.enabled = romlib_init(&desc);
+    library_count_supported();
+}
+
+// run the emulation for the given time, called on the main thread or the emulator thread
+static uint32_t emu_exec(uint32_t micro_seconds) {
+    if (state.loader.active) {
+        // the cartridge is incomplete while an image is loading
+        return 0;
+    }
+    else if (state.netplay.active) {
+        return netplay_exec(micro_seconds);
+    }
+    else if (thread_atomic_load(&state.dbg.stopped)) {
+        return 0;
+    }
+    else {
+        const uint32_t ticks = nes_exec(&state.nes, micro_seconds);
+        if (nes_breakpoint_hit(&state.nes)) {
+            dbg_breakpoint_hit();
+        }
+        return ticks;
+    }
+}
+
+// the NTSC filter doubles the horizontal resolution
+static chips_dim_t video_pixel_aspect(void) {
+    return (chips_dim_t){ .width = 1, .height = (state.video.filter == NES_VIDEO_FILTER_NTSC) ? NES_VIDEO_NTSC_SCALE : 1 };
+}
+
+static void video_set_filter(nes_video_filter_t filter) {
+    nes_video_set_filter(&state.video, filter);
+    gfx_set_pixel_aspect(video_pixel_aspect());
+}
+
+// RGBA display info of the most recent frame, in threaded mode the frame is taken from the triple buffer
+static chips_display_info_t emu_display_info(void) {
+    const uint8_t* fb = state.nes.fb;
+    const uint8_t* emphasis = state.nes.fb_emphasis;
+    uint32_t frame_count = state.nes.frame_count;
+    if (state.emu_thread.enabled) {
+        const uint8_t* frame;
+        thread_tribuf_acquire(&state.emu_thread.frames, &frame);
+        fb = frame;
+        emphasis = frame + PPU_FRAMEBUFFER_SIZE_BYTES;
+        memcpy(&frame_count, emphasis + PPU_DISPLAY_HEIGHT, sizeof(frame_count));
+    }
+    const uint64_t start_time = stm_now();
+    const chips_display_info_t info = nes_video_process(&state.video, fb, emphasis, frame_count);
+    prof_push(PROF_VIDEO, (float)stm_ms(stm_since(start_time)));
+    return info;
+}
+
 static void app_frame(void) {
     state.frame_time_us = clock_frame_time();
-    const uint64_t emu_start_time = stm_now();
-    state.ticks = nes_exec(&state.nes, state.frame_time_us);
-    state.emu_time_ms = stm_ms(stm_since(emu_start_time));
+    if (state.emu_thread.enabled) {
+        state.ticks = thread_atomic_load(&state.emu_thread.ticks);
+        state.emu_time_ms = (double)thread_atomic_load(&state.emu_thread.emu_time_us) * 0.001;
+    }
+    else {
+        const uint64_t emu_start_time = stm_now();
+        emu_lock();
+        state.ticks = emu_exec(state.frame_time_us);
+        emu_publish_status();
+        emu_unlock();
+        state.emu_time_ms = stm_ms(stm_since(emu_start_time));
+    }
+    // the startup time is measured from launch to the first emulated frame
+    if (thread_atomic_load(&state.status.frame_count) > 0) {
+        prof_startup_end();
+    }
     draw_status_bar();
-    gfx_draw(nes_display_info(&state.nes));
+    gfx_draw(emu_display_info());
     handle_file_loading();
+    snapshot_dowork();
+    if (romlib_update()) {
+        library_count_supported();
+    }
 }
 
 static void app_cleanup(void) {
+    ctrlsock_stop();
+    gdbstub_stop();
+    emu_thread_stop();
+    thread_mutex_destroy(&state.emu_thread.lock);
+    recorder_stop();
+    romlib_shutdown();
+    snapshot_shutdown();
+    #ifdef CHIPS_USE_UI
+        for (size_t slot = 0; slot < UI_SNAPSHOT_MAX_SLOTS; slot++) {
+            pagestore_release(state.snapshots[slot].body);
+            free(state.snapshots[slot].thumbnail);
+        }
+    #endif
+    pagestore_shutdown();
+    metrics_shutdown();
+    free(state.loader.inflate);
+    netplay_stop();
     nes_discard(&state.nes);
     #ifdef CHIPS_USE_UI
         ui_nes_discard(&state.ui);
@@ -143,6 +507,8 @@ static void app_cleanup(void) {
 static void draw_status_bar(void) {
     prof_push(PROF_EMU, (float)state.emu_time_ms);
     prof_stats_t emu_stats = prof_stats(PROF_EMU);
+    const clock_stats_t clock_st = clock_stats();
+    static const char* pacing_names[] = { "vsync", "audio", "hybrid" };
 
     const uint32_t text_color = 0xFFFFFFFF;
     const uint32_t cart_active = 0xFF00EE00;
@@ -157,7 +523,7 @@ static void draw_status_bar(void) {
 
     sdtx_puts("PAD: ");
     sdtx_font(1);
-    const uint8_t padmask = nes_pad_mask(&state.nes);
+    const uint8_t padmask = (uint8_t)state.pad_mask;
     sdtx_color1i((padmask & NES_PAD_LEFT) ? pad_active : pad_inactive);
     sdtx_putc(0x88); // arrow left
     sdtx_color1i((padmask & NES_PAD_RIGHT) ? pad_active : pad_inactive);
@@ -179,24 +545,163 @@ static void draw_status_bar(void) {
     // cartridge inserted LED
     sdtx_color1i(text_color);
     sdtx_puts(" CART: ");
-    sdtx_color1i(nes_cartridge_inserted(&state.nes) ? cart_active : cart_inactive);
+    sdtx_color1i(thread_atomic_load(&state.status.cart_inserted) ? cart_active : cart_inactive);
     sdtx_putc(0xCF);    // filled circle
 
     sdtx_font(0);
     sdtx_color1i(text_color);
     sdtx_pos(0.0f, 1.5f);
     sdtx_printf("frame:%.2fms emu:%.2fms (min:%.2fms max:%.2fms) ticks:%d", (float)state.frame_time_us * 0.001f, emu_stats.avg_val, emu_stats.min_val, emu_stats.max_val, state.ticks);
+    if (state.emu_thread.enabled) {
+        // the pacing stats only apply to emulation on the main thread
+        sdtx_printf(" thread");
+    }
+    else {
+        sdtx_printf(" %s drift:%+.2fms speed:%.3f", pacing_names[clock_st.pacing], (float)clock_st.drift_us * 0.001f, clock_st.speed);
+    }
+    const prof_stats_t video_stats = prof_stats(PROF_VIDEO);
+    sdtx_printf(" video:%s%s%s %.2fms", nes_video_filter_name(state.video.filter),
+        state.video.disable_emphasis ? "" : "+emphasis", gfx_crt() ? "+crt" : "", video_stats.avg_val);
+    sdtx_printf(" startup:%.1fms", prof_startup_ms());
+
+    if (recorder_active()) {
+        const recorder_stats_t rec_stats = recorder_stats();
+        sdtx_color1i(0xFF0000FF);
+        sdtx_printf(" REC");
+        sdtx_color1i(text_color);
+        sdtx_printf(" frames:%d dropped:%d size:%dKB", rec_stats.frames_written, rec_stats.frames_dropped, rec_stats.kbytes_written);
+    }
+
+    if (state.romlib.enabled) {
+        const romlib_status_t lib_status = romlib_status();
+        sdtx_printf(" roms:%d supported:%d", romlib_num_entries(), state.romlib.num_supported);
+        if (lib_status.scanning) {
+            sdtx_printf(" (scanning: %d found, %d parsed)", lib_status.files_found, lib_status.files_parsed);
+        }
+    }
+
+    if (thread_atomic_load(&state.status.netplay_active)) {
+        const uint32_t resim_count = thread_atomic_load(&state.status.resim_count);
+        if (resim_count != state.netplay.resim_count) {
+            state.netplay.resim_count = resim_count;
+            prof_push(PROF_RESIM, (float)thread_atomic_load(&state.status.resim_us) * 0.001f);
+        }
+        const prof_stats_t resim_stats = prof_stats(PROF_RESIM);
+        // number of frames which can be re-simulated within one NES frame
+        const int window = (resim_stats.avg_val > 0.0f) ? (int)((thread_atomic_load(&state.status.frame_us) * 0.001f) / resim_stats.avg_val) : 0;
+        sdtx_pos(0.0f, 2.5f);
+        sdtx_printf("netplay: rollbacks:%d last:%d max:%d stalls:%d resim:%.3fms/frame window:%d frames",
+            thread_atomic_load(&state.status.rollbacks), thread_atomic_load(&state.status.last_rollback_frames),
+            thread_atomic_load(&state.status.max_rollback_frames), thread_atomic_load(&state.status.stalls),
+            resim_stats.avg_val, window);
+    }
+}
+
+// pass decompressed image data to the cartridge slot(s)
+static bool loader_output(const uint8_t* data, size_t size, void* user_data) {
+    (void)user_data;
+    bool ok = nes_insert_cart_feed(&state.nes, data, size);
+    if (state.netplay.enabled) {
+        ok &= nes_insert_cart_feed(&state.netplay.peer, data, size);
+    }
+    return ok;
+}
+
+// start streaming a new image, the emulator is paused until loader_end()
+static void loader_begin(void) {
+    emu_lock();
+    free(state.loader.inflate);
+    state.loader.inflate = 0;
+    state.loader.active = true;
+    state.loader.failed = false;
+    netplay_stop();
+    if (state.netplay.enabled) {
+        // both instances must start from exactly the same state
+        const nes_desc_t desc = nes_desc();
+        nes_init(&state.nes, &desc);
+        nes_init(&state.netplay.peer, &(nes_desc_t){ .audio.sample_rate = desc.audio.sample_rate, .region = desc.region });
+        nes_insert_cart_begin(&state.netplay.peer);
+    }
+    nes_insert_cart_begin(&state.nes);
+    static const char* compressed_exts[] = { "gz", "zip" };
+    for (size_t i = 0; i < sizeof(compressed_exts) / sizeof(compressed_exts[0]); i++) {
+        inflate_format_t format;
+        if (fs_ext(FS_CHANNEL_IMAGES, compressed_exts[i]) && inflate_format_from_ext(compressed_exts[i], &format)) {
+            state.loader.inflate = (inflate_stream_t*) calloc(1, sizeof(inflate_stream_t));
+            inflate_stream_init(state.loader.inflate, &(inflate_desc_t){
+                .format = format,
+                .output = loader_output,
+                .zip_ext = "nes",
+            });
+        }
+    }
+    if (!state.loader.inflate && !fs_ext(FS_CHANNEL_IMAGES, "nes")) {
+        state.loader.failed = true;
+    }
+    emu_unlock();
+}
+
+static void loader_feed(chips_range_t chunk) {
+    emu_lock();
+    if (!state.loader.failed) {
+        if (state.loader.inflate) {
+            state.loader.failed = INFLATE_RESULT_ERROR == inflate_stream_feed(state.loader.inflate, chunk.ptr, chunk.size);
+        }
+        else {
+            state.loader.failed = !loader_output(chunk.ptr, chunk.size, 0);
+        }
+    }
+    emu_unlock();
+}
+
+// finish loading, activates the cartridge and resumes the emulator, returns false on error
+static bool loader_end(bool ok) {
+    if (!state.loader.active) {
+        return false;
+    }
+    emu_lock();
+    ok = ok && !state.loader.failed;
+    if (ok && state.loader.inflate) {
+        ok = inflate_stream_done(state.loader.inflate);
+    }
+    ok = ok && nes_insert_cart_end(&state.nes);
+    if (state.netplay.enabled) {
+        ok = ok && nes_insert_cart_end(&state.netplay.peer);
+    }
+    if (ok) {
+        if (state.netplay.enabled) {
+            netplay_start();
+        }
+    }
+    else {
+        nes_remove_cartridge(&state.nes);
+    }
+    free(state.loader.inflate);
+    state.loader.inflate = 0;
+    state.loader.active = false;
+    emu_unlock();
+    return ok;
+}
+
+// chunk callback of the image loading channel, called from fs_dowork()
+static void load_chunk(fs_channel_t chn, chips_range_t chunk) {
+    (void)chn;
+    if (!state.loader.active) {
+        loader_begin();
+    }
+    loader_feed(chunk);
 }
 
 static void handle_file_loading(void) {
     fs_dowork();
     const uint32_t load_delay_frames = 120;
-    if (fs_success(FS_CHANNEL_IMAGES) && clock_frame_count_60hz() > load_delay_frames) {
-
-        bool load_success = false;
-        if (fs_ext(FS_CHANNEL_IMAGES, "nes")) {
-            load_success = nes_insert_cart(&state.nes, fs_data(FS_CHANNEL_IMAGES));
-        }
+    if (fs_failed(FS_CHANNEL_IMAGES)) {
+        loader_end(false);
+        gfx_flash_error();
+        fs_reset(FS_CHANNEL_IMAGES);
+    }
+    else if (fs_success(FS_CHANNEL_IMAGES) && clock_frame_count_60hz() > load_delay_frames) {
+        const bool load_success = loader_end(true);
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
                 gfx_flash_success();
@@ -212,7 +717,7 @@ static void handle_file_loading(void) {
 void app_input(const sapp_event* event) {
     // accept dropped files also when ImGui grabs input
     if (event->type == SAPP_EVENTTYPE_FILES_DROPPED) {
-        fs_load_dropped_file_async(FS_CHANNEL_IMAGES);
+        fs_load_dropped_file_chunked_async(FS_CHANNEL_IMAGES, load_chunk);
     }
 #ifdef CHIPS_USE_UI
     if (ui_input(event)) {
@@ -223,25 +728,44 @@ void app_input(const sapp_event* event) {
     switch (event->type) {
         case SAPP_EVENTTYPE_KEY_DOWN:
         case SAPP_EVENTTYPE_KEY_UP: {
-            int c;
+            // F2: toggle NTSC filter, F3: toggle CRT shader, F4: toggle color emphasis
+            if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && !event->key_repeat) {
+                switch (event->key_code) {
+                    case SAPP_KEYCODE_F2:
+                        video_set_filter((state.video.filter == NES_VIDEO_FILTER_NTSC) ? NES_VIDEO_FILTER_PALETTE : NES_VIDEO_FILTER_NTSC);
+                        break;
+                    case SAPP_KEYCODE_F3:
+                        gfx_set_crt(!gfx_crt());
+                        break;
+                    case SAPP_KEYCODE_F4:
+                        nes_video_set_emphasis(&state.video, state.video.disable_emphasis);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            uint32_t mask;
             switch (event->key_code) {
-                case SAPP_KEYCODE_LEFT:         c = 0x01; break;
-                case SAPP_KEYCODE_RIGHT:        c = 0x02; break;
-                case SAPP_KEYCODE_DOWN:         c = 0x03; break;
-                case SAPP_KEYCODE_UP:           c = 0x04; break;
-                case SAPP_KEYCODE_ENTER:        c = 0x05; break;
-                case SAPP_KEYCODE_F:            c = 0x06; break;
-                case SAPP_KEYCODE_D:            c = 0x07; break;
-                case SAPP_KEYCODE_S:            c = 0x08; break;
-                default:                        c = 0x00; break;
+                case SAPP_KEYCODE_LEFT:         mask = NES_PAD_LEFT; break;
+                case SAPP_KEYCODE_RIGHT:        mask = NES_PAD_RIGHT; break;
+                case SAPP_KEYCODE_DOWN:         mask = NES_PAD_DOWN; break;
+                case SAPP_KEYCODE_UP:           mask = NES_PAD_UP; break;
+                case SAPP_KEYCODE_ENTER:        mask = NES_PAD_START; break;
+                case SAPP_KEYCODE_F:            mask = NES_PAD_A; break;
+                case SAPP_KEYCODE_D:            mask = NES_PAD_B; break;
+                case SAPP_KEYCODE_S:            mask = NES_PAD_SEL; break;
+                default:                        mask = 0; break;
             }
-            if (c) {
+            // the host input state is latched by the emulator when the game strobes the pad
+            if (mask) {
+                uint32_t pad_mask = state.pad_mask;
                 if (event->type == SAPP_EVENTTYPE_KEY_DOWN) {
-                    nes_key_down(&state.nes, c);
+                    pad_mask |= mask;
                 }
                 else {
-                    nes_key_up(&state.nes, c);
+                    pad_mask &= ~mask;
                 }
+                thread_atomic_store(&state.pad_mask, pad_mask);
             }
             break;
         default:
@@ -250,41 +774,578 @@ void app_input(const sapp_event* event) {
     }
 }
 
+// start a loopback netplay session, the peer instance runs the same cartridge as player 2,
+// both instances have been initialized and loaded by the ROM loader
+static void netplay_start(void) {
+    nes_netplay_loopback_init(&state.netplay.loopback, &state.netplay.loopback_desc);
+    for (int i = 0; i < 2; i++) {
+        nes_netplay_init(&state.netplay.session[i], &(nes_netplay_desc_t){
+            .nes = (i == 0) ? &state.nes : &state.netplay.peer,
+            .local_player = i,
+            .transport = nes_netplay_loopback_transport(&state.netplay.loopback, i),
+        });
+    }
+    state.netplay.time_acc_us = 0;
+    state.netplay.rand_state = 0x2545F491;
+    state.netplay.peer_pad = 0;
+    state.netplay.active = true;
+}
+
+static void netplay_stop(void) {
+    if (state.netplay.active) {
+        nes_netplay_discard(&state.netplay.session[0]);
+        nes_netplay_discard(&state.netplay.session[1]);
+        nes_discard(&state.netplay.peer);
+        state.netplay.active = false;
+    }
+}
+
+// pseudo-random peer input which changes a few times per second, so that
+// predictions fail and rollbacks actually happen
+static uint8_t netplay_peer_pad(void) {
+    uint32_t x = state.netplay.rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state.netplay.rand_state = x;
+    if ((x & 15) == 0) {
+        state.netplay.peer_pad = (uint8_t)(x >> 8);
+    }
+    return state.netplay.peer_pad;
+}
+
+// run netplay sessions in whole NES frames of the cartridge's console timing
+static uint32_t netplay_exec(uint32_t micro_seconds) {
+    const uint32_t frame_us = nes_frame_us(&state.nes);
+    state.netplay.time_acc_us += micro_seconds;
+    while (state.netplay.time_acc_us >= frame_us) {
+        state.netplay.time_acc_us -= frame_us;
+        nes_netplay_loopback_advance(&state.netplay.loopback, frame_us);
+
+        const uint32_t resim_frames = state.netplay.session[0].stats.resim_frames;
+        const uint64_t start_time = stm_now();
+        const bool advanced = nes_netplay_advance(&state.netplay.session[0], (uint8_t)thread_atomic_load(&state.pad_mask));
+        const double elapsed_ms = stm_ms(stm_since(start_time));
+        // cost of simulating one frame, including re-simulated frames
+        const uint32_t num_frames = (advanced ? 1 : 0) + state.netplay.session[0].stats.resim_frames - resim_frames;
+        if (num_frames > 0) {
+            thread_atomic_store(&state.status.resim_us, (uint32_t)((elapsed_ms * 1000.0) / num_frames));
+            thread_atomic_store(&state.status.resim_count, thread_atomic_load(&state.status.resim_count) + 1);
+        }
+        nes_netplay_advance(&state.netplay.session[1], netplay_peer_pad());
+    }
+    // individual ticks are not tracked in netplay mode
+    return 0;
+}
+
+// the lock exists in non-threaded mode too, the webapi functions are called from the GDB stub and control socket threads
+static void emu_lock(void) {
+    thread_mutex_lock(&state.emu_thread.lock);
+}
+
+static void emu_unlock(void) {
+    thread_mutex_unlock(&state.emu_thread.lock);
+}
+
+// publish the status bar values, called with the emulator lock held after each emulation slice
+static void emu_publish_status(void) {
+    thread_atomic_store(&state.status.frame_count, state.nes.frame_count);
+    thread_atomic_store(&state.status.cart_inserted, nes_cartridge_inserted(&state.nes) ? 1 : 0);
+    thread_atomic_store(&state.status.netplay_active, state.netplay.active ? 1 : 0);
+    thread_atomic_store(&state.status.frame_us, nes_frame_us(&state.nes));
+    if (state.netplay.active) {
+        const nes_netplay_stats_t np_stats = nes_netplay_stats(&state.netplay.session[0]);
+        thread_atomic_store(&state.status.rollbacks, np_stats.rollbacks);
+        thread_atomic_store(&state.status.last_rollback_frames, np_stats.last_rollback_frames);
+        thread_atomic_store(&state.status.max_rollback_frames, np_stats.max_rollback_frames);
+        thread_atomic_store(&state.status.stalls, np_stats.stalls);
+    }
+}
+
+// hand the current frame to the main thread (threaded mode only, called with the emulator lock held)
+static void emu_publish_frame(void) {
+    uint8_t* frame = thread_tribuf_back(&state.emu_thread.frames);
+    memcpy(frame, state.nes.fb, PPU_FRAMEBUFFER_SIZE_BYTES);
+    memcpy(frame + PPU_FRAMEBUFFER_SIZE_BYTES, state.nes.fb_emphasis, PPU_DISPLAY_HEIGHT);
+    memcpy(frame + PPU_FRAMEBUFFER_SIZE_BYTES + PPU_DISPLAY_HEIGHT, &state.nes.frame_count, sizeof(uint32_t));
+    thread_tribuf_publish(&state.emu_thread.frames);
+}
+
+// the emulator thread, paced by the audio device (or the wall clock if there's no audio)
+static void emu_thread_func(void* user_data) {
+    (void)user_data;
+    uint64_t lap_time = 0;
+    while (!thread_atomic_load(&state.emu_thread.quit)) {
+        uint32_t micro_seconds;
+        if (saudio_isvalid()) {
+            // emulate as much time as fits into the audio buffer
+            micro_seconds = (uint32_t)(((uint64_t)saudio_expect() * 1000000) / (uint64_t)saudio_sample_rate());
+        }
+        else {
+            micro_seconds = (uint32_t)stm_us(stm_laptime(&lap_time));
+        }
+        if (micro_seconds > EMU_THREAD_MAX_SLICE_US) {
+            micro_seconds = EMU_THREAD_MAX_SLICE_US;
+        }
+        if (micro_seconds >= 1000) {
+            thread_mutex_lock(&state.emu_thread.lock);
+            const uint32_t frame_count = state.nes.frame_count;
+            const uint64_t start_time = stm_now();
+            thread_atomic_store(&state.emu_thread.ticks, emu_exec(micro_seconds));
+            thread_atomic_store(&state.emu_thread.emu_time_us, (uint32_t)stm_us(stm_since(start_time)));
+            if (frame_count != state.nes.frame_count) {
+                emu_publish_frame();
+            }
+            emu_publish_status();
+            thread_mutex_unlock(&state.emu_thread.lock);
+        }
+        // give debugger and cartridge operations waiting for the lock a chance to grab it
+        thread_sleep_us(1000);
+    }
+}
+
+static void emu_thread_start(void) {
+    thread_tribuf_init(&state.emu_thread.frames, EMU_FRAME_SIZE_BYTES);
+    state.emu_thread.quit = 0;
+    state.emu_thread.enabled = thread_create(&state.emu_thread.thread, emu_thread_func, 0);
+    if (!state.emu_thread.enabled) {
+        thread_tribuf_discard(&state.emu_thread.frames);
+    }
+}
+
+static void emu_thread_stop(void) {
+    if (state.emu_thread.enabled) {
+        thread_atomic_store(&state.emu_thread.quit, 1);
+        thread_join(&state.emu_thread.thread);
+        thread_tribuf_discard(&state.emu_thread.frames);
+        state.emu_thread.enabled = false;
+    }
+}
+
+// debugger interface (see webapi.h), these functions are called from the GDB stub and control socket threads
+static void dbg_update_breakpoints(void) {
+    const bool active = (state.dbg.num_breakpoints > 0) || (state.dbg.step_over_addr >= 0);
+    nes_set_breakpoints(&state.nes, active ? state.dbg.breakpoints : 0);
+}
+
+static bool dbg_test_breakpoint(uint16_t addr) {
+    return 0 != (state.dbg.breakpoints[addr >> 3] & (1 << (addr & 7)));
+}
+
+static void dbg_set_breakpoint(uint16_t addr, bool enabled) {
+    if (enabled) {
+        state.dbg.breakpoints[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+    }
+    else {
+        state.dbg.breakpoints[addr >> 3] &= (uint8_t)~(1 << (addr & 7));
+    }
+}
+
+static void dbg_clear_step_over(void) {
+    if (state.dbg.step_over_addr >= 0) {
+        dbg_set_breakpoint((uint16_t)state.dbg.step_over_addr, false);
+        state.dbg.step_over_addr = -1;
+        dbg_update_breakpoints();
+    }
+}
+
+static void dbg_stop(int stop_reason) {
+    thread_atomic_store(&state.dbg.stopped, 1);
+    webapi_event_stopped(stop_reason, m6502_pc(&state.nes.cpu));
+}
+
+// called from emu_exec() with the emulator lock held
+static void dbg_breakpoint_hit(void) {
+    const uint16_t pc = m6502_pc(&state.nes.cpu);
+    const bool step_over_done = (state.dbg.step_over_addr == (int)pc);
+    dbg_clear_step_over();
+    dbg_stop(step_over_done ? WEBAPI_STOPREASON_STEP : WEBAPI_STOPREASON_BREAKPOINT);
+}
+
+static void web_dbg_connect(void) {
+    emu_lock();
+    state.dbg.connected = true;
+    dbg_stop(WEBAPI_STOPREASON_BREAK);
+    emu_unlock();
+}
+
+static void web_dbg_disconnect(void) {
+    emu_lock();
+    state.dbg.connected = false;
+    memset(state.dbg.breakpoints, 0, sizeof(state.dbg.breakpoints));
+    state.dbg.num_breakpoints = 0;
+    state.dbg.step_over_addr = -1;
+    dbg_update_breakpoints();
+    thread_atomic_store(&state.dbg.stopped, 0);
+    webapi_event_continued();
+    emu_unlock();
+}
+
+static void web_dbg_add_breakpoint(uint16_t addr) {
+    emu_lock();
+    // a pending step-over breakpoint at the same address becomes a regular one
+    if (state.dbg.step_over_addr == (int)addr) {
+        state.dbg.step_over_addr = -1;
+    }
+    if (!dbg_test_breakpoint(addr)) {
+        dbg_set_breakpoint(addr, true);
+        state.dbg.num_breakpoints++;
+    }
+    dbg_update_breakpoints();
+    emu_unlock();
+}
+
+static void web_dbg_remove_breakpoint(uint16_t addr) {
+    emu_lock();
+    if (dbg_test_breakpoint(addr) && (state.dbg.step_over_addr != (int)addr)) {
+        dbg_set_breakpoint(addr, false);
+        state.dbg.num_breakpoints--;
+    }
+    dbg_update_breakpoints();
+    emu_unlock();
+}
+
+static void web_dbg_break(void) {
+    emu_lock();
+    if (!thread_atomic_load(&state.dbg.stopped)) {
+        dbg_clear_step_over();
+        dbg_stop(WEBAPI_STOPREASON_BREAK);
+    }
+    emu_unlock();
+}
+
+static void web_dbg_continue(void) {
+    emu_lock();
+    thread_atomic_store(&state.dbg.stopped, 0);
+    webapi_event_continued();
+    emu_unlock();
+}
+
+static void web_dbg_step_into(void) {
+    emu_lock();
+    nes_step(&state.nes);
+    dbg_stop(WEBAPI_STOPREASON_STEP);
+    emu_unlock();
+}
+
+// step over subroutine calls by running to a temporary breakpoint behind the JSR
+static void web_dbg_step_next(void) {
+    emu_lock();
+    const uint16_t pc = m6502_pc(&state.nes.cpu);
+    const uint16_t next_pc = (uint16_t)(pc + 3);
+    if ((nes_mem_read(&state.nes, pc, true) == 0x20) && !dbg_test_breakpoint(next_pc)) {
+        dbg_set_breakpoint(next_pc, true);
+        state.dbg.step_over_addr = next_pc;
+        dbg_update_breakpoints();
+        thread_atomic_store(&state.dbg.stopped, 0);
+        webapi_event_continued();
+    }
+    else {
+        nes_step(&state.nes);
+        dbg_stop(WEBAPI_STOPREASON_STEP);
+    }
+    emu_unlock();
+}
+
+static webapi_cpu_state_t web_dbg_cpu_state(void) {
+    emu_lock();
+    m6502_t* cpu = &state.nes.cpu;
+    const webapi_cpu_state_t res = {
+        .items = {
+            [WEBAPI_CPUSTATE_TYPE] = WEBAPI_CPUTYPE_6502,
+            [WEBAPI_CPUSTATE_6502_A] = m6502_a(cpu),
+            [WEBAPI_CPUSTATE_6502_X] = m6502_x(cpu),
+            [WEBAPI_CPUSTATE_6502_Y] = m6502_y(cpu),
+            [WEBAPI_CPUSTATE_6502_S] = m6502_s(cpu),
+            [WEBAPI_CPUSTATE_6502_P] = m6502_p(cpu),
+            [WEBAPI_CPUSTATE_6502_PC] = m6502_pc(cpu),
+        }
+    };
+    emu_unlock();
+    return res;
+}
+
+typedef struct {
+    uint16_t addr;
+    webapi_dasm_line_t* line;
+} dbg_dasm_t;
+
+static uint8_t dbg_dasm_in(void* user_data) {
+    dbg_dasm_t* dasm = (dbg_dasm_t*)user_data;
+    const uint8_t val = nes_mem_read(&state.nes, dasm->addr++, true);
+    if (dasm->line && (dasm->line->num_bytes < WEBAPI_DASM_LINE_MAX_BYTES)) {
+        dasm->line->bytes[dasm->line->num_bytes++] = val;
+    }
+    return val;
+}
+
+static void dbg_dasm_out(char c, void* user_data) {
+    dbg_dasm_t* dasm = (dbg_dasm_t*)user_data;
+    if (dasm->line && (dasm->line->num_chars < WEBAPI_DASM_LINE_MAX_CHARS)) {
+        dasm->line->chars[dasm->line->num_chars++] = c;
+    }
+}
+
+// disassemble one instruction, returns the address of the next instruction
+static uint16_t dbg_dasm_op(uint16_t addr, webapi_dasm_line_t* line) {
+    dbg_dasm_t dasm = { .addr = addr, .line = line };
+    if (line) {
+        memset(line, 0, sizeof(webapi_dasm_line_t));
+        line->addr = addr;
+    }
+    return m6502dasm_op(addr, dbg_dasm_in, dbg_dasm_out, &dasm);
+}
+
+// find an address offset_lines instructions before addr (instructions have 1 to 3 bytes,
+// look for a start address from which disassembling forward lands exactly on addr)
+static uint16_t dbg_dasm_backward(uint16_t addr, int offset_lines) {
+    for (int start_offset = offset_lines * 3; start_offset >= offset_lines; start_offset--) {
+        uint16_t lines_addr[3 * 64];
+        int num_lines = 0;
+        const uint16_t start = (uint16_t)(addr - start_offset);
+        uint16_t cur = start;
+        while ((uint16_t)(cur - start) < start_offset) {
+            lines_addr[num_lines++] = cur;
+            cur = dbg_dasm_op(cur, 0);
+        }
+        if ((cur == addr) && (num_lines >= offset_lines)) {
+            return lines_addr[num_lines - offset_lines];
+        }
+    }
+    return (uint16_t)(addr - offset_lines);
+}
+
+static void web_dbg_request_disassembly(uint16_t addr, int offset_lines, int num_lines, webapi_dasm_line_t* dst_lines) {
+    emu_lock();
+    if (offset_lines < 0) {
+        addr = dbg_dasm_backward(addr, (-offset_lines > 64) ? 64 : -offset_lines);
+    }
+    else {
+        for (int i = 0; i < offset_lines; i++) {
+            addr = dbg_dasm_op(addr, 0);
+        }
+    }
+    for (int i = 0; i < num_lines; i++) {
+        addr = dbg_dasm_op(addr, &dst_lines[i]);
+    }
+    emu_unlock();
+}
+
+static void web_dbg_read_memory(uint16_t addr, int num_bytes, uint8_t* dst_ptr) {
+    emu_lock();
+    for (int i = 0; i < num_bytes; i++) {
+        dst_ptr[i] = nes_mem_read(&state.nes, (uint16_t)(addr + i), true);
+    }
+    emu_unlock();
+}
+
+static void web_reset(void) {
+    emu_lock();
+    nes_reset(&state.nes);
+    emu_unlock();
+}
+
+// a webapi file is an iNES image behind a webapi_fileheader_t with type 'NES '
+static bool web_load(chips_range_t data) {
+    const webapi_fileheader_t* hdr = (const webapi_fileheader_t*)data.ptr;
+    if ((hdr->type[0] != 'N') || (hdr->type[1] != 'E') || (hdr->type[2] != 'S') || (hdr->type[3] != ' ')) {
+        return false;
+    }
+    emu_lock();
+    bool ok = false;
+    if (!state.loader.active && !state.netplay.enabled) {
+        ok = nes_insert_cart(&state.nes, (chips_range_t){ .ptr = (void*)hdr->payload, .size = data.size - sizeof(webapi_fileheader_t) });
+        if (ok && (hdr->flags & WEBAPI_FILEHEADER_FLAG_STOPONENTRY)) {
+            dbg_stop(WEBAPI_STOPREASON_ENTRY);
+        }
+    }
+    emu_unlock();
+    return ok;
+}
+
+// run whole frames, also while the debugger has stopped the emulator
+static uint32_t web_step_frames(uint32_t num_frames) {
+    emu_lock();
+    uint32_t frame = 0;
+    if (!state.loader.active && !state.netplay.enabled) {
+        for (; frame < num_frames; frame++) {
+            nes_exec_frame(&state.nes);
+            if (nes_breakpoint_hit(&state.nes)) {
+                dbg_breakpoint_hit();
+                break;
+            }
+        }
+        if (state.emu_thread.enabled && (frame > 0)) {
+            emu_publish_frame();
+        }
+    }
+    emu_unlock();
+    return frame;
+}
+
+static void web_input(int port, uint32_t mask) {
+    if ((port >= 0) && (port < 2)) {
+        thread_atomic_store(&state.remote_pad_mask[port], mask);
+    }
+}
+
+// palette-converted current frame (without video filter, the filter state belongs to the main thread)
+static bool web_screenshot(chips_range_t dst, int* out_width, int* out_height) {
+    emu_lock();
+    const chips_display_info_t info = nes_display_info(&state.nes);
+    const int width = info.frame.dim.width;
+    const int height = info.frame.dim.height;
+    const bool fits = dst.size >= (size_t)(width * height) * sizeof(uint32_t);
+    if (fits) {
+        const uint8_t* src = (const uint8_t*)info.frame.buffer.ptr;
+        const uint32_t* palette = (const uint32_t*)info.palette.ptr;
+        const size_t num_colors = info.palette.size / sizeof(uint32_t);
+        uint32_t* pixels = (uint32_t*)dst.ptr;
+        for (int i = 0; i < width * height; i++) {
+            pixels[i] = palette[src[i] % num_colors];
+        }
+        *out_width = width;
+        *out_height = height;
+    }
+    emu_unlock();
+    return fits;
+}
+
+static bool web_ready(void) {
+    emu_lock();
+    const bool ready = !state.loader.active && nes_cartridge_inserted(&state.nes);
+    emu_unlock();
+    return ready;
+}
+
+static webapi_interface_t web_api_funcs(void) {
+    return (webapi_interface_t){
+        .boot = web_reset,
+        .reset = web_reset,
+        .ready = web_ready,
+        .load = web_load,
+        .dbg_connect = web_dbg_connect,
+        .dbg_disconnect = web_dbg_disconnect,
+        .dbg_add_breakpoint = web_dbg_add_breakpoint,
+        .dbg_remove_breakpoint = web_dbg_remove_breakpoint,
+        .dbg_break = web_dbg_break,
+        .dbg_continue = web_dbg_continue,
+        .dbg_step_next = web_dbg_step_next,
+        .dbg_step_into = web_dbg_step_into,
+        .dbg_cpu_state = web_dbg_cpu_state,
+        .dbg_request_disassembly = web_dbg_request_disassembly,
+        .dbg_read_memory = web_dbg_read_memory,
+        .step_frames = web_step_frames,
+        .input = web_input,
+        .screenshot = web_screenshot,
+    };
+}
+
 #if defined(CHIPS_USE_UI)
 static void ui_draw_cb(const ui_draw_info_t* draw_info) {
+    // the debug windows and menus inspect and modify the emulator state directly, with
+    // everything closed only the menu bar is drawn and the emulator thread keeps running
+    const bool active = ui_nes_is_active(&state.ui);
+    if (active) {
+        emu_lock();
+    }
     ui_nes_draw(&state.ui, &(ui_nes_frame_t){
         .display = draw_info->display,
     });
+    if (active) {
+        emu_unlock();
+    }
 }
 
-static void ui_update_snapshot_screenshot(size_t slot) {
-    ui_snapshot_screenshot_t screenshot = {
-        .texture = ui_create_screenshot_texture(nes_display_info(&state.snapshots[slot].nes))
-    };
-    ui_snapshot_screenshot_t prev_screenshot = ui_snapshot_set_screenshot(&state.ui.snapshot, slot, screenshot);
-    if (prev_screenshot.texture) {
-        ui_destroy_texture(prev_screenshot.texture);
+// scratch buffer for assembling and restoring a snapshot slot
+static uint8_t ui_snapshot_buf[SNAPSHOT_MAX_SIZE];
+
+// put a snapshot into its slot: the state goes into the page store with the RAM sections
+// starting on their own pages, the texture is only created from the thumbnail when the snapshot
+// menu is shown, until then the slot shows the empty slot icon
+static void ui_store_snapshot(size_t slot, const uint8_t* fb, const uint8_t* emphasis, const uint8_t* data, size_t size) {
+    nes_snapshot_t* snapshot = &state.snapshots[slot];
+    chips_range_t sections[PAGESTORE_MAX_SECTIONS];
+    const int num_sections = nes_state_split(data, size, PAGESTORE_PAGE_SIZE, sections, PAGESTORE_MAX_SECTIONS);
+    pagestore_release(snapshot->body);
+    snapshot->body = pagestore_put(sections, num_sections);
+    if (!snapshot->thumbnail) {
+        snapshot->thumbnail = (uint32_t*)malloc(NES_VIDEO_THUMBNAIL_WIDTH * NES_VIDEO_THUMBNAIL_HEIGHT * sizeof(uint32_t));
+    }
+    // without a thumbnail the slot keeps showing the empty slot icon
+    if (snapshot->thumbnail) {
+        nes_video_thumbnail(&state.video, fb, emphasis, snapshot->thumbnail);
+    }
+    if (snapshot->texture) {
+        ui_destroy_texture(snapshot->texture);
+        snapshot->texture = 0;
+    }
+    // this marks the slot as valid
+    ui_snapshot_set_screenshot(&state.ui.snapshot, slot, (ui_snapshot_screenshot_t){
+        .texture = ui_shared_empty_snapshot_texture(),
+    });
+    const pagestore_stats_t stats = pagestore_stats();
+    metrics_set(state.metrics.snapshot_bytes, stats.snapshot_bytes);
+    metrics_set(state.metrics.snapshot_stored_bytes, stats.stored_bytes);
+}
+
+// called by the UI when the snapshot menu is shown, creates the pending thumbnail textures
+static void ui_snapshot_menu_cb(void) {
+    for (size_t slot = 0; slot < UI_SNAPSHOT_MAX_SLOTS; slot++) {
+        nes_snapshot_t* snapshot = &state.snapshots[slot];
+        if (snapshot->thumbnail) {
+            snapshot->texture = ui_create_thumbnail_texture(snapshot->thumbnail, NES_VIDEO_THUMBNAIL_WIDTH, NES_VIDEO_THUMBNAIL_HEIGHT);
+            ui_snapshot_set_screenshot(&state.ui.snapshot, slot, (ui_snapshot_screenshot_t){ .texture = snapshot->texture });
+            free(snapshot->thumbnail);
+            snapshot->thumbnail = 0;
+        }
     }
 }
 
 static bool ui_load_snapshot(size_t slot) {
     bool success = false;
-    if ((slot < UI_SNAPSHOT_MAX_SLOTS) && (state.ui.snapshot.slots[slot].valid)) {
-        success = nes_load_snapshot(&state.nes, state.snapshots[slot].version, &state.snapshots[slot].nes);
+    if ((slot < UI_SNAPSHOT_MAX_SLOTS) && (state.ui.snapshot.slots[slot].valid) && state.snapshots[slot].body) {
+        const size_t size = pagestore_get(state.snapshots[slot].body, ui_snapshot_buf, sizeof(ui_snapshot_buf));
+        success = (size > 0) && nes_load_state(&state.nes, ui_snapshot_buf, size);
     }
     return success;
 }
 
+// compression and writing the file happen on the snapshot worker thread
 static void ui_save_snapshot(size_t slot) {
     if (slot < UI_SNAPSHOT_MAX_SLOTS) {
-        state.snapshots[slot].version = nes_save_snapshot(&state.nes, &state.snapshots[slot].nes);
-        ui_update_snapshot_screenshot(slot);
-        fs_save_snapshot("nes", slot, (chips_range_t){ .ptr = &state.snapshots[slot], sizeof(nes_snapshot_t) });
+        uint8_t* data = ui_snapshot_buf + PPU_FRAMEBUFFER_SIZE_BYTES;
+        const size_t state_size = nes_save_state(&state.nes, data, NES_STATE_MAX_SIZE);
+        if (state_size == 0) {
+            return;
+        }
+        memcpy(ui_snapshot_buf, state.nes.fb, PPU_FRAMEBUFFER_SIZE_BYTES);
+        ui_store_snapshot(slot, state.nes.fb, state.nes.fb_emphasis, data, state_size);
+        snapshot_save_async("nes", slot, (chips_range_t){ .ptr = ui_snapshot_buf, .size = PPU_FRAMEBUFFER_SIZE_BYTES + state_size }, 0);
+    }
+}
+
+// called from snapshot_dowork() with the decompressed file content of a prefetched slot
+static void ui_fetch_snapshot_callback(const fs_snapshot_response_t* response) {
+    if (response->result != FS_RESULT_SUCCESS) {
+        return;
+    }
+    const size_t slot = response->snapshot_index;
+    if ((slot >= UI_SNAPSHOT_MAX_SLOTS) || (state.ui.snapshot.slots[slot].valid)) {
+        // don't overwrite a slot which has been saved in the meantime
+        return;
+    }
+    if ((response->data.size <= PPU_FRAMEBUFFER_SIZE_BYTES) || (response->data.size > SNAPSHOT_MAX_SIZE)) {
+        return;
     }
+    // the emphasis bits aren't stored in the file
+    const uint8_t* ptr = (const uint8_t*)response->data.ptr;
+    ui_store_snapshot(slot, ptr, 0, ptr + PPU_FRAMEBUFFER_SIZE_BYTES, response->data.size - PPU_FRAMEBUFFER_SIZE_BYTES);
 }
 #endif
 
 sapp_desc sokol_main(int argc, char* argv[]) {
+    prof_startup_begin();
     sargs_setup(&(sargs_desc){ .argc=argc, .argv=argv });
     return (sapp_desc) {
         .init_cb = app_init,
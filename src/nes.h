@@ -28,8 +28,11 @@
     ## Warning
 
     This emulator is not fully implemented:
-        - PAL, Dendy not implemented
-        - only mappers 0, 1, 2, 3, 7 & 66 are implemented
+        - PAL and Dendy only differ in timing (CPU clock, PPU/CPU ratio, frame height,
+          APU frame sequencer), the PAL noise period table is not implemented
+        - only mappers 0, 1, 2, 3, 7, 19, 24, 26, 66 & 69 are implemented
+        - expansion audio: VRC6 (pulses and saw), Namco 163 (wavetable channels) and
+          Sunsoft 5B (tone channels only, the envelope and noise generators are not implemented)
         - audio is limited to pulses 1 & 2 and noise channels (triangle and DMC channels are not implemented)
         - only the standard NES controller is supported
 
@@ -65,9 +68,21 @@ extern "C" {
 #define NES_DEFAULT_AUDIO_SAMPLE_RATE (44100)
 #define NES_DEFAULT_AUDIO_SAMPLES (128)     // default number of samples in internal sample buffer
 #define NES_MAX_AUDIO_SAMPLES (1024)        // max number of audio samples in internal sample buffer
+#define NES_MAX_AUDIO_CHANNELS (8)          // max number of expansion audio channels of a cartridge
+#define NES_BLIP_TAPS (16)                  // length of the band-limited step kernel in samples
+#define NES_BLIP_PHASES (32)                // sub-sample resolution of the band-limited step kernel
+#define NES_BLIP_BUFFER_SIZE (NES_MAX_AUDIO_SAMPLES * 2 + NES_BLIP_TAPS)
 
 // bump when nes_t memory layout changes
-#define NES_SNAPSHOT_VERSION (0x0001)
+#define NES_SNAPSHOT_VERSION (0x0005)
+
+// serialized state format (see nes_save_state()), only bumped on incompatible changes
+#define NES_STATE_VERSION (1)
+// max size of a serialized state
+#define NES_STATE_MAX_SIZE (32 * 1024)
+
+// max number of active cheat codes
+#define NES_MAX_CHEATS (32)
 
 // pad mask bits
 #define NES_PAD_RIGHT (1<<0)
@@ -97,10 +112,41 @@ typedef struct {
     uint8_t reserved_1[7];
 } nes_cartridge_header;
 
+// TV system / console timing (see nes_desc_t.region)
+typedef enum {
+    NES_REGION_AUTO,        // from the cartridge header (NES 2.0 or iNES flags 9), NTSC if not specified
+    NES_REGION_NTSC,        // 1.79 MHz, 262 lines, 3 PPU dots per CPU cycle
+    NES_REGION_PAL,         // 1.66 MHz, 312 lines, 3.2 PPU dots per CPU cycle
+    NES_REGION_DENDY,       // 1.77 MHz, 312 lines, 3 PPU dots per CPU cycle
+    NES_NUM_REGIONS,
+} nes_region_t;
+
+// input provider callback, returns the current pad mask (NES_PAD_*) of controller port 0 or 1
+typedef uint8_t (*nes_input_func_t)(int port, void* user_data);
+
+typedef struct {
+    nes_input_func_t func;
+    void* user_data;
+} nes_input_provider_t;
+
+// frame callback, called when the PPU has completed a frame with the palette-indexed framebuffer
+typedef struct {
+    void (*func)(const uint8_t* fb, void* user_data);
+    void* user_data;
+} nes_frame_callback_t;
+
 // configuration parameters for nes_init()
 typedef struct {
     chips_audio_desc_t audio;
     chips_debug_t debug;
+    // optional, called when the game strobes the controllers, overrides nes_pad()/nes_key_down()
+    nes_input_provider_t input;
+    // optional, called for each completed frame
+    nes_frame_callback_t frame;
+    // render more than 8 sprites per scanline (reduces flicker, the sprite overflow flag is unaffected)
+    bool unlimited_sprites;
+    // console timing, default is NES_REGION_AUTO
+    nes_region_t region;
 } nes_desc_t;
 
 typedef union {
@@ -123,6 +169,7 @@ typedef enum {
     FourScreen  = 8,
     OneScreenLower,
     OneScreenHigher,
+    NameTableBanks,     // the mapper selects each nametable page (see _nes_n163_name_tables)
 } name_table_mirroring_t;
 
 typedef struct {
@@ -130,6 +177,13 @@ typedef struct {
     void (*write_prg)(uint16_t address, uint8_t value, void* user_data);
     uint8_t (*read_chr)(uint16_t address, void* user_data);
     void (*write_chr)(uint16_t addr, uint8_t data, void* user_data);
+    // $4020-$5FFF, read_only: a debugger peek, which must not have side effects
+    uint8_t (*read_exp)(uint16_t address, bool read_only, void* user_data);
+    void (*write_exp)(uint16_t address, uint8_t value, void* user_data);
+    // called once apu.clock_counter reaches irq_clock, so mapper IRQ counters cost nothing per tick
+    void (*irq_event)(void* user_data);
+    uint32_t irq_clock;
+    bool irq;                   // state of the IRQ line
 
     union {
         struct {
@@ -156,10 +210,82 @@ typedef struct {
             uint8_t prg_bank;
             uint8_t chr_bank;
         } data66;
+        struct {
+            uint8_t chr_bank[12];       // $8000-$B800: 1KB pattern pages, $C000-$D800: nametable pages
+            uint8_t prg_bank[3];        // $E000, $E800, $F000: 8KB pages at $8000, $A000, $C000
+            uint8_t sound_disable;      // $E000 bit 6
+            uint16_t irq_counter;       // $5000/$5800, bit 15: enable, at irq_base_clock
+            uint32_t irq_base_clock;
+            uint8_t audio_addr;         // $F800, bit 7: auto increment
+            uint8_t audio_ram[128];     // wavetables and channel registers
+        } data19;
+        struct {
+            uint8_t prg_bank16;         // $8000: 16KB page at $8000
+            uint8_t prg_bank8;          // $C000: 8KB page at $C000
+            uint8_t chr_bank[8];        // $D000-$E003: 1KB pages
+            uint8_t ppu_ctrl;           // $B003
+            uint8_t irq_latch;          // $F000
+            uint8_t irq_ctrl;           // $F001
+            uint8_t irq_counter;        // at irq_base_clock
+            int16_t irq_prescaler;      // at irq_base_clock
+            uint32_t irq_base_clock;
+            uint8_t pulse[2][3];        // $9000-$9002, $A000-$A002
+            uint8_t saw[3];             // $B000-$B002
+            uint8_t freq_ctrl;          // $9003
+            bool swap_a0_a1;            // mapper 26
+        } data24;
+        struct {
+            uint8_t command;            // $8000
+            uint8_t chr_bank[8];        // commands 0-7: 1KB pages
+            uint8_t prg_bank[4];        // commands 8-B: 8KB pages at $6000 (unused), $8000, $A000, $C000
+            uint8_t irq_ctrl;           // command D
+            uint16_t irq_counter;       // commands E/F, at irq_base_clock
+            uint32_t irq_base_clock;
+            uint8_t audio_addr;         // $C000
+            uint8_t audio_regs[16];     // $E000
+        } data69;
     };
     name_table_mirroring_t mirroring;
 } nes_mapper_t;
 
+/*
+    A cheat code: addresses in PRG-ROM ($8000..$FFFF) patch the value the
+    CPU reads (optionally only if the ROM contains the compare value, as
+    8-letter Game Genie codes do), addresses in RAM ($0000..$07FF) or
+    cartridge RAM ($6000..$7FFF) are frozen to the value once per frame.
+*/
+typedef struct {
+    uint16_t addr;
+    uint8_t value;
+    uint8_t compare;
+    bool has_compare;
+} nes_cheat_t;
+
+/*
+    An expansion audio channel (see _nes_exp_audio_add_channel), run()
+    synthesizes the waveform from clock up to end_clock and reports the
+    level changes with _nes_exp_audio_level().
+*/
+typedef struct {
+    void (*run)(void* user_data, int index, uint32_t end_clock);
+    uint32_t clock;             // CPU clock the channel has been synthesized up to
+    uint32_t timer;             // cycles until the next waveform step
+    uint32_t phase;             // position in the waveform
+    uint32_t accum;             // VRC6 saw accumulator
+    float level;                // current output level
+} nes_audio_channel_t;
+
+// band-limited step buffer of the expansion audio channels
+typedef struct {
+    uint64_t factor;            // output samples per CPU clock, 32.32 fixed point
+    uint64_t offset;            // position of frame_clock in the buffer, 32.32 fixed point
+    uint32_t frame_clock;       // CPU clock at offset
+    float integrator;
+    float dc_in;                // DC blocker state
+    float dc_out;
+    float buf[NES_BLIP_BUFFER_SIZE];
+} nes_blip_t;
+
 typedef struct {
     uint16_t timer;
     uint16_t reload;
@@ -197,6 +323,7 @@ typedef struct {
 typedef struct {
     uint32_t clock_counter;
     uint32_t frame_clock_counter;
+    uint8_t frame_counter;          // last $4017 write: bit 7 selects the 5-step sequence, bit 6 inhibits the (not emulated) frame IRQ
     double global_time;
     double audio_time;
     double audio_time_per_system_sample;
@@ -223,44 +350,91 @@ typedef struct {
     } noise;
 } apu_t;
 
-// NES emulator state
-typedef struct {
-    m6502_t cpu;
-    r2c02_t ppu;
-    uint16_t dma_wait;
-
-    chips_debug_t debug;
-
-    uint8_t ram[0x800];             // 2KB
-    uint8_t extended_ram[0x2000];   // 8KB
-
-    uint8_t ppu_ram[0x1000];        // 4KB
-    uint8_t ppu_pal_ram[0x20];      // 32B
-    uint16_t ppu_name_table[4];
+/*
+    NES emulator state
 
-    struct {
-        nes_cartridge_header header;
-        nes_mapper_t mapper;
-        uint8_t character_ram[0x20000]; // 128KB
-        uint8_t rom[0x40000];           // 256KB
-    } cart;
+    The layout is split by access frequency: the state which is touched on
+    every tick (CPU, mapper, APU, PPU registers) comes first and occupies a
+    few contiguous cache lines, followed by the per-scanline PPU tables (OAM,
+    sprite buckets, emphasis), the cheats, the memory arrays and the bulk data
+    (cartridge, picture buffers), each aligned to a cache line.
 
+    Everything up to cart.rom is the mutable emulator state, the PRG-ROM,
+    picture buffers and framebuffer at the end are not (see nes_netplay.h).
+*/
+typedef struct {
+    // hot: accessed on every tick
+    alignas(64) m6502_t cpu;
+    uint64_t pins;
+    uint16_t dma_wait;
+    uint32_t frame_count;           // number of completed PPU frames
+    nes_region_t region;            // active timing (never NES_REGION_AUTO)
+    nes_region_t region_select;     // requested timing (see nes_set_region)
+    uint8_t ppu_phase;              // PAL: CPU cycle within a group of 5 (16 PPU dots)
+    bool valid;
+    bool breakpoint_hit;            // set when nes_exec() stopped at a breakpoint
+    const uint8_t* breakpoints;     // optional breakpoint bitmap (see nes_set_breakpoints)
+    nes_mapper_t mapper;
+    apu_t apu;
     struct {
         uint32_t sample_rate;
         chips_audio_callback_t callback;
         int num_samples;
         int sample_pos;
-        float sample_buffer[NES_MAX_AUDIO_SAMPLES];
     } audio;
-    apu_t apu;
-
+    uint8_t ppu_pal_ram[0x20];      // 32B
+    uint32_t ppu_name_table[4];     // byte offsets of the nametable pages at $2000, $2400, $2800, $2C00 in nes_t (see _nes_mirroring)
     controller_t controller[2];
     uint8_t controller_state[2];
+    nes_input_provider_t input;
+    nes_frame_callback_t frame;
+    chips_debug_t debug;
+    // the PPU comes last, the per-dot registers are at the start of r2c02_t and
+    // its OAM, emphasis and sprite bucket tables end the hot state
+    r2c02_t ppu;
 
-    uint64_t pins;
-    bool valid;
+    // active cheats (see nes_add_cheat), PRG-ROM patches are applied by wrapping
+    // mapper.read_prg, which is only done while a patch exists
+    struct {
+        uint8_t (*read_prg)(uint16_t address, void* user_data);    // the wrapped mapper function
+        uint32_t prg_pages;         // bit n set: the 1KB page at $8000 + n * $400 is patched
+        int num_cheats;
+        int num_freezes;
+        nes_cheat_t cheats[NES_MAX_CHEATS];
+    } cheats;
+
+    // memory
+    alignas(64) uint8_t ram[0x800];             // 2KB
+    alignas(64) uint8_t ppu_ram[PPU_RAM_SIZE];  // 2KB nametable RAM (CIRAM)
+    alignas(64) uint8_t extended_ram[0x2000];   // 8KB
+    alignas(64) float audio_samples[NES_MAX_AUDIO_SAMPLES];
+
+    // expansion audio of the cartridge, mixed into audio_samples once per sample packet
+    struct {
+        int num_channels;
+        nes_audio_channel_t channels[NES_MAX_AUDIO_CHANNELS];
+        alignas(64) nes_blip_t blip;
+    } exp_audio;
+
+    // streaming cartridge loader state (see nes_insert_cart_begin)
+    struct {
+        size_t offset;                  // number of bytes received so far
+        bool failed;
+        uint8_t header[sizeof(nes_cartridge_header)];
+    } cart_loader;
 
+    // cold bulk data
+    struct {
+        nes_cartridge_header header;
+        uint32_t checksum;                          // checksum of the PRG and CHR data
+        alignas(64) uint8_t four_screen_ram[0x800]; // 2KB, the extra nametables of four-screen cartridges
+        alignas(64) uint8_t character_ram[0x20000]; // 128KB
+        alignas(64) uint8_t rom[0x40000];           // 256KB, must be the last member (see above)
+    } cart;
+    alignas(64) float blip_kernel[NES_BLIP_PHASES][NES_BLIP_TAPS];    // band-limited step, see _nes_blip_init()
+    alignas(64) uint8_t picture_buffer[PPU_FRAMEBUFFER_SIZE_BYTES];   // rendered by the PPU
     alignas(64) uint8_t fb[PPU_FRAMEBUFFER_SIZE_BYTES];
+    uint8_t fb_emphasis[PPU_DISPLAY_HEIGHT];    // color emphasis bits of each line in fb (see nes_video.h)
 } nes_t;
 
 // initialize a new NES instance
@@ -273,16 +447,58 @@ void nes_discard(nes_t* nes);
 chips_display_info_t nes_display_info(nes_t* nes);
 // run NES instance for given amount of micro_seconds, returns number of ticks executed
 uint32_t nes_exec(nes_t* nes, uint32_t micro_seconds);
+// select the console timing, NES_REGION_AUTO uses the cartridge header
+void nes_set_region(nes_t* nes, nes_region_t region);
+// get the active console timing
+nes_region_t nes_region(nes_t* nes);
+// get the CPU clock frequency in Hz of the active console timing
+uint32_t nes_cpu_frequency(nes_t* nes);
+// get the duration of a frame in micro seconds of the active console timing
+uint32_t nes_frame_us(nes_t* nes);
+// run NES instance until the PPU has completed the current frame, returns number of ticks executed
+uint32_t nes_exec_frame(nes_t* nes);
+// run NES instance until the next instruction fetch (completes the current instruction), returns number of ticks executed
+uint32_t nes_step(nes_t* nes);
+// set a breakpoint bitmap (1 bit per CPU address, bit (addr & 7) of byte (addr >> 3)), or nullptr to remove it,
+// nes_exec() and nes_exec_frame() stop at the opcode fetch of an instruction at a marked address
+void nes_set_breakpoints(nes_t* nes, const uint8_t* bitmap);
+// return true if the last nes_exec()/nes_exec_frame() call stopped at a breakpoint (clears the flag)
+bool nes_breakpoint_hit(nes_t* nes);
 void nes_key_down(nes_t* nes, int value);
 void nes_key_up(nes_t* nes, int value);
 // set pad mask (combination of NES_PAD_*)
 void nes_pad(nes_t* sys, uint8_t mask);
 // get current pad bitmask state
 uint8_t nes_pad_mask(nes_t* sys);
+// set pad mask of controller port 0 or 1 (combination of NES_PAD_*)
+void nes_pad_port(nes_t* sys, int port, uint8_t mask);
 // return true if a cartridge is currently inserted
 bool nes_cartridge_inserted(nes_t* nes);
 // remove current cartridge
 void nes_remove_cartridge(nes_t* nes);
+// insert a cartridge from a complete iNES image
+bool nes_insert_cart(nes_t* nes, chips_range_t data);
+// start streaming an iNES image into the cartridge slot (removes the current cartridge)
+void nes_insert_cart_begin(nes_t* nes);
+// feed the next chunk of an iNES image, returns false if the image is invalid
+bool nes_insert_cart_feed(nes_t* nes, const uint8_t* data, size_t size);
+// finish streaming an iNES image, activates the mapper and resets the NES, returns false on error
+bool nes_insert_cart_end(nes_t* nes);
+// return true if the given iNES mapper number is supported
+bool nes_mapper_supported(uint8_t mapper_num);
+// serialize the emulator state into a buffer, returns the number of bytes written, or 0 if the buffer is too small
+size_t nes_save_state(nes_t* nes, uint8_t* buf, size_t buf_size);
+// restore a serialized state, the same cartridge must be inserted, returns false if the state is invalid
+bool nes_load_state(nes_t* nes, const uint8_t* buf, size_t size);
+// split a serialized state into consecutive ranges, a new range starts at the payload of each section with at least
+// min_size bytes (e.g. to align the RAM sections to the pages of a deduplicating store), returns the number of ranges
+int nes_state_split(const uint8_t* buf, size_t size, size_t min_size, chips_range_t* out_ranges, int max_ranges);
+// decode a 6- or 8-letter Game Genie code, or a raw code 'AAAA:VV' or 'AAAA?CC:VV' (hex), returns false if invalid
+bool nes_cheat_parse(const char* str, nes_cheat_t* out_cheat);
+// activate a cheat (stays active across cartridge changes), returns false if the address can't be patched or the table is full
+bool nes_add_cheat(nes_t* nes, nes_cheat_t cheat);
+// deactivate all cheats
+void nes_clear_cheats(nes_t* nes);
 
 uint8_t nes_ppu_read(nes_t* nes, uint16_t addr);
 void nes_ppu_write(nes_t* nes, uint16_t address, uint8_t data);
@@ -301,7 +517,29 @@ void nes_mem_write(nes_t* sys, uint16_t addr, uint8_t data);
     #define CHIPS_ASSERT(c) assert(c)
 #endif
 
-#define _NES_FREQUENCY            (1789773)              // clock frequency in Hz
+#if defined(_MSC_VER)
+    #define _NES_FORCE_INLINE __forceinline
+#else
+    #define _NES_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/*
+    Timing of the console variants. The per-tick code takes the region as
+    a parameter and is force-inlined into one instance per region (see
+    _NES_INSTANTIATE_REGION), so all lookups in this table fold into
+    constants and NTSC runs the same code as before PAL and Dendy existed.
+*/
+typedef struct {
+    uint32_t cpu_frequency;         // CPU clock in Hz
+    uint32_t frame_us;              // duration of a frame in micro seconds (rounded up)
+    uint16_t apu_frame_steps[5];    // APU frame sequencer steps, in APU cycles (2 CPU cycles), the last one ends the 5-step sequence
+} _nes_timing_t;
+
+static const _nes_timing_t _nes_timing[NES_NUM_REGIONS] = {
+    [NES_REGION_NTSC]  = { .cpu_frequency = 1789773, .frame_us = 16640, .apu_frame_steps = { 3729, 7457, 11186, 14916, 18641 } },
+    [NES_REGION_PAL]   = { .cpu_frequency = 1662607, .frame_us = 19998, .apu_frame_steps = { 4157, 8313, 12469, 16626, 20783 } },
+    [NES_REGION_DENDY] = { .cpu_frequency = 1773448, .frame_us = 19998, .apu_frame_steps = { 3729, 7457, 11186, 14916, 18641 } },
+};
 
 #define _PPUCTRL    (0x2000)
 #define _PPUMASK    (0x2001)
@@ -322,9 +560,25 @@ static const uint8_t length_table[] = {
 static uint8_t _ppu_read(uint16_t addr, void* user_data);
 static void _ppu_write(uint16_t address, uint8_t data, void* user_data);
 static void _ppu_set_pixels(uint8_t* buffer, void* user_data);
-static uint64_t _nes_tick(nes_t* sys, uint64_t pins);
+static uint64_t _nes_tick_ntsc(nes_t* sys, uint64_t pins);
+static uint64_t _nes_tick_pal(nes_t* sys, uint64_t pins);
+static uint64_t _nes_tick_dendy(nes_t* sys, uint64_t pins);
+static uint32_t _nes_dma_stall_ntsc(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame);
+static uint32_t _nes_dma_stall_pal(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame);
+static uint32_t _nes_dma_stall_dendy(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame);
+static void _nes_oam_dma(nes_t* sys, uint8_t page);
 static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num);
+static void _nes_install_cheats(nes_t* sys);
+static void _nes_update_region(nes_t* sys);
 static void _nes_mirroring(nes_t* sys);
+static uint32_t _nes_name_table_page(int page);
+static void _nes_blip_init(nes_t* sys);
+static void _nes_blip_reset(nes_t* sys);
+static void _nes_exp_audio_mix(nes_t* sys);
+static void _apu_frame_clock(apu_t* sys, bool half_frame_clock);
+static uint8_t _nes_read_exp0(uint16_t addr, bool read_only, void* user_data);
+static void _nes_write_exp0(uint16_t addr, uint8_t value, void* user_data);
+static void _nes_irq_none(void* user_data);
 
 static uint8_t _nes_read_prg0(uint16_t addr, void* user_data);
 static void _nes_write_prg0(uint16_t addr, uint8_t value, void* user_data);
@@ -351,6 +605,28 @@ static uint8_t _nes_read_prg66(uint16_t addr, void* user_data);
 static void _nes_write_prg66(uint16_t addr, uint8_t value, void* user_data);
 static uint8_t _nes_read_chr66(uint16_t addr, void* user_data);
 
+static uint8_t _nes_read_prg19(uint16_t addr, void* user_data);
+static void _nes_write_prg19(uint16_t addr, uint8_t value, void* user_data);
+static uint8_t _nes_read_chr19(uint16_t addr, void* user_data);
+static uint8_t _nes_read_exp19(uint16_t addr, bool read_only, void* user_data);
+static void _nes_write_exp19(uint16_t addr, uint8_t value, void* user_data);
+static void _nes_irq19(void* user_data);
+static void _nes_run_n163(void* user_data, int index, uint32_t end_clock);
+static void _nes_n163_name_tables(nes_t* sys);
+
+static uint8_t _nes_read_prg24(uint16_t addr, void* user_data);
+static void _nes_write_prg24(uint16_t addr, uint8_t value, void* user_data);
+static uint8_t _nes_read_chr24(uint16_t addr, void* user_data);
+static void _nes_irq24(void* user_data);
+static void _nes_run_vrc6_pulse(void* user_data, int index, uint32_t end_clock);
+static void _nes_run_vrc6_saw(void* user_data, int index, uint32_t end_clock);
+
+static uint8_t _nes_read_prg69(uint16_t addr, void* user_data);
+static void _nes_write_prg69(uint16_t addr, uint8_t value, void* user_data);
+static uint8_t _nes_read_chr69(uint16_t addr, void* user_data);
+static void _nes_irq69(void* user_data);
+static void _nes_run_5b(void* user_data, int index, uint32_t end_clock);
+
 uint8_t nes_ppu_read(nes_t* nes, uint16_t address) {
     return _ppu_read(address, nes);
 }
@@ -367,12 +643,15 @@ void nes_init(nes_t* sys, const nes_desc_t* desc) {
     memset(sys, 0, sizeof(nes_t));
     sys->valid = true;
     sys->debug = desc->debug;
+    sys->input = desc->input;
+    sys->frame = desc->frame;
     sys->audio.callback = desc->audio.callback;
     sys->audio.num_samples = _NES_DEFAULT(desc->audio.num_samples, NES_DEFAULT_AUDIO_SAMPLES);
     sys->audio.sample_rate = _NES_DEFAULT(desc->audio.sample_rate, NES_DEFAULT_AUDIO_SAMPLE_RATE);
     CHIPS_ASSERT(sys->audio.num_samples <= NES_MAX_AUDIO_SAMPLES);
  	sys->apu.audio_time_per_system_sample = 1.0 / (double)sys->audio.sample_rate;
-	sys->apu.audio_time_per_nes_clock = 1.0 / (double)_NES_FREQUENCY; // APU Clock Frequency
+    sys->region_select = desc->region;
+    _nes_blip_init(sys);
 
     // initialize the CPU
     sys->pins = m6502_init(&sys->cpu, &(m6502_desc_t){
@@ -384,8 +663,11 @@ void nes_init(nes_t* sys, const nes_desc_t* desc) {
         .write = _ppu_write,
         .set_pixels = _ppu_set_pixels,
         .user_data = sys,
+        .framebuffer = { .ptr = sys->picture_buffer, .size = sizeof(sys->picture_buffer) },
+        .unlimited_sprites = desc->unlimited_sprites,
     });
     _nes_use_mapper(sys, 0);
+    _nes_update_region(sys);
 }
 
 bool nes_cartridge_inserted(nes_t* sys) {
@@ -403,6 +685,7 @@ void nes_remove_cartridge(nes_t* sys) {
     memset(&sys->ppu_pal_ram, 0, sizeof(sys->ppu_pal_ram));
     memset(&sys->ppu_name_table, 0, sizeof(sys->ppu_name_table));
     _nes_use_mapper(sys, 0);
+    _nes_update_region(sys);
     nes_reset(sys);
 }
 
@@ -418,26 +701,181 @@ void nes_reset(nes_t* sys) {
     r2c02_reset(&sys->ppu);
 }
 
-uint32_t nes_exec(nes_t* sys, uint32_t micro_seconds) {
-    CHIPS_ASSERT(sys && sys->valid);
-    const uint32_t num_ticks = clk_us_to_ticks(_NES_FREQUENCY, micro_seconds);
+// check if the CPU is fetching an opcode at an address marked in the breakpoint bitmap
+static inline bool _nes_at_breakpoint(const uint8_t* breakpoints, uint64_t pins) {
+    if (pins & M6502_SYNC) {
+        const uint16_t addr = M6502_GET_ADDR(pins);
+        return 0 != (breakpoints[addr >> 3] & (1 << (addr & 7)));
+    }
+    return false;
+}
+
+// select the region instance of the per-tick functions, the region is a constant in all callers but nes_step()
+static _NES_FORCE_INLINE uint64_t _nes_tick(nes_t* sys, uint64_t pins, const nes_region_t region) {
+    switch (region) {
+        case NES_REGION_PAL:    return _nes_tick_pal(sys, pins);
+        case NES_REGION_DENDY:  return _nes_tick_dendy(sys, pins);
+        default:                return _nes_tick_ntsc(sys, pins);
+    }
+}
+
+static _NES_FORCE_INLINE uint32_t _nes_dma_stall(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame, const nes_region_t region) {
+    switch (region) {
+        case NES_REGION_PAL:    return _nes_dma_stall_pal(sys, pins, max_ticks, stop_at_frame);
+        case NES_REGION_DENDY:  return _nes_dma_stall_dendy(sys, pins, max_ticks, stop_at_frame);
+        default:                return _nes_dma_stall_ntsc(sys, pins, max_ticks, stop_at_frame);
+    }
+}
+
+static _NES_FORCE_INLINE uint32_t _nes_exec(nes_t* sys, uint32_t micro_seconds, const nes_region_t region) {
+    const uint32_t num_ticks = clk_us_to_ticks(_nes_timing[region].cpu_frequency, micro_seconds);
+    const uint8_t* breakpoints = sys->breakpoints;
     uint64_t pins = sys->pins;
+    uint32_t tick = 0;
     if (0 == sys->debug.callback.func) {
-        // run without debug hook
-        for (uint32_t tick = 0; tick < num_ticks; tick++) {
-            pins = _nes_tick(sys, pins);
+        // run without debug hook, OAM DMA stalls are run as one block
+        while (tick < num_ticks) {
+            if (sys->dma_wait) {
+                tick += _nes_dma_stall(sys, pins, num_ticks - tick, false, region);
+            }
+            else {
+                pins = _nes_tick(sys, pins, region);
+                tick++;
+                if (breakpoints && _nes_at_breakpoint(breakpoints, pins)) {
+                    sys->breakpoint_hit = true;
+                    break;
+                }
+            }
         }
     } else {
         // run with debug hook
-        for (uint32_t tick = 0; (tick < num_ticks) && !(*sys->debug.stopped); tick++) {
-            pins = _nes_tick(sys, pins);
+        for (; (tick < num_ticks) && !(*sys->debug.stopped); tick++) {
+            pins = _nes_tick(sys, pins, region);
             sys->debug.callback.func(sys->debug.callback.user_data, pins);
+            if (breakpoints && _nes_at_breakpoint(breakpoints, pins)) {
+                sys->breakpoint_hit = true;
+                tick++;
+                break;
+            }
+        }
+    }
+    sys->pins = pins;
+    return tick;
+}
+
+uint32_t nes_exec(nes_t* sys, uint32_t micro_seconds) {
+    CHIPS_ASSERT(sys && sys->valid);
+    switch (sys->region) {
+        case NES_REGION_PAL:    return _nes_exec(sys, micro_seconds, NES_REGION_PAL);
+        case NES_REGION_DENDY:  return _nes_exec(sys, micro_seconds, NES_REGION_DENDY);
+        default:                return _nes_exec(sys, micro_seconds, NES_REGION_NTSC);
+    }
+}
+
+static _NES_FORCE_INLINE uint32_t _nes_exec_frame(nes_t* sys, const nes_region_t region) {
+    const uint32_t frame_count = sys->frame_count;
+    const uint8_t* breakpoints = sys->breakpoints;
+    uint32_t num_ticks = 0;
+    uint64_t pins = sys->pins;
+    while (frame_count == sys->frame_count) {
+        if (sys->dma_wait) {
+            num_ticks += _nes_dma_stall(sys, pins, sys->dma_wait, true, region);
         }
+        else {
+            pins = _nes_tick(sys, pins, region);
+            num_ticks++;
+            if (breakpoints && _nes_at_breakpoint(breakpoints, pins)) {
+                sys->breakpoint_hit = true;
+                break;
+            }
+        }
+    }
+    sys->pins = pins;
+    return num_ticks;
+}
+
+uint32_t nes_exec_frame(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    switch (sys->region) {
+        case NES_REGION_PAL:    return _nes_exec_frame(sys, NES_REGION_PAL);
+        case NES_REGION_DENDY:  return _nes_exec_frame(sys, NES_REGION_DENDY);
+        default:                return _nes_exec_frame(sys, NES_REGION_NTSC);
     }
+}
+
+uint32_t nes_step(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    // give up after one frame in case the CPU is jammed
+    const uint32_t max_ticks = clk_us_to_ticks(_nes_timing[sys->region].cpu_frequency, _nes_timing[sys->region].frame_us);
+    uint64_t pins = sys->pins;
+    uint32_t num_ticks = 0;
+    do {
+        pins = _nes_tick(sys, pins, sys->region);
+        num_ticks++;
+        if (sys->debug.callback.func) {
+            sys->debug.callback.func(sys->debug.callback.user_data, pins);
+        }
+    } while (!(pins & M6502_SYNC) && (num_ticks < max_ticks));
     sys->pins = pins;
     return num_ticks;
 }
 
+// NES 2.0 byte 12, or iNES flags 9 if bytes 12 to 15 are clear (older dumps may have garbage in bytes 7 to 15)
+static nes_region_t _nes_cart_region(const nes_cartridge_header* hdr) {
+    if ((hdr->reserved_0 & 0x0C) == 0x08) {
+        switch (hdr->reserved_1[3] & 3) {
+            case 1:     return NES_REGION_PAL;
+            case 3:     return NES_REGION_DENDY;
+            default:    return NES_REGION_NTSC;     // NTSC or multi-region
+        }
+    }
+    const bool clean = (hdr->reserved_1[3] | hdr->reserved_1[4] | hdr->reserved_1[5] | hdr->reserved_1[6]) == 0;
+    return (clean && (hdr->reserved_1[0] & 1)) ? NES_REGION_PAL : NES_REGION_NTSC;
+}
+
+static void _nes_update_region(nes_t* sys) {
+    const nes_region_t region = (sys->region_select != NES_REGION_AUTO) ? sys->region_select : _nes_cart_region(&sys->cart.header);
+    CHIPS_ASSERT((region > NES_REGION_AUTO) && (region < NES_NUM_REGIONS));
+    sys->region = region;
+    sys->ppu_phase = 0;
+    sys->apu.audio_time_per_nes_clock = 1.0 / (double)_nes_timing[region].cpu_frequency;
+    sys->exp_audio.blip.factor = ((uint64_t)sys->audio.sample_rate << 32) / _nes_timing[region].cpu_frequency;
+}
+
+void nes_set_region(nes_t* sys, nes_region_t region) {
+    CHIPS_ASSERT(sys && sys->valid);
+    CHIPS_ASSERT((region >= NES_REGION_AUTO) && (region < NES_NUM_REGIONS));
+    sys->region_select = region;
+    _nes_update_region(sys);
+}
+
+nes_region_t nes_region(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    return sys->region;
+}
+
+uint32_t nes_cpu_frequency(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    return _nes_timing[sys->region].cpu_frequency;
+}
+
+uint32_t nes_frame_us(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    return _nes_timing[sys->region].frame_us;
+}
+
+void nes_set_breakpoints(nes_t* sys, const uint8_t* bitmap) {
+    CHIPS_ASSERT(sys && sys->valid);
+    sys->breakpoints = bitmap;
+}
+
+bool nes_breakpoint_hit(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    const bool hit = sys->breakpoint_hit;
+    sys->breakpoint_hit = false;
+    return hit;
+}
+
 void nes_key_down(nes_t* sys, int value) {
     switch(value) {
         case 1: sys->controller[0].left =   1; break;
@@ -474,6 +912,12 @@ uint8_t nes_pad_mask(nes_t* sys) {
     return sys->controller[0].value;
 }
 
+void nes_pad_port(nes_t* sys, int port, uint8_t mask) {
+    CHIPS_ASSERT(sys && sys->valid);
+    CHIPS_ASSERT((port >= 0) && (port < 2));
+    sys->controller[port].value = mask;
+}
+
 chips_display_info_t nes_display_info(nes_t* sys) {
     const chips_display_info_t res = {
         .frame = {
@@ -501,62 +945,114 @@ chips_display_info_t nes_display_info(nes_t* sys) {
     return res;
 }
 
-bool nes_insert_cart(nes_t* sys, chips_range_t data) {
+void nes_insert_cart_begin(nes_t* sys) {
     CHIPS_ASSERT(sys && sys->valid);
-    if (data.size <= sizeof(nes_cartridge_header)) {
-        return false;
-    }
-    const nes_cartridge_header* hdr = (nes_cartridge_header*) data.ptr;
+    memset(&sys->cart, 0, sizeof(sys->cart));
+    memset(&sys->cart_loader, 0, sizeof(sys->cart_loader));
+    _nes_use_mapper(sys, 0);
+}
+
+static bool _nes_check_cart_header(const nes_cartridge_header* hdr) {
     if(strncmp(hdr->magic, "NES\x1A", 4))
         return false;
-
     // not supported
-    const uint8_t mapper_num = hdr->mapper_low | (hdr->mapper_hi << 4);
-    if(hdr->trainer || hdr->vram_expansion || hdr->prg_page_count > 16 || hdr->tile_page_count > 16)
+    if(hdr->prg_page_count > 16 || hdr->tile_page_count > 16)
         return false;
+    return true;
+}
 
-    // read PRG-ROM (16KB banks)
-    const size_t prg_size = hdr->prg_page_count * 0x4000;
-    memcpy(&sys->cart.header, hdr, sizeof(nes_cartridge_header));
-    memcpy(sys->cart.rom, ((uint8_t*)data.ptr) + sizeof(nes_cartridge_header), prg_size);
+// copy the part of the input stream at [offset, offset+size) which overlaps [begin, begin+dst_size) into dst
+static void _nes_copy_cart_range(uint8_t* dst, size_t begin, size_t dst_size, size_t offset, const uint8_t* data, size_t size) {
+    const size_t end = begin + dst_size;
+    const size_t lo = (offset > begin) ? offset : begin;
+    const size_t hi = ((offset + size) < end) ? (offset + size) : end;
+    if (lo < hi) {
+        memcpy(dst + (lo - begin), data + (lo - offset), hi - lo);
+    }
+}
 
-    // read CHR-ROM (8KB banks)
-    if(hdr->tile_page_count > 0) {
-        memcpy(sys->cart.character_ram, ((uint8_t*)data.ptr) + sizeof(nes_cartridge_header) + prg_size, hdr->tile_page_count * 0x2000);
+bool nes_insert_cart_feed(nes_t* sys, const uint8_t* data, size_t size) {
+    CHIPS_ASSERT(sys && sys->valid);
+    CHIPS_ASSERT(data || (size == 0));
+    if (sys->cart_loader.failed) {
+        return false;
+    }
+    const size_t hdr_size = sizeof(nes_cartridge_header);
+    size_t offset = sys->cart_loader.offset;
+    if (offset < hdr_size) {
+        const size_t num = ((hdr_size - offset) < size) ? (hdr_size - offset) : size;
+        memcpy(&sys->cart_loader.header[offset], data, num);
+        offset += num;
+        data += num;
+        size -= num;
+        if ((offset == hdr_size) && !_nes_check_cart_header((const nes_cartridge_header*)sys->cart_loader.header)) {
+            sys->cart_loader.failed = true;
+            return false;
+        }
+    }
+    if (size > 0) {
+        const nes_cartridge_header* hdr = (const nes_cartridge_header*)sys->cart_loader.header;
+        // read the optional 512 byte trainer (loaded to $7000), PRG-ROM (16KB banks)
+        // and CHR-ROM (8KB banks), trailing data is ignored
+        const size_t trainer_size = hdr->trainer ? 0x200 : 0;
+        const size_t prg_size = hdr->prg_page_count * 0x4000;
+        const size_t chr_size = hdr->tile_page_count * 0x2000;
+        _nes_copy_cart_range(sys->extended_ram + 0x1000, hdr_size, trainer_size, offset, data, size);
+        _nes_copy_cart_range(sys->cart.rom, hdr_size + trainer_size, prg_size, offset, data, size);
+        _nes_copy_cart_range(sys->cart.character_ram, hdr_size + trainer_size + prg_size, chr_size, offset, data, size);
+        offset += size;
     }
+    sys->cart_loader.offset = offset;
+    return true;
+}
 
+bool nes_insert_cart_end(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    const nes_cartridge_header* hdr = (const nes_cartridge_header*)sys->cart_loader.header;
+    const size_t hdr_size = sizeof(nes_cartridge_header);
+    if (sys->cart_loader.failed || (sys->cart_loader.offset <= hdr_size)) {
+        return false;
+    }
+    const size_t img_size = hdr_size + (hdr->trainer ? 0x200 : 0) + hdr->prg_page_count * 0x4000 + hdr->tile_page_count * 0x2000;
+    if (sys->cart_loader.offset < img_size) {
+        return false;
+    }
+    const uint8_t mapper_num = hdr->mapper_low | (hdr->mapper_hi << 4);
+    memcpy(&sys->cart.header, hdr, hdr_size);
+    // identifies the cartridge in serialized states (FNV-1a)
+    uint32_t checksum = 0x811C9DC5;
+    const size_t prg_size = hdr->prg_page_count * 0x4000;
+    const size_t chr_size = hdr->tile_page_count * 0x2000;
+    for (size_t i = 0; i < prg_size; i++) {
+        checksum = (checksum ^ sys->cart.rom[i]) * 0x01000193;
+    }
+    for (size_t i = 0; i < chr_size; i++) {
+        checksum = (checksum ^ sys->cart.character_ram[i]) * 0x01000193;
+    }
+    sys->cart.checksum = checksum;
     if(_nes_use_mapper(sys, mapper_num)) {
+        _nes_update_region(sys);
         nes_reset(sys);
         return true;
     }
+    memset(&sys->cart.header, 0, hdr_size);
     return false;
 }
 
+bool nes_insert_cart(nes_t* sys, chips_range_t data) {
+    CHIPS_ASSERT(sys && sys->valid);
+    nes_insert_cart_begin(sys);
+    return nes_insert_cart_feed(sys, (const uint8_t*)data.ptr, data.size) && nes_insert_cart_end(sys);
+}
+
 static uint8_t _ppu_read(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if (addr < 0x2000) {
-        return sys->cart.mapper.read_chr(addr, sys);
+        return sys->mapper.read_chr(addr, sys);
     } else if(addr < 0x3f00) {
-        const uint16_t index = addr & 0x3ff;
-        // Name tables upto 0x3000, then mirrored upto 3eff
-        uint16_t normalizedAddr = addr;
-        if (addr >= 0x3000)
-            normalizedAddr -= 0x1000;
-        if(sys->ppu_name_table[0] >= 0x2c00) {
-            return sys->cart.mapper.read_chr(normalizedAddr, sys);
-        } else
-        {
-            if (normalizedAddr < 0x2400)      //NT0
-                normalizedAddr = sys->ppu_name_table[0] + index;
-            else if (normalizedAddr < 0x2800) //NT1
-                normalizedAddr = sys->ppu_name_table[1] + index;
-            else if (normalizedAddr < 0x2c00) //NT2
-                normalizedAddr = sys->ppu_name_table[2] + index;
-            else
-                normalizedAddr = sys->ppu_name_table[3] + index;
-            return sys->ppu_ram[normalizedAddr-0x2000];
-        }
+        // nametables, $3000-$3EFF mirrors $2000-$2EFF
+        return ((const uint8_t*)sys)[sys->ppu_name_table[(addr >> 10) & 3] + (addr & 0x3ff)];
     } else if(addr <= 0x3f0c && addr % 4 == 0) {
         return sys->ppu_pal_ram[0];
     } else if (addr < 0x4000) {
@@ -574,27 +1070,10 @@ static void _ppu_write(uint16_t addr, uint8_t data, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if (addr < 0x2000) {
-        sys->cart.mapper.write_chr(addr, data, sys);
+        sys->mapper.write_chr(addr, data, sys);
     } else if (addr < 0x3f00) {
-        const uint16_t index = addr & 0x3ff;
-        // Name tables upto 0x3000, then mirrored upto 3eff
-        uint16_t normalizedAddr = addr;
-        if (addr >= 0x3000)
-            normalizedAddr -= 0x1000;
-        if(sys->ppu_name_table[0] >= 0x2c00) {
-            sys->cart.mapper.write_chr(normalizedAddr, data, sys);
-        } else
-        {
-            if (normalizedAddr < 0x2400)      //NT0
-                normalizedAddr = sys->ppu_name_table[0] + index;
-            else if (normalizedAddr < 0x2800) //NT1
-                normalizedAddr = sys->ppu_name_table[1] + index;
-            else if (normalizedAddr < 0x2c00) //NT2
-                normalizedAddr = sys->ppu_name_table[2] + index;
-            else
-                normalizedAddr = sys->ppu_name_table[3] + index;
-            sys->ppu_ram[normalizedAddr-0x2000] = data;
-        }
+        // nametables, $3000-$3EFF mirrors $2000-$2EFF
+        ((uint8_t*)sys)[sys->ppu_name_table[(addr >> 10) & 3] + (addr & 0x3ff)] = data;
     } else if (addr < 0x4000) {
         uint16_t normalizedAddr = addr & 0x1f;
         // Addresses $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C
@@ -605,10 +1084,124 @@ static void _ppu_write(uint16_t addr, uint8_t data, void* user_data) {
    }
 }
 
+static void _nes_apply_freezes(nes_t* sys) {
+    for (int i = 0; i < sys->cheats.num_cheats; i++) {
+        const nes_cheat_t* cheat = &sys->cheats.cheats[i];
+        if (cheat->addr < 0x2000) {
+            sys->ram[cheat->addr & 0x7ff] = cheat->value;
+        }
+        else if ((cheat->addr >= 0x6000) && (cheat->addr < 0x8000)) {
+            sys->extended_ram[cheat->addr - 0x6000] = cheat->value;
+        }
+    }
+}
+
 static void _ppu_set_pixels(uint8_t* buffer, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     memcpy(sys->fb, buffer, 256*240);
+    memcpy(sys->fb_emphasis, sys->ppu.emphasis, sizeof(sys->fb_emphasis));
+    sys->frame_count++;
+    if (sys->cheats.num_freezes > 0) {
+        _nes_apply_freezes(sys);
+    }
+    if (sys->frame.func) {
+        sys->frame.func(sys->fb, sys->frame.user_data);
+    }
+}
+
+// APU registers $4000-$4015 and the frame counter at $4017 (also used by the NSF player, see nsf.h)
+static void _apu_write(apu_t* sys, uint16_t addr, uint8_t data) {
+    if(addr == 0x4000) {
+        switch ((data & 0xc0) >> 6) {
+        case 0x00: sys->pulse[0].seq.new_sequence = 0b01000000; sys->pulse[0].pulse.duty_cycle = 0.125; break;
+        case 0x01: sys->pulse[0].seq.new_sequence = 0b01100000; sys->pulse[0].pulse.duty_cycle = 0.250; break;
+        case 0x02: sys->pulse[0].seq.new_sequence = 0b01111000; sys->pulse[0].pulse.duty_cycle = 0.500; break;
+        case 0x03: sys->pulse[0].seq.new_sequence = 0b10011111; sys->pulse[0].pulse.duty_cycle = 0.750; break;
+        }
+        sys->pulse[0].seq.sequence = sys->pulse[0].seq.new_sequence;
+        sys->pulse[0].halt = (data & 0x20);
+        sys->pulse[0].env.volume = (data & 0x0f);
+		sys->pulse[0].env.disable = (data & 0x10);
+    } else if(addr == 0x4001) {
+        sys->pulse[0].sweeper.enabled = data & 0x80;
+		sys->pulse[0].sweeper.period = (data & 0x70) >> 4;
+		sys->pulse[0].sweeper.down = data & 0x08;
+		sys->pulse[0].sweeper.shift = data & 0x07;
+		sys->pulse[0].sweeper.reload = true;
+    } else if(addr == 0x4002) {
+        sys->pulse[0].seq.reload = (sys->pulse[0].seq.reload & 0xff00) | data;
+    } else if(addr == 0x4003) {
+        sys->pulse[0].seq.reload = (uint16_t)((data & 0x07)) << 8 | (sys->pulse[0].seq.reload & 0x00ff);
+        sys->pulse[0].seq.timer = sys->pulse[0].seq.reload;
+        sys->pulse[0].seq.sequence = sys->pulse[0].seq.new_sequence;
+        sys->pulse[0].len_counter = length_table[(data & 0xf8) >> 3];
+        sys->pulse[0].env.start = true;
+    } else if(addr == 0x4004) {
+        switch ((data & 0xc0) >> 6) {
+        case 0x00: sys->pulse[1].seq.new_sequence = 0b01000000; sys->pulse[1].pulse.duty_cycle = 0.125; break;
+        case 0x01: sys->pulse[1].seq.new_sequence = 0b01100000; sys->pulse[1].pulse.duty_cycle = 0.250; break;
+        case 0x02: sys->pulse[1].seq.new_sequence = 0b01111000; sys->pulse[1].pulse.duty_cycle = 0.500; break;
+        case 0x03: sys->pulse[1].seq.new_sequence = 0b10011111; sys->pulse[1].pulse.duty_cycle = 0.750; break;
+        }
+        sys->pulse[1].seq.sequence = sys->pulse[1].seq.new_sequence;
+        sys->pulse[1].halt = (data & 0x20);
+        sys->pulse[1].env.volume = (data & 0x0f);
+		sys->pulse[1].env.disable = (data & 0x10);
+    } else if(addr == 0x4005) {
+        sys->pulse[1].sweeper.enabled = data & 0x80;
+		sys->pulse[1].sweeper.period = (data & 0x70) >> 4;
+		sys->pulse[1].sweeper.down = data & 0x08;
+		sys->pulse[1].sweeper.shift = data & 0x07;
+		sys->pulse[1].sweeper.reload = true;
+    } else if(addr == 0x4006) {
+        sys->pulse[1].seq.reload = (sys->pulse[1].seq.reload & 0xff00) | data;
+    } else if(addr == 0x4007) {
+        sys->pulse[1].seq.reload = (uint16_t)((data & 0x07)) << 8 | (sys->pulse[1].seq.reload & 0x00ff);
+        sys->pulse[1].seq.timer = sys->pulse[1].seq.reload;
+        sys->pulse[1].seq.sequence = sys->pulse[1].seq.new_sequence;
+        sys->pulse[1].len_counter = length_table[(data & 0xf8) >> 3];
+        sys->pulse[1].env.start = true;
+    } else if(addr == 0x400c) {
+        sys->noise.env.volume = (data & 0x0F);
+        sys->noise.env.disable = (data & 0x10);
+		sys->noise.halt = (data & 0x20);
+    } else if(addr == 0x400e) {
+		switch (data & 0x0f) {
+		case 0x00: sys->noise.seq.reload = 0; break;
+		case 0x01: sys->noise.seq.reload = 4; break;
+		case 0x02: sys->noise.seq.reload = 8; break;
+		case 0x03: sys->noise.seq.reload = 16; break;
+		case 0x04: sys->noise.seq.reload = 32; break;
+		case 0x05: sys->noise.seq.reload = 64; break;
+		case 0x06: sys->noise.seq.reload = 96; break;
+		case 0x07: sys->noise.seq.reload = 128; break;
+		case 0x08: sys->noise.seq.reload = 160; break;
+		case 0x09: sys->noise.seq.reload = 202; break;
+		case 0x0A: sys->noise.seq.reload = 254; break;
+		case 0x0B: sys->noise.seq.reload = 380; break;
+		case 0x0C: sys->noise.seq.reload = 508; break;
+		case 0x0D: sys->noise.seq.reload = 1016; break;
+		case 0x0E: sys->noise.seq.reload = 2034; break;
+		case 0x0F: sys->noise.seq.reload = 4068; break;
+		}
+    } else if(addr == 0x400f) {
+        sys->pulse[0].env.start = true;
+        sys->pulse[1].env.start = true;
+        sys->noise.env.start = true;
+		sys->noise.len_counter = length_table[(data & 0xf8) >> 3];
+    } else if(addr == 0x4015) {
+        sys->pulse[0].enable = data & 1;
+        sys->pulse[1].enable = data & 2;
+        sys->noise.enable = data & 0x04;
+    } else if(addr == 0x4017) {
+        // frame counter: restarts the sequence, the 5-step mode clocks the units right away
+        sys->frame_counter = data & 0xc0;
+        sys->frame_clock_counter = 0;
+        if (data & 0x80) {
+            _apu_frame_clock(sys, true);
+        }
+    }
 }
 
 uint8_t nes_mem_read(nes_t* sys, uint16_t addr, bool read_only) {
@@ -623,12 +1216,11 @@ uint8_t nes_mem_read(nes_t* sys, uint16_t addr, bool read_only) {
             addr = addr & 0x2007;
         return r2c02_read(&sys->ppu, addr-0x2000, read_only);
     } else if (addr < 0x6000) {
-        // TODO: Expansion ROM
-        return 0xFF;
+        return sys->mapper.read_exp(addr, read_only, sys);
     } else if (addr < 0x8000) {
         return sys->extended_ram[addr - 0x6000];
     } else {
-        return sys->cart.mapper.read_prg(addr, sys);
+        return sys->mapper.read_prg(addr, sys);
     }
 }
 
@@ -639,106 +1231,28 @@ void nes_mem_write(nes_t* sys, uint16_t addr, uint8_t data) {
         //PPU registers, mirrored
         addr = addr & 0x0007;
         r2c02_write(&sys->ppu, addr, data);
-    } else if(addr == 0x4000) {
-        switch ((data & 0xc0) >> 6) {
-        case 0x00: sys->apu.pulse[0].seq.new_sequence = 0b01000000; sys->apu.pulse[0].pulse.duty_cycle = 0.125; break;
-        case 0x01: sys->apu.pulse[0].seq.new_sequence = 0b01100000; sys->apu.pulse[0].pulse.duty_cycle = 0.250; break;
-        case 0x02: sys->apu.pulse[0].seq.new_sequence = 0b01111000; sys->apu.pulse[0].pulse.duty_cycle = 0.500; break;
-        case 0x03: sys->apu.pulse[0].seq.new_sequence = 0b10011111; sys->apu.pulse[0].pulse.duty_cycle = 0.750; break;
-        }
-        sys->apu.pulse[0].seq.sequence = sys->apu.pulse[0].seq.new_sequence;
-        sys->apu.pulse[0].halt = (data & 0x20);
-        sys->apu.pulse[0].env.volume = (data & 0x0f);
-		sys->apu.pulse[0].env.disable = (data & 0x10);
-    } else if(addr == 0x4001) {
-        sys->apu.pulse[0].sweeper.enabled = data & 0x80;
-		sys->apu.pulse[0].sweeper.period = (data & 0x70) >> 4;
-		sys->apu.pulse[0].sweeper.down = data & 0x08;
-		sys->apu.pulse[0].sweeper.shift = data & 0x07;
-		sys->apu.pulse[0].sweeper.reload = true;
-    } else if(addr == 0x4002) {
-        sys->apu.pulse[0].seq.reload = (sys->apu.pulse[0].seq.reload & 0xff00) | data;
-    } else if(addr == 0x4003) {
-        sys->apu.pulse[0].seq.reload = (uint16_t)((data & 0x07)) << 8 | (sys->apu.pulse[0].seq.reload & 0x00ff);
-        sys->apu.pulse[0].seq.timer = sys->apu.pulse[0].seq.reload;
-        sys->apu.pulse[0].seq.sequence = sys->apu.pulse[0].seq.new_sequence;
-        sys->apu.pulse[0].len_counter = length_table[(data & 0xf8) >> 3];
-        sys->apu.pulse[0].env.start = true;
-    } else if(addr == 0x4004) {
-        switch ((data & 0xc0) >> 6) {
-        case 0x00: sys->apu.pulse[1].seq.new_sequence = 0b01000000; sys->apu.pulse[1].pulse.duty_cycle = 0.125; break;
-        case 0x01: sys->apu.pulse[1].seq.new_sequence = 0b01100000; sys->apu.pulse[1].pulse.duty_cycle = 0.250; break;
-        case 0x02: sys->apu.pulse[1].seq.new_sequence = 0b01111000; sys->apu.pulse[1].pulse.duty_cycle = 0.500; break;
-        case 0x03: sys->apu.pulse[1].seq.new_sequence = 0b10011111; sys->apu.pulse[1].pulse.duty_cycle = 0.750; break;
-        }
-        sys->apu.pulse[1].seq.sequence = sys->apu.pulse[1].seq.new_sequence;
-        sys->apu.pulse[1].halt = (data & 0x20);
-        sys->apu.pulse[1].env.volume = (data & 0x0f);
-		sys->apu.pulse[1].env.disable = (data & 0x10);
-    } else if(addr == 0x4005) {
-        sys->apu.pulse[1].sweeper.enabled = data & 0x80;
-		sys->apu.pulse[1].sweeper.period = (data & 0x70) >> 4;
-		sys->apu.pulse[1].sweeper.down = data & 0x08;
-		sys->apu.pulse[1].sweeper.shift = data & 0x07;
-		sys->apu.pulse[1].sweeper.reload = true;
-    } else if(addr == 0x4006) {
-        sys->apu.pulse[1].seq.reload = (sys->apu.pulse[1].seq.reload & 0xff00) | data;
-    } else if(addr == 0x4007) {
-        sys->apu.pulse[1].seq.reload = (uint16_t)((data & 0x07)) << 8 | (sys->apu.pulse[1].seq.reload & 0x00ff);
-        sys->apu.pulse[1].seq.timer = sys->apu.pulse[1].seq.reload;
-        sys->apu.pulse[1].seq.sequence = sys->apu.pulse[1].seq.new_sequence;
-        sys->apu.pulse[1].len_counter = length_table[(data & 0xf8) >> 3];
-        sys->apu.pulse[1].env.start = true;
-    } else if(addr == 0x400c) {
-        sys->apu.noise.env.volume = (data & 0x0F);
-        sys->apu.noise.env.disable = (data & 0x10);
-		sys->apu.noise.halt = (data & 0x20);
-    } else if(addr == 0x400e) {
-		switch (data & 0x0f) {
-		case 0x00: sys->apu.noise.seq.reload = 0; break;
-		case 0x01: sys->apu.noise.seq.reload = 4; break;
-		case 0x02: sys->apu.noise.seq.reload = 8; break;
-		case 0x03: sys->apu.noise.seq.reload = 16; break;
-		case 0x04: sys->apu.noise.seq.reload = 32; break;
-		case 0x05: sys->apu.noise.seq.reload = 64; break;
-		case 0x06: sys->apu.noise.seq.reload = 96; break;
-		case 0x07: sys->apu.noise.seq.reload = 128; break;
-		case 0x08: sys->apu.noise.seq.reload = 160; break;
-		case 0x09: sys->apu.noise.seq.reload = 202; break;
-		case 0x0A: sys->apu.noise.seq.reload = 254; break;
-		case 0x0B: sys->apu.noise.seq.reload = 380; break;
-		case 0x0C: sys->apu.noise.seq.reload = 508; break;
-		case 0x0D: sys->apu.noise.seq.reload = 1016; break;
-		case 0x0E: sys->apu.noise.seq.reload = 2034; break;
-		case 0x0F: sys->apu.noise.seq.reload = 4068; break;
-		}
-    } else if(addr == 0x400f) {
-        sys->apu.pulse[0].env.start = true;
-        sys->apu.pulse[1].env.start = true;
-        sys->apu.noise.env.start = true;
-		sys->apu.noise.len_counter = length_table[(data & 0xf8) >> 3];
     } else if(addr == 0x4014) {
+        // OAMDMA, the CPU is halted while the data is copied (see _nes_dma_stall())
         sys->dma_wait = 513 + (sys->ppu.even_frame ? 0 : 1);
-        // OAMDMA
-        uint16_t page = data << 8;
-        if(page < 0x2000) {
-            uint8_t* page_ptr = sys->ram + (page & 0x7ff);
-            memcpy(sys->ppu.oam.reg + sys->ppu.sprite_data_address, page_ptr, 256 - sys->ppu.sprite_data_address);
-            if (sys->ppu.sprite_data_address)
-                memcpy(sys->ppu.oam.reg, page_ptr + (256 - sys->ppu.sprite_data_address), sys->ppu.sprite_data_address);
+        _nes_oam_dma(sys, data);
+    } else if (addr == 0x4016) {
+        // the strobe latches both controller ports, the host input is latched as late
+        // as possible, at the moment the game strobes the pads
+        for (int port = 0; port < 2; port++) {
+            if (sys->input.func) {
+                sys->controller[port].value = sys->input.func(port, sys->input.user_data);
+            }
+            sys->controller_state[port] = sys->controller[port].value;
         }
-    } else if(addr == 0x4015) {
-        sys->apu.pulse[0].enable = data & 1;
-        sys->apu.pulse[1].enable = data & 2;
-        sys->apu.noise.enable = data & 0x04;
-    } else if (addr >= 0x4016 && addr <= 0x4017) {
-        sys->controller_state[addr & 0x0001] = sys->controller[addr & 0x0001].value;
+    } else if (addr < 0x4020) {
+        // $4017 writes go to the APU frame counter
+        _apu_write(&sys->apu, addr, data);
     } else if (addr < 0x6000) {
-        // TODO: Expansion ROM
+        sys->mapper.write_exp(addr, data, sys);
     } else if (addr < 0x8000) {
         sys->extended_ram[addr - 0x6000] = data;
     } else {
-        sys->cart.mapper.write_prg(addr, data, sys);
+        sys->mapper.write_prg(addr, data, sys);
     }
 }
 
@@ -751,6 +1265,10 @@ bool nes_load_snapshot(nes_t* sys, uint32_t version, nes_t* src) {
     im = *src;
     chips_debug_snapshot_onload(&im.debug, &sys->debug);
     chips_audio_callback_snapshot_onload(&im.audio.callback, &sys->audio.callback);
+    im.input = sys->input;
+    im.frame = sys->frame;
+    im.breakpoints = sys->breakpoints;
+    im.ppu.picture_buffer = sys->picture_buffer;
     *sys = im;
     return true;
 }
@@ -760,62 +1278,835 @@ uint32_t nes_save_snapshot(nes_t* sys, nes_t* dst) {
     *dst = *sys;
     chips_debug_snapshot_onsave(&dst->debug);
     chips_audio_callback_snapshot_onsave(&dst->audio.callback);
+    dst->input = (nes_input_provider_t){0};
+    dst->frame = (nes_frame_callback_t){0};
+    dst->breakpoints = 0;
     return NES_SNAPSHOT_VERSION;
 }
 
-static inline double _approx_sin(double t) {
-    double j = t * 0.15915;
-    j = j - (int)j;
-    return 20.785 * j * (j - 0.5) * (j - 1.0);
-}
+/*
+    Serialized state format (little-endian):
+
+        "NESS", u32 format version
+        sections: u32 tag, u16 section version, u32 payload size, payload
+
+    Fields are only ever appended to a section (bumping the section version),
+    fields missing in an older section keep their current value, and unknown
+    sections or trailing fields written by a newer version are skipped.
+*/
+#define _NES_TAG(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b)<<8) | ((uint32_t)(c)<<16) | ((uint32_t)(d)<<24))
+#define _NES_TAG_CART _NES_TAG('C','A','R','T')
+#define _NES_TAG_CPU  _NES_TAG('C','P','U',' ')
+#define _NES_TAG_PPU  _NES_TAG('P','P','U',' ')
+#define _NES_TAG_APU  _NES_TAG('A','P','U',' ')
+#define _NES_TAG_MAPR _NES_TAG('M','A','P','R')
+#define _NES_TAG_RAM  _NES_TAG('R','A','M',' ')
+#define _NES_TAG_CTRL _NES_TAG('C','T','R','L')
+#define _NES_TAG_XAUD _NES_TAG('X','A','U','D')
+#define _NES_SECTION_HEADER_SIZE (10)
 
-static double _pulse_sample(pulse_t* pulse, double t) {
-    double a = 0;
-    double b = 0;
-    double p = pulse->duty_cycle * 2.0 * M_PI;
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    size_t pos;
+    size_t section_pos;
+} _nes_writer_t;
 
-    const double harmonics = 20;
-    for (double n = 1; n < harmonics; n++) {
-        double c = n * pulse->frequency * 2.0 * M_PI * t;
-        a += -_approx_sin(c) / n;
-        b += -_approx_sin(c - p * n) / n;
+typedef struct {
+    const uint8_t* ptr;
+    size_t size;
+    size_t pos;
+} _nes_reader_t;
+
+static void _nes_w_bytes(_nes_writer_t* w, const void* data, size_t size) {
+    if ((w->pos + size) <= w->size) {
+        memcpy(w->ptr + w->pos, data, size);
     }
+    w->pos += size;
+}
 
-    return (2.0 * pulse->amplitude / M_PI) * (a - b);
+static void _nes_w8(_nes_writer_t* w, uint8_t val) {
+    if (w->pos < w->size) {
+        w->ptr[w->pos] = val;
+    }
+    w->pos++;
 }
 
-static void _apu_env_clock(apu_envelope_t* env, bool loop) {
-    if (!env->start) {
-        if (env->divider_count == 0) {
-            env->divider_count = env->volume;
+static void _nes_w16(_nes_writer_t* w, uint16_t val) {
+    _nes_w8(w, (uint8_t)val);
+    _nes_w8(w, (uint8_t)(val >> 8));
+}
 
-            if (env->decay_count == 0) {
-                if (loop) env->decay_count = 15;
-            }
-            else
-                env->decay_count--;
-        }
-        else
-            env->divider_count--;
-    } else {
-        env->start = false;
-        env->decay_count = 15;
-        env->divider_count = env->volume;
-    }
+static void _nes_w32(_nes_writer_t* w, uint32_t val) {
+    _nes_w16(w, (uint16_t)val);
+    _nes_w16(w, (uint16_t)(val >> 16));
+}
 
-    env->output = env->disable ? env->volume : env->decay_count;
+static void _nes_w64(_nes_writer_t* w, uint64_t val) {
+    _nes_w32(w, (uint32_t)val);
+    _nes_w32(w, (uint32_t)(val >> 32));
 }
 
-static void _apu_sweeper_track(apu_sweeper_t* sweeper, uint16_t target) {
-    if (sweeper->enabled) {
-        sweeper->change = target >> sweeper->shift;
-        sweeper->mute = (target < 8) || (target > 0x7FF);
-    }
+static void _nes_wf64(_nes_writer_t* w, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    _nes_w64(w, bits);
 }
 
-static bool _apu_sweeper_clock(apu_sweeper_t* sweeper, uint16_t* target, bool channel) {
-    bool changed = false;
-    if (sweeper->timer == 0 && sweeper->enabled && sweeper->shift > 0 && !sweeper->mute) {
+static void _nes_wf32(_nes_writer_t* w, float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    _nes_w32(w, bits);
+}
+
+static void _nes_w_begin(_nes_writer_t* w, uint32_t tag, uint16_t version) {
+    _nes_w32(w, tag);
+    _nes_w16(w, version);
+    w->section_pos = w->pos;
+    _nes_w32(w, 0);     // patched in _nes_w_end()
+}
+
+static void _nes_w_end(_nes_writer_t* w) {
+    const size_t end_pos = w->pos;
+    const uint32_t size = (uint32_t)(end_pos - w->section_pos - 4);
+    w->pos = w->section_pos;
+    _nes_w32(w, size);
+    w->pos = end_pos;
+}
+
+// the _nes_r*() functions leave the value untouched if the section has no more data
+static bool _nes_r_avail(_nes_reader_t* r, size_t size) {
+    return (r->pos + size) <= r->size;
+}
+
+static void _nes_r_bytes(_nes_reader_t* r, void* data, size_t size) {
+    if (_nes_r_avail(r, size)) {
+        memcpy(data, r->ptr + r->pos, size);
+        r->pos += size;
+    }
+}
+
+static uint64_t _nes_r_uint(_nes_reader_t* r, int num_bytes, uint64_t def) {
+    if (!_nes_r_avail(r, (size_t)num_bytes)) {
+        return def;
+    }
+    uint64_t val = 0;
+    for (int i = 0; i < num_bytes; i++) {
+        val |= (uint64_t)r->ptr[r->pos++] << (i * 8);
+    }
+    return val;
+}
+
+static void _nes_r8(_nes_reader_t* r, uint8_t* val) { *val = (uint8_t)_nes_r_uint(r, 1, *val); }
+static void _nes_r16(_nes_reader_t* r, uint16_t* val) { *val = (uint16_t)_nes_r_uint(r, 2, *val); }
+static void _nes_r32(_nes_reader_t* r, uint32_t* val) { *val = (uint32_t)_nes_r_uint(r, 4, *val); }
+static void _nes_r64(_nes_reader_t* r, uint64_t* val) { *val = _nes_r_uint(r, 8, *val); }
+static void _nes_rbool(_nes_reader_t* r, bool* val) { *val = 0 != _nes_r_uint(r, 1, *val); }
+static void _nes_rint(_nes_reader_t* r, int* val) { *val = (int)(int32_t)_nes_r_uint(r, 4, (uint32_t)*val); }
+
+static void _nes_rf64(_nes_reader_t* r, double* val) {
+    uint64_t bits;
+    memcpy(&bits, val, sizeof(bits));
+    bits = _nes_r_uint(r, 8, bits);
+    memcpy(val, &bits, sizeof(bits));
+}
+
+static void _nes_rf32(_nes_reader_t* r, float* val) {
+    uint32_t bits;
+    memcpy(&bits, val, sizeof(bits));
+    bits = (uint32_t)_nes_r_uint(r, 4, bits);
+    memcpy(val, &bits, sizeof(bits));
+}
+
+static void _nes_w_sequencer(_nes_writer_t* w, const apu_sequencer_t* seq) {
+    _nes_w16(w, seq->timer);
+    _nes_w16(w, seq->reload);
+    _nes_w8(w, seq->output);
+    _nes_w32(w, seq->sequence);
+    _nes_w32(w, seq->new_sequence);
+}
+
+static void _nes_r_sequencer(_nes_reader_t* r, apu_sequencer_t* seq) {
+    _nes_r16(r, &seq->timer);
+    _nes_r16(r, &seq->reload);
+    _nes_r8(r, &seq->output);
+    _nes_r32(r, &seq->sequence);
+    _nes_r32(r, &seq->new_sequence);
+}
+
+static void _nes_w_envelope(_nes_writer_t* w, const apu_envelope_t* env) {
+    _nes_w8(w, env->start);
+    _nes_w8(w, env->disable);
+    _nes_w16(w, env->divider_count);
+    _nes_w16(w, env->volume);
+    _nes_w16(w, env->output);
+    _nes_w16(w, env->decay_count);
+}
+
+static void _nes_r_envelope(_nes_reader_t* r, apu_envelope_t* env) {
+    _nes_rbool(r, &env->start);
+    _nes_rbool(r, &env->disable);
+    _nes_r16(r, &env->divider_count);
+    _nes_r16(r, &env->volume);
+    _nes_r16(r, &env->output);
+    _nes_r16(r, &env->decay_count);
+}
+
+static uint8_t _nes_mapper_num(const nes_cartridge_header* hdr) {
+    return hdr->mapper_low | (hdr->mapper_hi << 4);
+}
+
+// the registers of the mappers which don't fit into the v1 MAPR fields (mapper 1 only),
+// fields are only ever appended per mapper, like the fields of a section
+static void _nes_w_mapper(_nes_writer_t* w, const nes_mapper_t* m, uint8_t mapper_num) {
+    switch (mapper_num) {
+        case 2:
+            _nes_w8(w, m->data2.select_prg);
+            break;
+        case 3:
+            _nes_w8(w, m->data3.select_chr);
+            break;
+        case 7:
+            _nes_w8(w, m->data7.prg_bank);
+            break;
+        case 66:
+            _nes_w8(w, m->data66.prg_bank);
+            _nes_w8(w, m->data66.chr_bank);
+            break;
+        case 19:
+            _nes_w_bytes(w, m->data19.chr_bank, sizeof(m->data19.chr_bank));
+            _nes_w_bytes(w, m->data19.prg_bank, sizeof(m->data19.prg_bank));
+            _nes_w8(w, m->data19.sound_disable);
+            _nes_w16(w, m->data19.irq_counter);
+            _nes_w32(w, m->data19.irq_base_clock);
+            _nes_w8(w, m->data19.audio_addr);
+            _nes_w_bytes(w, m->data19.audio_ram, sizeof(m->data19.audio_ram));
+            break;
+        case 24:
+        case 26:
+            _nes_w8(w, m->data24.prg_bank16);
+            _nes_w8(w, m->data24.prg_bank8);
+            _nes_w_bytes(w, m->data24.chr_bank, sizeof(m->data24.chr_bank));
+            _nes_w8(w, m->data24.ppu_ctrl);
+            _nes_w8(w, m->data24.irq_latch);
+            _nes_w8(w, m->data24.irq_ctrl);
+            _nes_w8(w, m->data24.irq_counter);
+            _nes_w16(w, (uint16_t)m->data24.irq_prescaler);
+            _nes_w32(w, m->data24.irq_base_clock);
+            _nes_w_bytes(w, m->data24.pulse, sizeof(m->data24.pulse));
+            _nes_w_bytes(w, m->data24.saw, sizeof(m->data24.saw));
+            _nes_w8(w, m->data24.freq_ctrl);
+            break;
+        case 69:
+            _nes_w8(w, m->data69.command);
+            _nes_w_bytes(w, m->data69.chr_bank, sizeof(m->data69.chr_bank));
+            _nes_w_bytes(w, m->data69.prg_bank, sizeof(m->data69.prg_bank));
+            _nes_w8(w, m->data69.irq_ctrl);
+            _nes_w16(w, m->data69.irq_counter);
+            _nes_w32(w, m->data69.irq_base_clock);
+            _nes_w8(w, m->data69.audio_addr);
+            _nes_w_bytes(w, m->data69.audio_regs, sizeof(m->data69.audio_regs));
+            break;
+        default:
+            break;
+    }
+}
+
+static void _nes_r_mapper(_nes_reader_t* r, nes_mapper_t* m, uint8_t mapper_num) {
+    switch (mapper_num) {
+        case 2:
+            _nes_r8(r, &m->data2.select_prg);
+            break;
+        case 3:
+            _nes_r8(r, &m->data3.select_chr);
+            break;
+        case 7:
+            _nes_r8(r, &m->data7.prg_bank);
+            break;
+        case 66:
+            _nes_r8(r, &m->data66.prg_bank);
+            _nes_r8(r, &m->data66.chr_bank);
+            break;
+        case 19:
+            _nes_r_bytes(r, m->data19.chr_bank, sizeof(m->data19.chr_bank));
+            _nes_r_bytes(r, m->data19.prg_bank, sizeof(m->data19.prg_bank));
+            _nes_r8(r, &m->data19.sound_disable);
+            _nes_r16(r, &m->data19.irq_counter);
+            _nes_r32(r, &m->data19.irq_base_clock);
+            _nes_r8(r, &m->data19.audio_addr);
+            _nes_r_bytes(r, m->data19.audio_ram, sizeof(m->data19.audio_ram));
+            break;
+        case 24:
+        case 26: {
+            _nes_r8(r, &m->data24.prg_bank16);
+            _nes_r8(r, &m->data24.prg_bank8);
+            _nes_r_bytes(r, m->data24.chr_bank, sizeof(m->data24.chr_bank));
+            _nes_r8(r, &m->data24.ppu_ctrl);
+            _nes_r8(r, &m->data24.irq_latch);
+            _nes_r8(r, &m->data24.irq_ctrl);
+            _nes_r8(r, &m->data24.irq_counter);
+            uint16_t prescaler = (uint16_t)m->data24.irq_prescaler;
+            _nes_r16(r, &prescaler);
+            m->data24.irq_prescaler = (int16_t)prescaler;
+            _nes_r32(r, &m->data24.irq_base_clock);
+            _nes_r_bytes(r, m->data24.pulse, sizeof(m->data24.pulse));
+            _nes_r_bytes(r, m->data24.saw, sizeof(m->data24.saw));
+            _nes_r8(r, &m->data24.freq_ctrl);
+        } break;
+        case 69:
+            _nes_r8(r, &m->data69.command);
+            _nes_r_bytes(r, m->data69.chr_bank, sizeof(m->data69.chr_bank));
+            _nes_r_bytes(r, m->data69.prg_bank, sizeof(m->data69.prg_bank));
+            _nes_r8(r, &m->data69.irq_ctrl);
+            _nes_r16(r, &m->data69.irq_counter);
+            _nes_r32(r, &m->data69.irq_base_clock);
+            _nes_r8(r, &m->data69.audio_addr);
+            _nes_r_bytes(r, m->data69.audio_regs, sizeof(m->data69.audio_regs));
+            break;
+        default:
+            break;
+    }
+}
+
+size_t nes_save_state(nes_t* sys, uint8_t* buf, size_t buf_size) {
+    CHIPS_ASSERT(sys && sys->valid && buf);
+    _nes_writer_t w = { .ptr = buf, .size = buf_size };
+    _nes_w_bytes(&w, "NESS", 4);
+    _nes_w32(&w, NES_STATE_VERSION);
+
+    // the cartridge ROM isn't stored, only what's needed to check that the same cartridge is inserted
+    _nes_w_begin(&w, _NES_TAG_CART, 1);
+    _nes_w_bytes(&w, &sys->cart.header, sizeof(nes_cartridge_header));
+    _nes_w32(&w, sys->cart.checksum);
+    _nes_w_end(&w);
+
+    _nes_w_begin(&w, _NES_TAG_CPU, 2);
+    const m6502_t* cpu = &sys->cpu;
+    _nes_w16(&w, cpu->IR);
+    _nes_w16(&w, cpu->PC);
+    _nes_w16(&w, cpu->AD);
+    _nes_w8(&w, cpu->A);
+    _nes_w8(&w, cpu->X);
+    _nes_w8(&w, cpu->Y);
+    _nes_w8(&w, cpu->S);
+    _nes_w8(&w, cpu->P);
+    _nes_w64(&w, cpu->PINS);
+    _nes_w16(&w, cpu->irq_pip);
+    _nes_w16(&w, cpu->nmi_pip);
+    _nes_w8(&w, cpu->brk_flags);
+    _nes_w8(&w, cpu->bcd_enabled);
+    _nes_w64(&w, sys->pins);
+    _nes_w16(&w, sys->dma_wait);
+    _nes_w32(&w, sys->frame_count);
+    _nes_w8(&w, sys->ppu_phase);        // version 2
+    _nes_w_end(&w);
+
+    // the framebuffer and partially rendered picture are not stored
+    _nes_w_begin(&w, _NES_TAG_PPU, 1);
+    const r2c02_t* ppu = &sys->ppu;
+    _nes_w_bytes(&w, ppu->oam.reg, sizeof(ppu->oam.reg));
+    _nes_w32(&w, (uint32_t)ppu->cycle);
+    _nes_w32(&w, (uint32_t)ppu->scanline);
+    _nes_w8(&w, ppu->even_frame);
+    _nes_w_bytes(&w, ppu->scanline_sprites, MAX_SCANLINE_SPRITES);
+    _nes_w32(&w, (uint32_t)ppu->scanline_sprites_num);
+    _nes_w16(&w, ppu->data_address);
+    _nes_w16(&w, ppu->temp_address);
+    _nes_w8(&w, ppu->fine_x_scroll);
+    _nes_w8(&w, ppu->first_write);
+    _nes_w8(&w, ppu->data_buffer);
+    _nes_w8(&w, ppu->sprite_data_address);
+    _nes_w8(&w, ppu->request_nmi);
+    _nes_w8(&w, ppu->request_irq);
+    _nes_w8(&w, ppu->ppu_status.reg);
+    _nes_w8(&w, ppu->ppu_mask.reg);
+    _nes_w8(&w, ppu->ppu_control.reg);
+    // sprites beyond the hardware limit (unlimited sprites)
+    _nes_w_bytes(&w, ppu->scanline_sprites + MAX_SCANLINE_SPRITES, sizeof(ppu->scanline_sprites) - MAX_SCANLINE_SPRITES);
+    _nes_w_end(&w);
+
+    _nes_w_begin(&w, _NES_TAG_APU, 2);
+    const apu_t* apu = &sys->apu;
+    _nes_w32(&w, apu->clock_counter);
+    _nes_w32(&w, apu->frame_clock_counter);
+    _nes_wf64(&w, apu->global_time);
+    _nes_wf64(&w, apu->audio_time);
+    _nes_wf32(&w, apu->audio_sample);
+    for (int i = 0; i < 2; i++) {
+        _nes_w_sequencer(&w, &apu->pulse[i].seq);
+        _nes_w_envelope(&w, &apu->pulse[i].env);
+        const apu_sweeper_t* sw = &apu->pulse[i].sweeper;
+        _nes_w8(&w, sw->enabled);
+        _nes_w8(&w, sw->down);
+        _nes_w8(&w, sw->reload);
+        _nes_w8(&w, sw->shift);
+        _nes_w8(&w, sw->timer);
+        _nes_w8(&w, sw->period);
+        _nes_w16(&w, sw->change);
+        _nes_w8(&w, sw->mute);
+        _nes_wf64(&w, apu->pulse[i].pulse.frequency);
+        _nes_wf64(&w, apu->pulse[i].pulse.duty_cycle);
+        _nes_wf64(&w, apu->pulse[i].pulse.amplitude);
+        _nes_w8(&w, apu->pulse[i].len_counter);
+        _nes_w8(&w, apu->pulse[i].enable);
+        _nes_w8(&w, apu->pulse[i].halt);
+        _nes_wf64(&w, apu->pulse[i].output);
+    }
+    _nes_w_sequencer(&w, &apu->noise.seq);
+    _nes_w_envelope(&w, &apu->noise.env);
+    _nes_w8(&w, apu->noise.len_counter);
+    _nes_w8(&w, apu->noise.enable);
+    _nes_w8(&w, apu->noise.halt);
+    _nes_wf64(&w, apu->noise.output);
+    // v2: frame counter mode
+    _nes_w8(&w, apu->frame_counter);
+    _nes_w_end(&w);
+
+    // mapper registers, and CHR-RAM for cartridges without CHR-ROM
+    _nes_w_begin(&w, _NES_TAG_MAPR, 3);
+    _nes_w_bytes(&w, &sys->mapper.data1, sizeof(sys->mapper.data1));
+    _nes_w8(&w, (uint8_t)sys->mapper.mirroring);
+    if (sys->cart.header.tile_page_count == 0) {
+        _nes_w_bytes(&w, sys->cart.character_ram, 0x2000);
+    }
+    // v3: IRQ state, the registers of the mappers beyond mapper 1
+    _nes_w32(&w, sys->mapper.irq_clock);
+    _nes_w8(&w, sys->mapper.irq);
+    _nes_w_mapper(&w, &sys->mapper, _nes_mapper_num(&sys->cart.header));
+    _nes_w_end(&w);
+
+    _nes_w_begin(&w, _NES_TAG_XAUD, 1);
+    _nes_w8(&w, (uint8_t)sys->exp_audio.num_channels);
+    for (int i = 0; i < sys->exp_audio.num_channels; i++) {
+        const nes_audio_channel_t* ch = &sys->exp_audio.channels[i];
+        _nes_w32(&w, ch->clock);
+        _nes_w32(&w, ch->timer);
+        _nes_w32(&w, ch->phase);
+        _nes_w32(&w, ch->accum);
+        _nes_wf32(&w, ch->level);
+    }
+    _nes_w_end(&w);
+
+    _nes_w_begin(&w, _NES_TAG_RAM, 1);
+    _nes_w_bytes(&w, sys->ram, sizeof(sys->ram));
+    _nes_w_bytes(&w, sys->extended_ram, sizeof(sys->extended_ram));
+    // nametable RAM and four-screen VRAM, followed by the page mapping as PPU addresses
+    _nes_w_bytes(&w, sys->ppu_ram, sizeof(sys->ppu_ram));
+    _nes_w_bytes(&w, sys->cart.four_screen_ram, sizeof(sys->cart.four_screen_ram));
+    _nes_w_bytes(&w, sys->ppu_pal_ram, sizeof(sys->ppu_pal_ram));
+    for (int i = 0; i < 4; i++) {
+        int page = 0;
+        while ((page < 3) && (_nes_name_table_page(page) != sys->ppu_name_table[i])) {
+            page++;
+        }
+        _nes_w16(&w, (uint16_t)(0x2000 + page * 0x400));
+    }
+    _nes_w_end(&w);
+
+    _nes_w_begin(&w, _NES_TAG_CTRL, 1);
+    for (int i = 0; i < 2; i++) {
+        _nes_w8(&w, sys->controller[i].value);
+        _nes_w8(&w, sys->controller_state[i]);
+    }
+    _nes_w_end(&w);
+
+    return (w.pos <= w.size) ? w.pos : 0;
+}
+
+// iterate over the sections of a serialized state, returns false at the end or on a truncated section
+static bool _nes_next_section(_nes_reader_t* r, uint32_t* out_tag, uint16_t* out_version, _nes_reader_t* out_section) {
+    if (!_nes_r_avail(r, _NES_SECTION_HEADER_SIZE)) {
+        return false;
+    }
+    *out_tag = (uint32_t)_nes_r_uint(r, 4, 0);
+    *out_version = (uint16_t)_nes_r_uint(r, 2, 0);
+    const uint32_t size = (uint32_t)_nes_r_uint(r, 4, 0);
+    if (!_nes_r_avail(r, size)) {
+        return false;
+    }
+    *out_section = (_nes_reader_t){ .ptr = r->ptr + r->pos, .size = size };
+    r->pos += size;
+    return true;
+}
+
+int nes_state_split(const uint8_t* buf, size_t size, size_t min_size, chips_range_t* out_ranges, int max_ranges) {
+    CHIPS_ASSERT(buf && out_ranges && (max_ranges > 0));
+    _nes_reader_t r = { .ptr = buf, .size = size, .pos = 8 };
+    size_t range_pos = 0;
+    int num_ranges = 0;
+    uint32_t tag;
+    uint16_t version;
+    _nes_reader_t sec;
+    while ((num_ranges + 1 < max_ranges) && _nes_next_section(&r, &tag, &version, &sec)) {
+        const size_t payload_pos = (size_t)(sec.ptr - buf);
+        if ((sec.size >= min_size) && (payload_pos > range_pos)) {
+            out_ranges[num_ranges++] = (chips_range_t){ .ptr = (void*)(buf + range_pos), .size = payload_pos - range_pos };
+            range_pos = payload_pos;
+        }
+    }
+    out_ranges[num_ranges++] = (chips_range_t){ .ptr = (void*)(buf + range_pos), .size = size - range_pos };
+    return num_ranges;
+}
+
+bool nes_load_state(nes_t* sys, const uint8_t* buf, size_t size) {
+    CHIPS_ASSERT(sys && sys->valid && buf);
+    _nes_reader_t r = { .ptr = buf, .size = size };
+    if ((size < 8) || (0 != memcmp(buf, "NESS", 4))) {
+        return false;
+    }
+    r.pos = 4;
+    if (_nes_r_uint(&r, 4, 0) != NES_STATE_VERSION) {
+        return false;
+    }
+
+    // first pass: check that the state is complete and belongs to the inserted cartridge
+    const size_t sections_pos = r.pos;
+    uint32_t tag;
+    uint16_t version;
+    _nes_reader_t sec;
+    bool cart_matches = false;
+    while (_nes_next_section(&r, &tag, &version, &sec)) {
+        if (tag == _NES_TAG_CART) {
+            nes_cartridge_header hdr;
+            uint32_t checksum = 0;
+            if (!_nes_r_avail(&sec, sizeof(hdr) + 4)) {
+                return false;
+            }
+            _nes_r_bytes(&sec, &hdr, sizeof(hdr));
+            _nes_r32(&sec, &checksum);
+            cart_matches = (0 == memcmp(&hdr, &sys->cart.header, sizeof(hdr))) && (checksum == sys->cart.checksum);
+        }
+    }
+    if ((r.pos != size) || !cart_matches) {
+        return false;
+    }
+
+    // second pass: restore the sections, fields missing in an older section version keep their value
+    r.pos = sections_pos;
+    while (_nes_next_section(&r, &tag, &version, &sec)) {
+        (void)version;
+        switch (tag) {
+            case _NES_TAG_CPU: {
+                m6502_t* cpu = &sys->cpu;
+                _nes_r16(&sec, &cpu->IR);
+                _nes_r16(&sec, &cpu->PC);
+                _nes_r16(&sec, &cpu->AD);
+                _nes_r8(&sec, &cpu->A);
+                _nes_r8(&sec, &cpu->X);
+                _nes_r8(&sec, &cpu->Y);
+                _nes_r8(&sec, &cpu->S);
+                _nes_r8(&sec, &cpu->P);
+                _nes_r64(&sec, &cpu->PINS);
+                _nes_r16(&sec, &cpu->irq_pip);
+                _nes_r16(&sec, &cpu->nmi_pip);
+                _nes_r8(&sec, &cpu->brk_flags);
+                _nes_r8(&sec, &cpu->bcd_enabled);
+                _nes_r64(&sec, &sys->pins);
+                _nes_r16(&sec, &sys->dma_wait);
+                _nes_r32(&sec, &sys->frame_count);
+                _nes_r8(&sec, &sys->ppu_phase);
+                if (sys->ppu_phase >= 5) {
+                    sys->ppu_phase = 0;
+                }
+            } break;
+            case _NES_TAG_PPU: {
+                r2c02_t* ppu = &sys->ppu;
+                _nes_r_bytes(&sec, ppu->oam.reg, sizeof(ppu->oam.reg));
+                _nes_rint(&sec, &ppu->cycle);
+                _nes_rint(&sec, &ppu->scanline);
+                _nes_rbool(&sec, &ppu->even_frame);
+                _nes_r_bytes(&sec, ppu->scanline_sprites, MAX_SCANLINE_SPRITES);
+                _nes_rint(&sec, &ppu->scanline_sprites_num);
+                if ((ppu->scanline_sprites_num < 0) || (ppu->scanline_sprites_num > (int)sizeof(ppu->scanline_sprites))) {
+                    ppu->scanline_sprites_num = 0;
+                }
+                _nes_r16(&sec, &ppu->data_address);
+                _nes_r16(&sec, &ppu->temp_address);
+                _nes_r8(&sec, &ppu->fine_x_scroll);
+                _nes_rbool(&sec, &ppu->first_write);
+                _nes_r8(&sec, &ppu->data_buffer);
+                _nes_r8(&sec, &ppu->sprite_data_address);
+                _nes_rbool(&sec, &ppu->request_nmi);
+                _nes_rbool(&sec, &ppu->request_irq);
+                _nes_r8(&sec, &ppu->ppu_status.reg);
+                _nes_r8(&sec, &ppu->ppu_mask.reg);
+                _nes_r8(&sec, &ppu->ppu_control.reg);
+                _nes_r_bytes(&sec, ppu->scanline_sprites + MAX_SCANLINE_SPRITES, sizeof(ppu->scanline_sprites) - MAX_SCANLINE_SPRITES);
+                r2c02_invalidate_sprites(ppu);
+            } break;
+            case _NES_TAG_APU: {
+                apu_t* apu = &sys->apu;
+                _nes_r32(&sec, &apu->clock_counter);
+                _nes_r32(&sec, &apu->frame_clock_counter);
+                _nes_rf64(&sec, &apu->global_time);
+                _nes_rf64(&sec, &apu->audio_time);
+                _nes_rf32(&sec, &apu->audio_sample);
+                for (int i = 0; i < 2; i++) {
+                    _nes_r_sequencer(&sec, &apu->pulse[i].seq);
+                    _nes_r_envelope(&sec, &apu->pulse[i].env);
+                    apu_sweeper_t* sw = &apu->pulse[i].sweeper;
+                    _nes_rbool(&sec, &sw->enabled);
+                    _nes_rbool(&sec, &sw->down);
+                    _nes_rbool(&sec, &sw->reload);
+                    _nes_r8(&sec, &sw->shift);
+                    _nes_r8(&sec, &sw->timer);
+                    _nes_r8(&sec, &sw->period);
+                    _nes_r16(&sec, &sw->change);
+                    _nes_rbool(&sec, &sw->mute);
+                    _nes_rf64(&sec, &apu->pulse[i].pulse.frequency);
+                    _nes_rf64(&sec, &apu->pulse[i].pulse.duty_cycle);
+                    _nes_rf64(&sec, &apu->pulse[i].pulse.amplitude);
+                    _nes_r8(&sec, &apu->pulse[i].len_counter);
+                    _nes_rbool(&sec, &apu->pulse[i].enable);
+                    _nes_rbool(&sec, &apu->pulse[i].halt);
+                    _nes_rf64(&sec, &apu->pulse[i].output);
+                }
+                _nes_r_sequencer(&sec, &apu->noise.seq);
+                _nes_r_envelope(&sec, &apu->noise.env);
+                _nes_r8(&sec, &apu->noise.len_counter);
+                _nes_rbool(&sec, &apu->noise.enable);
+                _nes_rbool(&sec, &apu->noise.halt);
+                _nes_rf64(&sec, &apu->noise.output);
+                apu->frame_counter = 0;
+                if (version >= 2) {
+                    _nes_r8(&sec, &apu->frame_counter);
+                }
+            } break;
+            case _NES_TAG_MAPR: {
+                // restores the mapper callbacks, then the register values
+                const nes_cartridge_header* hdr = &sys->cart.header;
+                _nes_use_mapper(sys, _nes_mapper_num(hdr));
+                _nes_r_bytes(&sec, &sys->mapper.data1, sizeof(sys->mapper.data1));
+                uint8_t mirroring = (uint8_t)sys->mapper.mirroring;
+                _nes_r8(&sec, &mirroring);
+                sys->mapper.mirroring = (name_table_mirroring_t)mirroring;
+                if (hdr->tile_page_count == 0) {
+                    _nes_r_bytes(&sec, sys->cart.character_ram, 0x2000);
+                }
+                // v2 was a host-layout dump of the mapper registers and is ignored beyond the v1 fields
+                if (version >= 3) {
+                    _nes_r32(&sec, &sys->mapper.irq_clock);
+                    _nes_rbool(&sec, &sys->mapper.irq);
+                    _nes_r_mapper(&sec, &sys->mapper, _nes_mapper_num(hdr));
+                }
+            } break;
+            case _NES_TAG_XAUD: {
+                // the channels were registered by the mapper (MAPR comes first), the buffered output is dropped
+                uint8_t num_channels = 0;
+                _nes_r8(&sec, &num_channels);
+                if (num_channels == sys->exp_audio.num_channels) {
+                    for (int i = 0; i < num_channels; i++) {
+                        nes_audio_channel_t* ch = &sys->exp_audio.channels[i];
+                        _nes_r32(&sec, &ch->clock);
+                        _nes_r32(&sec, &ch->timer);
+                        _nes_r32(&sec, &ch->phase);
+                        _nes_r32(&sec, &ch->accum);
+                        _nes_rf32(&sec, &ch->level);
+                    }
+                }
+                _nes_blip_reset(sys);
+            } break;
+            case _NES_TAG_RAM: {
+                _nes_r_bytes(&sec, sys->ram, sizeof(sys->ram));
+                _nes_r_bytes(&sec, sys->extended_ram, sizeof(sys->extended_ram));
+                _nes_r_bytes(&sec, sys->ppu_ram, sizeof(sys->ppu_ram));
+                _nes_r_bytes(&sec, sys->cart.four_screen_ram, sizeof(sys->cart.four_screen_ram));
+                _nes_r_bytes(&sec, sys->ppu_pal_ram, sizeof(sys->ppu_pal_ram));
+                for (int i = 0; i < 4; i++) {
+                    uint16_t addr = 0x2000;
+                    _nes_r16(&sec, &addr);
+                    sys->ppu_name_table[i] = _nes_name_table_page(((addr - 0x2000) >> 10) & 3);
+                }
+                if (sys->mapper.mirroring == NameTableBanks) {
+                    // pages banked from CHR-ROM have no PPU address, resolve them from the mapper registers
+                    _nes_mirroring(sys);
+                }
+            } break;
+            case _NES_TAG_CTRL: {
+                for (int i = 0; i < 2; i++) {
+                    _nes_r8(&sec, &sys->controller[i].value);
+                    _nes_r8(&sec, &sys->controller_state[i]);
+                }
+            } break;
+            default:
+                // unknown section from a newer version
+                break;
+        }
+    }
+    return true;
+}
+
+// ********* CHEATS **************
+
+// replaces mapper.read_prg while PRG-ROM patches exist, so that reads without cheats have no extra cost
+static uint8_t _nes_read_prg_cheats(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    uint8_t data = sys->cheats.read_prg(addr, sys);
+    if (sys->cheats.prg_pages & (1u << ((addr >> 10) & 31))) {
+        for (int i = 0; i < sys->cheats.num_cheats; i++) {
+            const nes_cheat_t* cheat = &sys->cheats.cheats[i];
+            if ((cheat->addr == addr) && (!cheat->has_compare || (cheat->compare == data))) {
+                data = cheat->value;
+            }
+        }
+    }
+    return data;
+}
+
+// (re-)wrap the mapper read function, called whenever the cheats or the mapper change
+static void _nes_install_cheats(nes_t* sys) {
+    if (sys->mapper.read_prg != _nes_read_prg_cheats) {
+        sys->cheats.read_prg = sys->mapper.read_prg;
+    }
+    sys->mapper.read_prg = (sys->cheats.prg_pages != 0) ? _nes_read_prg_cheats : sys->cheats.read_prg;
+}
+
+static int _nes_hex_digit(char c) {
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+// parse exactly num_digits hex digits, returns -1 on error
+static int _nes_parse_hex(const char* str, int num_digits) {
+    int val = 0;
+    for (int i = 0; i < num_digits; i++) {
+        const int digit = _nes_hex_digit(str[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        val = (val << 4) | digit;
+    }
+    return val;
+}
+
+bool nes_cheat_parse(const char* str, nes_cheat_t* out_cheat) {
+    CHIPS_ASSERT(str && out_cheat);
+    const size_t len = strlen(str);
+    memset(out_cheat, 0, sizeof(nes_cheat_t));
+    if ((len == 7) || (len == 10)) {
+        // raw code: AAAA:VV or AAAA?CC:VV
+        const int addr = _nes_parse_hex(str, 4);
+        const int compare = (len == 10) ? _nes_parse_hex(str + 5, 2) : 0;
+        const int value = _nes_parse_hex(str + len - 2, 2);
+        if ((addr < 0) || (compare < 0) || (value < 0) || (str[len - 3] != ':') || ((len == 10) && (str[4] != '?'))) {
+            return false;
+        }
+        out_cheat->addr = (uint16_t)addr;
+        out_cheat->value = (uint8_t)value;
+        out_cheat->compare = (uint8_t)compare;
+        out_cheat->has_compare = (len == 10);
+        return true;
+    }
+    if ((len != 6) && (len != 8)) {
+        return false;
+    }
+    // Game Genie: each letter encodes 4 bits, which are scrambled into address, value and compare
+    static const char letters[] = "APZLGITYEOXUKSVN";
+    uint8_t n[8];
+    for (size_t i = 0; i < len; i++) {
+        const char c = (str[i] >= 'a') && (str[i] <= 'z') ? (char)(str[i] - 'a' + 'A') : str[i];
+        const char* p = strchr(letters, c);
+        if (!p) {
+            return false;
+        }
+        n[i] = (uint8_t)(p - letters);
+    }
+    out_cheat->addr = (uint16_t)(0x8000 |
+        ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8) |
+        ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8));
+    out_cheat->value = (uint8_t)(((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7));
+    if (len == 6) {
+        out_cheat->value |= (n[5] & 8);
+    }
+    else {
+        out_cheat->value |= (n[7] & 8);
+        out_cheat->compare = (uint8_t)(((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8));
+        out_cheat->has_compare = true;
+    }
+    return true;
+}
+
+bool nes_add_cheat(nes_t* sys, nes_cheat_t cheat) {
+    CHIPS_ASSERT(sys && sys->valid);
+    const bool is_rom = cheat.addr >= 0x8000;
+    const bool is_ram = (cheat.addr < 0x2000) || ((cheat.addr >= 0x6000) && (cheat.addr < 0x8000));
+    if ((!is_rom && !is_ram) || (sys->cheats.num_cheats >= NES_MAX_CHEATS)) {
+        return false;
+    }
+    sys->cheats.cheats[sys->cheats.num_cheats++] = cheat;
+    if (is_rom) {
+        sys->cheats.prg_pages |= 1u << ((cheat.addr >> 10) & 31);
+        _nes_install_cheats(sys);
+    }
+    else {
+        sys->cheats.num_freezes++;
+    }
+    return true;
+}
+
+void nes_clear_cheats(nes_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    sys->cheats.num_cheats = 0;
+    sys->cheats.num_freezes = 0;
+    sys->cheats.prg_pages = 0;
+    _nes_install_cheats(sys);
+}
+
+static inline double _approx_sin(double t) {
+    double j = t * 0.15915;
+    j = j - (int)j;
+    return 20.785 * j * (j - 0.5) * (j - 1.0);
+}
+
+static double _pulse_sample(pulse_t* pulse, double t) {
+    double a = 0;
+    double b = 0;
+    double p = pulse->duty_cycle * 2.0 * M_PI;
+
+    const double harmonics = 20;
+    for (double n = 1; n < harmonics; n++) {
+        double c = n * pulse->frequency * 2.0 * M_PI * t;
+        a += -_approx_sin(c) / n;
+        b += -_approx_sin(c - p * n) / n;
+    }
+
+    return (2.0 * pulse->amplitude / M_PI) * (a - b);
+}
+
+static void _apu_env_clock(apu_envelope_t* env, bool loop) {
+    if (!env->start) {
+        if (env->divider_count == 0) {
+            env->divider_count = env->volume;
+
+            if (env->decay_count == 0) {
+                if (loop) env->decay_count = 15;
+            }
+            else
+                env->decay_count--;
+        }
+        else
+            env->divider_count--;
+    } else {
+        env->start = false;
+        env->decay_count = 15;
+        env->divider_count = env->volume;
+    }
+
+    env->output = env->disable ? env->volume : env->decay_count;
+}
+
+static void _apu_sweeper_track(apu_sweeper_t* sweeper, uint16_t target) {
+    if (sweeper->enabled) {
+        sweeper->change = target >> sweeper->shift;
+        sweeper->mute = (target < 8) || (target > 0x7FF);
+    }
+}
+
+static bool _apu_sweeper_clock(apu_sweeper_t* sweeper, uint16_t* target, bool channel) {
+    bool changed = false;
+    if (sweeper->timer == 0 && sweeper->enabled && sweeper->shift > 0 && !sweeper->mute) {
         if (*target >= 8 && sweeper->change < 0x07FF) {
             if (sweeper->down) {
                 *target -= sweeper->change - channel;
@@ -869,7 +2160,24 @@ static uint8_t _apu_seq_clock(apu_sequencer_t* seq, bool enable, _apu_seq_func f
     return seq->output;
 }
 
-static bool _apu_tick(apu_t* sys) {
+// quarter frame "beats" adjust the volume envelope, half frame "beats"
+// adjust the note length and frequency sweepers
+static void _apu_frame_clock(apu_t* sys, bool half_frame_clock) {
+    _apu_env_clock(&sys->pulse[0].env, sys->pulse[0].halt);
+    _apu_env_clock(&sys->pulse[1].env, sys->pulse[1].halt);
+    _apu_env_clock(&sys->noise.env, sys->noise.halt);
+    if (half_frame_clock) {
+        _apu_len_counter_clock(sys->pulse[0].enable, &sys->pulse[0].len_counter, sys->pulse[0].halt);
+        _apu_sweeper_clock(&sys->pulse[0].sweeper, &sys->pulse[0].seq.reload, 0);
+
+        _apu_len_counter_clock(sys->pulse[1].enable, &sys->pulse[1].len_counter, sys->pulse[1].halt);
+        _apu_sweeper_clock(&sys->pulse[1].sweeper, &sys->pulse[1].seq.reload, 0);
+
+        _apu_len_counter_clock(sys->noise.enable, &sys->noise.len_counter, sys->noise.halt);
+    }
+}
+
+static _NES_FORCE_INLINE bool _apu_tick(apu_t* sys, const nes_region_t region) {
     bool quarter_frame_clock = false;
     bool half_frame_clock = false;
     bool audio_sample_ready = false;
@@ -877,47 +2185,28 @@ static bool _apu_tick(apu_t* sys) {
     if (sys->clock_counter % 2 == 0) {
         sys->frame_clock_counter++;
 
-        // 4-Step Sequence Mode
-        switch (sys->frame_clock_counter) {
-            case 3729:
-                quarter_frame_clock = true;
-                break;
-            case 7457:
-                quarter_frame_clock = true;
-                half_frame_clock = true;
-                break;
-            case 11186:
-                quarter_frame_clock = true;
-                break;
-            case 14916:
-                quarter_frame_clock = true;
-                half_frame_clock = true;
-                sys->frame_clock_counter = 0;
-                break;
+        // 4-step sequence, or 5-step sequence ($4017 bit 7) which has no clock at the 4th step
+        const uint16_t* steps = _nes_timing[region].apu_frame_steps;
+        const bool five_step = 0 != (sys->frame_counter & 0x80);
+        if (sys->frame_clock_counter == steps[0]) {
+            quarter_frame_clock = true;
+        } else if (sys->frame_clock_counter == steps[1]) {
+            quarter_frame_clock = true;
+            half_frame_clock = true;
+        } else if (sys->frame_clock_counter == steps[2]) {
+            quarter_frame_clock = true;
+        } else if (sys->frame_clock_counter == steps[five_step ? 4 : 3]) {
+            quarter_frame_clock = true;
+            half_frame_clock = true;
+            sys->frame_clock_counter = 0;
         }
-
-        // Quater frame "beats" adjust the volume envelope
         if (quarter_frame_clock) {
-            _apu_env_clock(&sys->pulse[0].env, sys->pulse[0].halt);
-            _apu_env_clock(&sys->pulse[1].env, sys->pulse[1].halt);
-            _apu_env_clock(&sys->noise.env, sys->noise.halt);
-        }
-
-        // Half frame "beats" adjust the note length and
-        // frequency sweepers
-        if (half_frame_clock) {
-            _apu_len_counter_clock(sys->pulse[0].enable, &sys->pulse[0].len_counter, sys->pulse[0].halt);
-            _apu_sweeper_clock(&sys->pulse[0].sweeper, &sys->pulse[0].seq.reload, 0);
-
-            _apu_len_counter_clock(sys->pulse[1].enable, &sys->pulse[1].len_counter, sys->pulse[1].halt);
-            _apu_sweeper_clock(&sys->pulse[1].sweeper, &sys->pulse[1].seq.reload, 0);
-
-            _apu_len_counter_clock(sys->noise.enable, &sys->noise.len_counter, sys->noise.halt);
+            _apu_frame_clock(sys, half_frame_clock);
         }
 
         // pulse 1
         _apu_seq_clock(&sys->pulse[0].seq, sys->pulse[0].enable, _apu_pulse_seq);
-        sys->pulse[0].pulse.frequency = (double)_NES_FREQUENCY / (16.0 * (double)(sys->pulse[0].seq.reload + 1));
+        sys->pulse[0].pulse.frequency = (double)_nes_timing[region].cpu_frequency / (16.0 * (double)(sys->pulse[0].seq.reload + 1));
         sys->pulse[0].pulse.amplitude = (double)(sys->pulse[0].env.output - 1) / 16.0;
         float pulse1_sample = (float)(_pulse_sample(&sys->pulse[0].pulse, sys->global_time));
 
@@ -930,7 +2219,7 @@ static bool _apu_tick(apu_t* sys) {
 
         // pulse 2
         _apu_seq_clock(&sys->pulse[1].seq, sys->pulse[1].enable, _apu_pulse_seq);
-        sys->pulse[1].pulse.frequency = (double)_NES_FREQUENCY / (16.0 * (double)(sys->pulse[1].seq.reload + 1));
+        sys->pulse[1].pulse.frequency = (double)_nes_timing[region].cpu_frequency / (16.0 * (double)(sys->pulse[1].seq.reload + 1));
         sys->pulse[1].pulse.amplitude = (double)(sys->pulse[1].env.output - 1) / 16.0;
         float pulse2_sample = (float)(_pulse_sample(&sys->pulse[1].pulse, sys->global_time));
 
@@ -972,15 +2261,53 @@ static bool _apu_tick(apu_t* sys) {
     return audio_sample_ready;
 }
 
-static uint64_t _nes_tick(nes_t* sys, uint64_t pins) {
+static _NES_FORCE_INLINE void _nes_tick_ppu(nes_t* sys, uint64_t pins, const nes_region_t region) {
+    switch (region) {
+        case NES_REGION_PAL:    r2c02_tick_pal(&sys->ppu, pins); break;
+        case NES_REGION_DENDY:  r2c02_tick_dendy(&sys->ppu, pins); break;
+        default:                r2c02_tick(&sys->ppu, pins); break;
+    }
+}
+
+// tick the APU and PPU for one CPU cycle
+static _NES_FORCE_INLINE void _nes_tick_devices(nes_t* sys, uint64_t pins, const nes_region_t region) {
+    // tick the sound chip...
+    if(_apu_tick(&sys->apu, region)) {
+        // new sound sample ready
+        sys->audio_samples[sys->audio.sample_pos++] = sys->apu.audio_sample;
+        if (sys->audio.sample_pos == sys->audio.num_samples) {
+            if (sys->exp_audio.num_channels > 0) {
+                _nes_exp_audio_mix(sys);
+            }
+            if (sys->audio.callback.func) {
+                // new sample packet is ready
+                sys->audio.callback.func(sys->audio_samples, sys->audio.num_samples, sys->audio.callback.user_data);
+            }
+            sys->audio.sample_pos = 0;
+        }
+    }
+    _nes_tick_ppu(sys, pins, region);
+    _nes_tick_ppu(sys, pins, region);
+    _nes_tick_ppu(sys, pins, region);
+    if (region == NES_REGION_PAL) {
+        // 16 PPU dots per 5 CPU cycles
+        if (++sys->ppu_phase == 5) {
+            sys->ppu_phase = 0;
+            _nes_tick_ppu(sys, pins, region);
+        }
+    }
+}
+
+static _NES_FORCE_INLINE uint64_t _nes_tick_impl(nes_t* sys, uint64_t pins, const nes_region_t region) {
     if(sys->ppu.request_nmi) {
         pins |= M6502_NMI;
         sys->ppu.request_nmi = false;
     }
-    if(sys->ppu.request_irq) {
-        pins |= M6502_IRQ;
-        sys->ppu.request_irq = false;
+    // mapper IRQ counters are scheduled events, the line is level triggered
+    if ((int32_t)(sys->apu.clock_counter - sys->mapper.irq_clock) >= 0) {
+        sys->mapper.irq_event(sys);
     }
+    pins = sys->mapper.irq ? (pins | M6502_IRQ) : (pins & ~M6502_IRQ);
     if(sys->dma_wait) {
         sys->dma_wait--;
     } else {
@@ -999,33 +2326,235 @@ static uint64_t _nes_tick(nes_t* sys, uint64_t pins) {
             nes_mem_write(sys, addr, M6502_GET_DATA(pins));
         }
     }
+    _nes_tick_devices(sys, pins, region);
+    return pins;
+}
 
-    // tick the sound chip...
-    if(_apu_tick(&sys->apu)) {
-        // new sound sample ready
-        sys->audio.sample_buffer[sys->audio.sample_pos++] = sys->apu.audio_sample;
-        if (sys->audio.sample_pos == sys->audio.num_samples) {
-            if (sys->audio.callback.func) {
-                // new sample packet is ready
-                sys->audio.callback.func(sys->audio.sample_buffer, sys->audio.num_samples, sys->audio.callback.user_data);
-            }
-            sys->audio.sample_pos = 0;
+/*
+    Fast-forward the APU and PPU through (a part of) an OAM DMA stall,
+    returns the number of ticks executed. The CPU is halted, so NMI and
+    IRQ requests stay pending until the next _nes_tick().
+*/
+static _NES_FORCE_INLINE uint32_t _nes_dma_stall_impl(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame, const nes_region_t region) {
+    const uint32_t frame_count = sys->frame_count;
+    const uint32_t num_ticks = (sys->dma_wait < max_ticks) ? sys->dma_wait : max_ticks;
+    uint32_t tick = 0;
+    while (tick < num_ticks) {
+        _nes_tick_devices(sys, pins, region);
+        tick++;
+        if (stop_at_frame && (frame_count != sys->frame_count)) {
+            break;
         }
     }
-    r2c02_tick(&sys->ppu, pins);
-    r2c02_tick(&sys->ppu, pins);
-    r2c02_tick(&sys->ppu, pins);
+    sys->dma_wait -= (uint16_t)tick;
+    return tick;
+}
 
-    return pins;
+// one instance of the per-tick functions for each region, with the timing constants folded in
+#define _NES_INSTANTIATE_REGION(suffix, region) \
+    static uint64_t _nes_tick_##suffix(nes_t* sys, uint64_t pins) { \
+        return _nes_tick_impl(sys, pins, region); \
+    } \
+    static uint32_t _nes_dma_stall_##suffix(nes_t* sys, uint64_t pins, uint32_t max_ticks, bool stop_at_frame) { \
+        return _nes_dma_stall_impl(sys, pins, max_ticks, stop_at_frame, region); \
+    }
+_NES_INSTANTIATE_REGION(ntsc, NES_REGION_NTSC)
+_NES_INSTANTIATE_REGION(pal, NES_REGION_PAL)
+_NES_INSTANTIATE_REGION(dendy, NES_REGION_DENDY)
+
+// copy a 256 byte page into OAM, starting at the OAM address
+static void _nes_oam_dma(nes_t* sys, uint8_t page) {
+    const uint16_t base = (uint16_t)(page << 8);
+    uint8_t* oam = sys->ppu.oam.reg;
+    const uint8_t oam_addr = sys->ppu.sprite_data_address;
+    if (base < 0x2000) {
+        // fast path for the internal RAM, reads have no side effects
+        const uint8_t* page_ptr = sys->ram + (base & 0x7ff);
+        memcpy(oam + oam_addr, page_ptr, 256 - oam_addr);
+        if (oam_addr) {
+            memcpy(oam, page_ptr + (256 - oam_addr), oam_addr);
+        }
+    }
+    else {
+        // any other page is read through the memory map (SRAM, PRG-ROM, registers)
+        for (int i = 0; i < 256; i++) {
+            oam[(uint8_t)(oam_addr + i)] = nes_mem_read(sys, (uint16_t)(base | i), false);
+        }
+    }
+    r2c02_invalidate_sprites(&sys->ppu);
+}
+
+// *************************
+// ***** EXPANSION AUDIO ***
+// *************************
+/*
+    Expansion audio channels are not ticked. A channel synthesizes its
+    waveform on demand, up to the current CPU clock before a write to its
+    registers and at the end of each sample packet, and only reports its
+    level changes. These are added as band-limited steps at their exact
+    CPU clock into a shared buffer (a "blip buffer"), which is integrated
+    and mixed into the APU samples once per sample packet. The cost
+    depends on the number of level changes, not on the number of channels,
+    and the per-tick code has no expansion audio path at all.
+*/
+#define _NES_BLIP_PHASE_SHIFT (32 - 5)      // log2(NES_BLIP_PHASES)
+#define _NES_BLIP_LATENCY (2)               // samples of headroom, absorbs the rounding of the packet length
+#define _NES_IRQ_NEVER (0x40000000)         // IRQ event distance of a disabled counter
+
+// windowed sinc kernel for each sub-sample phase, integrated into steps by _nes_exp_audio_mix()
+static void _nes_blip_init(nes_t* sys) {
+    const double half = NES_BLIP_TAPS / 2;
+    for (int p = 0; p < NES_BLIP_PHASES; p++) {
+        double kernel[NES_BLIP_TAPS];
+        double sum = 0.0;
+        for (int i = 0; i < NES_BLIP_TAPS; i++) {
+            const double x = (double)(i - half + 1) - (double)p / NES_BLIP_PHASES;
+            const double window = 0.5 + 0.5 * cos(M_PI * x / half);
+            // cut off a bit below the Nyquist frequency
+            const double sinc = (x == 0.0) ? 1.0 : sin(M_PI * 0.9 * x) / (M_PI * 0.9 * x);
+            kernel[i] = sinc * window;
+            sum += kernel[i];
+        }
+        for (int i = 0; i < NES_BLIP_TAPS; i++) {
+            sys->blip_kernel[p][i] = (float)(kernel[i] / sum);
+        }
+    }
+}
+
+// drop the buffered output and restart at the current CPU clock
+static void _nes_blip_reset(nes_t* sys) {
+    nes_blip_t* blip = &sys->exp_audio.blip;
+    const uint64_t factor = blip->factor;
+    memset(blip, 0, sizeof(nes_blip_t));
+    blip->factor = factor;
+    blip->offset = (uint64_t)_NES_BLIP_LATENCY << 32;
+    blip->frame_clock = sys->apu.clock_counter;
+}
+
+static void _nes_blip_add_delta(nes_t* sys, uint32_t clock, float delta) {
+    nes_blip_t* blip = &sys->exp_audio.blip;
+    const uint64_t t = blip->offset + (uint64_t)(clock - blip->frame_clock) * blip->factor;
+    const uint64_t pos = t >> 32;
+    if (pos + NES_BLIP_TAPS > NES_BLIP_BUFFER_SIZE) {
+        // only when no packet was completed for a long time
+        return;
+    }
+    const float* kernel = sys->blip_kernel[(t >> _NES_BLIP_PHASE_SHIFT) & (NES_BLIP_PHASES - 1)];
+    float* buf = &blip->buf[pos];
+    for (int i = 0; i < NES_BLIP_TAPS; i++) {
+        buf[i] += delta * kernel[i];
+    }
+}
+
+static void _nes_exp_audio_add_channel(nes_t* sys, void (*run)(void* user_data, int index, uint32_t end_clock)) {
+    CHIPS_ASSERT(sys->exp_audio.num_channels < NES_MAX_AUDIO_CHANNELS);
+    sys->exp_audio.channels[sys->exp_audio.num_channels++] = (nes_audio_channel_t){
+        .run = run,
+        .clock = sys->apu.clock_counter,
+    };
+}
+
+// set the output of a channel at a CPU clock (not before the end of the last sample packet)
+static void _nes_exp_audio_level(nes_t* sys, nes_audio_channel_t* ch, uint32_t clock, float level) {
+    if (level != ch->level) {
+        _nes_blip_add_delta(sys, clock, level - ch->level);
+        ch->level = level;
+    }
+}
+
+// bring all channels up to the current CPU clock, call before changing their registers
+static void _nes_exp_audio_sync(nes_t* sys) {
+    const uint32_t clock = sys->apu.clock_counter;
+    for (int i = 0; i < sys->exp_audio.num_channels; i++) {
+        sys->exp_audio.channels[i].run(sys, i, clock);
+    }
+}
+
+/*
+    Advance a channel to end_clock in waveform steps of period CPU cycles,
+    step() updates the channel and returns its new level. Inlined into
+    each channel type, so the step function is a direct call.
+*/
+static _NES_FORCE_INLINE void _nes_exp_audio_steps(nes_t* sys, nes_audio_channel_t* ch, uint32_t end_clock, uint32_t period, float (*step)(nes_t* sys, nes_audio_channel_t* ch)) {
+    while ((int32_t)(end_clock - ch->clock) > 0) {
+        const uint32_t cycles = end_clock - ch->clock;
+        if (ch->timer > cycles) {
+            ch->timer -= cycles;
+            ch->clock = end_clock;
+            break;
+        }
+        ch->clock += ch->timer;
+        ch->timer = period;
+        _nes_exp_audio_level(sys, ch, ch->clock, step(sys, ch));
+    }
+}
+
+// called when a sample packet is complete: add the expansion audio to audio_samples
+static void _nes_exp_audio_mix(nes_t* sys) {
+    _nes_exp_audio_sync(sys);
+    nes_blip_t* blip = &sys->exp_audio.blip;
+    blip->offset += (uint64_t)(sys->apu.clock_counter - blip->frame_clock) * blip->factor;
+    blip->frame_clock = sys->apu.clock_counter;
+
+    // the samples before offset can't receive any more steps
+    const int available = (int)(blip->offset >> 32);
+    const int num_samples = (available < sys->audio.num_samples) ? available : sys->audio.num_samples;
+    float integrator = blip->integrator;
+    float dc_in = blip->dc_in;
+    float dc_out = blip->dc_out;
+    for (int i = 0; i < num_samples; i++) {
+        integrator += blip->buf[i];
+        // remove the DC offset of the channel levels
+        dc_out = integrator - dc_in + 0.999f * dc_out;
+        dc_in = integrator;
+        sys->audio_samples[i] += dc_out;
+    }
+    blip->integrator = integrator;
+    blip->dc_in = dc_in;
+    blip->dc_out = dc_out;
+    const int remaining = (int)(NES_BLIP_BUFFER_SIZE - num_samples);
+    memmove(blip->buf, blip->buf + num_samples, (size_t)remaining * sizeof(float));
+    memset(blip->buf + remaining, 0, (size_t)num_samples * sizeof(float));
+    blip->offset -= (uint64_t)num_samples << 32;
+}
+
+static uint8_t _nes_read_exp0(uint16_t addr, bool read_only, void* user_data) {
+    (void)addr; (void)read_only; (void)user_data;
+    return 0xFF;
+}
+
+static void _nes_write_exp0(uint16_t addr, uint8_t value, void* user_data) {
+    (void)addr; (void)value; (void)user_data;
+}
+
+static void _nes_irq_none(void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    sys->mapper.irq_clock = sys->apu.clock_counter + _NES_IRQ_NEVER;
+}
+
+// number of 1KB CHR pages and 8KB PRG pages, bank registers are reduced modulo these on write
+static uint32_t _nes_chr_pages_1k(const nes_t* sys) {
+    return sys->cart.header.tile_page_count ? (uint32_t)sys->cart.header.tile_page_count * 8 : 8;
+}
+
+static uint32_t _nes_prg_pages_8k(const nes_t* sys) {
+    return sys->cart.header.prg_page_count ? (uint32_t)sys->cart.header.prg_page_count * 2 : 2;
 }
 
 // *************************
 // ********* MAPPERS *******
 // *************************
-static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
-    bool supported = true;
-    memset(&sys->cart.mapper, 0, sizeof(sys->cart.mapper));
-    sys->cart.mapper = (nes_mapper_t){
+// the mapper callbacks, initial register values and expansion audio channels of a
+// mapper, returns false if the mapper isn't supported (see nes_mapper_supported())
+typedef struct {
+    nes_mapper_t mapper;
+    int num_channels;
+    void (*channels[NES_MAX_AUDIO_CHANNELS])(void* user_data, int index, uint32_t end_clock);
+} _nes_mapper_setup_t;
+
+static bool _nes_mapper_setup(uint8_t mapper_num, uint8_t prg_page_count, _nes_mapper_setup_t* setup) {
+    memset(setup, 0, sizeof(_nes_mapper_setup_t));
+    setup->mapper = (nes_mapper_t){
         .read_prg = _nes_read_prg0,
         .write_prg = _nes_write_prg0,
         .read_chr = _nes_read_chr0,
@@ -1035,10 +2564,10 @@ static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
         case 0:
             break;
         case 1:
-            sys->cart.mapper = (nes_mapper_t) {
+            setup->mapper = (nes_mapper_t) {
                 .data1 = {
                     .ctrl_reg = 0x1c,
-                    .prg_bank_sel16[1] = sys->cart.header.prg_page_count - 1,
+                    .prg_bank_sel16[1] = prg_page_count - 1,
                 },
                 .read_prg = _nes_read_prg1,
                 .write_prg = _nes_write_prg1,
@@ -1047,7 +2576,7 @@ static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
             };
             break;
         case 2:
-            sys->cart.mapper = (nes_mapper_t) {
+            setup->mapper = (nes_mapper_t) {
                 .read_prg = _nes_read_prg2,
                 .write_prg = _nes_write_prg2,
                 .read_chr = _nes_read_chr0,
@@ -1055,7 +2584,7 @@ static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
             };
             break;
         case 3:
-            sys->cart.mapper = (nes_mapper_t) {
+            setup->mapper = (nes_mapper_t) {
                 .read_prg = _nes_read_prg3,
                 .write_prg = _nes_write_prg3,
                 .read_chr = _nes_read_chr3,
@@ -1063,7 +2592,7 @@ static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
             };
             break;
         case 7:
-            sys->cart.mapper = (nes_mapper_t) {
+            setup->mapper = (nes_mapper_t) {
                 .mirroring = OneScreenLower,
                 .read_prg = _nes_read_prg7,
                 .write_prg = _nes_write_prg7,
@@ -1072,43 +2601,121 @@ static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
             };
             break;
         case 66:
-            sys->cart.mapper = (nes_mapper_t) {
+            setup->mapper = (nes_mapper_t) {
                 .read_prg = _nes_read_prg66,
                 .write_prg = _nes_write_prg66,
                 .read_chr = _nes_read_chr66,
                 .write_chr = _nes_write_chr0,
             };
             break;
-        default:
-            supported = false;
+        case 19:
+            // Namco 163
+            setup->mapper = (nes_mapper_t) {
+                .data19 = {
+                    .prg_bank = { 0, 1, 2 },
+                    .chr_bank = { [8] = 0xE0, [9] = 0xE0, [10] = 0xE1, [11] = 0xE1 },
+                },
+                .read_prg = _nes_read_prg19,
+                .write_prg = _nes_write_prg19,
+                .read_chr = _nes_read_chr19,
+                .write_chr = _nes_write_chr0,
+                .read_exp = _nes_read_exp19,
+                .write_exp = _nes_write_exp19,
+                .irq_event = _nes_irq19,
+            };
+            for (int i = 0; i < 8; i++) {
+                setup->channels[setup->num_channels++] = _nes_run_n163;
+            }
             break;
+        case 24:
+        case 26:
+            // Konami VRC6, mapper 26 has the register address lines A0 and A1 swapped
+            setup->mapper = (nes_mapper_t) {
+                .data24 = { .swap_a0_a1 = (mapper_num == 26) },
+                .read_prg = _nes_read_prg24,
+                .write_prg = _nes_write_prg24,
+                .read_chr = _nes_read_chr24,
+                .write_chr = _nes_write_chr0,
+                .irq_event = _nes_irq24,
+            };
+            setup->channels[setup->num_channels++] = _nes_run_vrc6_pulse;
+            setup->channels[setup->num_channels++] = _nes_run_vrc6_pulse;
+            setup->channels[setup->num_channels++] = _nes_run_vrc6_saw;
+            break;
+        case 69:
+            // Sunsoft FME-7 / 5B
+            setup->mapper = (nes_mapper_t) {
+                .read_prg = _nes_read_prg69,
+                .write_prg = _nes_write_prg69,
+                .read_chr = _nes_read_chr69,
+                .write_chr = _nes_write_chr0,
+                .irq_event = _nes_irq69,
+            };
+            for (int i = 0; i < 3; i++) {
+                setup->channels[setup->num_channels++] = _nes_run_5b;
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool _nes_use_mapper(nes_t* sys, uint8_t mapper_num) {
+    _nes_mapper_setup_t setup;
+    const bool supported = _nes_mapper_setup(mapper_num, sys->cart.header.prg_page_count, &setup);
+    sys->mapper = setup.mapper;
+    sys->exp_audio.num_channels = 0;
+    for (int i = 0; i < setup.num_channels; i++) {
+        _nes_exp_audio_add_channel(sys, setup.channels[i]);
+    }
+    if (!sys->mapper.read_exp) {
+        sys->mapper.read_exp = _nes_read_exp0;
+        sys->mapper.write_exp = _nes_write_exp0;
+    }
+    if (!sys->mapper.irq_event) {
+        sys->mapper.irq_event = _nes_irq_none;
     }
-    sys->cart.mapper.mirroring = sys->cart.header.mirror_mode ? Vertical : Horizontal;
+    sys->mapper.irq_clock = sys->apu.clock_counter + _NES_IRQ_NEVER;
+    _nes_blip_reset(sys);
+    sys->mapper.mirroring = (mapper_num == 19) ? NameTableBanks : (sys->cart.header.mirror_mode ? Vertical : Horizontal);
     _nes_mirroring(sys);
+    _nes_install_cheats(sys);
     return supported;
 }
 
+bool nes_mapper_supported(uint8_t mapper_num) {
+    _nes_mapper_setup_t setup;
+    return _nes_mapper_setup(mapper_num, 1, &setup);
+}
+
+// byte offset of a nametable page in nes_t, pages 0 and 1 are the console's CIRAM,
+// pages 2 and 3 the extra VRAM of four-screen cartridges
+static uint32_t _nes_name_table_page(int page) {
+    if (page < 2) {
+        return (uint32_t)(offsetof(nes_t, ppu_ram) + page * 0x400);
+    }
+    return (uint32_t)(offsetof(nes_t, cart.four_screen_ram) + (page - 2) * 0x400);
+}
+
+// resolve the nametable pages, the PPU accesses them through nes_t.ppu_name_table without further checks
 static void _nes_mirroring(nes_t* sys) {
-    switch (sys->cart.mapper.mirroring) {
-        case Horizontal:
-            sys->ppu_name_table[0] = sys->ppu_name_table[1] = 0x2000;
-            sys->ppu_name_table[2] = sys->ppu_name_table[3] = 0x2400;
-            break;
-        case Vertical:
-            sys->ppu_name_table[0] = sys->ppu_name_table[2] = 0x2000;
-            sys->ppu_name_table[1] = sys->ppu_name_table[3] = 0x2400;
-            break;
-        case OneScreenLower:
-            sys->ppu_name_table[0] = sys->ppu_name_table[1] = sys->ppu_name_table[2] = sys->ppu_name_table[3] = 0x2000;
-            break;
-        case OneScreenHigher:
-            sys->ppu_name_table[0] = sys->ppu_name_table[1] = sys->ppu_name_table[2] = sys->ppu_name_table[3] = 0x2400;
-            break;
-        case FourScreen:
-            sys->ppu_name_table[0] = 0x2800;
-            break;
-        default:
-            sys->ppu_name_table[0] = sys->ppu_name_table[1] = sys->ppu_name_table[2] = sys->ppu_name_table[3] = 0x2000;
+    static const uint8_t pages[][4] = {
+        [Horizontal]        = { 0, 0, 1, 1 },
+        [Vertical]          = { 0, 1, 0, 1 },
+        [FourScreen]        = { 0, 1, 2, 3 },
+        [OneScreenLower]    = { 0, 0, 0, 0 },
+        [OneScreenHigher]   = { 1, 1, 1, 1 },
+    };
+    // four-screen cartridges ignore the mirroring control of the mapper
+    const name_table_mirroring_t mirroring = sys->cart.header.vram_expansion ? FourScreen : sys->mapper.mirroring;
+    if (mirroring == NameTableBanks) {
+        _nes_n163_name_tables(sys);
+        return;
+    }
+    const uint8_t* p = (mirroring <= OneScreenHigher) ? pages[mirroring] : pages[Horizontal];
+    for (int i = 0; i < 4; i++) {
+        sys->ppu_name_table[i] = _nes_name_table_page(p[i]);
     }
 }
 
@@ -1146,13 +2753,13 @@ static uint8_t _nes_read_prg1(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     uint32_t mapped_addr;
-    if (sys->cart.mapper.data1.ctrl_reg & 0b01000) {
+    if (sys->mapper.data1.ctrl_reg & 0b01000) {
         // 16K Mode
         int sel = (addr < 0xc000) ? 0 : 1;
-        mapped_addr = sys->cart.mapper.data1.prg_bank_sel16[sel] * 0x4000 + (addr & 0x3fff);
+        mapped_addr = sys->mapper.data1.prg_bank_sel16[sel] * 0x4000 + (addr & 0x3fff);
     } else {
         // 32K Mode
-        mapped_addr = sys->cart.mapper.data1.prg_bank_sel32 * 0x8000 + (addr & 0x7FFF);
+        mapped_addr = sys->mapper.data1.prg_bank_sel32 * 0x8000 + (addr & 0x7FFF);
     }
     return sys->cart.rom[mapped_addr];
 }
@@ -1161,13 +2768,13 @@ static uint8_t _nes_read_chr1(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if (sys->cart.header.tile_page_count != 0) {
-        if (sys->cart.mapper.data1.ctrl_reg & 0x10) {
+        if (sys->mapper.data1.ctrl_reg & 0x10) {
             // 4K CHR Bank Mode
             int sel = (addr < 0x1000) ? 0 : 1;
-            addr = sys->cart.mapper.data1.chr_bank_sel4[sel] * 0x1000 + (addr & 0x0fff);
+            addr = sys->mapper.data1.chr_bank_sel4[sel] * 0x1000 + (addr & 0x0fff);
         } else {
             // 8K CHR Bank Mode
-            addr = sys->cart.mapper.data1.chr_bank_sel8 * 0x2000 + (addr & 0x1FFF);
+            addr = sys->mapper.data1.chr_bank_sel8 * 0x2000 + (addr & 0x1FFF);
         }
     }
     return sys->cart.character_ram[addr];
@@ -1177,70 +2784,71 @@ static void _nes_write_prg1(uint16_t addr, uint8_t data, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(data & 0x80) {
-        sys->cart.mapper.data1.load_reg = 0x00;
-        sys->cart.mapper.data1.load_reg_count = 0;
-        sys->cart.mapper.data1.ctrl_reg = sys->cart.mapper.data1.ctrl_reg | 0x0c;
+        sys->mapper.data1.load_reg = 0x00;
+        sys->mapper.data1.load_reg_count = 0;
+        sys->mapper.data1.ctrl_reg = sys->mapper.data1.ctrl_reg | 0x0c;
     } else {
-        sys->cart.mapper.data1.load_reg >>= 1;
-        sys->cart.mapper.data1.load_reg |= (data & 0x01) << 4;
-        sys->cart.mapper.data1.load_reg_count++;
-        if (sys->cart.mapper.data1.load_reg_count == 5) {
+        sys->mapper.data1.load_reg >>= 1;
+        sys->mapper.data1.load_reg |= (data & 0x01) << 4;
+        sys->mapper.data1.load_reg_count++;
+        if (sys->mapper.data1.load_reg_count == 5) {
             uint8_t tgt_reg = (addr >> 13) & 0x03;
 
             switch (tgt_reg) {
                 case 0:
                     // 0x8000 - 0x9FFF: Set Control Register
-                    sys->cart.mapper.data1.ctrl_reg = sys->cart.mapper.data1.load_reg & 0x1f;
+                    sys->mapper.data1.ctrl_reg = sys->mapper.data1.load_reg & 0x1f;
 
-                    switch (sys->cart.mapper.data1.ctrl_reg & 0x03)
+                    switch (sys->mapper.data1.ctrl_reg & 0x03)
                     {
-                    case 0: sys->cart.mapper.mirroring = OneScreenLower; break;
-                    case 1: sys->cart.mapper.mirroring = OneScreenHigher; break;
-                    case 2: sys->cart.mapper.mirroring = Vertical;     break;
-                    case 3: sys->cart.mapper.mirroring = Horizontal;   break;
+                    case 0: sys->mapper.mirroring = OneScreenLower; break;
+                    case 1: sys->mapper.mirroring = OneScreenHigher; break;
+                    case 2: sys->mapper.mirroring = Vertical;     break;
+                    case 3: sys->mapper.mirroring = Horizontal;   break;
                     }
+                    _nes_mirroring(sys);
                     break;
                 case 1:
                     // 0xA000 - 0xBFFF: Set CHR Bank Lo
-                    if (sys->cart.mapper.data1.ctrl_reg & 0b10000) {
+                    if (sys->mapper.data1.ctrl_reg & 0b10000) {
                         // 4K CHR Bank at PPU 0x0000
-                        sys->cart.mapper.data1.chr_bank_sel4[0] = sys->cart.mapper.data1.load_reg & 0x1f;
+                        sys->mapper.data1.chr_bank_sel4[0] = sys->mapper.data1.load_reg & 0x1f;
                     } else {
                         // 8K CHR Bank at PPU 0x0000
-                        sys->cart.mapper.data1.chr_bank_sel8 = sys->cart.mapper.data1.load_reg & 0x1e;
+                        sys->mapper.data1.chr_bank_sel8 = sys->mapper.data1.load_reg & 0x1e;
                     }
                     break;
                 case 2:
                     // 0xC000 - 0xDFFF: Set CHR Bank Hi
-                    if (sys->cart.mapper.data1.ctrl_reg & 0b10000) {
+                    if (sys->mapper.data1.ctrl_reg & 0b10000) {
                         // 4K CHR Bank at PPU 0x1000
-                        sys->cart.mapper.data1.chr_bank_sel4[1] = sys->cart.mapper.data1.load_reg & 0x1f;
+                        sys->mapper.data1.chr_bank_sel4[1] = sys->mapper.data1.load_reg & 0x1f;
                     }
                     break;
                 case 3: {
                     // 0xE000 - 0xFFFF: Configure PRG Banks
-                    uint8_t prg_mode = (sys->cart.mapper.data1.ctrl_reg >> 2) & 0x03;
+                    uint8_t prg_mode = (sys->mapper.data1.ctrl_reg >> 2) & 0x03;
 
                     if (prg_mode == 0 || prg_mode == 1) {
                         // Set 32K PRG Bank at CPU 0x8000
-                        sys->cart.mapper.data1.prg_bank_sel32 = (sys->cart.mapper.data1.load_reg & 0x0e) >> 1;
+                        sys->mapper.data1.prg_bank_sel32 = (sys->mapper.data1.load_reg & 0x0e) >> 1;
                     } else if (prg_mode == 2) {
                         // Fix 16KB PRG Bank at CPU 0x8000 to First Bank
-                        sys->cart.mapper.data1.prg_bank_sel16[0] = 0;
+                        sys->mapper.data1.prg_bank_sel16[0] = 0;
                         // Set 16KB PRG Bank at CPU 0xC000
-                        sys->cart.mapper.data1.prg_bank_sel16[1] = sys->cart.mapper.data1.load_reg & 0x0f;
+                        sys->mapper.data1.prg_bank_sel16[1] = sys->mapper.data1.load_reg & 0x0f;
                     } else if (prg_mode == 3) {
                         // Set 16KB PRG Bank at CPU 0x8000
-                        sys->cart.mapper.data1.prg_bank_sel16[0] = sys->cart.mapper.data1.load_reg & 0x0f;
+                        sys->mapper.data1.prg_bank_sel16[0] = sys->mapper.data1.load_reg & 0x0f;
                         // Fix 16KB PRG Bank at CPU 0xC000 to Last Bank
-                        sys->cart.mapper.data1.prg_bank_sel16[1] = sys->cart.header.prg_page_count - 1;
+                        sys->mapper.data1.prg_bank_sel16[1] = sys->cart.header.prg_page_count - 1;
                     }
                 } break;
             }
 
             // reset load register
-            sys->cart.mapper.data1.load_reg = 0x00;
-            sys->cart.mapper.data1.load_reg_count = 0;
+            sys->mapper.data1.load_reg = 0x00;
+            sys->mapper.data1.load_reg_count = 0;
         }
     }
 }
@@ -1253,7 +2861,7 @@ static uint8_t _nes_read_prg2(uint16_t addr, void* user_data) {
     uint16_t page;
     if(addr < 0xc000) {
         // CPU $8000-$BFFF: 16 KB switchable PRG ROM bank
-        page = sys->cart.mapper.data2.select_prg;
+        page = sys->mapper.data2.select_prg;
     } else {
         // CPU $C000-$FFFF: 16 KB PRG ROM bank, fixed to the last bank
         page = sys->cart.header.prg_page_count - 1;
@@ -1266,7 +2874,7 @@ static void _nes_write_prg2(uint16_t addr, uint8_t value, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     CHIPS_ASSERT(value < sys->cart.header.prg_page_count);
-    sys->cart.mapper.data2.select_prg = value;
+    sys->mapper.data2.select_prg = value;
 }
 
 // ********* MAPPER 3 **************
@@ -1286,13 +2894,13 @@ static void _nes_write_prg3(uint16_t addr, uint8_t value, void* user_data) {
     (void)addr;
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
-    sys->cart.mapper.data3.select_chr = value & 0x3;
+    sys->mapper.data3.select_chr = value & 0x3;
 }
 
 static uint8_t _nes_read_chr3(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
-    return sys->cart.character_ram[addr | (sys->cart.mapper.data3.select_chr << 13)];
+    return sys->cart.character_ram[addr | (sys->mapper.data3.select_chr << 13)];
 }
 
 // ********* MAPPER 7 **************
@@ -1301,7 +2909,7 @@ static uint8_t _nes_read_prg7(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(addr >= 0x8000) {
-        return sys->cart.rom[(sys->cart.mapper.data7.prg_bank * 0x8000) + (addr & 0x7fff)];
+        return sys->cart.rom[(sys->mapper.data7.prg_bank * 0x8000) + (addr & 0x7fff)];
     } else {
         return 0;
     }
@@ -1311,8 +2919,8 @@ static void _nes_write_prg7(uint16_t addr, uint8_t data, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(addr >= 0x8000) {
-        sys->cart.mapper.data7.prg_bank = (data & 0x07);
-        sys->cart.mapper.mirroring = (data & 0x10) ? OneScreenHigher : OneScreenLower;
+        sys->mapper.data7.prg_bank = (data & 0x07);
+        sys->mapper.mirroring = (data & 0x10) ? OneScreenHigher : OneScreenLower;
         _nes_mirroring(sys);
     }
 }
@@ -1340,7 +2948,7 @@ static uint8_t _nes_read_prg66(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(addr >= 0x8000) {
-        return sys->cart.rom[(sys->cart.mapper.data66.prg_bank * 0x8000) + (addr & 0x7fff)];
+        return sys->cart.rom[(sys->mapper.data66.prg_bank * 0x8000) + (addr & 0x7fff)];
     } else {
         return 0;
     }
@@ -1350,9 +2958,9 @@ static void _nes_write_prg66(uint16_t addr, uint8_t data, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(addr >= 0x8000) {
-        sys->cart.mapper.data66.prg_bank = ((data & 0x30) >> 4);
-        sys->cart.mapper.data66.chr_bank = (data & 0x3);
-        sys->cart.mapper.mirroring = Vertical;
+        sys->mapper.data66.prg_bank = ((data & 0x30) >> 4);
+        sys->mapper.data66.chr_bank = (data & 0x3);
+        sys->mapper.mirroring = Vertical;
         _nes_mirroring(sys);
     }
 }
@@ -1361,9 +2969,534 @@ static uint8_t _nes_read_chr66(uint16_t addr, void* user_data) {
     nes_t* sys = (nes_t*)user_data;
     CHIPS_ASSERT(sys && sys->valid);
     if(addr < 0x2000) {
-        return sys->cart.character_ram[(sys->cart.mapper.data66.chr_bank * 0x2000) + addr];
+        return sys->cart.character_ram[(sys->mapper.data66.chr_bank * 0x2000) + addr];
     }
     return 0;
 }
 
+// ********* MAPPER 19 **************
+/*
+    Namco 163: 8KB PRG pages, 1KB CHR pages, nametable pages from CIRAM
+    or CHR-ROM, a 15-bit IRQ counter and up to 8 time-multiplexed
+    wavetable channels in 128 bytes of sound RAM (CHR-RAM in CIRAM via
+    pattern pages >= $E0 is not implemented).
+*/
+#define _NES_N163_SCALE (1.0f / 1200.0f)
+
+static uint8_t _nes_read_prg19(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    const uint32_t slot = (addr >> 13) & 3;
+    const uint32_t page = (slot < 3) ? sys->mapper.data19.prg_bank[slot] : _nes_prg_pages_8k(sys) - 1;
+    return sys->cart.rom[page * 0x2000 + (addr & 0x1fff)];
+}
+
+static uint8_t _nes_read_chr19(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    return sys->cart.character_ram[sys->mapper.data19.chr_bank[(addr >> 10) & 7] * 0x400 + (addr & 0x3ff)];
+}
+
+static void _nes_n163_name_tables(nes_t* sys) {
+    for (int i = 0; i < 4; i++) {
+        const uint8_t bank = sys->mapper.data19.chr_bank[8 + i];
+        if (bank >= 0xE0) {
+            sys->ppu_name_table[i] = _nes_name_table_page(bank & 1);
+        } else {
+            sys->ppu_name_table[i] = (uint32_t)(offsetof(nes_t, cart.character_ram) + (bank % _nes_chr_pages_1k(sys)) * 0x400);
+        }
+    }
+}
+
+static void _nes_n163_irq_sync(nes_t* sys) {
+    const uint32_t clock = sys->apu.clock_counter;
+    const uint16_t counter = sys->mapper.data19.irq_counter;
+    if ((counter & 0x8000) && ((counter & 0x7fff) < 0x7fff)) {
+        // counts up to $7FFF and stays there
+        const uint32_t count = (counter & 0x7fff) + (clock - sys->mapper.data19.irq_base_clock);
+        sys->mapper.data19.irq_counter = (uint16_t)(0x8000 | ((count < 0x7fff) ? count : 0x7fff));
+    }
+    sys->mapper.data19.irq_base_clock = clock;
+}
+
+static void _nes_n163_irq_schedule(nes_t* sys) {
+    const uint16_t counter = sys->mapper.data19.irq_counter;
+    const bool counting = (counter & 0x8000) && ((counter & 0x7fff) < 0x7fff);
+    sys->mapper.irq_clock = sys->mapper.data19.irq_base_clock + (counting ? (uint32_t)(0x7fff - (counter & 0x7fff)) : _NES_IRQ_NEVER);
+}
+
+static void _nes_irq19(void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    _nes_n163_irq_sync(sys);
+    if (sys->mapper.data19.irq_counter == 0xffff) {
+        sys->mapper.irq = true;
+    }
+    _nes_n163_irq_schedule(sys);
+}
+
+static uint8_t _nes_read_exp19(uint16_t addr, bool read_only, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    switch (addr & 0xf800) {
+        case 0x4800: {
+            // the channels write their phase back into the sound RAM, a peek
+            // sees the sound RAM as of the last sync and doesn't auto-increment
+            if (!read_only) {
+                _nes_exp_audio_sync(sys);
+            }
+            const uint8_t audio_addr = sys->mapper.data19.audio_addr;
+            if ((audio_addr & 0x80) && !read_only) {
+                sys->mapper.data19.audio_addr = (uint8_t)(0x80 | ((audio_addr + 1) & 0x7f));
+            }
+            return sys->mapper.data19.audio_ram[audio_addr & 0x7f];
+        }
+        case 0x5000:
+            _nes_n163_irq_sync(sys);
+            return (uint8_t)sys->mapper.data19.irq_counter;
+        case 0x5800:
+            _nes_n163_irq_sync(sys);
+            return (uint8_t)(sys->mapper.data19.irq_counter >> 8);
+        default:
+            return 0xFF;
+    }
+}
+
+static void _nes_write_exp19(uint16_t addr, uint8_t value, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    switch (addr & 0xf800) {
+        case 0x4800: {
+            _nes_exp_audio_sync(sys);
+            const uint8_t audio_addr = sys->mapper.data19.audio_addr;
+            if (audio_addr & 0x80) {
+                sys->mapper.data19.audio_addr = (uint8_t)(0x80 | ((audio_addr + 1) & 0x7f));
+            }
+            sys->mapper.data19.audio_ram[audio_addr & 0x7f] = value;
+        } break;
+        case 0x5000:
+        case 0x5800:
+            // writing either half acknowledges the IRQ
+            _nes_n163_irq_sync(sys);
+            if (addr & 0x0800) {
+                sys->mapper.data19.irq_counter = (uint16_t)((sys->mapper.data19.irq_counter & 0x00ff) | (value << 8));
+            } else {
+                sys->mapper.data19.irq_counter = (uint16_t)((sys->mapper.data19.irq_counter & 0xff00) | value);
+            }
+            sys->mapper.irq = false;
+            _nes_n163_irq_schedule(sys);
+            break;
+        default:
+            break;
+    }
+}
+
+static void _nes_write_prg19(uint16_t addr, uint8_t value, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    const int reg = (addr - 0x8000) >> 11;
+    if (reg < 8) {
+        sys->mapper.data19.chr_bank[reg] = (uint8_t)(value % _nes_chr_pages_1k(sys));
+    } else if (reg < 12) {
+        sys->mapper.data19.chr_bank[reg] = value;
+        _nes_mirroring(sys);
+    } else if (reg < 15) {
+        if (reg == 12) {
+            _nes_exp_audio_sync(sys);
+            sys->mapper.data19.sound_disable = value & 0x40;
+        }
+        sys->mapper.data19.prg_bank[reg - 12] = (uint8_t)((value & 0x3f) % _nes_prg_pages_8k(sys));
+    } else {
+        sys->mapper.data19.audio_addr = value;
+    }
+}
+
+// one wavetable update of a channel, the channels take turns every 15 CPU cycles
+static float _nes_n163_step(nes_t* sys, nes_audio_channel_t* ch) {
+    uint8_t* ram = sys->mapper.data19.audio_ram;
+    const int num_channels = ((ram[0x7f] >> 4) & 7) + 1;
+    // channel 0 uses the registers at $78-$7F and is always active
+    uint8_t* regs = &ram[0x78 - 8 * (ch - sys->exp_audio.channels)];
+    const uint32_t freq = regs[0] | (regs[2] << 8) | ((regs[4] & 3) << 16);
+    const uint32_t length = (uint32_t)(256 - (regs[4] & 0xfc)) << 16;
+    uint32_t phase = regs[1] | (regs[3] << 8) | (regs[5] << 16);
+    phase = (phase + freq) % length;
+    regs[1] = (uint8_t)phase;
+    regs[3] = (uint8_t)(phase >> 8);
+    regs[5] = (uint8_t)(phase >> 16);
+    const uint8_t sample_addr = (uint8_t)((phase >> 16) + regs[6]);
+    const int sample = (ram[sample_addr >> 1] >> ((sample_addr & 1) * 4)) & 0x0f;
+    return (float)((sample - 8) * (regs[7] & 0x0f)) * _NES_N163_SCALE / (float)num_channels;
+}
+
+static void _nes_run_n163(void* user_data, int index, uint32_t end_clock) {
+    nes_t* sys = (nes_t*)user_data;
+    nes_audio_channel_t* ch = &sys->exp_audio.channels[index];
+    const int num_channels = ((sys->mapper.data19.audio_ram[0x7f] >> 4) & 7) + 1;
+    if (sys->mapper.data19.sound_disable || (index >= num_channels)) {
+        _nes_exp_audio_level(sys, ch, ch->clock, 0.0f);
+        ch->clock = end_clock;
+        return;
+    }
+    _nes_exp_audio_steps(sys, ch, end_clock, 15 * (uint32_t)num_channels, _nes_n163_step);
+}
+
+// ********* MAPPER 24/26 **************
+/*
+    Konami VRC6: a 16KB and an 8KB PRG page, 1KB CHR pages (PPU banking
+    mode 0 only), a scanline/cycle IRQ counter, two pulse channels and a
+    saw channel.
+*/
+#define _NES_VRC6_SCALE (1.0f / 160.0f)
+
+static uint8_t _nes_read_prg24(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    if (addr < 0xc000) {
+        return sys->cart.rom[sys->mapper.data24.prg_bank16 * 0x4000 + (addr & 0x3fff)];
+    } else if (addr < 0xe000) {
+        return sys->cart.rom[sys->mapper.data24.prg_bank8 * 0x2000 + (addr & 0x1fff)];
+    } else {
+        return sys->cart.rom[(_nes_prg_pages_8k(sys) - 1) * 0x2000 + (addr & 0x1fff)];
+    }
+}
+
+static uint8_t _nes_read_chr24(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    return sys->cart.character_ram[sys->mapper.data24.chr_bank[(addr >> 10) & 7] * 0x400 + (addr & 0x3ff)];
+}
+
+// CPU cycles until the IRQ counter has been clocked num_clocks times
+static uint32_t _nes_vrc6_irq_cycles(const nes_t* sys, uint32_t num_clocks) {
+    if (sys->mapper.data24.irq_ctrl & 4) {
+        // cycle mode
+        return num_clocks;
+    }
+    // scanline mode: the prescaler counts down by 3 per cycle from 341
+    int32_t prescaler = sys->mapper.data24.irq_prescaler;
+    uint32_t cycles = 0;
+    for (uint32_t i = 0; i < num_clocks; i++) {
+        const int32_t steps = (prescaler + 2) / 3;
+        cycles += (uint32_t)steps;
+        prescaler += 341 - 3 * steps;
+    }
+    return cycles;
+}
+
+// bring the IRQ counter up to the current CPU clock, returns true if it overflowed
+static bool _nes_vrc6_irq_sync(nes_t* sys) {
+    const uint32_t clock = sys->apu.clock_counter;
+    const uint32_t elapsed = clock - sys->mapper.data24.irq_base_clock;
+    sys->mapper.data24.irq_base_clock = clock;
+    if (!(sys->mapper.data24.irq_ctrl & 2)) {
+        return false;
+    }
+    uint32_t num_clocks = elapsed;
+    if (!(sys->mapper.data24.irq_ctrl & 4)) {
+        int32_t prescaler = sys->mapper.data24.irq_prescaler - 3 * (int32_t)elapsed;
+        num_clocks = 0;
+        if (prescaler <= 0) {
+            num_clocks = (uint32_t)(-prescaler / 341 + 1);
+            prescaler += 341 * (int32_t)num_clocks;
+        }
+        sys->mapper.data24.irq_prescaler = (int16_t)prescaler;
+    }
+    const uint8_t latch = sys->mapper.data24.irq_latch;
+    uint32_t counter = sys->mapper.data24.irq_counter + num_clocks;
+    const bool overflow = counter > 0xff;
+    if (overflow) {
+        // reloaded from the latch on each overflow
+        counter = latch + (counter - 0x100) % (0x100 - latch);
+    }
+    sys->mapper.data24.irq_counter = (uint8_t)counter;
+    return overflow;
+}
+
+static void _nes_vrc6_irq_schedule(nes_t* sys) {
+    const bool enabled = sys->mapper.data24.irq_ctrl & 2;
+    sys->mapper.irq_clock = sys->mapper.data24.irq_base_clock +
+        (enabled ? _nes_vrc6_irq_cycles(sys, 0x100 - sys->mapper.data24.irq_counter) : _NES_IRQ_NEVER);
+}
+
+static void _nes_irq24(void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    if (_nes_vrc6_irq_sync(sys)) {
+        sys->mapper.irq = true;
+    }
+    _nes_vrc6_irq_schedule(sys);
+}
+
+static void _nes_write_prg24(uint16_t addr, uint8_t value, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    if (sys->mapper.data24.swap_a0_a1) {
+        addr = (uint16_t)((addr & 0xfffc) | ((addr & 1) << 1) | ((addr & 2) >> 1));
+    }
+    const int reg = addr & 3;
+    switch (addr & 0xf000) {
+        case 0x8000:
+            sys->mapper.data24.prg_bank16 = (uint8_t)((value & 0x0f) % (_nes_prg_pages_8k(sys) / 2));
+            break;
+        case 0x9000:
+        case 0xa000:
+            _nes_exp_audio_sync(sys);
+            if (reg < 3) {
+                sys->mapper.data24.pulse[(addr >> 13) & 1][reg] = value;
+            } else if (addr & 0x1000) {
+                sys->mapper.data24.freq_ctrl = value;
+            }
+            break;
+        case 0xb000:
+            if (reg < 3) {
+                _nes_exp_audio_sync(sys);
+                sys->mapper.data24.saw[reg] = value;
+            } else {
+                sys->mapper.data24.ppu_ctrl = value;
+                switch ((value >> 2) & 3) {
+                    case 0: sys->mapper.mirroring = Vertical; break;
+                    case 1: sys->mapper.mirroring = Horizontal; break;
+                    case 2: sys->mapper.mirroring = OneScreenLower; break;
+                    case 3: sys->mapper.mirroring = OneScreenHigher; break;
+                }
+                _nes_mirroring(sys);
+            }
+            break;
+        case 0xc000:
+            sys->mapper.data24.prg_bank8 = (uint8_t)((value & 0x1f) % _nes_prg_pages_8k(sys));
+            break;
+        case 0xd000:
+        case 0xe000:
+            sys->mapper.data24.chr_bank[((addr >> 11) & 4) | reg] = (uint8_t)(value % _nes_chr_pages_1k(sys));
+            break;
+        case 0xf000:
+            if (_nes_vrc6_irq_sync(sys)) {
+                sys->mapper.irq = true;
+            }
+            switch (reg) {
+                case 0:
+                    sys->mapper.data24.irq_latch = value;
+                    break;
+                case 1:
+                    sys->mapper.data24.irq_ctrl = value & 7;
+                    if (value & 2) {
+                        sys->mapper.data24.irq_counter = sys->mapper.data24.irq_latch;
+                        sys->mapper.data24.irq_prescaler = 341;
+                    }
+                    sys->mapper.irq = false;
+                    break;
+                case 2: {
+                    // acknowledge, the 'enable after acknowledgement' bit becomes the enable bit
+                    const uint8_t ctrl = sys->mapper.data24.irq_ctrl;
+                    sys->mapper.data24.irq_ctrl = (uint8_t)((ctrl & ~2) | ((ctrl & 1) << 1));
+                    sys->mapper.irq = false;
+                } break;
+                default:
+                    break;
+            }
+            _nes_vrc6_irq_schedule(sys);
+            break;
+    }
+}
+
+static uint32_t _nes_vrc6_period(const nes_t* sys, const uint8_t* regs) {
+    uint32_t freq = (uint32_t)((regs[2] & 0x0f) << 8) | regs[1];
+    // $9003 bits 1 and 2 speed up all channels by 16 or 256
+    if (sys->mapper.data24.freq_ctrl & 4) {
+        freq >>= 8;
+    } else if (sys->mapper.data24.freq_ctrl & 2) {
+        freq >>= 4;
+    }
+    return freq + 1;
+}
+
+static float _nes_vrc6_pulse_level(const uint8_t* regs, uint32_t phase) {
+    const bool high = (regs[0] & 0x80) || (phase <= (uint32_t)((regs[0] >> 4) & 7));
+    return high ? (float)(regs[0] & 0x0f) * _NES_VRC6_SCALE : 0.0f;
+}
+
+static float _nes_vrc6_pulse_step(nes_t* sys, nes_audio_channel_t* ch) {
+    const uint8_t* regs = sys->mapper.data24.pulse[ch - sys->exp_audio.channels];
+    ch->phase = (ch->phase - 1) & 15;
+    return _nes_vrc6_pulse_level(regs, ch->phase);
+}
+
+static void _nes_run_vrc6_pulse(void* user_data, int index, uint32_t end_clock) {
+    nes_t* sys = (nes_t*)user_data;
+    nes_audio_channel_t* ch = &sys->exp_audio.channels[index];
+    const uint8_t* regs = sys->mapper.data24.pulse[index];
+    if (sys->mapper.data24.freq_ctrl & 1) {
+        // halted
+        ch->clock = end_clock;
+        return;
+    }
+    if (!(regs[2] & 0x80)) {
+        ch->phase = 15;
+        _nes_exp_audio_level(sys, ch, ch->clock, 0.0f);
+        ch->clock = end_clock;
+        return;
+    }
+    // volume and duty changes take effect immediately
+    _nes_exp_audio_level(sys, ch, ch->clock, _nes_vrc6_pulse_level(regs, ch->phase));
+    _nes_exp_audio_steps(sys, ch, end_clock, _nes_vrc6_period(sys, regs), _nes_vrc6_pulse_step);
+}
+
+static float _nes_vrc6_saw_step(nes_t* sys, nes_audio_channel_t* ch) {
+    // the rate is added every second step, the accumulator is cleared after the 7th
+    if (++ch->phase == 14) {
+        ch->phase = 0;
+        ch->accum = 0;
+    } else if (!(ch->phase & 1)) {
+        ch->accum = (ch->accum + (sys->mapper.data24.saw[0] & 0x3f)) & 0xff;
+    }
+    return (float)(ch->accum >> 3) * _NES_VRC6_SCALE;
+}
+
+static void _nes_run_vrc6_saw(void* user_data, int index, uint32_t end_clock) {
+    nes_t* sys = (nes_t*)user_data;
+    nes_audio_channel_t* ch = &sys->exp_audio.channels[index];
+    const uint8_t* regs = sys->mapper.data24.saw;
+    if (sys->mapper.data24.freq_ctrl & 1) {
+        ch->clock = end_clock;
+        return;
+    }
+    if (!(regs[2] & 0x80)) {
+        ch->phase = 0;
+        ch->accum = 0;
+        _nes_exp_audio_level(sys, ch, ch->clock, 0.0f);
+        ch->clock = end_clock;
+        return;
+    }
+    _nes_exp_audio_steps(sys, ch, end_clock, _nes_vrc6_period(sys, regs), _nes_vrc6_saw_step);
+}
+
+// ********* MAPPER 69 **************
+/*
+    Sunsoft FME-7 with the 5B sound chip: 8KB PRG pages, 1KB CHR pages,
+    a 16-bit cycle IRQ counter and three square channels with a
+    logarithmic volume. The cartridge RAM is always mapped at $6000 (PRG-ROM
+    at $6000 is not implemented), as are the envelope and noise generators.
+*/
+#define _NES_5B_SCALE (0.1f)
+
+// 3dB per volume step
+static const float _nes_5b_volume[16] = {
+    0.0f, 0.0079f, 0.0112f, 0.0158f, 0.0224f, 0.0316f, 0.0447f, 0.0631f,
+    0.0891f, 0.1259f, 0.1778f, 0.2512f, 0.3548f, 0.5012f, 0.7079f, 1.0f
+};
+
+static uint8_t _nes_read_prg69(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    const uint32_t slot = (addr >> 13) & 3;
+    const uint32_t page = (slot < 3) ? sys->mapper.data69.prg_bank[1 + slot] : _nes_prg_pages_8k(sys) - 1;
+    return sys->cart.rom[page * 0x2000 + (addr & 0x1fff)];
+}
+
+static uint8_t _nes_read_chr69(uint16_t addr, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    return sys->cart.character_ram[sys->mapper.data69.chr_bank[(addr >> 10) & 7] * 0x400 + (addr & 0x3ff)];
+}
+
+// bring the IRQ counter up to the current CPU clock, returns true if it wrapped around
+static bool _nes_fme7_irq_sync(nes_t* sys) {
+    const uint32_t clock = sys->apu.clock_counter;
+    const uint32_t elapsed = clock - sys->mapper.data69.irq_base_clock;
+    sys->mapper.data69.irq_base_clock = clock;
+    if (!(sys->mapper.data69.irq_ctrl & 0x80)) {
+        return false;
+    }
+    const bool wrapped = elapsed > sys->mapper.data69.irq_counter;
+    sys->mapper.data69.irq_counter = (uint16_t)(sys->mapper.data69.irq_counter - elapsed);
+    return wrapped;
+}
+
+static void _nes_fme7_irq_schedule(nes_t* sys) {
+    const bool counting = sys->mapper.data69.irq_ctrl & 0x80;
+    sys->mapper.irq_clock = sys->mapper.data69.irq_base_clock +
+        (counting ? (uint32_t)sys->mapper.data69.irq_counter + 1 : _NES_IRQ_NEVER);
+}
+
+static void _nes_irq69(void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    if (_nes_fme7_irq_sync(sys) && (sys->mapper.data69.irq_ctrl & 1)) {
+        sys->mapper.irq = true;
+    }
+    _nes_fme7_irq_schedule(sys);
+}
+
+static void _nes_write_prg69(uint16_t addr, uint8_t value, void* user_data) {
+    nes_t* sys = (nes_t*)user_data;
+    CHIPS_ASSERT(sys && sys->valid);
+    switch (addr & 0xe000) {
+        case 0x8000:
+            sys->mapper.data69.command = value & 0x0f;
+            break;
+        case 0xa000: {
+            const uint8_t cmd = sys->mapper.data69.command;
+            if (cmd < 8) {
+                sys->mapper.data69.chr_bank[cmd] = (uint8_t)(value % _nes_chr_pages_1k(sys));
+            } else if (cmd == 8) {
+                sys->mapper.data69.prg_bank[0] = value;
+            } else if (cmd < 0x0c) {
+                sys->mapper.data69.prg_bank[cmd - 8] = (uint8_t)((value & 0x3f) % _nes_prg_pages_8k(sys));
+            } else if (cmd == 0x0c) {
+                switch (value & 3) {
+                    case 0: sys->mapper.mirroring = Vertical; break;
+                    case 1: sys->mapper.mirroring = Horizontal; break;
+                    case 2: sys->mapper.mirroring = OneScreenLower; break;
+                    case 3: sys->mapper.mirroring = OneScreenHigher; break;
+                }
+                _nes_mirroring(sys);
+            } else {
+                _nes_fme7_irq_sync(sys);
+                if (cmd == 0x0d) {
+                    // writing the control register acknowledges the IRQ
+                    sys->mapper.data69.irq_ctrl = value;
+                    sys->mapper.irq = false;
+                } else if (cmd == 0x0e) {
+                    sys->mapper.data69.irq_counter = (uint16_t)((sys->mapper.data69.irq_counter & 0xff00) | value);
+                } else {
+                    sys->mapper.data69.irq_counter = (uint16_t)((sys->mapper.data69.irq_counter & 0x00ff) | (value << 8));
+                }
+                _nes_fme7_irq_schedule(sys);
+            }
+        } break;
+        case 0xc000:
+            sys->mapper.data69.audio_addr = value & 0x0f;
+            break;
+        case 0xe000:
+            _nes_exp_audio_sync(sys);
+            sys->mapper.data69.audio_regs[sys->mapper.data69.audio_addr] = value;
+            break;
+    }
+}
+
+static float _nes_5b_level(const nes_t* sys, int index, uint32_t phase) {
+    const uint8_t* regs = sys->mapper.data69.audio_regs;
+    // a channel with the tone disabled outputs its volume (used for sample playback)
+    const bool high = (regs[7] & (1 << index)) || (phase & 1);
+    return high ? _nes_5b_volume[regs[8 + index] & 0x0f] * _NES_5B_SCALE : 0.0f;
+}
+
+static float _nes_5b_step(nes_t* sys, nes_audio_channel_t* ch) {
+    ch->phase ^= 1;
+    return _nes_5b_level(sys, (int)(ch - sys->exp_audio.channels), ch->phase);
+}
+
+static void _nes_run_5b(void* user_data, int index, uint32_t end_clock) {
+    nes_t* sys = (nes_t*)user_data;
+    nes_audio_channel_t* ch = &sys->exp_audio.channels[index];
+    const uint8_t* regs = sys->mapper.data69.audio_regs;
+    _nes_exp_audio_level(sys, ch, ch->clock, _nes_5b_level(sys, index, ch->phase));
+    if (regs[7] & (1 << index)) {
+        ch->clock = end_clock;
+        return;
+    }
+    // the square toggles every 16 * period CPU cycles
+    uint32_t period = (uint32_t)((regs[index * 2 + 1] & 0x0f) << 8) | regs[index * 2];
+    period = (period ? period : 1) * 16;
+    _nes_exp_audio_steps(sys, ch, end_clock, period, _nes_5b_step);
+}
+
 #endif /* CHIPS_IMPL */
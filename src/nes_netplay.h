@@ -0,0 +1,468 @@
+#pragma once
+/*#
+    # nes_netplay.h
+
+    Rollback netcode for two-player nes.h sessions.
+
+    Do this:
+    ~~~C
+    #define CHIPS_IMPL
+    ~~~
+    before you include this file in *one* C or C++ file to create the
+    implementation.
+
+    Optionally provide the following macros with your own implementation
+
+    ~~~C
+    CHIPS_ASSERT(c)
+    ~~~
+        your own assert macro (default: assert(c))
+
+    You need to include the following headers before including nes_netplay.h:
+
+    - chips/chips_common.h
+    - chips/m6502.h
+    - r2c02.h
+    - nes.h
+
+    ## How it works
+
+    Both peers run the same emulation frame by frame. Each frame the local
+    pad state is sent to the peer, and the remote pad state is *predicted*
+    by repeating the last confirmed remote input. Before each frame a copy
+    of the emulator state is stored in a ring buffer.
+
+    When a remote input arrives for a frame which has already been simulated
+    with a different prediction, the state at that frame is restored and
+    all frames up to the current frame are re-simulated with the corrected
+    inputs (within the same host frame). If the remote peer falls behind
+    by more than `max_rollback_frames`, nes_netplay_advance() stalls until
+    the missing inputs arrive.
+
+    The number of frames that can be re-simulated within one host frame
+    limits the useful rollback window, see nes_netplay_stats_t.
+
+    Packets are sent through a nes_netplay_transport_t, the included
+    loopback transport connects two sessions in the same process and
+    simulates network latency and jitter.
+
+    ## zlib/libpng license
+
+        Copyright (c) 2023 Scemino
+        This software is provided 'as-is', without any express or implied warranty.
+        In no event will the authors be held liable for any damages arising from the
+        use of this software.
+        Permission is granted to anyone to use this software for any purpose,
+        including commercial applications, and to alter it and redistribute it
+        freely, subject to the following restrictions:
+        1. The origin of this software must not be misrepresented; you must not
+        claim that you wrote the original software. If you use this software in a
+        product, an acknowledgment in the product documentation would be
+        appreciated but is not required.
+        2. Altered source versions must be plainly marked as such, and must not
+        be misrepresented as being the original software.
+        3. This notice may not be removed or altered from any source
+        distribution.
+#*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_NETPLAY_MAX_ROLLBACK_FRAMES (15)    // max number of frames that can be rolled back
+#define NES_NETPLAY_DEFAULT_ROLLBACK_FRAMES (8)
+#define NES_NETPLAY_MAX_INPUT_DELAY (8)         // max number of frames local input can be delayed
+#define NES_NETPLAY_INPUT_WINDOW (16)           // max number of (redundant) inputs per packet
+#define NES_NETPLAY_INPUT_RING (64)             // size of input ring buffers (power of 2)
+#define NES_NETPLAY_MAX_PACKET_SIZE (12 + NES_NETPLAY_INPUT_WINDOW)
+#define NES_NETPLAY_LOOPBACK_QUEUE_SIZE (256)
+// size of a saved emulator state, the PRG-ROM and picture buffers (the tail of nes_t) are not saved
+#define NES_NETPLAY_STATE_SIZE (offsetof(nes_t, cart.rom))
+
+// packet transport interface
+typedef struct {
+    // send a packet, return false if the packet was dropped
+    bool (*send)(const uint8_t* data, size_t num_bytes, void* user_data);
+    // receive the next packet into data, return number of bytes or 0 if no packet available
+    size_t (*recv)(uint8_t* data, size_t max_bytes, void* user_data);
+    void* user_data;
+} nes_netplay_transport_t;
+
+// configuration parameters for nes_netplay_init()
+typedef struct {
+    nes_t* nes;                         // the emulator instance driven by this session
+    int local_player;                   // 0: local pad is controller port 0, 1: controller port 1
+    int input_delay;                    // local input delay in frames (default: 0)
+    int max_rollback_frames;            // default: NES_NETPLAY_DEFAULT_ROLLBACK_FRAMES
+    nes_netplay_transport_t transport;
+} nes_netplay_desc_t;
+
+// session statistics
+typedef struct {
+    uint32_t frame;                     // next frame to simulate
+    uint32_t confirmed_frame;           // number of frames with confirmed remote input
+    uint32_t rollbacks;                 // number of rollbacks
+    uint32_t resim_frames;              // total number of re-simulated frames
+    uint32_t last_rollback_frames;      // number of frames re-simulated in last rollback
+    uint32_t max_rollback_frames;       // longest rollback so far
+    uint32_t stalls;                    // number of frames stalled waiting for remote input
+    uint32_t packets_sent;
+    uint32_t packets_received;
+} nes_netplay_stats_t;
+
+// rollback session state
+typedef struct {
+    nes_t* nes;
+    nes_netplay_transport_t transport;
+    int local_player;
+    int input_delay;
+    int max_rollback_frames;
+    uint32_t frame;                     // next frame to simulate
+    uint32_t local_frame;               // next frame without local input
+    uint32_t remote_frame;              // next frame without confirmed remote input
+    uint32_t peer_ack;                  // next frame the peer has no local input for
+    uint32_t rollback_frame;            // oldest frame with a misprediction (== frame if none)
+    uint8_t local_inputs[NES_NETPLAY_INPUT_RING];
+    uint8_t remote_inputs[NES_NETPLAY_INPUT_RING];
+    uint8_t predicted_inputs[NES_NETPLAY_INPUT_RING];
+    nes_netplay_stats_t stats;
+    bool valid;
+    // emulator state at the start of each frame, without PRG-ROM and picture buffers
+    uint8_t states[NES_NETPLAY_MAX_ROLLBACK_FRAMES + 1][NES_NETPLAY_STATE_SIZE];
+} nes_netplay_t;
+
+// simulated network conditions for the loopback transport
+typedef struct {
+    uint32_t latency_us;                // one-way latency in microseconds
+    uint32_t jitter_us;                 // max random additional latency in microseconds
+    uint32_t seed;                      // random seed for jitter (default: 1)
+} nes_netplay_loopback_desc_t;
+
+// an in-process packet pipe between two endpoints
+typedef struct {
+    struct {
+        uint64_t deliver_time_us;
+        uint8_t num_bytes;
+        uint8_t data[NES_NETPLAY_MAX_PACKET_SIZE];
+    } packets[NES_NETPLAY_LOOPBACK_QUEUE_SIZE];
+    int num_packets;
+} nes_netplay_loopback_queue_t;
+
+typedef struct {
+    void* loopback;
+    int index;
+} nes_netplay_loopback_endpoint_t;
+
+typedef struct {
+    uint32_t latency_us;
+    uint32_t jitter_us;
+    uint32_t rand_state;
+    uint64_t time_us;
+    nes_netplay_loopback_queue_t queue[2];  // queue[i] holds packets sent *to* endpoint i
+    nes_netplay_loopback_endpoint_t endpoints[2];
+} nes_netplay_loopback_t;
+
+// initialize a rollback session, the emulator must already have a cartridge inserted,
+// the session takes over both controller ports (any input provider is removed)
+void nes_netplay_init(nes_netplay_t* np, const nes_netplay_desc_t* desc);
+// discard a rollback session
+void nes_netplay_discard(nes_netplay_t* np);
+// advance the session by one frame, returns false if stalled waiting for remote input
+bool nes_netplay_advance(nes_netplay_t* np, uint8_t local_pad_mask);
+// get session statistics
+nes_netplay_stats_t nes_netplay_stats(const nes_netplay_t* np);
+
+// initialize a loopback transport
+void nes_netplay_loopback_init(nes_netplay_loopback_t* lb, const nes_netplay_loopback_desc_t* desc);
+// advance the simulated network time of a loopback transport
+void nes_netplay_loopback_advance(nes_netplay_loopback_t* lb, uint32_t micro_seconds);
+// get the transport of endpoint 0 or 1
+nes_netplay_transport_t nes_netplay_loopback_transport(nes_netplay_loopback_t* lb, int endpoint);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*-- IMPLEMENTATION ----------------------------------------------------------*/
+#ifdef CHIPS_IMPL
+#include <string.h>
+#ifndef CHIPS_ASSERT
+    #include <assert.h>
+    #define CHIPS_ASSERT(c) assert(c)
+#endif
+
+#define _NES_NETPLAY_RING_MASK (NES_NETPLAY_INPUT_RING - 1)
+#define _NES_NETPLAY_NUM_STATES (NES_NETPLAY_MAX_ROLLBACK_FRAMES + 1)
+
+// the PRG-ROM never changes, and the picture buffers are the output of a frame,
+// both are at the end of nes_t and are skipped to make saving a state per frame cheap
+static void _nes_netplay_save_state(nes_netplay_t* np, uint32_t frame) {
+    memcpy(np->states[frame % _NES_NETPLAY_NUM_STATES], np->nes, NES_NETPLAY_STATE_SIZE);
+}
+
+static void _nes_netplay_load_state(nes_netplay_t* np, uint32_t frame) {
+    memcpy(np->nes, np->states[frame % _NES_NETPLAY_NUM_STATES], NES_NETPLAY_STATE_SIZE);
+}
+
+static void _nes_netplay_put_u32(uint8_t* dst, uint32_t val) {
+    dst[0] = (uint8_t)val;
+    dst[1] = (uint8_t)(val >> 8);
+    dst[2] = (uint8_t)(val >> 16);
+    dst[3] = (uint8_t)(val >> 24);
+}
+
+static uint32_t _nes_netplay_get_u32(const uint8_t* src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+void nes_netplay_init(nes_netplay_t* np, const nes_netplay_desc_t* desc) {
+    CHIPS_ASSERT(np && desc && desc->nes);
+    CHIPS_ASSERT(desc->transport.send && desc->transport.recv);
+    CHIPS_ASSERT((desc->local_player >= 0) && (desc->local_player < 2));
+    CHIPS_ASSERT((desc->input_delay >= 0) && (desc->input_delay <= NES_NETPLAY_MAX_INPUT_DELAY));
+    CHIPS_ASSERT(desc->max_rollback_frames <= NES_NETPLAY_MAX_ROLLBACK_FRAMES);
+    memset(np, 0, offsetof(nes_netplay_t, states));
+    np->valid = true;
+    np->nes = desc->nes;
+    np->transport = desc->transport;
+    np->local_player = desc->local_player;
+    np->input_delay = desc->input_delay;
+    np->max_rollback_frames = desc->max_rollback_frames > 0 ? desc->max_rollback_frames : NES_NETPLAY_DEFAULT_ROLLBACK_FRAMES;
+    // the first 'input_delay' frames run with an empty local input
+    np->local_frame = (uint32_t)np->input_delay;
+    // controller inputs are only applied by the session
+    np->nes->input = (nes_input_provider_t){0};
+}
+
+void nes_netplay_discard(nes_netplay_t* np) {
+    CHIPS_ASSERT(np && np->valid);
+    np->valid = false;
+}
+
+nes_netplay_stats_t nes_netplay_stats(const nes_netplay_t* np) {
+    CHIPS_ASSERT(np && np->valid);
+    nes_netplay_stats_t stats = np->stats;
+    stats.frame = np->frame;
+    stats.confirmed_frame = np->remote_frame;
+    return stats;
+}
+
+// send all local inputs the peer hasn't acknowledged yet
+static void _nes_netplay_send(nes_netplay_t* np) {
+    uint32_t start_frame = np->peer_ack;
+    // never resend inputs which have already been overwritten in the ring buffer
+    if ((np->local_frame - start_frame) > (NES_NETPLAY_INPUT_RING - NES_NETPLAY_INPUT_WINDOW)) {
+        start_frame = np->local_frame - (NES_NETPLAY_INPUT_RING - NES_NETPLAY_INPUT_WINDOW);
+    }
+    uint32_t num_inputs = np->local_frame - start_frame;
+    if (num_inputs > NES_NETPLAY_INPUT_WINDOW) {
+        num_inputs = NES_NETPLAY_INPUT_WINDOW;
+    }
+    uint8_t packet[NES_NETPLAY_MAX_PACKET_SIZE];
+    _nes_netplay_put_u32(&packet[0], start_frame);
+    _nes_netplay_put_u32(&packet[4], np->remote_frame);
+    _nes_netplay_put_u32(&packet[8], num_inputs);
+    for (uint32_t i = 0; i < num_inputs; i++) {
+        packet[12 + i] = np->local_inputs[(start_frame + i) & _NES_NETPLAY_RING_MASK];
+    }
+    np->transport.send(packet, 12 + num_inputs, np->transport.user_data);
+    np->stats.packets_sent++;
+}
+
+// receive remote inputs, and find the oldest mispredicted frame
+static void _nes_netplay_receive(nes_netplay_t* np) {
+    uint8_t packet[NES_NETPLAY_MAX_PACKET_SIZE];
+    size_t num_bytes;
+    while ((num_bytes = np->transport.recv(packet, sizeof(packet), np->transport.user_data)) >= 12) {
+        np->stats.packets_received++;
+        const uint32_t start_frame = _nes_netplay_get_u32(&packet[0]);
+        const uint32_t ack = _nes_netplay_get_u32(&packet[4]);
+        uint32_t num_inputs = _nes_netplay_get_u32(&packet[8]);
+        if ((num_inputs > NES_NETPLAY_INPUT_WINDOW) || ((12 + num_inputs) > num_bytes)) {
+            continue;
+        }
+        if ((int32_t)(ack - np->peer_ack) > 0) {
+            np->peer_ack = ack;
+        }
+        for (uint32_t i = 0; i < num_inputs; i++) {
+            const uint32_t frame = start_frame + i;
+            // only accept the next contiguous input, older ones are duplicates
+            if (frame != np->remote_frame) {
+                continue;
+            }
+            // the peer can't be further ahead than the ring buffer size
+            if ((int32_t)(frame - np->frame) >= (NES_NETPLAY_INPUT_RING - NES_NETPLAY_INPUT_WINDOW)) {
+                break;
+            }
+            const uint8_t input = packet[12 + i];
+            np->remote_inputs[frame & _NES_NETPLAY_RING_MASK] = input;
+            np->remote_frame++;
+            if ((frame < np->frame) && (frame < np->rollback_frame)) {
+                if (np->predicted_inputs[frame & _NES_NETPLAY_RING_MASK] != input) {
+                    np->rollback_frame = frame;
+                }
+            }
+        }
+    }
+}
+
+// the remote input for a frame, either confirmed or predicted from the last confirmed input
+static uint8_t _nes_netplay_remote_input(nes_netplay_t* np, uint32_t frame) {
+    if (frame < np->remote_frame) {
+        return np->remote_inputs[frame & _NES_NETPLAY_RING_MASK];
+    }
+    else if (np->remote_frame > 0) {
+        return np->remote_inputs[(np->remote_frame - 1) & _NES_NETPLAY_RING_MASK];
+    }
+    else {
+        return 0;
+    }
+}
+
+// save state, apply inputs and run a single frame
+static void _nes_netplay_run_frame(nes_netplay_t* np, uint32_t frame) {
+    _nes_netplay_save_state(np, frame);
+    const uint8_t remote_input = _nes_netplay_remote_input(np, frame);
+    np->predicted_inputs[frame & _NES_NETPLAY_RING_MASK] = remote_input;
+    nes_pad_port(np->nes, np->local_player, np->local_inputs[frame & _NES_NETPLAY_RING_MASK]);
+    nes_pad_port(np->nes, 1 - np->local_player, remote_input);
+    nes_exec_frame(np->nes);
+}
+
+static void _nes_netplay_rollback(nes_netplay_t* np) {
+    const uint32_t first_frame = np->rollback_frame;
+    CHIPS_ASSERT((np->frame - first_frame) <= (uint32_t)np->max_rollback_frames);
+    _nes_netplay_load_state(np, first_frame);
+    // don't push audio or frames, or call the debugger for frames which have already been played
+    const chips_audio_callback_t audio_callback = np->nes->audio.callback;
+    const nes_frame_callback_t frame_callback = np->nes->frame;
+    const chips_debug_t debug = np->nes->debug;
+    np->nes->audio.callback = (chips_audio_callback_t){0};
+    np->nes->frame = (nes_frame_callback_t){0};
+    np->nes->debug = (chips_debug_t){0};
+    for (uint32_t frame = first_frame; frame < np->frame; frame++) {
+        _nes_netplay_run_frame(np, frame);
+    }
+    np->nes->audio.callback = audio_callback;
+    np->nes->frame = frame_callback;
+    np->nes->debug = debug;
+    const uint32_t num_frames = np->frame - first_frame;
+    np->stats.rollbacks++;
+    np->stats.resim_frames += num_frames;
+    np->stats.last_rollback_frames = num_frames;
+    if (num_frames > np->stats.max_rollback_frames) {
+        np->stats.max_rollback_frames = num_frames;
+    }
+}
+
+bool nes_netplay_advance(nes_netplay_t* np, uint8_t local_pad_mask) {
+    CHIPS_ASSERT(np && np->valid);
+
+    // record the local input (delayed by input_delay frames), unless we're stalled
+    if ((np->local_frame - np->frame) <= (uint32_t)np->input_delay) {
+        np->local_inputs[np->local_frame & _NES_NETPLAY_RING_MASK] = local_pad_mask;
+        np->local_frame++;
+    }
+    np->rollback_frame = np->frame;
+    _nes_netplay_receive(np);
+    _nes_netplay_send(np);
+
+    // re-simulate mispredicted frames
+    if (np->rollback_frame < np->frame) {
+        _nes_netplay_rollback(np);
+    }
+
+    // stall if the remote peer is too far behind
+    if ((np->frame - np->remote_frame) >= (uint32_t)np->max_rollback_frames) {
+        np->stats.stalls++;
+        return false;
+    }
+    _nes_netplay_run_frame(np, np->frame);
+    np->frame++;
+    return true;
+}
+
+static uint32_t _nes_netplay_loopback_rand(nes_netplay_loopback_t* lb) {
+    // xorshift32
+    uint32_t x = lb->rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    lb->rand_state = x;
+    return x;
+}
+
+static bool _nes_netplay_loopback_send(const uint8_t* data, size_t num_bytes, void* user_data) {
+    CHIPS_ASSERT(user_data && (num_bytes <= NES_NETPLAY_MAX_PACKET_SIZE));
+    const nes_netplay_loopback_endpoint_t* ep = (const nes_netplay_loopback_endpoint_t*) user_data;
+    nes_netplay_loopback_t* lb = (nes_netplay_loopback_t*) ep->loopback;
+    const int index = ep->index;
+    nes_netplay_loopback_queue_t* queue = &lb->queue[1 - index];
+    if (queue->num_packets >= NES_NETPLAY_LOOPBACK_QUEUE_SIZE) {
+        return false;
+    }
+    uint32_t jitter = (lb->jitter_us > 0) ? (_nes_netplay_loopback_rand(lb) % (lb->jitter_us + 1)) : 0;
+    queue->packets[queue->num_packets].deliver_time_us = lb->time_us + lb->latency_us + jitter;
+    queue->packets[queue->num_packets].num_bytes = (uint8_t)num_bytes;
+    memcpy(queue->packets[queue->num_packets].data, data, num_bytes);
+    queue->num_packets++;
+    return true;
+}
+
+static size_t _nes_netplay_loopback_recv(uint8_t* data, size_t max_bytes, void* user_data) {
+    CHIPS_ASSERT(user_data);
+    const nes_netplay_loopback_endpoint_t* ep = (const nes_netplay_loopback_endpoint_t*) user_data;
+    nes_netplay_loopback_t* lb = (nes_netplay_loopback_t*) ep->loopback;
+    const int index = ep->index;
+    nes_netplay_loopback_queue_t* queue = &lb->queue[index];
+    // find the oldest deliverable packet, jitter may reorder packets
+    int found = -1;
+    for (int i = 0; i < queue->num_packets; i++) {
+        if (queue->packets[i].deliver_time_us <= lb->time_us) {
+            if ((found < 0) || (queue->packets[i].deliver_time_us < queue->packets[found].deliver_time_us)) {
+                found = i;
+            }
+        }
+    }
+    if (found < 0) {
+        return 0;
+    }
+    size_t num_bytes = queue->packets[found].num_bytes;
+    if (num_bytes > max_bytes) {
+        num_bytes = max_bytes;
+    }
+    memcpy(data, queue->packets[found].data, num_bytes);
+    queue->packets[found] = queue->packets[--queue->num_packets];
+    return num_bytes;
+}
+
+void nes_netplay_loopback_init(nes_netplay_loopback_t* lb, const nes_netplay_loopback_desc_t* desc) {
+    CHIPS_ASSERT(lb && desc);
+    memset(lb, 0, sizeof(nes_netplay_loopback_t));
+    lb->latency_us = desc->latency_us;
+    lb->jitter_us = desc->jitter_us;
+    lb->rand_state = desc->seed ? desc->seed : 1;
+    for (int i = 0; i < 2; i++) {
+        lb->endpoints[i].loopback = lb;
+        lb->endpoints[i].index = i;
+    }
+}
+
+void nes_netplay_loopback_advance(nes_netplay_loopback_t* lb, uint32_t micro_seconds) {
+    CHIPS_ASSERT(lb);
+    lb->time_us += micro_seconds;
+}
+
+nes_netplay_transport_t nes_netplay_loopback_transport(nes_netplay_loopback_t* lb, int endpoint) {
+    CHIPS_ASSERT(lb && (endpoint >= 0) && (endpoint < 2));
+    return (nes_netplay_transport_t) {
+        .send = _nes_netplay_loopback_send,
+        .recv = _nes_netplay_loopback_recv,
+        .user_data = &lb->endpoints[endpoint],
+    };
+}
+
+#endif /* CHIPS_IMPL */
@@ -0,0 +1,408 @@
+#pragma once
+/*#
+    # nes_video.h
+
+    CPU-side video post-processing for nes.h frames.
+
+    Do this:
+    ~~~C
+    #define CHIPS_IMPL
+    ~~~
+    before you include this file in *one* C or C++ file to create the
+    implementation.
+
+    Optionally provide the following macros with your own implementation
+
+    ~~~C
+    CHIPS_ASSERT(c)
+    ~~~
+        your own assert macro (default: assert(c))
+
+    You need to include the following headers before including nes_video.h:
+
+    - chips/chips_common.h
+    - r2c02.h
+
+    ## How it works
+
+    The NES framebuffer contains 6-bit palette indices, the color emphasis
+    bits of PPUMASK are recorded once per scanline (see nes_t.fb_emphasis).
+    nes_video_process() converts a frame into RGBA8 pixels with one of
+    two filters:
+
+    - NES_VIDEO_FILTER_PALETTE: a palette lookup in a 512-entry palette
+      (64 colors * 8 emphasis combinations), with emphasis disabled this
+      is the same as the GPU palette lookup
+    - NES_VIDEO_FILTER_NTSC: the composite video signal of each pixel is
+      synthesized (8 samples per pixel, 12 samples per color subcarrier
+      cycle) and decoded into RGB at twice the horizontal resolution,
+      which produces the color fringes and dot crawl of a real NES on
+      a TV
+
+    The NTSC decoder is linear, so the contribution of an input pixel to
+    its neighbouring output pixels only depends on the pixel value and the
+    subcarrier phase the pixel starts at (one of 3). These contributions
+    are precomputed in nes_video_init() as kernels of 8 16-bit values (RGB
+    of two output pixels), an output pixel pair is the (SIMD) sum of the
+    kernels of 5 input pixels.
+
+    nes_video_thumbnail() downscales a frame by 2 in both directions with
+    a 2x2 box filter (palette colors only), e.g. for snapshot screenshots.
+
+    ## zlib/libpng license
+
+        Copyright (c) 2023 Scemino
+        This software is provided 'as-is', without any express or implied warranty.
+        In no event will the authors be held liable for any damages arising from the
+        use of this software.
+        Permission is granted to anyone to use this software for any purpose,
+        including commercial applications, and to alter it and redistribute it
+        freely, subject to the following restrictions:
+        1. The origin of this software must not be misrepresented; you must not
+        claim that you wrote the original software. If you use this software in a
+        product, an acknowledgment in the product documentation would be
+        appreciated but is not required.
+        2. Altered source versions must be plainly marked as such, and must not
+        be misrepresented as being the original software.
+        3. This notice may not be removed or altered from any source
+        distribution.
+#*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdalign.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_VIDEO_NUM_COLORS (64 * 8)               // palette colors * emphasis combinations
+#define NES_VIDEO_NTSC_SCALE (2)                    // horizontal upscaling of the NTSC filter
+#define NES_VIDEO_NTSC_TAPS (5)                     // input pixels per output pixel
+#define NES_VIDEO_NTSC_PHASES (3)                   // subcarrier phases a pixel can start at
+#define NES_VIDEO_MAX_WIDTH (PPU_DISPLAY_WIDTH * NES_VIDEO_NTSC_SCALE)
+#define NES_VIDEO_THUMBNAIL_WIDTH (PPU_DISPLAY_WIDTH / 2)
+#define NES_VIDEO_THUMBNAIL_HEIGHT (PPU_DISPLAY_HEIGHT / 2)
+
+typedef enum {
+    NES_VIDEO_FILTER_PALETTE,
+    NES_VIDEO_FILTER_NTSC,
+    NES_VIDEO_NUM_FILTERS,
+} nes_video_filter_t;
+
+// configuration parameters for nes_video_init()
+typedef struct {
+    nes_video_filter_t filter;
+    bool disable_emphasis;      // ignore the PPUMASK color emphasis bits
+} nes_video_desc_t;
+
+typedef struct {
+    bool valid;
+    nes_video_filter_t filter;
+    bool disable_emphasis;
+    uint32_t palette[NES_VIDEO_NUM_COLORS];
+    // NTSC kernels: [phase][color|emphasis<<6][tap] => R,G,B,0 of two output pixels
+    alignas(16) int16_t ntsc_kernels[NES_VIDEO_NTSC_PHASES][NES_VIDEO_NUM_COLORS][NES_VIDEO_NTSC_TAPS][8];
+    alignas(16) uint32_t rgba[NES_VIDEO_MAX_WIDTH * PPU_DISPLAY_HEIGHT];
+} nes_video_t;
+
+// initialize a video filter instance, this precomputes the palette and NTSC kernels
+void nes_video_init(nes_video_t* sys, const nes_video_desc_t* desc);
+// select the filter
+void nes_video_set_filter(nes_video_t* sys, nes_video_filter_t filter);
+// enable or disable color emphasis
+void nes_video_set_emphasis(nes_video_t* sys, bool enabled);
+// convert a frame (6-bit palette indices and per-line emphasis bits) into RGBA8, frame is the
+// emulated frame number (nes_t.frame_count) which selects the NTSC subcarrier phase (dot crawl),
+// the returned display info points into the video instance
+chips_display_info_t nes_video_process(nes_video_t* sys, const uint8_t* fb, const uint8_t* emphasis, uint32_t frame);
+// downscale a frame into NES_VIDEO_THUMBNAIL_WIDTH * NES_VIDEO_THUMBNAIL_HEIGHT RGBA8 pixels,
+// emphasis may be null (e.g. for a framebuffer from a snapshot file)
+void nes_video_thumbnail(const nes_video_t* sys, const uint8_t* fb, const uint8_t* emphasis, uint32_t* dst);
+// return a short name for a filter
+const char* nes_video_filter_name(nes_video_filter_t filter);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*-- IMPLEMENTATION ----------------------------------------------------------*/
+#ifdef CHIPS_IMPL
+#include <string.h>
+#include <math.h>
+#ifndef CHIPS_ASSERT
+    #include <assert.h>
+    #define CHIPS_ASSERT(c) assert(c)
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define _NES_VIDEO_SSE2 (1)
+#endif
+
+#define _NES_VIDEO_PI (3.14159265358979f)
+// attenuation of the non-emphasized color channels / of the signal during emphasized phases
+#define _NES_VIDEO_ATTENUATION (0.746f)
+// fixed point fraction bits of the NTSC kernels
+#define _NES_VIDEO_KERNEL_SHIFT (5)
+// the decoder constants are fitted to the ppu_palette colors
+#define _NES_VIDEO_HUE (4.0f)           // in subcarrier samples (1/12 cycle)
+#define _NES_VIDEO_SATURATION (0.8f)
+#define _NES_VIDEO_BRIGHTNESS (0.88f)
+// widths of the luma and chroma lowpass filters in samples (multiples of a subcarrier cycle)
+#define _NES_VIDEO_LUMA_WIDTH (12)
+#define _NES_VIDEO_CHROMA_WIDTH (24)
+
+// the emphasis bits darken the two other color channels
+static void _nes_video_init_palette(nes_video_t* sys) {
+    for (int e = 0; e < 8; e++) {
+        for (int c = 0; c < 64; c++) {
+            const uint32_t rgba = ppu_palette[c];
+            float rgb[3] = {
+                (float)(rgba & 0xFF),
+                (float)((rgba >> 8) & 0xFF),
+                (float)((rgba >> 16) & 0xFF),
+            };
+            for (int ch = 0; ch < 3; ch++) {
+                for (int bit = 0; bit < 3; bit++) {
+                    if ((e & (1 << bit)) && (bit != ch)) {
+                        rgb[ch] *= _NES_VIDEO_ATTENUATION;
+                    }
+                }
+            }
+            sys->palette[(e << 6) | c] = 0xFF000000 |
+                ((uint32_t)(rgb[2] + 0.5f) << 16) |
+                ((uint32_t)(rgb[1] + 0.5f) << 8) |
+                (uint32_t)(rgb[0] + 0.5f);
+        }
+    }
+}
+
+// normalized composite signal level of a pixel (color | emphasis<<6) at a subcarrier phase (0..11),
+// see https://www.nesdev.org/wiki/NTSC_video
+static float _nes_video_signal(int pixel, int phase) {
+    static const float black = 0.518f, white = 1.962f;
+    static const float levels[8] = {
+        0.350f, 0.518f, 0.962f, 1.550f,     // signal low
+        1.094f, 1.506f, 1.962f, 1.962f,     // signal high
+    };
+    const int color = pixel & 0x0F;
+    int level = (pixel >> 4) & 3;
+    const int emphasis = pixel >> 6;
+    if (color > 13) {
+        level = 1;
+    }
+    float low = levels[level];
+    float high = levels[4 + level];
+    if (color == 0) {
+        low = high;
+    }
+    if (color > 12) {
+        high = low;
+    }
+    #define _NES_VIDEO_IN_PHASE(c) ((((c) + phase) % 12) < 6)
+    float signal = _NES_VIDEO_IN_PHASE(color) ? high : low;
+    if (((emphasis & 1) && _NES_VIDEO_IN_PHASE(0)) ||
+        ((emphasis & 2) && _NES_VIDEO_IN_PHASE(4)) ||
+        ((emphasis & 4) && _NES_VIDEO_IN_PHASE(8)))
+    {
+        signal *= _NES_VIDEO_ATTENUATION;
+    }
+    #undef _NES_VIDEO_IN_PHASE
+    return (signal - black) / (white - black);
+}
+
+static int16_t _nes_video_fixed(float val) {
+    float f = val * 255.0f * (float)(1 << _NES_VIDEO_KERNEL_SHIFT);
+    f = (f < -32768.0f) ? -32768.0f : ((f > 32767.0f) ? 32767.0f : f);
+    return (int16_t)lrintf(f);
+}
+
+/*
+    An input pixel x+tap-2 covers the signal samples 8*(x+tap-2)..+7, output
+    pixel 2*x+sub is centered at sample 8*x+4*sub+2. The luma and chroma
+    lowpass filters are box filters over whole subcarrier cycles, so flat
+    areas decode to the exact palette color.
+*/
+static void _nes_video_init_ntsc(nes_video_t* sys) {
+    for (int phase = 0; phase < NES_VIDEO_NTSC_PHASES; phase++) {
+        for (int pixel = 0; pixel < NES_VIDEO_NUM_COLORS; pixel++) {
+            for (int tap = 0; tap < NES_VIDEO_NTSC_TAPS; tap++) {
+                for (int sub = 0; sub < NES_VIDEO_NTSC_SCALE; sub++) {
+                    float y = 0.0f, i = 0.0f, q = 0.0f;
+                    for (int n = 0; n < 8; n++) {
+                        const int sample_phase = (phase * 4 + n) % 12;
+                        const float s = _nes_video_signal(pixel, sample_phase);
+                        const int r = (tap - 2) * 8 + n - (sub * 4 + 2);
+                        if ((r >= -_NES_VIDEO_LUMA_WIDTH/2) && (r < _NES_VIDEO_LUMA_WIDTH/2)) {
+                            y += s / _NES_VIDEO_LUMA_WIDTH;
+                        }
+                        if ((r >= -_NES_VIDEO_CHROMA_WIDTH/2) && (r < _NES_VIDEO_CHROMA_WIDTH/2)) {
+                            const float a = _NES_VIDEO_PI * ((float)sample_phase + _NES_VIDEO_HUE) / 6.0f;
+                            i += s * cosf(a) * (2.0f * _NES_VIDEO_SATURATION / _NES_VIDEO_CHROMA_WIDTH);
+                            q += s * sinf(a) * (2.0f * _NES_VIDEO_SATURATION / _NES_VIDEO_CHROMA_WIDTH);
+                        }
+                    }
+                    int16_t* k = &sys->ntsc_kernels[phase][pixel][tap][sub * 4];
+                    k[0] = _nes_video_fixed(_NES_VIDEO_BRIGHTNESS * (y + 0.946882f * i + 0.623557f * q));
+                    k[1] = _nes_video_fixed(_NES_VIDEO_BRIGHTNESS * (y - 0.274788f * i - 0.635691f * q));
+                    k[2] = _nes_video_fixed(_NES_VIDEO_BRIGHTNESS * (y - 1.108545f * i + 1.709007f * q));
+                    k[3] = 0;
+                }
+            }
+        }
+    }
+}
+
+void nes_video_init(nes_video_t* sys, const nes_video_desc_t* desc) {
+    CHIPS_ASSERT(sys && desc);
+    CHIPS_ASSERT((desc->filter >= 0) && (desc->filter < NES_VIDEO_NUM_FILTERS));
+    memset(sys, 0, sizeof(nes_video_t));
+    sys->filter = desc->filter;
+    sys->disable_emphasis = desc->disable_emphasis;
+    _nes_video_init_palette(sys);
+    _nes_video_init_ntsc(sys);
+    sys->valid = true;
+}
+
+void nes_video_set_filter(nes_video_t* sys, nes_video_filter_t filter) {
+    CHIPS_ASSERT(sys && sys->valid);
+    CHIPS_ASSERT((filter >= 0) && (filter < NES_VIDEO_NUM_FILTERS));
+    sys->filter = filter;
+}
+
+void nes_video_set_emphasis(nes_video_t* sys, bool enabled) {
+    CHIPS_ASSERT(sys && sys->valid);
+    sys->disable_emphasis = !enabled;
+}
+
+const char* nes_video_filter_name(nes_video_filter_t filter) {
+    switch (filter) {
+        case NES_VIDEO_FILTER_PALETTE:  return "palette";
+        case NES_VIDEO_FILTER_NTSC:     return "ntsc";
+        default:                        return "???";
+    }
+}
+
+static void _nes_video_palette_line(const nes_video_t* sys, const uint8_t* src, uint8_t emphasis, uint32_t* dst) {
+    const uint32_t* pal = &sys->palette[emphasis << 6];
+    for (int x = 0; x < PPU_DISPLAY_WIDTH; x++) {
+        dst[x] = pal[src[x] & 0x3F];
+    }
+}
+
+static void _nes_video_ntsc_line(const nes_video_t* sys, const uint8_t* src, uint8_t emphasis, int line_phase, uint32_t* dst) {
+    // the line is padded with black pixels for the kernel taps outside the picture
+    const int pad = NES_VIDEO_NTSC_TAPS / 2;
+    const int16_t* kernels[PPU_DISPLAY_WIDTH + NES_VIDEO_NTSC_TAPS - 1];
+    for (int i = 0; i < (PPU_DISPLAY_WIDTH + 2 * pad); i++) {
+        const int x = i - pad;
+        const int pixel = (((x >= 0) && (x < PPU_DISPLAY_WIDTH)) ? (src[x] & 0x3F) : 0x0F) | (emphasis << 6);
+        // a pixel is 8 samples long, so each pixel starts 2/3 of a subcarrier cycle later
+        const int phase = (line_phase + 2 * i) % NES_VIDEO_NTSC_PHASES;
+        kernels[i] = sys->ntsc_kernels[phase][pixel][0];
+    }
+    #if defined(_NES_VIDEO_SSE2)
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        for (int x = 0; x < PPU_DISPLAY_WIDTH; x++) {
+            __m128i acc = _mm_load_si128((const __m128i*)(kernels[x] + 0 * 8));
+            acc = _mm_adds_epi16(acc, _mm_load_si128((const __m128i*)(kernels[x + 1] + 1 * 8)));
+            acc = _mm_adds_epi16(acc, _mm_load_si128((const __m128i*)(kernels[x + 2] + 2 * 8)));
+            acc = _mm_adds_epi16(acc, _mm_load_si128((const __m128i*)(kernels[x + 3] + 3 * 8)));
+            acc = _mm_adds_epi16(acc, _mm_load_si128((const __m128i*)(kernels[x + 4] + 4 * 8)));
+            acc = _mm_srai_epi16(acc, _NES_VIDEO_KERNEL_SHIFT);
+            const __m128i rgba = _mm_or_si128(_mm_packus_epi16(acc, acc), alpha);
+            _mm_storel_epi64((__m128i*)(dst + x * 2), rgba);
+        }
+    #else
+        uint8_t* out = (uint8_t*)dst;
+        for (int x = 0; x < PPU_DISPLAY_WIDTH; x++) {
+            for (int c = 0; c < 8; c++) {
+                int acc = 0;
+                for (int tap = 0; tap < NES_VIDEO_NTSC_TAPS; tap++) {
+                    acc += kernels[x + tap][tap * 8 + c];
+                }
+                acc >>= _NES_VIDEO_KERNEL_SHIFT;
+                out[x * 8 + c] = ((c & 3) == 3) ? 0xFF : (uint8_t)((acc < 0) ? 0 : ((acc > 255) ? 255 : acc));
+            }
+        }
+    #endif
+}
+
+// byte-wise rounding average, the same as _mm_avg_epu8()
+static inline uint32_t _nes_video_avg(uint32_t a, uint32_t b) {
+    return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+/*
+    Both source lines are averaged first, then two horizontally neighbouring
+    pixels. The SSE2 path computes 4 output pixels per step from two groups
+    of 4 palette colors per line, and produces the same result as the scalar
+    path.
+*/
+void nes_video_thumbnail(const nes_video_t* sys, const uint8_t* fb, const uint8_t* emphasis, uint32_t* dst) {
+    CHIPS_ASSERT(sys && sys->valid && fb && dst);
+    const bool use_emphasis = emphasis && !sys->disable_emphasis;
+    for (int y = 0; y < NES_VIDEO_THUMBNAIL_HEIGHT; y++) {
+        const uint8_t* src0 = fb + (2 * y) * PPU_DISPLAY_WIDTH;
+        const uint8_t* src1 = src0 + PPU_DISPLAY_WIDTH;
+        const uint32_t* pal0 = &sys->palette[use_emphasis ? ((emphasis[2 * y] & 7) << 6) : 0];
+        const uint32_t* pal1 = &sys->palette[use_emphasis ? ((emphasis[2 * y + 1] & 7) << 6) : 0];
+        uint32_t* out = dst + y * NES_VIDEO_THUMBNAIL_WIDTH;
+        #if defined(_NES_VIDEO_SSE2)
+            #define _NES_VIDEO_PIXELS(pal, src, x) _mm_set_epi32((int)pal[src[x+3] & 0x3F], (int)pal[src[x+2] & 0x3F], (int)pal[src[x+1] & 0x3F], (int)pal[src[x] & 0x3F])
+            for (int x = 0; x < PPU_DISPLAY_WIDTH; x += 8, out += 4) {
+                const __m128i v0 = _mm_avg_epu8(_NES_VIDEO_PIXELS(pal0, src0, x), _NES_VIDEO_PIXELS(pal1, src1, x));
+                const __m128i v1 = _mm_avg_epu8(_NES_VIDEO_PIXELS(pal0, src0, x + 4), _NES_VIDEO_PIXELS(pal1, src1, x + 4));
+                // separate the even and odd pixels of both groups
+                const __m128i even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(2, 0, 2, 0)));
+                const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(3, 1, 3, 1)));
+                _mm_storeu_si128((__m128i*)out, _mm_avg_epu8(even, odd));
+            }
+            #undef _NES_VIDEO_PIXELS
+        #else
+            for (int x = 0; x < PPU_DISPLAY_WIDTH; x += 2, out++) {
+                const uint32_t left = _nes_video_avg(pal0[src0[x] & 0x3F], pal1[src1[x] & 0x3F]);
+                const uint32_t right = _nes_video_avg(pal0[src0[x + 1] & 0x3F], pal1[src1[x + 1] & 0x3F]);
+                *out = _nes_video_avg(left, right);
+            }
+        #endif
+    }
+}
+
+chips_display_info_t nes_video_process(nes_video_t* sys, const uint8_t* fb, const uint8_t* emphasis, uint32_t frame) {
+    CHIPS_ASSERT(sys && sys->valid && fb && emphasis);
+    const int width = (sys->filter == NES_VIDEO_FILTER_NTSC) ? NES_VIDEO_MAX_WIDTH : PPU_DISPLAY_WIDTH;
+    for (int y = 0; y < PPU_DISPLAY_HEIGHT; y++) {
+        const uint8_t* src = fb + y * PPU_DISPLAY_WIDTH;
+        const uint8_t e = sys->disable_emphasis ? 0 : (emphasis[y] & 7);
+        uint32_t* dst = sys->rgba + y * width;
+        if (sys->filter == NES_VIDEO_FILTER_NTSC) {
+            // a line is 341 pixels long, so the subcarrier phase advances by 1/3 cycle per line
+            _nes_video_ntsc_line(sys, src, e, (int)((frame + (uint32_t)y) % NES_VIDEO_NTSC_PHASES), dst);
+        }
+        else {
+            _nes_video_palette_line(sys, src, e, dst);
+        }
+    }
+    const chips_display_info_t res = {
+        .frame = {
+            .dim = {
+                .width = width,
+                .height = PPU_DISPLAY_HEIGHT,
+            },
+            .bytes_per_pixel = 4,
+            .buffer = {
+                .ptr = sys->rgba,
+                .size = (size_t)(width * PPU_DISPLAY_HEIGHT) * sizeof(uint32_t),
+            }
+        },
+        .screen = {
+            .x = 0,
+            .y = 0,
+            .width = width,
+            .height = PPU_DISPLAY_HEIGHT,
+        },
+    };
+    return res;
+}
+#endif /* CHIPS_IMPL */
@@ -0,0 +1,226 @@
+/*
+    nesbench.c
+
+    Run one or more NES instances headless and report the time and the
+    hardware performance counters (cycles, instructions, IPC, branch and
+    cache misses) per emulated frame, split into the emulator, the NTSC
+    video filter and state serialization, and the startup time from launch
+    to the first emulated frame of all instances. Counters are only available on
+    Linux when perf events are permitted, otherwise only time is reported.
+
+    The optional CSV report has one row per frame and subsystem with the
+    values averaged over all instances.
+
+    Usage: nesbench rom.nes [instances] [frames] [report.csv]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#define CHIPS_IMPL
+#include "chips/chips_common.h"
+#include "chips/clk.h"
+#include "chips/m6502.h"
+#include "r2c02.h"
+#include "nes.h"
+#include "nes_video.h"
+#include "perfctr.h"
+
+#define NESBENCH_MAX_INSTANCES (256)
+
+// the subsystems which are measured separately
+typedef enum {
+    BUCKET_EMU,         // nes_exec_frame()
+    BUCKET_VIDEO,       // NTSC filter (nes_video_process())
+    BUCKET_STATE,       // state serialization (nes_save_state())
+    NUM_BUCKETS,
+} bucket_type_t;
+
+static const char* bucket_names[NUM_BUCKETS] = { "emu", "video", "state" };
+
+typedef struct {
+    double ms;
+    perfctr_bucket_t ctr;
+} bucket_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+// a measurement in progress
+typedef struct {
+    double start_ms;
+    perfctr_sample_t start;
+} measure_t;
+
+static measure_t measure_begin(void) {
+    measure_t m;
+    perfctr_read(&m.start);
+    m.start_ms = now_ms();
+    return m;
+}
+
+static void measure_end(const measure_t* m, bucket_t* frame_bucket, bucket_t* total_bucket) {
+    const double ms = now_ms() - m->start_ms;
+    perfctr_sample_t end;
+    perfctr_read(&end);
+    perfctr_accum(&frame_bucket->ctr, &m->start, &end);
+    perfctr_accum(&total_bucket->ctr, &m->start, &end);
+    frame_bucket->ms += ms;
+    total_bucket->ms += ms;
+}
+
+static void print_row(FILE* fp, const char* prefix, const char* name, const bucket_t* b, double num_frames) {
+    fprintf(fp, "%s%s,%.4f", prefix, name, b->ms / num_frames);
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        if (perfctr_event_available((perfctr_event_t)i)) {
+            fprintf(fp, ",%.0f", (double)b->ctr.values[i] / num_frames);
+        } else {
+            fprintf(fp, ",");
+        }
+    }
+    fprintf(fp, ",%.3f\n", perfctr_ipc(&b->ctr));
+}
+
+static uint8_t* load_file(const char* path, size_t* out_size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* data = (size > 0) ? malloc((size_t)size) : 0;
+    if (data && (fread(data, (size_t)size, 1, fp) != 1)) {
+        free(data);
+        data = 0;
+    }
+    fclose(fp);
+    *out_size = (size_t)size;
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    const double launch_ms = now_ms();
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s rom.nes [instances] [frames] [report.csv]\n", argv[0]);
+        return 10;
+    }
+    const int num_instances = (argc > 2) ? atoi(argv[2]) : 1;
+    const int num_frames = (argc > 3) ? atoi(argv[3]) : 600;
+    if ((num_instances < 1) || (num_instances > NESBENCH_MAX_INSTANCES) || (num_frames < 1)) {
+        fprintf(stderr, "instances must be 1..%d, frames must be > 0\n", NESBENCH_MAX_INSTANCES);
+        return 10;
+    }
+    size_t rom_size = 0;
+    uint8_t* rom = load_file(argv[1], &rom_size);
+    if (!rom) {
+        fprintf(stderr, "failed to load '%s'\n", argv[1]);
+        return 10;
+    }
+    FILE* csv = 0;
+    if (argc > 4) {
+        csv = fopen(argv[4], "w");
+        if (!csv) {
+            fprintf(stderr, "failed to open '%s'\n", argv[4]);
+            return 10;
+        }
+    }
+
+    // each instance gets its own cache line aligned allocation
+    static nes_t* nes[NESBENCH_MAX_INSTANCES];
+    for (int i = 0; i < num_instances; i++) {
+        nes[i] = aligned_alloc(64, sizeof(nes_t));
+        if (!nes[i]) {
+            fprintf(stderr, "out of memory\n");
+            return 10;
+        }
+        nes_init(nes[i], &(nes_desc_t){0});
+        if (!nes_insert_cart(nes[i], (chips_range_t){ .ptr = rom, .size = rom_size })) {
+            fprintf(stderr, "failed to insert '%s'\n", argv[1]);
+            return 10;
+        }
+    }
+    free(rom);
+    static nes_video_t video;
+    nes_video_init(&video, &(nes_video_desc_t){ .filter = NES_VIDEO_FILTER_NTSC });
+    static uint8_t state_buf[NES_STATE_MAX_SIZE];
+
+    if (!perfctr_init()) {
+        fprintf(stderr, "hardware performance counters not available, reporting time only\n");
+    }
+    if (csv) {
+        fprintf(csv, "frame,bucket,ms");
+        for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+            fprintf(csv, ",%s", perfctr_event_name((perfctr_event_t)i));
+        }
+        fprintf(csv, ",ipc\n");
+    }
+
+    // round-robin the instances one frame at a time, like a multi-session host would
+    bucket_t totals[NUM_BUCKETS];
+    memset(totals, 0, sizeof(totals));
+    double startup_ms = 0.0;
+    for (int frame = 0; frame < num_frames; frame++) {
+        bucket_t buckets[NUM_BUCKETS];
+        memset(buckets, 0, sizeof(buckets));
+        for (int i = 0; i < num_instances; i++) {
+            measure_t m = measure_begin();
+            nes_exec_frame(nes[i]);
+            measure_end(&m, &buckets[BUCKET_EMU], &totals[BUCKET_EMU]);
+            m = measure_begin();
+            nes_video_process(&video, nes[i]->fb, nes[i]->fb_emphasis, nes[i]->frame_count);
+            measure_end(&m, &buckets[BUCKET_VIDEO], &totals[BUCKET_VIDEO]);
+            m = measure_begin();
+            nes_save_state(nes[i], state_buf, sizeof(state_buf));
+            measure_end(&m, &buckets[BUCKET_STATE], &totals[BUCKET_STATE]);
+        }
+        if (frame == 0) {
+            startup_ms = now_ms() - launch_ms;
+        }
+        if (csv) {
+            char prefix[16];
+            snprintf(prefix, sizeof(prefix), "%d,", frame);
+            for (int b = 0; b < NUM_BUCKETS; b++) {
+                print_row(csv, prefix, bucket_names[b], &buckets[b], (double)num_instances);
+            }
+        }
+    }
+
+    const double total_frames = (double)num_frames * (double)num_instances;
+    // the hot state ends with the PPU registers, in front of the OAM and sprite tables
+    const size_t hot_size = offsetof(nes_t, ppu.oam);
+    printf("nes_t: %zu bytes, hot state %zu bytes (%zu cache lines)\n", sizeof(nes_t), hot_size, (hot_size + 63) / 64);
+    printf("startup: %.2f ms (launch to first emulated frame of all instances)\n", startup_ms);
+    printf("instances: %d, frames: %d, values per emulated frame:\n\n", num_instances, num_frames);
+    printf("%-8s %10s", "bucket", "ms");
+    for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+        printf(" %14s", perfctr_event_name((perfctr_event_t)i));
+    }
+    printf(" %6s\n", "ipc");
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        printf("%-8s %10.4f", bucket_names[b], totals[b].ms / total_frames);
+        for (int i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+            if (perfctr_event_available((perfctr_event_t)i)) {
+                printf(" %14.0f", (double)totals[b].ctr.values[i] / total_frames);
+            } else {
+                printf(" %14s", "-");
+            }
+        }
+        printf(" %6.2f\n", perfctr_ipc(&totals[b].ctr));
+    }
+    if (csv) {
+        fclose(csv);
+    }
+    perfctr_shutdown();
+    for (int i = 0; i < num_instances; i++) {
+        nes_discard(nes[i]);
+        free(nes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+    nesrec.c
+
+    Convert a capture recorded with madNES record=file.nrec into a
+    Y4M video (4:4:4, full resolution) and a WAV file (32-bit float mono).
+
+    Usage: nesrec input.nrec output.y4m [output.wav]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "recfile.h"
+
+// NTSC NES frame rate (1789773 Hz / 29780.5 cycles per frame)
+#define NESREC_FPS_NUM (3579546)
+#define NESREC_FPS_DEN (59561)
+
+static void put_u16(FILE* fp, uint16_t val) {
+    const uint8_t bytes[2] = { (uint8_t)val, (uint8_t)(val >> 8) };
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+static void put_u32(FILE* fp, uint32_t val) {
+    const uint8_t bytes[4] = { (uint8_t)val, (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24) };
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+// write a WAV header for 32-bit float mono samples
+static void write_wav_header(FILE* fp, uint32_t sample_rate, uint32_t num_samples) {
+    const uint32_t data_size = num_samples * 4;
+    fwrite("RIFF", 4, 1, fp);
+    put_u32(fp, 36 + data_size);
+    fwrite("WAVEfmt ", 8, 1, fp);
+    put_u32(fp, 16);
+    put_u16(fp, 3);     // WAVE_FORMAT_IEEE_FLOAT
+    put_u16(fp, 1);     // mono
+    put_u32(fp, sample_rate);
+    put_u32(fp, sample_rate * 4);
+    put_u16(fp, 4);
+    put_u16(fp, 32);
+    fwrite("data", 4, 1, fp);
+    put_u32(fp, data_size);
+}
+
+static uint8_t clamp_u8(int val) {
+    return (uint8_t)((val < 0) ? 0 : ((val > 255) ? 255 : val));
+}
+
+// precomputed BT.601 full-range YUV value of each palette entry
+static uint8_t pal_yuv[3][RECFILE_MAX_COLORS];
+
+static void write_y4m_frame(FILE* fp, const uint8_t* frame, uint8_t* plane, size_t num_pixels) {
+    fputs("FRAME\n", fp);
+    for (int p = 0; p < 3; p++) {
+        for (size_t i = 0; i < num_pixels; i++) {
+            plane[i] = pal_yuv[p][frame[i]];
+        }
+        fwrite(plane, num_pixels, 1, fp);
+    }
+}
+
+static void write_silence(FILE* fp, uint32_t num_samples) {
+    static const float zeros[1024];
+    while (num_samples > 0) {
+        const uint32_t num = (num_samples < 1024) ? num_samples : 1024;
+        fwrite(zeros, sizeof(float), num, fp);
+        num_samples -= num;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s input.nrec output.y4m [output.wav]\n", argv[0]);
+        return 10;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "failed to open '%s'\n", argv[1]);
+        return 10;
+    }
+    static recfile_header_t hdr;
+    if (!recfile_read_header(in, &hdr)) {
+        fprintf(stderr, "'%s' is not a valid capture file\n", argv[1]);
+        fclose(in);
+        return 10;
+    }
+    FILE* y4m = fopen(argv[2], "wb");
+    if (!y4m) {
+        fprintf(stderr, "failed to create '%s'\n", argv[2]);
+        fclose(in);
+        return 10;
+    }
+    FILE* wav = 0;
+    if (argc > 3) {
+        wav = fopen(argv[3], "wb");
+        if (!wav) {
+            fprintf(stderr, "failed to create '%s'\n", argv[3]);
+            fclose(y4m);
+            fclose(in);
+            return 10;
+        }
+        // placeholder, patched when the number of samples is known
+        write_wav_header(wav, hdr.sample_rate, 0);
+    }
+
+    for (uint32_t i = 0; i < hdr.num_colors; i++) {
+        const int r = (int)(hdr.palette[i] & 0xFF);
+        const int g = (int)((hdr.palette[i] >> 8) & 0xFF);
+        const int b = (int)((hdr.palette[i] >> 16) & 0xFF);
+        pal_yuv[0][i] = clamp_u8((  77 * r + 150 * g +  29 * b + 128) >> 8);
+        pal_yuv[1][i] = clamp_u8((( -43 * r -  85 * g + 128 * b + 128) >> 8) + 128);
+        pal_yuv[2][i] = clamp_u8((( 128 * r - 107 * g -  21 * b + 128) >> 8) + 128);
+    }
+    fprintf(y4m, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C444 XCOLORRANGE=FULL\n", hdr.width, hdr.height, NESREC_FPS_NUM, NESREC_FPS_DEN);
+
+    const size_t num_pixels = (size_t)hdr.width * hdr.height;
+    uint8_t* frame = (uint8_t*)calloc(1, num_pixels);
+    uint8_t* plane = (uint8_t*)malloc(num_pixels);
+    size_t chunk_capacity = RECFILE_MAX_ENCODED_SIZE(num_pixels);
+    uint8_t* chunk = (uint8_t*)malloc(chunk_capacity);
+    uint32_t num_frames = 0;
+    uint32_t num_samples = 0;
+    uint32_t num_dropped_frames = 0;
+    bool ok = true;
+    uint8_t type;
+    uint32_t size;
+    while (ok && recfile_read_chunk_header(in, &type, &size)) {
+        if (size > chunk_capacity) {
+            chunk_capacity = size;
+            chunk = (uint8_t*)realloc(chunk, chunk_capacity);
+        }
+        if ((size > 0) && (1 != fread(chunk, size, 1, in))) {
+            fprintf(stderr, "truncated chunk, stopping\n");
+            break;
+        }
+        if (type == RECFILE_CHUNK_FRAME) {
+            if (!recfile_decode_frame(chunk, size, frame, num_pixels)) {
+                fprintf(stderr, "corrupt frame %u\n", num_frames);
+                ok = false;
+                break;
+            }
+            write_y4m_frame(y4m, frame, plane, num_pixels);
+            num_frames++;
+        }
+        else if (type == RECFILE_CHUNK_AUDIO) {
+            if (wav) {
+                fwrite(chunk, size, 1, wav);
+            }
+            num_samples += size / 4;
+        }
+        else if ((type == RECFILE_CHUNK_DROP) && (size == RECFILE_DROP_SIZE)) {
+            // keep video and audio in sync: repeat the previous frame, pad the audio with silence
+            uint32_t drop_frames, drop_samples;
+            recfile_decode_drop(chunk, &drop_frames, &drop_samples);
+            for (uint32_t i = 0; i < drop_frames; i++) {
+                write_y4m_frame(y4m, frame, plane, num_pixels);
+            }
+            if (wav) {
+                write_silence(wav, drop_samples);
+            }
+            num_frames += drop_frames;
+            num_samples += drop_samples;
+            num_dropped_frames += drop_frames;
+        }
+    }
+    if (wav) {
+        fseek(wav, 0, SEEK_SET);
+        write_wav_header(wav, hdr.sample_rate, num_samples);
+        fclose(wav);
+    }
+    fclose(y4m);
+    fclose(in);
+    free(chunk);
+    free(plane);
+    free(frame);
+    printf("%u frames (%u repeated for dropped frames), %u audio samples (%.2f seconds)\n", num_frames, num_dropped_frames, num_samples, hdr.sample_rate ? (double)num_samples / hdr.sample_rate : 0.0);
+    return ok ? 0 : 10;
+}
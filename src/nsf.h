@@ -0,0 +1,385 @@
+#pragma once
+/*#
+    # nsf.h
+
+    A headless NSF (NES Sound Format) player in a C header: the tune's code
+    runs on the m6502 and drives the APU of nes.h (apu_t), there is no PPU,
+    so a song renders several hundred times faster than real time.
+
+    Do this:
+    ~~~C
+    #define CHIPS_IMPL
+    ~~~
+    before you include this file in *one* C or C++ file to create the
+    implementation.
+
+    You need to include the following headers before including nsf.h:
+
+    - chips/chips_common.h
+    - chips/clk.h
+    - chips/m6502.h
+    - r2c02.h
+    - nes.h (in the implementation file also with CHIPS_IMPL, the player
+      uses the APU functions of nes.h)
+
+    ## How it works
+
+    The file data is mapped into $8000-$FFFF in 4KB pages, switched through
+    $5FF8-$5FFF if the header has initial bank values, RAM is at $0000-$07FF
+    and $6000-$7FFF. The reset vector points to a small driver at $4100 which
+    calls INIT with the song number in A and the region in X and then spins
+    in an idle loop. At the PLAY rate of the header the idle loop's jump is
+    redirected into a JSR PLAY, so a PLAY call which takes longer than its
+    period delays the next one instead of piling up.
+
+    The file data isn't copied, it must stay valid while the player uses it
+    (several players may share the same data, e.g. on different threads).
+
+    ## Warning
+
+    - expansion sound chips are not supported (the 2A03 part of such tunes plays)
+    - the APU limitations of nes.h apply (no triangle and DMC channels)
+    - NSF2 and NSFe extensions are ignored
+
+    ## zlib/libpng license
+
+        Copyright (c) 2023 Scemino
+        This software is provided 'as-is', without any express or implied warranty.
+        In no event will the authors be held liable for any damages arising from the
+        use of this software.
+        Permission is granted to anyone to use this software for any purpose,
+        including commercial applications, and to alter it and redistribute it
+        freely, subject to the following restrictions:
+        1. The origin of this software must not be misrepresented; you must not
+        claim that you wrote the original software. If you use this software in a
+        product, an acknowledgment in the product documentation would be
+        appreciated but is not required.
+        2. Altered source versions must be plainly marked as such, and must not
+        be misrepresented as being the original software.
+        3. This notice may not be removed or altered from any source
+        distribution.
+#*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NSF_HEADER_SIZE (0x80)
+#define NSF_DRIVER_ADDR (0x4100)        // the driver code is mapped here
+#define NSF_DRIVER_SIZE (16)
+
+// configuration parameters for nsf_init()
+typedef struct {
+    chips_audio_desc_t audio;
+    // console timing, NES_REGION_AUTO is NTSC unless the tune is PAL only
+    nes_region_t region;
+} nsf_desc_t;
+
+// the header fields of a loaded file
+typedef struct {
+    char name[33];
+    char artist[33];
+    char copyright[33];
+    int num_songs;
+    int start_song;                 // 0-based
+    uint16_t load_addr;
+    uint16_t init_addr;
+    uint16_t play_addr;
+    uint16_t play_us[2];            // PLAY period in micro seconds, NTSC and PAL
+    uint8_t init_banks[8];
+    bool banked;                    // true if any of init_banks is set
+    uint8_t region_flags;           // bit 0: PAL, bit 1: NTSC and PAL
+    uint8_t expansion_chips;        // not supported
+} nsf_info_t;
+
+// NSF player state
+typedef struct {
+    m6502_t cpu;
+    uint64_t pins;
+    apu_t apu;
+    nes_region_t region;            // active timing (never NES_REGION_AUTO)
+    nes_region_t region_select;
+    bool valid;
+    bool loaded;
+    int song;                       // 0-based
+    uint64_t play_clock;            // micro seconds * CPU frequency since the last PLAY period
+    uint64_t play_period;           // PLAY period in micro seconds * CPU frequency
+    bool play_pending;
+    uint16_t bank[8];               // 4KB pages at $8000-$FFFF, 0xFFFF: unmapped
+    uint8_t driver[NSF_DRIVER_SIZE];
+    struct {
+        uint32_t sample_rate;
+        chips_audio_callback_t callback;
+        int num_samples;
+        int sample_pos;
+    } audio;
+    nsf_info_t info;
+    const uint8_t* data;            // the file data after the header (not copied)
+    size_t data_size;
+    uint32_t data_offset;           // load_addr & $FFF, the data starts at this offset in its first page
+    uint8_t ram[0x800];
+    uint8_t sram[0x2000];
+    float audio_samples[NES_MAX_AUDIO_SAMPLES];
+} nsf_t;
+
+// initialize a new NSF player instance
+void nsf_init(nsf_t* nsf, const nsf_desc_t* desc);
+// discard an NSF player instance
+void nsf_discard(nsf_t* nsf);
+// parse the header of an NSF file, returns false if it isn't a valid NSF file
+bool nsf_parse_header(chips_range_t data, nsf_info_t* out_info);
+// load an NSF file (the data isn't copied) and start its default song, returns false if the file is invalid
+bool nsf_load(nsf_t* nsf, chips_range_t data);
+// restart the player with a song (0-based), returns false if there is no such song
+bool nsf_start_song(nsf_t* nsf, int song);
+// run the player for given amount of micro_seconds, returns number of ticks executed
+uint32_t nsf_exec(nsf_t* nsf, uint32_t micro_seconds);
+// get the CPU clock frequency in Hz of the active console timing
+uint32_t nsf_cpu_frequency(nsf_t* nsf);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*-- IMPLEMENTATION ----------------------------------------------------------*/
+#ifdef CHIPS_IMPL
+#include <string.h>
+#ifndef CHIPS_ASSERT
+    #include <assert.h>
+    #define CHIPS_ASSERT(c) assert(c)
+#endif
+
+// the driver entry points: LDA #song, LDX #region, JSR INIT, idle: JMP idle, play: JSR PLAY, JMP idle
+#define _NSF_IDLE_ADDR (NSF_DRIVER_ADDR + 7)
+#define _NSF_PLAY_ADDR (NSF_DRIVER_ADDR + 10)
+
+static uint16_t _nsf_u16(const uint8_t* ptr) {
+    return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+void nsf_init(nsf_t* sys, const nsf_desc_t* desc) {
+    CHIPS_ASSERT(sys && desc);
+    memset(sys, 0, sizeof(nsf_t));
+    sys->valid = true;
+    sys->audio.callback = desc->audio.callback;
+    sys->audio.num_samples = _NES_DEFAULT(desc->audio.num_samples, NES_DEFAULT_AUDIO_SAMPLES);
+    sys->audio.sample_rate = _NES_DEFAULT(desc->audio.sample_rate, NES_DEFAULT_AUDIO_SAMPLE_RATE);
+    CHIPS_ASSERT(sys->audio.num_samples <= NES_MAX_AUDIO_SAMPLES);
+    sys->region_select = desc->region;
+    sys->region = (desc->region != NES_REGION_AUTO) ? desc->region : NES_REGION_NTSC;
+}
+
+void nsf_discard(nsf_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    sys->valid = false;
+}
+
+bool nsf_parse_header(chips_range_t data, nsf_info_t* out_info) {
+    CHIPS_ASSERT(out_info);
+    const uint8_t* hdr = (const uint8_t*)data.ptr;
+    if (!hdr || (data.size <= NSF_HEADER_SIZE) || (0 != memcmp(hdr, "NESM\x1A", 5))) {
+        return false;
+    }
+    nsf_info_t info;
+    memset(&info, 0, sizeof(info));
+    memcpy(info.name, hdr + 0x0E, 32);
+    memcpy(info.artist, hdr + 0x2E, 32);
+    memcpy(info.copyright, hdr + 0x4E, 32);
+    info.num_songs = hdr[0x06];
+    info.start_song = (hdr[0x07] > 0) ? (hdr[0x07] - 1) : 0;
+    info.load_addr = _nsf_u16(hdr + 0x08);
+    info.init_addr = _nsf_u16(hdr + 0x0A);
+    info.play_addr = _nsf_u16(hdr + 0x0C);
+    info.play_us[0] = _nsf_u16(hdr + 0x6E);
+    info.play_us[1] = _nsf_u16(hdr + 0x78);
+    // 0 isn't a valid rate, use the vertical blank rate
+    if (info.play_us[0] == 0) {
+        info.play_us[0] = 16639;
+    }
+    if (info.play_us[1] == 0) {
+        info.play_us[1] = 19997;
+    }
+    for (int i = 0; i < 8; i++) {
+        info.init_banks[i] = hdr[0x70 + i];
+        info.banked |= (info.init_banks[i] != 0);
+    }
+    info.region_flags = hdr[0x7A] & 3;
+    info.expansion_chips = hdr[0x7B];
+    // only tunes in the ROM area are supported
+    if ((info.num_songs == 0) || (info.load_addr < 0x8000) || (info.init_addr < 0x8000) || (info.play_addr < 0x8000)) {
+        return false;
+    }
+    if (info.start_song >= info.num_songs) {
+        info.start_song = 0;
+    }
+    *out_info = info;
+    return true;
+}
+
+bool nsf_load(nsf_t* sys, chips_range_t data) {
+    CHIPS_ASSERT(sys && sys->valid);
+    nsf_info_t info;
+    if (!nsf_parse_header(data, &info)) {
+        return false;
+    }
+    sys->info = info;
+    sys->data = (const uint8_t*)data.ptr + NSF_HEADER_SIZE;
+    sys->data_size = data.size - NSF_HEADER_SIZE;
+    sys->data_offset = info.load_addr & 0x0FFF;
+    if (sys->region_select == NES_REGION_AUTO) {
+        sys->region = (info.region_flags == 1) ? NES_REGION_PAL : NES_REGION_NTSC;
+    }
+    sys->loaded = true;
+    return nsf_start_song(sys, info.start_song);
+}
+
+uint32_t nsf_cpu_frequency(nsf_t* sys) {
+    CHIPS_ASSERT(sys && sys->valid);
+    return _nes_timing[sys->region].cpu_frequency;
+}
+
+bool nsf_start_song(nsf_t* sys, int song) {
+    CHIPS_ASSERT(sys && sys->valid);
+    if (!sys->loaded || (song < 0) || (song >= sys->info.num_songs)) {
+        return false;
+    }
+    sys->song = song;
+    memset(sys->ram, 0, sizeof(sys->ram));
+    memset(sys->sram, 0, sizeof(sys->sram));
+
+    // initial pages: from the header, or the data in one piece at the load address
+    const int first_page = (sys->info.load_addr - 0x8000) >> 12;
+    for (int i = 0; i < 8; i++) {
+        if (sys->info.banked) {
+            sys->bank[i] = sys->info.init_banks[i];
+        } else {
+            sys->bank[i] = (i >= first_page) ? (uint16_t)(i - first_page) : 0xFFFF;
+        }
+    }
+
+    // APU in the power-up state the tunes expect
+    const uint32_t cpu_frequency = _nes_timing[sys->region].cpu_frequency;
+    memset(&sys->apu, 0, sizeof(sys->apu));
+    sys->apu.noise.seq.sequence = 0xdbdb;
+    sys->apu.audio_time_per_system_sample = 1.0 / (double)sys->audio.sample_rate;
+    sys->apu.audio_time_per_nes_clock = 1.0 / (double)cpu_frequency;
+    for (uint16_t addr = 0x4000; addr < 0x4014; addr++) {
+        _apu_write(&sys->apu, addr, 0);
+    }
+    _apu_write(&sys->apu, 0x4015, 0x0F);
+    sys->audio.sample_pos = 0;
+
+    // PAL tunes get X=1, Dendy runs at the PAL frame rate
+    const bool pal = sys->region != NES_REGION_NTSC;
+    const uint16_t init = sys->info.init_addr;
+    const uint16_t play = sys->info.play_addr;
+    const uint8_t driver[NSF_DRIVER_SIZE] = {
+        0xA9, (uint8_t)song,                                        // LDA #song
+        0xA2, pal ? 1 : 0,                                          // LDX #region
+        0x20, (uint8_t)init, (uint8_t)(init >> 8),                  // JSR INIT
+        0x4C, (uint8_t)_NSF_IDLE_ADDR, (uint8_t)(_NSF_IDLE_ADDR >> 8),      // idle: JMP idle
+        0x20, (uint8_t)play, (uint8_t)(play >> 8),                  // play: JSR PLAY
+        0x4C, (uint8_t)_NSF_IDLE_ADDR, (uint8_t)(_NSF_IDLE_ADDR >> 8),      // JMP idle
+    };
+    memcpy(sys->driver, driver, sizeof(driver));
+    sys->play_period = (uint64_t)sys->info.play_us[pal ? 1 : 0] * cpu_frequency;
+    sys->play_clock = 0;
+    sys->play_pending = false;
+
+    // the reset vector enters the driver
+    sys->pins = m6502_init(&sys->cpu, &(m6502_desc_t){
+        .bcd_disabled = true
+    });
+    return true;
+}
+
+static uint8_t _nsf_mem_read(nsf_t* sys, uint16_t addr) {
+    if (addr < 0x2000) {
+        return sys->ram[addr & 0x7ff];
+    } else if (addr >= 0x8000) {
+        if ((addr & 0xFFFE) == 0xFFFC) {
+            return (addr & 1) ? (uint8_t)(NSF_DRIVER_ADDR >> 8) : (uint8_t)NSF_DRIVER_ADDR;
+        }
+        // a page before the data start or past its end reads as 0
+        const uint32_t offset = (uint32_t)sys->bank[(addr >> 12) & 7] * 0x1000 + (addr & 0x0FFF) - sys->data_offset;
+        return (offset < sys->data_size) ? sys->data[offset] : 0;
+    } else if (addr >= 0x6000) {
+        return sys->sram[addr - 0x6000];
+    } else if ((addr >= NSF_DRIVER_ADDR) && (addr < NSF_DRIVER_ADDR + NSF_DRIVER_SIZE)) {
+        return sys->driver[addr - NSF_DRIVER_ADDR];
+    }
+    return 0;
+}
+
+static void _nsf_mem_write(nsf_t* sys, uint16_t addr, uint8_t data) {
+    if (addr < 0x2000) {
+        sys->ram[addr & 0x7ff] = data;
+    } else if ((addr >= 0x4000) && (addr < 0x4020)) {
+        _apu_write(&sys->apu, addr, data);
+    } else if ((addr >= 0x5FF8) && (addr < 0x6000)) {
+        sys->bank[addr - 0x5FF8] = data;
+    } else if ((addr >= 0x6000) && (addr < 0x8000)) {
+        sys->sram[addr - 0x6000] = data;
+    }
+}
+
+static _NES_FORCE_INLINE uint64_t _nsf_tick(nsf_t* sys, uint64_t pins, const nes_region_t region) {
+    pins = m6502_tick(&sys->cpu, pins);
+    const uint16_t addr = M6502_GET_ADDR(pins);
+    if (pins & M6502_SYNC) {
+        // redirect the idle jump into the PLAY call while a PLAY period is due
+        if (addr == _NSF_IDLE_ADDR) {
+            const uint16_t target = sys->play_pending ? _NSF_PLAY_ADDR : _NSF_IDLE_ADDR;
+            sys->driver[_NSF_IDLE_ADDR + 1 - NSF_DRIVER_ADDR] = (uint8_t)target;
+        } else if (addr == _NSF_PLAY_ADDR) {
+            sys->play_pending = false;
+        }
+    }
+    if (pins & M6502_RW) {
+        M6502_SET_DATA(pins, _nsf_mem_read(sys, addr));
+    } else {
+        _nsf_mem_write(sys, addr, M6502_GET_DATA(pins));
+    }
+    sys->play_clock += 1000000;
+    if (sys->play_clock >= sys->play_period) {
+        sys->play_clock -= sys->play_period;
+        sys->play_pending = true;
+    }
+    if (_apu_tick(&sys->apu, region)) {
+        sys->audio_samples[sys->audio.sample_pos++] = sys->apu.audio_sample;
+        if (sys->audio.sample_pos == sys->audio.num_samples) {
+            if (sys->audio.callback.func) {
+                sys->audio.callback.func(sys->audio_samples, sys->audio.num_samples, sys->audio.callback.user_data);
+            }
+            sys->audio.sample_pos = 0;
+        }
+    }
+    return pins;
+}
+
+static _NES_FORCE_INLINE uint32_t _nsf_exec(nsf_t* sys, uint32_t micro_seconds, const nes_region_t region) {
+    const uint32_t num_ticks = clk_us_to_ticks(_nes_timing[region].cpu_frequency, micro_seconds);
+    uint64_t pins = sys->pins;
+    for (uint32_t tick = 0; tick < num_ticks; tick++) {
+        pins = _nsf_tick(sys, pins, region);
+    }
+    sys->pins = pins;
+    return num_ticks;
+}
+
+uint32_t nsf_exec(nsf_t* sys, uint32_t micro_seconds) {
+    CHIPS_ASSERT(sys && sys->valid);
+    if (!sys->loaded) {
+        return 0;
+    }
+    switch (sys->region) {
+        case NES_REGION_PAL:    return _nsf_exec(sys, micro_seconds, NES_REGION_PAL);
+        case NES_REGION_DENDY:  return _nsf_exec(sys, micro_seconds, NES_REGION_DENDY);
+        default:                return _nsf_exec(sys, micro_seconds, NES_REGION_NTSC);
+    }
+}
+
+#endif /* CHIPS_IMPL */
@@ -0,0 +1,258 @@
+/*
+    nsfrender.c
+
+    Render the songs of one or more NSF files into WAV files (32-bit float
+    mono) as fast as possible, without the PPU and without real-time pacing.
+    The songs are spread over worker threads, the files are loaded once and
+    shared by all players.
+
+    Each song is written to out_dir/<file name>_<song>.wav, the songs are
+    numbered from 1.
+
+    Usage: nsfrender [-j threads] [-s seconds] [-r sample_rate] out_dir file.nsf...
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#define CHIPS_IMPL
+#include "chips/chips_common.h"
+#include "chips/clk.h"
+#include "chips/m6502.h"
+#include "r2c02.h"
+#include "nes.h"
+#include "nsf.h"
+#include "thread.h"
+
+#define NSFRENDER_MAX_THREADS (64)
+#define NSFRENDER_CHUNK_US (100000)     // nsf_exec() granularity
+
+typedef struct {
+    const char* path;
+    const char* base_name;          // file name without directory and extension
+    int base_len;
+    uint8_t* data;
+    size_t size;
+    nsf_info_t info;
+} nsf_file_t;
+
+typedef struct {
+    int file;
+    int song;
+} job_t;
+
+static struct {
+    const char* out_dir;
+    uint32_t seconds;
+    uint32_t sample_rate;
+    nsf_file_t* files;
+    int num_files;
+    job_t* jobs;
+    int num_jobs;
+    int next_job;
+    int num_failed;
+    thread_mutex_t mutex;
+} state;
+
+// the output of one song in progress
+typedef struct {
+    FILE* fp;
+    uint32_t num_samples;
+    uint32_t max_samples;
+} render_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+static void put_u16(FILE* fp, uint16_t val) {
+    const uint8_t bytes[2] = { (uint8_t)val, (uint8_t)(val >> 8) };
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+static void put_u32(FILE* fp, uint32_t val) {
+    const uint8_t bytes[4] = { (uint8_t)val, (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24) };
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+// write a WAV header for 32-bit float mono samples
+static void write_wav_header(FILE* fp, uint32_t sample_rate, uint32_t num_samples) {
+    const uint32_t data_size = num_samples * 4;
+    fwrite("RIFF", 4, 1, fp);
+    put_u32(fp, 36 + data_size);
+    fwrite("WAVEfmt ", 8, 1, fp);
+    put_u32(fp, 16);
+    put_u16(fp, 3);     // WAVE_FORMAT_IEEE_FLOAT
+    put_u16(fp, 1);     // mono
+    put_u32(fp, sample_rate);
+    put_u32(fp, sample_rate * 4);
+    put_u16(fp, 4);
+    put_u16(fp, 32);
+    fwrite("data", 4, 1, fp);
+    put_u32(fp, data_size);
+}
+
+static bool load_file(const char* path, nsf_file_t* file) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    file->data = (size > 0) ? (uint8_t*)malloc((size_t)size) : 0;
+    const bool ok = file->data && (1 == fread(file->data, (size_t)size, 1, fp));
+    fclose(fp);
+    if (!ok || !nsf_parse_header((chips_range_t){ .ptr = file->data, .size = (size_t)size }, &file->info)) {
+        free(file->data);
+        file->data = 0;
+        return false;
+    }
+    file->size = (size_t)size;
+    file->path = path;
+    const char* slash = strrchr(path, '/');
+    file->base_name = slash ? (slash + 1) : path;
+    const char* dot = strrchr(file->base_name, '.');
+    file->base_len = dot ? (int)(dot - file->base_name) : (int)strlen(file->base_name);
+    return true;
+}
+
+static void audio_callback(const float* samples, int num_samples, void* user_data) {
+    render_t* r = (render_t*)user_data;
+    const uint32_t remaining = r->max_samples - r->num_samples;
+    const uint32_t n = ((uint32_t)num_samples < remaining) ? (uint32_t)num_samples : remaining;
+    fwrite(samples, sizeof(float), n, r->fp);
+    r->num_samples += n;
+}
+
+static bool render_song(nsf_t* player, const nsf_file_t* file, int song) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%.*s_%02d.wav", state.out_dir, file->base_len, file->base_name, song + 1);
+    render_t r = { .fp = fopen(path, "wb"), .max_samples = state.seconds * state.sample_rate };
+    if (!r.fp) {
+        fprintf(stderr, "failed to create '%s'\n", path);
+        return false;
+    }
+    // placeholder, patched when the number of samples is known
+    write_wav_header(r.fp, state.sample_rate, 0);
+    nsf_init(player, &(nsf_desc_t){
+        .audio = {
+            .callback = { .func = audio_callback, .user_data = &r },
+            .sample_rate = (int)state.sample_rate,
+        },
+    });
+    bool ok = nsf_load(player, (chips_range_t){ .ptr = file->data, .size = file->size }) && nsf_start_song(player, song);
+    while (ok && (r.num_samples < r.max_samples)) {
+        nsf_exec(player, NSFRENDER_CHUNK_US);
+    }
+    nsf_discard(player);
+    fseek(r.fp, 0, SEEK_SET);
+    write_wav_header(r.fp, state.sample_rate, r.num_samples);
+    fclose(r.fp);
+    return ok;
+}
+
+static void worker_func(void* user_data) {
+    (void)user_data;
+    // nsf_t is too big for small thread stacks
+    nsf_t* player = (nsf_t*)malloc(sizeof(nsf_t));
+    while (true) {
+        thread_mutex_lock(&state.mutex);
+        const int job_index = state.next_job++;
+        thread_mutex_unlock(&state.mutex);
+        if (job_index >= state.num_jobs) {
+            break;
+        }
+        const job_t* job = &state.jobs[job_index];
+        if (!render_song(player, &state.files[job->file], job->song)) {
+            thread_mutex_lock(&state.mutex);
+            state.num_failed++;
+            thread_mutex_unlock(&state.mutex);
+        }
+    }
+    free(player);
+}
+
+int main(int argc, char* argv[]) {
+    int num_threads = 4;
+    state.seconds = 180;
+    state.sample_rate = NES_DEFAULT_AUDIO_SAMPLE_RATE;
+    int arg = 1;
+    for (; (arg + 1 < argc) && (argv[arg][0] == '-'); arg += 2) {
+        const int val = atoi(argv[arg + 1]);
+        if (0 == strcmp(argv[arg], "-j")) {
+            num_threads = (val < 1) ? 1 : ((val > NSFRENDER_MAX_THREADS) ? NSFRENDER_MAX_THREADS : val);
+        } else if (0 == strcmp(argv[arg], "-s")) {
+            state.seconds = (val < 1) ? 1 : (uint32_t)val;
+        } else if (0 == strcmp(argv[arg], "-r")) {
+            state.sample_rate = (val < 8000) ? 8000 : (uint32_t)val;
+        } else {
+            break;
+        }
+    }
+    if (argc - arg < 2) {
+        fprintf(stderr, "usage: %s [-j threads] [-s seconds] [-r sample_rate] out_dir file.nsf...\n", argv[0]);
+        return 10;
+    }
+    state.out_dir = argv[arg++];
+
+    // load all files up front, the players share the data
+    state.files = (nsf_file_t*)calloc((size_t)(argc - arg), sizeof(nsf_file_t));
+    for (; arg < argc; arg++) {
+        nsf_file_t* file = &state.files[state.num_files];
+        if (!load_file(argv[arg], file)) {
+            fprintf(stderr, "'%s' is not a valid NSF file, skipped\n", argv[arg]);
+            continue;
+        }
+        if (file->info.expansion_chips) {
+            fprintf(stderr, "'%s' uses expansion sound chips (not supported), only the 2A03 part is rendered\n", argv[arg]);
+        }
+        state.num_jobs += file->info.num_songs;
+        state.num_files++;
+    }
+    state.jobs = (job_t*)calloc((size_t)state.num_jobs + 1, sizeof(job_t));
+    int job_index = 0;
+    for (int f = 0; f < state.num_files; f++) {
+        for (int s = 0; s < state.files[f].info.num_songs; s++) {
+            state.jobs[job_index++] = (job_t){ .file = f, .song = s };
+        }
+    }
+
+    const double start_ms = now_ms();
+    thread_mutex_init(&state.mutex);
+    if (num_threads > state.num_jobs) {
+        num_threads = (state.num_jobs > 0) ? state.num_jobs : 1;
+    }
+    thread_t threads[NSFRENDER_MAX_THREADS];
+    int num_started = 0;
+    if (thread_supported()) {
+        while ((num_started < num_threads) && thread_create(&threads[num_started], worker_func, 0)) {
+            num_started++;
+        }
+    }
+    if (num_started == 0) {
+        // no threads, render everything on the main thread
+        worker_func(0);
+    }
+    for (int i = 0; i < num_started; i++) {
+        thread_join(&threads[i]);
+    }
+    thread_mutex_destroy(&state.mutex);
+    const double ms = now_ms() - start_ms;
+
+    const double audio_seconds = (double)(state.num_jobs - state.num_failed) * state.seconds;
+    printf("%d songs from %d files, %.0f seconds of audio in %.2f seconds on %d threads (%.0fx real time)\n",
+        state.num_jobs - state.num_failed, state.num_files, audio_seconds, ms / 1000.0,
+        (num_started > 0) ? num_started : 1, (ms > 0.0) ? (audio_seconds * 1000.0 / ms) : 0.0);
+    for (int f = 0; f < state.num_files; f++) {
+        free(state.files[f].data);
+    }
+    free(state.files);
+    free(state.jobs);
+    return (state.num_failed > 0) ? 10 : 0;
+}
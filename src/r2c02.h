@@ -16,6 +16,8 @@
     #define CHIPS_ASSERT(x) your_own_asset_macro(x)
     ~~~
 
+    You need to include chips/chips_common.h before r2c02.h.
+
     ## Real Pins
           ___  ___
          |*  \/   |
@@ -94,10 +96,14 @@ const uint32_t ppu_palette[] = {
 #define I8255_PIN_A2    (10)
 
 #define PICTURE_BUFFER_SIZE     (256*240)
+#define MAX_SCANLINE_SPRITES    (8)         // hardware limit of sprites per scanline
 #define SCANLINE_END_CYCLE      (340)
 #define VISIBLE_SCANLINES       (240)
 #define SCANLINE_VISIBLE_DOTS   (256)
-#define FRAME_END_SCANLINE      (261)
+#define FRAME_END_SCANLINE      (261)       // NTSC: 262 lines per frame (pre-render line -1 to 260)
+#define FRAME_END_SCANLINE_PAL  (311)       // PAL and Dendy: 312 lines per frame
+#define VBLANK_SCANLINE         (241)       // NTSC and PAL: vblank starts right after the post-render line
+#define VBLANK_SCANLINE_DENDY   (291)       // Dendy: 51 post-render lines before vblank
 
 typedef struct {
     uint8_t (*read)(uint16_t addr, void* user_data);
@@ -105,22 +111,15 @@ typedef struct {
     void (*set_pixels)(uint8_t* buffer, void* user_data);
     void* user_data;
 
-    union {
-        struct {
-            uint8_t y;            // Y position of sprite
-            uint8_t id;           // ID of tile from pattern memory
-            uint8_t attribute;    // Flags define how sprite should be rendered
-            uint8_t x;            // X position of sprite
-        } data[64];
-        uint8_t reg[64*4];
-    } oam;
-
+    // the per-tick state comes first, the larger arrays are at the end
     int cycle;
     int scanline;
     bool even_frame;
-    uint8_t picture_buffer[PICTURE_BUFFER_SIZE];
-    uint8_t scanline_sprites[8];
+    uint8_t* picture_buffer;                // PICTURE_BUFFER_SIZE bytes, provided by the owner (see r2c02_desc_t)
     int scanline_sprites_num;
+    bool unlimited_sprites;                 // render all sprites of a scanline (the overflow flag is still set)
+    bool sprite_buckets_valid;              // see r2c02_invalidate_sprites()
+    int sprite_buckets_height;              // sprite height the buckets were built for
 
     //Registers
     uint16_t data_address;
@@ -172,6 +171,19 @@ typedef struct {
 		uint8_t reg;
 	} ppu_control;
 
+    union {
+        struct {
+            uint8_t y;            // Y position of sprite
+            uint8_t id;           // ID of tile from pattern memory
+            uint8_t attribute;    // Flags define how sprite should be rendered
+            uint8_t x;            // X position of sprite
+        } data[64];
+        uint8_t reg[64*4];
+    } oam;
+    uint8_t scanline_sprites[64];           // OAM indices of the sprites on the next scanline
+    uint8_t emphasis[VISIBLE_SCANLINES];    // color emphasis bits (PPUMASK bits 5..7) of each scanline
+    // sprites bucketed by scanline, rebuilt when OAM or the sprite size changes
+    uint64_t sprite_buckets[VISIBLE_SCANLINES];    // bit i: OAM sprite i is in range of the scanline
 } r2c02_t;
 
 typedef struct {
@@ -179,17 +191,25 @@ typedef struct {
     void (*write)(uint16_t addr, uint8_t data, void* user_data);
     void (*set_pixels)(uint8_t* buffer, void* user_data);
     void* user_data;
+    chips_range_t framebuffer;  // the rendered picture, at least PICTURE_BUFFER_SIZE bytes
+    bool unlimited_sprites;     // lift the 8 sprites per scanline limit to reduce flicker
 } r2c02_desc_t;
 
 /* initialize a new r2c02_t instance */
 void r2c02_init(r2c02_t* sys, const r2c02_desc_t* desc);
 /* reset r2c02_t instance */
 void r2c02_reset(r2c02_t* sys);
-/* tick r2c02_t instance */
+/* tick r2c02_t instance (2C02, NTSC timing) */
 uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins);
+/* tick r2c02_t instance with 2C07 (PAL) timing: 312 lines, no skipped dot on odd frames */
+uint64_t r2c02_tick_pal(r2c02_t* sys, uint64_t pins);
+/* tick r2c02_t instance with UA6538 (Dendy) timing: 312 lines, vblank starts at line 291, no skipped dot */
+uint64_t r2c02_tick_dendy(r2c02_t* sys, uint64_t pins);
 
 uint8_t r2c02_read(r2c02_t* sys, uint8_t addr, bool read_only);
 void r2c02_write(r2c02_t* sys, uint8_t addr, uint8_t data);
+/* call after OAM has been modified directly (OAM DMA, debugger, loading a state) */
+void r2c02_invalidate_sprites(r2c02_t* sys);
 
 /*-- IMPLEMENTATION ----------------------------------------------------------*/
 #ifdef CHIPS_IMPL
@@ -198,6 +218,11 @@ void r2c02_write(r2c02_t* sys, uint8_t addr, uint8_t data);
     #include <assert.h>
     #define CHIPS_ASSERT(c) assert(c)
 #endif
+#if defined(_MSC_VER)
+    #define _R2C02_FORCE_INLINE __forceinline
+#else
+    #define _R2C02_FORCE_INLINE inline __attribute__((always_inline))
+#endif
 
 void r2c02_init(r2c02_t* sys, const r2c02_desc_t* desc) {
     CHIPS_ASSERT(sys);
@@ -206,6 +231,14 @@ void r2c02_init(r2c02_t* sys, const r2c02_desc_t* desc) {
     sys->write = desc->write;
     sys->set_pixels = desc->set_pixels;
     sys->user_data = desc->user_data;
+    CHIPS_ASSERT(desc->framebuffer.ptr && (desc->framebuffer.size >= PICTURE_BUFFER_SIZE));
+    sys->picture_buffer = (uint8_t*)desc->framebuffer.ptr;
+    sys->unlimited_sprites = desc->unlimited_sprites;
+}
+
+void r2c02_invalidate_sprites(r2c02_t* sys) {
+    CHIPS_ASSERT(sys);
+    sys->sprite_buckets_valid = false;
 }
 
 void r2c02_reset(r2c02_t* sys) {
@@ -217,6 +250,7 @@ void r2c02_reset(r2c02_t* sys) {
     sys->data_address = sys->cycle = sys->sprite_data_address = sys->fine_x_scroll = sys->temp_address = 0;
     sys->scanline = -1;
     sys->scanline_sprites_num = 0;
+    sys->sprite_buckets_valid = false;
 }
 
 uint8_t r2c02_read(r2c02_t* sys, uint8_t addr, bool read_only) {
@@ -276,6 +310,7 @@ void r2c02_write(r2c02_t* sys, uint8_t addr, uint8_t data) {
         case 0x04: {
             // set OAM data
             sys->oam.reg[sys->sprite_data_address++] = data;
+            sys->sprite_buckets_valid = false;
         } break;
         case 0x05: {
             // set scroll
@@ -402,7 +437,54 @@ static uint8_t _r2c02_render_background(r2c02_t* sys, bool* bg_opaque) {
     return bg_color;
 }
 
-uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
+static int _r2c02_ctz64(uint64_t mask) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(mask);
+    #else
+        int i = 0;
+        while (0 == (mask & 1)) {
+            mask >>= 1;
+            i++;
+        }
+        return i;
+    #endif
+}
+
+// sort the sprites into per-scanline masks, only done when OAM or the sprite size has changed
+static void _r2c02_build_sprite_buckets(r2c02_t* sys, int height) {
+    memset(sys->sprite_buckets, 0, sizeof(sys->sprite_buckets));
+    for (int i = 0; i < 64; i++) {
+        const int y = sys->oam.data[i].y;
+        for (int line = y; (line < (y + height)) && (line < VISIBLE_SCANLINES); line++) {
+            sys->sprite_buckets[line] |= (uint64_t)1 << i;
+        }
+    }
+    sys->sprite_buckets_height = height;
+    sys->sprite_buckets_valid = true;
+}
+
+// find the sprites on the next scanline, evaluation starts at the OAM address
+static void _r2c02_evaluate_sprites(r2c02_t* sys) {
+    const int height = sys->ppu_control.sprite_size ? 16 : 8;
+    if (!sys->sprite_buckets_valid || (sys->sprite_buckets_height != height)) {
+        _r2c02_build_sprite_buckets(sys, height);
+    }
+    uint64_t mask = sys->sprite_buckets[sys->scanline] & (~(uint64_t)0 << (sys->sprite_data_address / 4));
+    sys->scanline_sprites_num = 0;
+    while (mask) {
+        if (sys->scanline_sprites_num == MAX_SCANLINE_SPRITES) {
+            sys->ppu_status.sprite_overflow = true;
+            if (!sys->unlimited_sprites) {
+                break;
+            }
+        }
+        sys->scanline_sprites[sys->scanline_sprites_num++] = (uint8_t)_r2c02_ctz64(mask);
+        mask &= mask - 1;
+    }
+}
+
+// the timing parameters are compile-time constants in each of the r2c02_tick*() instances
+static _R2C02_FORCE_INLINE uint64_t _r2c02_tick(r2c02_t* sys, uint64_t pins, const int frame_end_scanline, const int vblank_scanline, const bool skip_odd_dot) {
     CHIPS_ASSERT(sys);
     if (sys->scanline == -1) {
         // Pre render
@@ -416,8 +498,8 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
             //Set vertical bits
             sys->data_address &= ~0x7be0; //Unset bits related to horizontal
             sys->data_address |= sys->temp_address & 0x7be0; //Copy
-        } else  if (sys->cycle >= SCANLINE_END_CYCLE - (!sys->even_frame && sys->ppu_mask.render_background && sys->ppu_mask.render_sprites)) {
-            // if rendering is on, every other frame is one cycle shorter
+        } else  if (sys->cycle >= SCANLINE_END_CYCLE - (skip_odd_dot && !sys->even_frame && sys->ppu_mask.render_background && sys->ppu_mask.render_sprites)) {
+            // if rendering is on, every other NTSC frame is one cycle shorter
             sys->cycle++;
         }
 
@@ -462,7 +544,14 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
             else if (!bg_opaque && !spr_opaque)
                 palette_addr = 0;
             
-            sys->picture_buffer[x + (y << 8)] = sys->read(0x3f00 + palette_addr, sys->user_data);
+            uint8_t color = sys->read(0x3f00 + palette_addr, sys->user_data) & 0x3F;
+            if (sys->ppu_mask.greyscale) {
+                color &= 0x30;
+            }
+            if (x == 0) {
+                sys->emphasis[y] = sys->ppu_mask.reg >> 5;
+            }
+            sys->picture_buffer[x + (y << 8)] = color;
         } else if (sys->cycle == SCANLINE_VISIBLE_DOTS + 1 && sys->ppu_mask.render_background) {
             // Shamelessly copied from nesdev wiki
             if ((sys->data_address & 0x7000) != 0x7000) {  // if fine Y < 7
@@ -495,24 +584,7 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
             // Find and index sprites that are on the next Scanline
             // This isn't where/when this indexing, actually copying in 2C02 is done
             // but (I think) it shouldn't hurt any games if this is done here
-            sys->scanline_sprites_num = 0;
-            int range = 8;
-            if (sys->ppu_control.sprite_size) {
-                range = 16;
-            }
-            
-            size_t j = 0;
-            for (size_t i = sys->sprite_data_address / 4; i < 64; ++i) {
-                int diff = (sys->scanline - sys->oam.reg[i * 4]);
-                if (0 <= diff && diff < range) {
-                    if (j >= 8) {
-                        sys->ppu_status.sprite_overflow = true;
-                        break;
-                    }
-                    sys->scanline_sprites[sys->scanline_sprites_num++] = i;
-                    ++j;
-                }
-            }
+            _r2c02_evaluate_sprites(sys);
             
             ++sys->scanline;
             sys->cycle = 0;
@@ -522,9 +594,9 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
         if (sys->cycle >= SCANLINE_END_CYCLE) {
             sys->set_pixels(sys->picture_buffer, sys->user_data);
         }
-    } else if (sys->scanline <= FRAME_END_SCANLINE) {
-        // v blanking scanlines 241 - 261
-        if (sys->cycle == 1 && sys->scanline == VISIBLE_SCANLINES + 1) {
+    } else if (sys->scanline <= frame_end_scanline) {
+        // post render and v blanking scanlines 241 - 261 (NTSC) or 311 (PAL, Dendy)
+        if (sys->cycle == 1 && sys->scanline == vblank_scanline) {
             // set v-blank
             sys->ppu_status.vertical_blank = true;
             if (sys->ppu_control.enable_nmi) {
@@ -536,7 +608,7 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
 
     // increment cycle and scanlines
     if(++sys->cycle >= (SCANLINE_END_CYCLE+1)) {
-        if (++sys->scanline >= FRAME_END_SCANLINE) {
+        if (++sys->scanline >= frame_end_scanline) {
             sys->scanline = -1;
             sys->even_frame = !sys->even_frame;
         }
@@ -546,4 +618,16 @@ uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
     return pins;
 }
 
+uint64_t r2c02_tick(r2c02_t* sys, uint64_t pins) {
+    return _r2c02_tick(sys, pins, FRAME_END_SCANLINE, VBLANK_SCANLINE, true);
+}
+
+uint64_t r2c02_tick_pal(r2c02_t* sys, uint64_t pins) {
+    return _r2c02_tick(sys, pins, FRAME_END_SCANLINE_PAL, VBLANK_SCANLINE, false);
+}
+
+uint64_t r2c02_tick_dendy(r2c02_t* sys, uint64_t pins) {
+    return _r2c02_tick(sys, pins, FRAME_END_SCANLINE_PAL, VBLANK_SCANLINE_DENDY, false);
+}
+
 #endif /* CHIPS_IMPL */
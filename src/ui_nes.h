@@ -64,6 +64,7 @@ typedef struct {
     ui_dbg_texture_callbacks_t dbg_texture;     // debug texture create/update/destroy callbacks
     ui_dbg_keys_desc_t dbg_keys;                // user-defined hotkeys for ui_dbg_t
     ui_snapshot_desc_t snapshot;                // snapshot ui setup params
+    void (*snapshot_menu_cb)(void);             // optional, called when the snapshot menu is shown
 } ui_nes_desc_t;
 
 typedef struct {
@@ -78,7 +79,7 @@ typedef struct {
     ui_texture_t tex_name_table_tooltip;
     ui_texture_t tex_sprites;
     int pattern_pal_index;
-    uint32_t pixel_buffer[512*512];
+    uint32_t* pixel_buffer;     // 512*512 pixels, allocated with the textures when the window is first opened
 } ui_nes_video_t;
 
 typedef struct {
@@ -115,11 +116,22 @@ typedef struct {
     ui_r2c02_t ppu;
     ui_dbg_t dbg;
     ui_snapshot_t snapshot;
+    void (*snapshot_menu_cb)(void);
+    // the hardware and debug windows (except the CPU debugger) are initialized when first opened
+    struct {
+        bool cpu;
+        bool audio;
+        bool video;
+        bool memedit[4];
+        bool dasm[4];
+    } inited;
 } ui_nes_t;
 
 void ui_nes_init(ui_nes_t* ui, const ui_nes_desc_t* desc);
 void ui_nes_discard(ui_nes_t* ui);
 void ui_nes_draw(ui_nes_t* ui, const ui_nes_frame_t* frame);
+// true if the next ui_nes_draw() may access the emulator: a window or menu is open, or the debugger is stopped
+bool ui_nes_is_active(const ui_nes_t* ui);
 chips_debug_t ui_nes_get_debug(ui_nes_t* ui);
 
 #ifdef __cplusplus
@@ -132,6 +144,7 @@ chips_debug_t ui_nes_get_debug(ui_nes_t* ui);
 #error "implementation must be compiled as C++"
 #endif
 #include <string.h> /* memset */
+#include <stdlib.h> /* malloc, free */
 #ifndef CHIPS_ASSERT
     #include <assert.h>
     #define CHIPS_ASSERT(c) assert(c)
@@ -145,6 +158,9 @@ static void _ui_nes_draw_menu(ui_nes_t* ui) {
     CHIPS_ASSERT(ui && ui->nes);
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("System")) {
+            if (ui->snapshot_menu_cb) {
+                ui->snapshot_menu_cb();
+            }
             ui_snapshot_menus(&ui->snapshot);
             if (ImGui::MenuItem("Reset")) {
                 nes_reset(ui->nes);
@@ -264,6 +280,7 @@ static void _ui_nes_sprite_mem_write(int layer, uint16_t addr, uint8_t data, voi
     nes_t* nes = ui_nes->nes;
     if (addr >= 0 && addr < 64*4 ) {
         nes->ppu.oam.reg[addr] = data;
+        r2c02_invalidate_sprites(&nes->ppu);
     }
 }
 
@@ -285,6 +302,7 @@ static void _ui_nes_oam_mem_write(int layer, uint16_t addr, uint8_t data, void*
     nes_t* nes = ui_nes->nes;
     if (addr >= 0 && addr < 64*4 ) {
         nes->ppu.oam.reg[addr] = data;
+        r2c02_invalidate_sprites(&nes->ppu);
     }
 }
 
@@ -316,19 +334,113 @@ static void _ui_nes_mem_write(int layer, uint16_t addr, uint8_t data, void* user
     }
 }
 
+// cascaded window positions, the index is the position in the cascade
+#define _UI_NES_WINDOW_POS(index) (20 + (index) * 10)
+
+static void _ui_nes_init_cpu(ui_nes_t* ui) {
+    ui_m6502_desc_t desc = {0};
+    desc.title = "MOS 6502";
+    desc.cpu = &ui->nes->cpu;
+    desc.x = _UI_NES_WINDOW_POS(1);
+    desc.y = _UI_NES_WINDOW_POS(1);
+    UI_CHIP_INIT_DESC(&desc.chip_desc, "6502", 32, _ui_nes_cpu_pins);
+    ui_m6502_init(&ui->cpu, &desc);
+}
+
+static void _ui_nes_init_audio(ui_nes_t* ui) {
+    ui_audio_desc_t desc = {0};
+    desc.title = "Audio Output";
+    desc.sample_buffer = ui->nes->audio_samples;
+    desc.num_samples = ui->nes->audio.num_samples;
+    desc.x = _UI_NES_WINDOW_POS(2);
+    desc.y = _UI_NES_WINDOW_POS(2);
+    ui_audio_init(&ui->audio, &desc);
+}
+
+static void _ui_nes_init_memedit(ui_nes_t* ui, int i) {
+    static const char* titles[] = { "Memory Editor #1", "Memory Editor #2", "Memory Editor #3", "Memory Editor #4" };
+    ui_memedit_desc_t desc = {0};
+    for (int l = 0; l < _UI_NES_MEMLAYER_NUM; l++) {
+        desc.layers[l] = _ui_nes_memlayer_names[l];
+    }
+    desc.read_cb = _ui_nes_mem_read;
+    desc.write_cb = _ui_nes_mem_write;
+    desc.user_data = ui;
+    desc.title = titles[i];
+    desc.x = _UI_NES_WINDOW_POS(3 + i);
+    desc.y = _UI_NES_WINDOW_POS(3 + i);
+    ui_memedit_init(&ui->memedit[i], &desc);
+}
+
+static void _ui_nes_init_dasm(ui_nes_t* ui, int i) {
+    static const char* titles[4] = { "Disassembler #1", "Disassembler #2", "Disassembler #2", "Dissassembler #3" };
+    ui_dasm_desc_t desc = {0};
+    desc.layers[0] = "System";
+    desc.read_cb = _ui_nes_mem_read;
+    desc.cpu_type = UI_DASM_CPUTYPE_M6502;
+    desc.user_data = ui;
+    desc.title = titles[i];
+    desc.x = _UI_NES_WINDOW_POS(8 + i);
+    desc.y = _UI_NES_WINDOW_POS(8 + i);
+    ui_dasm_init(&ui->dasm[i], &desc);
+}
+
+// returns false if the pixel buffer can't be allocated
+static bool _ui_nes_init_video(ui_nes_t* ui) {
+    ui->video.pixel_buffer = (uint32_t*) malloc(512*512*sizeof(uint32_t));
+    if (!ui->video.pixel_buffer) {
+        return false;
+    }
+    ui->video.tex_pattern_tables[0] = ui->video.texture_cbs.create_cb(128, 128);
+    ui->video.tex_pattern_tables[1] = ui->video.texture_cbs.create_cb(128, 128);
+    ui->video.tex_name_table_tooltip = ui->video.texture_cbs.create_cb(8, 8);
+    ui->video.tex_name_tables = ui->video.texture_cbs.create_cb(512, 512);
+    ui->video.tex_sprites = ui->video.texture_cbs.create_cb(64, 64);
+    return true;
+}
+
+// initialize the windows which have been opened from the menu for the first time,
+// the window init functions reset the open flag
+static void _ui_nes_init_opened(ui_nes_t* ui) {
+    if (ui->cpu.open && !ui->inited.cpu) {
+        _ui_nes_init_cpu(ui);
+        ui->cpu.open = ui->inited.cpu = true;
+    }
+    if (ui->audio.open && !ui->inited.audio) {
+        _ui_nes_init_audio(ui);
+        ui->audio.open = ui->inited.audio = true;
+    }
+    if (ui->video.open && !ui->inited.video) {
+        // if out of memory, close the window again and retry when it is opened next time
+        ui->inited.video = _ui_nes_init_video(ui);
+        ui->video.open = ui->inited.video;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (ui->memedit[i].open && !ui->inited.memedit[i]) {
+            _ui_nes_init_memedit(ui, i);
+            ui->memedit[i].open = ui->inited.memedit[i] = true;
+        }
+        if (ui->dasm[i].open && !ui->inited.dasm[i]) {
+            _ui_nes_init_dasm(ui, i);
+            ui->dasm[i].open = ui->inited.dasm[i] = true;
+        }
+    }
+}
+
 void ui_nes_init(ui_nes_t* ui, const ui_nes_desc_t* ui_desc) {
     CHIPS_ASSERT(ui && ui_desc);
     CHIPS_ASSERT(ui_desc->nes);
     memset(ui, 0, sizeof(ui_nes_t));
     
     ui->nes = ui_desc->nes;
+    ui->snapshot_menu_cb = ui_desc->snapshot_menu_cb;
     ui_snapshot_init(&ui->snapshot, &ui_desc->snapshot);
-    int x = 20, y = 20, dx = 10, dy = 10;
+    // the CPU debugger is always initialized, it's ticked by the emulator and handles the hotkeys
     {
         ui_dbg_desc_t desc = {0};
         desc.title = "CPU Debugger";
-        desc.x = x;
-        desc.y = y;
+        desc.x = _UI_NES_WINDOW_POS(0);
+        desc.y = _UI_NES_WINDOW_POS(0);
         desc.m6502 = &ui->nes->cpu;
         desc.read_cb = _ui_nes_mem_read;
         desc.texture_cbs = ui_desc->dbg_texture;
@@ -336,67 +448,12 @@ void ui_nes_init(ui_nes_t* ui, const ui_nes_desc_t* ui_desc) {
         desc.user_data = ui;
         ui_dbg_init(&ui->dbg, &desc);
     }
-    x += dx; y += dy;
-    {
-        ui_m6502_desc_t desc = {0};
-        desc.title = "MOS 6502";
-        desc.cpu = &ui->nes->cpu;
-        desc.x = x;
-        desc.y = y;
-        UI_CHIP_INIT_DESC(&desc.chip_desc, "6502", 32, _ui_nes_cpu_pins);
-        ui_m6502_init(&ui->cpu, &desc);
-    }
-    x += dx; y += dy;
-    {
-        ui_audio_desc_t desc = {0};
-        desc.title = "Audio Output";
-        desc.sample_buffer = ui->nes->audio.sample_buffer;
-        desc.num_samples = ui->nes->audio.num_samples;
-        desc.x = x;
-        desc.y = y;
-        ui_audio_init(&ui->audio, &desc);
-    }
-    x += dx; y += dy;
-    {
-        ui_memedit_desc_t desc = {0};
-        for (int i = 0; i < _UI_NES_MEMLAYER_NUM; i++) {
-            desc.layers[i] = _ui_nes_memlayer_names[i];
-        }
-        desc.read_cb = _ui_nes_mem_read;
-        desc.write_cb = _ui_nes_mem_write;
-        desc.user_data = ui;
-        static const char* titles[] = { "Memory Editor #1", "Memory Editor #2", "Memory Editor #3", "Memory Editor #4" };
-        for (int i = 0; i < 4; i++) {
-            desc.title = titles[i]; desc.x = x; desc.y = y;
-            ui_memedit_init(&ui->memedit[i], &desc);
-            x += dx; y += dy;
-        }
-    }
-    x += dx; y += dy;
-    {
-        ui_dasm_desc_t desc = {0};
-        desc.layers[0] = "System";
-        desc.read_cb = _ui_nes_mem_read;
-        desc.cpu_type = UI_DASM_CPUTYPE_M6502;
-        desc.user_data = ui;
-        static const char* titles[4] = { "Disassembler #1", "Disassembler #2", "Disassembler #2", "Dissassembler #3" };
-        for (int i = 0; i < 4; i++) {
-            desc.title = titles[i]; desc.x = x; desc.y = y;
-            ui_dasm_init(&ui->dasm[i], &desc);
-            x += dx; y += dy;
-        }
-    }
     {
         ui->video.texture_cbs = ui_desc->dbg_texture;
         ui->video.x = 10;
         ui->video.y = 20;
         ui->video.w = 562;
         ui->video.h = 568;
-        ui->video.tex_pattern_tables[0] = ui->video.texture_cbs.create_cb(128, 128);
-        ui->video.tex_pattern_tables[1] = ui->video.texture_cbs.create_cb(128, 128);
-        ui->video.tex_name_table_tooltip = ui->video.texture_cbs.create_cb(8, 8);
-        ui->video.tex_name_tables = ui->video.texture_cbs.create_cb(512, 512);
-        ui->video.tex_sprites = ui->video.texture_cbs.create_cb(64, 64);
     }
     {
         ui->cartridge.x = 10;
@@ -414,16 +471,28 @@ void ui_nes_init(ui_nes_t* ui, const ui_nes_desc_t* ui_desc) {
 
 void ui_nes_discard(ui_nes_t* ui) {
     CHIPS_ASSERT(ui && ui->nes);
-    ui->video.texture_cbs.destroy_cb(ui->video.tex_pattern_tables[0]);
-    ui->video.texture_cbs.destroy_cb(ui->video.tex_pattern_tables[1]);
-    ui->video.texture_cbs.destroy_cb(ui->video.tex_name_table_tooltip);
-    ui->video.texture_cbs.destroy_cb(ui->video.tex_name_tables);
-    ui->video.texture_cbs.destroy_cb(ui->video.tex_sprites);
-    ui_m6502_discard(&ui->cpu);
-    ui_audio_discard(&ui->audio);
+    if (ui->inited.video) {
+        ui->video.texture_cbs.destroy_cb(ui->video.tex_pattern_tables[0]);
+        ui->video.texture_cbs.destroy_cb(ui->video.tex_pattern_tables[1]);
+        ui->video.texture_cbs.destroy_cb(ui->video.tex_name_table_tooltip);
+        ui->video.texture_cbs.destroy_cb(ui->video.tex_name_tables);
+        ui->video.texture_cbs.destroy_cb(ui->video.tex_sprites);
+        free(ui->video.pixel_buffer);
+        ui->video.pixel_buffer = 0;
+    }
+    if (ui->inited.cpu) {
+        ui_m6502_discard(&ui->cpu);
+    }
+    if (ui->inited.audio) {
+        ui_audio_discard(&ui->audio);
+    }
     for (int i = 0; i < 4; i++) {
-        ui_memedit_discard(&ui->memedit[i]);
-        ui_dasm_discard(&ui->dasm[i]);
+        if (ui->inited.memedit[i]) {
+            ui_memedit_discard(&ui->memedit[i]);
+        }
+        if (ui->inited.dasm[i]) {
+            ui_dasm_discard(&ui->dasm[i]);
+        }
     }
     ui_dbg_discard(&ui->dbg);
 }
@@ -559,7 +628,7 @@ static void _ui_nes_update_sprites(ui_nes_t* ui) {
 }
 
 static void _ui_nes_draw_video(ui_nes_t* ui) {
-    if (!ui->video.open) {
+    if (!ui->video.open || !ui->inited.video) {
         return;
     }
     ImGui::SetNextWindowPos(ImVec2((float)ui->video.x, (float)ui->video.y), ImGuiCond_Once);
@@ -815,11 +884,20 @@ void _ui_r2c02_draw(ui_nes_t* ui) {
 void ui_nes_draw(ui_nes_t* ui, const ui_nes_frame_t* frame) {
     CHIPS_ASSERT(ui && ui->nes && frame);
     _ui_nes_draw_menu(ui);
-    ui_m6502_draw(&ui->cpu);
-    ui_audio_draw(&ui->audio, ui->nes->audio.sample_pos);
+    _ui_nes_init_opened(ui);
+    if (ui->inited.cpu) {
+        ui_m6502_draw(&ui->cpu);
+    }
+    if (ui->inited.audio) {
+        ui_audio_draw(&ui->audio, ui->nes->audio.sample_pos);
+    }
     for (int i = 0; i < 4; i++) {
-        ui_memedit_draw(&ui->memedit[i]);
-        ui_dasm_draw(&ui->dasm[i]);
+        if (ui->inited.memedit[i]) {
+            ui_memedit_draw(&ui->memedit[i]);
+        }
+        if (ui->inited.dasm[i]) {
+            ui_dasm_draw(&ui->dasm[i]);
+        }
     }
     ui_dbg_draw(&ui->dbg);
     _ui_nes_draw_video(ui);
@@ -829,6 +907,17 @@ void ui_nes_draw(ui_nes_t* ui, const ui_nes_frame_t* frame) {
     // ui_display_draw(&ui->display, &frame->display);
 }
 
+bool ui_nes_is_active(const ui_nes_t* ui) {
+    CHIPS_ASSERT(ui);
+    bool open = ui->cpu.open || ui->audio.open || ui->video.open || ui->cartridge.open || ui->input.open || ui->ppu.open;
+    for (int i = 0; i < 4; i++) {
+        open |= ui->memedit[i].open || ui->dasm[i].open;
+    }
+    open |= ui->dbg.ui.open || ui->dbg.ui.breakpoints.open || ui->dbg.ui.stopwatch.open || ui->dbg.ui.history.open || ui->dbg.ui.heatmap.open;
+    // the main menu bar menus are popups, the menu items act on the emulator
+    return open || ui->dbg.dbg.stopped || ImGui::IsPopupOpen("", ImGuiPopupFlags_AnyPopupId);
+}
+
 chips_debug_t ui_nes_get_debug(ui_nes_t* ui) {
     CHIPS_ASSERT(ui);
     chips_debug_t res = {};